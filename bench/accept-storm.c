@@ -0,0 +1,236 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures how fast clients can connect through a wayland-tracer in server
+ * mode.  The benchmark runs mock-compositor, starts the tracer in front
+ * of it and then keeps CONCURRENCY clients connecting at once, each
+ * sending a sync and hanging up as soon as the wl_callback.done comes
+ * back.
+ *
+ *	accept-storm [-n CONNECTIONS] [-c CONCURRENCY] [-t TRACER] [-d]
+ *
+ * With -d the clients connect straight to the compositor, which gives the
+ * baseline to compare against.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "bench-util.h"
+
+struct client {
+	int fd;
+	uint64_t start;
+};
+
+static int
+client_start(struct client *client, const struct sockaddr_un *addr)
+{
+	/* wl_display@1.sync(new_id 2) */
+	uint32_t msg[3] = { 1, 12 << 16, 2 };
+
+	client->start = bench_now();
+	client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (client->fd < 0)
+		return -1;
+
+	if (connect(client->fd, (const struct sockaddr *) addr,
+		    sizeof *addr) < 0 ||
+	    write(client->fd, msg, sizeof msg) != sizeof msg) {
+		close(client->fd);
+		client->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: accept-storm [-n CONNECTIONS] "
+		"[-c CONCURRENCY] [-t TRACER] [-d]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *tracer_path = "./wayland-tracer";
+	char upstream_name[64], tracer_name[64], spec[160], backlog[16];
+	struct sockaddr_un upstream_addr, tracer_addr, *addr;
+	struct client *clients;
+	struct pollfd *pfds;
+	uint64_t *latency, start, elapsed;
+	uint32_t reply[3];
+	pid_t compositor, tracer = -1;
+	int connections = 10000, concurrency = 50, direct = 0;
+	int opt, i, started = 0, done = 0, failed = 0, active;
+
+	while ((opt = getopt(argc, argv, "n:c:t:d")) != -1) {
+		switch (opt) {
+		case 'n':
+			connections = atoi(optarg);
+			break;
+		case 'c':
+			concurrency = atoi(optarg);
+			break;
+		case 't':
+			tracer_path = optarg;
+			break;
+		case 'd':
+			direct = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (connections <= 0 || concurrency <= 0)
+		usage();
+
+	snprintf(upstream_name, sizeof upstream_name,
+		 "accept-storm-upstream-%d", getpid());
+	snprintf(tracer_name, sizeof tracer_name,
+		 "accept-storm-tracer-%d", getpid());
+	if (bench_make_addr(&upstream_addr, upstream_name) < 0 ||
+	    bench_make_addr(&tracer_addr, tracer_name) < 0)
+		return EXIT_FAILURE;
+
+	compositor = bench_spawn_compositor(argv[0], upstream_name);
+	if (compositor < 0)
+		return EXIT_FAILURE;
+
+	if (direct) {
+		addr = &upstream_addr;
+	} else {
+		snprintf(spec, sizeof spec, "%s=%s", tracer_name,
+			 upstream_name);
+		snprintf(backlog, sizeof backlog, "%d", concurrency);
+		tracer = fork();
+		if (tracer == 0) {
+			execl(tracer_path, tracer_path, "-S", spec,
+			      "--backlog", backlog, "-o", "/dev/null",
+			      (char *) NULL);
+			fprintf(stderr, "failed to run %s: %m\n", tracer_path);
+			_exit(EXIT_FAILURE);
+		}
+		addr = &tracer_addr;
+	}
+
+	if (bench_wait_for_socket(addr) < 0) {
+		fprintf(stderr, "%s never came up\n",
+			direct ? "compositor" : "tracer");
+		goto out;
+	}
+
+	clients = calloc(concurrency, sizeof *clients);
+	pfds = calloc(concurrency, sizeof *pfds);
+	latency = calloc(connections, sizeof *latency);
+	if (clients == NULL || pfds == NULL || latency == NULL) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+
+	for (i = 0; i < concurrency; i++)
+		clients[i].fd = -1;
+
+	start = bench_now();
+	while (done + failed < connections) {
+		active = 0;
+		for (i = 0; i < concurrency; i++) {
+			if (clients[i].fd < 0 && started < connections) {
+				started++;
+				if (client_start(&clients[i], addr) < 0)
+					failed++;
+			}
+			pfds[i].fd = clients[i].fd;
+			pfds[i].events = POLLIN;
+			if (clients[i].fd >= 0)
+				active++;
+		}
+		if (active == 0)
+			continue;
+
+		if (poll(pfds, concurrency, 5000) <= 0) {
+			fprintf(stderr, "clients stalled\n");
+			break;
+		}
+
+		for (i = 0; i < concurrency; i++) {
+			if (pfds[i].fd < 0 || pfds[i].revents == 0)
+				continue;
+
+			if (read(clients[i].fd, reply, sizeof reply) ==
+			    sizeof reply)
+				latency[done++] = bench_now() - clients[i].start;
+			else
+				failed++;
+			close(clients[i].fd);
+			clients[i].fd = -1;
+		}
+	}
+	elapsed = bench_now() - start;
+
+	qsort(latency, done, sizeof *latency, compare_u64);
+	printf("%d connections (%d failed) through %s in %.3f s: "
+	       "%.0f connections/s\n",
+	       done, failed, direct ? "nothing" : "the tracer",
+	       elapsed / 1e9, done / (elapsed / 1e9));
+	if (done > 0)
+		printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		       latency[done / 2] / 1e3,
+		       latency[(uint64_t) done * 99 / 100] / 1e3,
+		       latency[done - 1] / 1e3);
+
+out:
+	if (tracer > 0)
+		kill(tracer, SIGTERM);
+	kill(compositor, SIGTERM);
+	while (wait(NULL) > 0)
+		;
+	unlink(upstream_addr.sun_path);
+	unlink(tracer_addr.sun_path);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "bench-util.h"
+
+uint64_t
+bench_now(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+int
+bench_make_addr(struct sockaddr_un *addr, const char *name)
+{
+	const char *runtime_dir;
+
+	runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir == NULL) {
+		fprintf(stderr, "XDG_RUNTIME_DIR not set in the environment\n");
+		return -1;
+	}
+
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	if (snprintf(addr->sun_path, sizeof addr->sun_path, "%s/%s",
+		     runtime_dir, name) >= (int) sizeof addr->sun_path) {
+		fprintf(stderr, "socket path too long\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+bench_wait_for_socket(const struct sockaddr_un *addr)
+{
+	int i, fd, ret;
+
+	for (i = 0; i < 500; i++) {
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		ret = connect(fd, (const struct sockaddr *) addr, sizeof *addr);
+		close(fd);
+		if (ret == 0)
+			return 0;
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+long
+bench_rss_kib(pid_t pid)
+{
+	char path[64], line[256];
+	long rss = -1;
+	FILE *fp;
+
+	snprintf(path, sizeof path, "/proc/%d/status", pid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(line, sizeof line, fp) != NULL) {
+		if (sscanf(line, "VmRSS: %ld kB", &rss) == 1)
+			break;
+	}
+	fclose(fp);
+
+	return rss;
+}
+
+pid_t
+bench_spawn_compositor(const char *argv0, const char *name)
+{
+	struct sockaddr_un addr;
+	const char *slash;
+	char path[4096];
+	pid_t pid;
+
+	if (bench_make_addr(&addr, name) < 0)
+		return -1;
+
+	slash = strrchr(argv0, '/');
+	if (slash != NULL)
+		snprintf(path, sizeof path, "%.*s/mock-compositor",
+			 (int) (slash - argv0), argv0);
+	else
+		snprintf(path, sizeof path, "mock-compositor");
+
+	pid = fork();
+	if (pid == 0) {
+		execlp(path, path, "-q", "-s", name, (char *) NULL);
+		fprintf(stderr, "failed to run %s: %m\n", path);
+		_exit(EXIT_FAILURE);
+	}
+	if (pid < 0)
+		return -1;
+
+	if (bench_wait_for_socket(&addr) < 0) {
+		fprintf(stderr, "compositor never came up\n");
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	return pid;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+/* Helpers shared by the benchmarks, which are built on their own */
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t bench_now(void);
+
+/* Fills in the address of socket name in XDG_RUNTIME_DIR */
+int bench_make_addr(struct sockaddr_un *addr, const char *name);
+
+/* Waits up to five seconds for something to listen at addr */
+int bench_wait_for_socket(const struct sockaddr_un *addr);
+
+long bench_rss_kib(pid_t pid);
+
+/*
+ * Starts the mock-compositor built next to the benchmark run as argv0,
+ * listening on name, and waits for it to come up.  Returns its pid or -1.
+ */
+pid_t bench_spawn_compositor(const char *argv0, const char *name);
+
+#endif
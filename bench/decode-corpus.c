@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Compares the decoders generated at build time with the interpreting
+ * one on a recorded capture (wayland-tracer --capture).  The tracer
+ * decodes the capture RUNS times either way with output going to
+ * /dev/null, the best time of each is reported after subtracting the
+ * time it takes to decode an empty capture, which is mostly loading the
+ * protocol files.
+ *
+ *	decode-corpus [-n RUNS] [-t TRACER] CAPTURE PROTOCOL.xml...
+ *
+ * Only messages of protocols that were compiled in (see configure
+ * --with-compiled-protocols) take the generated path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "bench-util.h"
+#include "wayland-tracer-record.h"
+
+#define MAX_PROTOCOLS 32
+
+static int
+count_records(const char *path, uint64_t *records, uint64_t *bytes)
+{
+	struct tracer_capture_header header;
+	struct tracer_record record;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != TRACER_CAPTURE_MAGIC) {
+		fclose(fp);
+		return -1;
+	}
+
+	*records = *bytes = 0;
+	while (fread(&record, sizeof record, 1, fp) == 1 &&
+	       record.size >= sizeof record) {
+		if (record.type == TRACER_RECORD_MESSAGE) {
+			(*records)++;
+			*bytes += record.length;
+		}
+		if (fseek(fp, record.size - sizeof record, SEEK_CUR) < 0)
+			break;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+/* Copies just the header of a capture, to measure the fixed costs */
+static int
+make_empty_capture(const char *path, char *empty, size_t size)
+{
+	struct tracer_capture_header header;
+	FILE *in, *out;
+	int fd, ret = -1;
+
+	snprintf(empty, size, "/tmp/decode-corpus-XXXXXX");
+	fd = mkstemp(empty);
+	if (fd < 0)
+		return -1;
+
+	in = fopen(path, "r");
+	out = fdopen(fd, "w");
+	if (in != NULL && out != NULL &&
+	    fread(&header, sizeof header, 1, in) == 1 &&
+	    fwrite(&header, sizeof header, 1, out) == 1)
+		ret = 0;
+
+	if (in != NULL)
+		fclose(in);
+	if (out != NULL)
+		fclose(out);
+	else
+		close(fd);
+
+	return ret;
+}
+
+/* Returns how long the tracer took to decode capture, or 0 if it failed */
+static uint64_t
+run_tracer(const char *tracer, const char *capture, char **protocols,
+	   int protocol_count, int interpret)
+{
+	char *args[2 * MAX_PROTOCOLS + 8];
+	uint64_t start;
+	pid_t pid;
+	int i, n = 0, status, null;
+
+	args[n++] = (char *) tracer;
+	args[n++] = "-o";
+	args[n++] = "/dev/null";
+	for (i = 0; i < protocol_count; i++) {
+		args[n++] = "-d";
+		args[n++] = protocols[i];
+	}
+	if (interpret)
+		args[n++] = "--no-compiled-decoders";
+	args[n++] = "--decode";
+	args[n++] = (char *) capture;
+	args[n] = NULL;
+
+	start = bench_now();
+	pid = fork();
+	if (pid < 0)
+		return 0;
+
+	if (pid == 0) {
+		null = open("/dev/null", O_WRONLY);
+		dup2(null, STDERR_FILENO);
+		execv(tracer, args);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0)
+		return 0;
+
+	return bench_now() - start;
+}
+
+static uint64_t
+best_of(int runs, const char *tracer, const char *capture,
+	char **protocols, int protocol_count, int interpret)
+{
+	uint64_t best = UINT64_MAX, elapsed;
+	int i;
+
+	for (i = 0; i < runs; i++) {
+		elapsed = run_tracer(tracer, capture, protocols,
+				     protocol_count, interpret);
+		if (elapsed == 0) {
+			fprintf(stderr, "%s failed on %s\n", tracer, capture);
+			exit(EXIT_FAILURE);
+		}
+		if (elapsed < best)
+			best = elapsed;
+	}
+
+	return best;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: decode-corpus [-n RUNS] [-t TRACER] "
+		"CAPTURE PROTOCOL.xml...\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *tracer = "./wayland-tracer", *capture;
+	char empty[64];
+	uint64_t records, bytes, base, interpreted, generated;
+	int runs = 5, opt, protocol_count;
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 't':
+			tracer = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	protocol_count = argc - optind - 1;
+	if (runs <= 0 || protocol_count < 1 ||
+	    protocol_count > MAX_PROTOCOLS)
+		usage();
+	capture = argv[optind];
+
+	if (count_records(capture, &records, &bytes) < 0 || records == 0) {
+		fprintf(stderr, "%s isn't a capture with messages\n", capture);
+		return EXIT_FAILURE;
+	}
+
+	if (make_empty_capture(capture, empty, sizeof empty) < 0) {
+		fprintf(stderr, "failed to create empty capture: %m\n");
+		return EXIT_FAILURE;
+	}
+
+	base = best_of(runs, tracer, empty, &argv[optind + 1],
+		       protocol_count, 0);
+	interpreted = best_of(runs, tracer, capture, &argv[optind + 1],
+			      protocol_count, 1);
+	generated = best_of(runs, tracer, capture, &argv[optind + 1],
+			    protocol_count, 0);
+	unlink(empty);
+
+	interpreted = interpreted > base ? interpreted - base : 1;
+	generated = generated > base ? generated - base : 1;
+
+	printf("%llu records, %llu bytes, startup %.1f ms\n",
+	       (unsigned long long) records, (unsigned long long) bytes,
+	       base / 1e6);
+	printf("interpreted: %8.1f ms, %6.1f ns per record\n",
+	       interpreted / 1e6, (double) interpreted / records);
+	printf("generated:   %8.1f ms, %6.1f ns per record\n",
+	       generated / 1e6, (double) generated / records);
+	printf("speedup:     %8.2fx\n", (double) interpreted / generated);
+
+	return EXIT_SUCCESS;
+}
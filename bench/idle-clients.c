@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures what idle clients cost a wayland-tracer in server mode.  Like
+ * accept-storm it runs mock-compositor and starts the tracer in front of
+ * it, then connects CLIENTS clients that each do one wl_display.sync
+ * round trip and then just stay connected.  The growth
+ * of the tracer's resident set size is printed, in total and per client.
+ * Arguments after -- are passed to the tracer.  Every client takes two
+ * fds in the tracer, mind the limit on open files.
+ *
+ *	idle-clients [-n CLIENTS] [-t TRACER] [-- TRACER-ARGS...]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "bench-util.h"
+
+/* Returns a client that made one round trip through the tracer, or -1 */
+static int
+connect_client(const struct sockaddr_un *addr)
+{
+	/* wl_display@1.sync(new_id 2) */
+	uint32_t msg[3] = { 1, 12 << 16, 2 }, reply[3];
+	struct pollfd pfd;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (connect(fd, (const struct sockaddr *) addr, sizeof *addr) < 0 ||
+	    write(fd, msg, sizeof msg) != sizeof msg ||
+	    poll(&pfd, 1, 5000) <= 0 ||
+	    read(fd, reply, sizeof reply) != sizeof reply) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: idle-clients [-n CLIENTS] [-t TRACER] "
+		"[-- TRACER-ARGS...]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *tracer_path = "./wayland-tracer";
+	char upstream_name[64], tracer_name[64], spec[160];
+	struct sockaddr_un upstream_addr, tracer_addr;
+	struct rlimit limit;
+	const char **args;
+	long before, after;
+	pid_t compositor, tracer;
+	int clients = 10000, opt, i, n, connected = 0;
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			clients = atoi(optarg);
+			break;
+		case 't':
+			tracer_path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (clients <= 0)
+		usage();
+
+	/* Inherited by the tracer and the compositor too */
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	snprintf(upstream_name, sizeof upstream_name,
+		 "idle-clients-upstream-%d", getpid());
+	snprintf(tracer_name, sizeof tracer_name,
+		 "idle-clients-tracer-%d", getpid());
+	if (bench_make_addr(&upstream_addr, upstream_name) < 0 ||
+	    bench_make_addr(&tracer_addr, tracer_name) < 0)
+		return EXIT_FAILURE;
+
+	compositor = bench_spawn_compositor(argv[0], upstream_name);
+	if (compositor < 0)
+		return EXIT_FAILURE;
+
+	args = calloc(argc - optind + 6, sizeof *args);
+	if (args == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	snprintf(spec, sizeof spec, "%s=%s", tracer_name, upstream_name);
+	n = 0;
+	args[n++] = tracer_path;
+	args[n++] = "-S";
+	args[n++] = spec;
+	args[n++] = "-o";
+	args[n++] = "/dev/null";
+	for (i = optind; i < argc; i++)
+		args[n++] = argv[i];
+
+	tracer = fork();
+	if (tracer == 0) {
+		execv(tracer_path, (char **) args);
+		fprintf(stderr, "failed to run %s: %m\n", tracer_path);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (bench_wait_for_socket(&tracer_addr) < 0) {
+		fprintf(stderr, "tracer never came up\n");
+		goto out;
+	}
+
+	before = bench_rss_kib(tracer);
+	for (i = 0; i < clients; i++) {
+		if (connect_client(&tracer_addr) < 0) {
+			fprintf(stderr, "client %d failed: %m\n", i);
+			break;
+		}
+		connected++;
+	}
+	after = bench_rss_kib(tracer);
+
+	printf("%d idle clients: tracer rss %ld KiB -> %ld KiB, "
+	       "%.2f KiB per client\n", connected, before, after,
+	       connected ? (double) (after - before) / connected : 0.0);
+
+out:
+	kill(tracer, SIGTERM);
+	kill(compositor, SIGTERM);
+	while (wait(NULL) > 0)
+		;
+	unlink(upstream_addr.sun_path);
+	unlink(tracer_addr.sun_path);
+
+	return connected == clients ? EXIT_SUCCESS : EXIT_FAILURE;
+}
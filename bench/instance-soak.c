@@ -0,0 +1,226 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Checks that a wayland-tracer in server mode doesn't grow over many
+ * short-lived clients.  Like accept-storm it runs mock-compositor and
+ * starts the tracer in front of it; then CYCLES clients, one after
+ * the other, connect, create OBJECTS objects (a registry and callbacks
+ * from wl_display.sync), wait for the last callback and hang up.  The
+ * tracer's resident set size is sampled every INTERVAL cycles, after a
+ * warm up of one interval, and the growth between the first and the last
+ * sample is printed.  Arguments after -- are passed to the tracer, e.g.
+ * "-- -d wayland.xml --damage-stats" to have it decode.
+ *
+ *	instance-soak [-n CYCLES] [-o OBJECTS] [-i INTERVAL] [-t TRACER]
+ *		      [-- TRACER-ARGS...]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "bench-util.h"
+
+/* Runs one client through the tracer, returns 0 if it got its reply */
+static int
+run_client(const struct sockaddr_un *addr, int objects)
+{
+	uint32_t msg[3 * 256], reply[1024], *p, size;
+	struct pollfd pfd;
+	int fd, i, len, offset, got = 0, done = 0, ret = -1;
+
+	/* wl_display@1.get_registry(new_id 2), then sync(new_id 3...) */
+	for (i = 0; i < objects; i++) {
+		msg[i * 3] = 1;
+		msg[i * 3 + 1] = 12 << 16 | (i == 0 ? 1 : 0);
+		msg[i * 3 + 2] = i + 2;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (const struct sockaddr *) addr, sizeof *addr) < 0 ||
+	    write(fd, msg, objects * 12) != objects * 12)
+		goto out;
+
+	/*
+	 * Read whole messages until the last callback is done, skipping
+	 * whatever else comes, such as the registry's globals
+	 */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (!done) {
+		if (poll(&pfd, 1, 5000) <= 0)
+			goto out;
+		len = read(fd, (char *) reply + got, sizeof reply - got);
+		if (len <= 0)
+			goto out;
+		got += len;
+
+		for (offset = 0; got - offset >= 8; offset += size) {
+			p = (uint32_t *) ((char *) reply + offset);
+			size = p[1] >> 16;
+			if (size < 8 || size > sizeof reply)
+				goto out;
+			if (got - offset < (int) size)
+				break;
+			if (p[0] == (uint32_t) objects + 1 &&
+			    (p[1] & 0xffff) == 0)
+				done = 1;
+		}
+		memmove(reply, (char *) reply + offset, got - offset);
+		got -= offset;
+	}
+	ret = 0;
+
+out:
+	close(fd);
+	return ret;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: instance-soak [-n CYCLES] [-o OBJECTS] "
+		"[-i INTERVAL] [-t TRACER] [-- TRACER-ARGS...]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *tracer_path = "./wayland-tracer";
+	char upstream_name[64], tracer_name[64], spec[160];
+	struct sockaddr_un upstream_addr, tracer_addr;
+	const char **args;
+	uint64_t start;
+	long first = -1, rss;
+	pid_t compositor, tracer;
+	int cycles = 100000, objects = 32, interval = 10000;
+	int opt, i, n, failed = 0;
+
+	while ((opt = getopt(argc, argv, "n:o:i:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			cycles = atoi(optarg);
+			break;
+		case 'o':
+			objects = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 't':
+			tracer_path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (cycles <= 0 || interval <= 0 || objects < 2 || objects > 256)
+		usage();
+	if (interval > cycles)
+		interval = cycles;
+
+	snprintf(upstream_name, sizeof upstream_name,
+		 "instance-soak-upstream-%d", getpid());
+	snprintf(tracer_name, sizeof tracer_name,
+		 "instance-soak-tracer-%d", getpid());
+	if (bench_make_addr(&upstream_addr, upstream_name) < 0 ||
+	    bench_make_addr(&tracer_addr, tracer_name) < 0)
+		return EXIT_FAILURE;
+
+	compositor = bench_spawn_compositor(argv[0], upstream_name);
+	if (compositor < 0)
+		return EXIT_FAILURE;
+
+	args = calloc(argc - optind + 6, sizeof *args);
+	if (args == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	snprintf(spec, sizeof spec, "%s=%s", tracer_name, upstream_name);
+	n = 0;
+	args[n++] = tracer_path;
+	args[n++] = "-S";
+	args[n++] = spec;
+	args[n++] = "-o";
+	args[n++] = "/dev/null";
+	for (i = optind; i < argc; i++)
+		args[n++] = argv[i];
+
+	tracer = fork();
+	if (tracer == 0) {
+		execv(tracer_path, (char **) args);
+		fprintf(stderr, "failed to run %s: %m\n", tracer_path);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (bench_wait_for_socket(&tracer_addr) < 0) {
+		fprintf(stderr, "tracer never came up\n");
+		goto out;
+	}
+
+	printf("%8s %10s\n", "cycles", "rss (KiB)");
+	start = bench_now();
+	for (i = 1; i <= cycles; i++) {
+		if (run_client(&tracer_addr, objects) < 0)
+			failed++;
+		if (i % interval != 0)
+			continue;
+
+		rss = bench_rss_kib(tracer);
+		printf("%8d %10ld\n", i, rss);
+		if (first < 0)
+			first = rss;
+	}
+
+	printf("%d cycles (%d failed) in %.1f s", cycles, failed,
+	       (bench_now() - start) / 1e9);
+	/* The first sample is the baseline, growth needs cycles past it */
+	if (first >= 0 && cycles > interval)
+		printf(", rss grew by %ld KiB after the first %d",
+		       bench_rss_kib(tracer) - first, interval);
+	printf("\n");
+
+out:
+	kill(tracer, SIGTERM);
+	kill(compositor, SIGTERM);
+	while (wait(NULL) > 0)
+		;
+	unlink(upstream_addr.sun_path);
+	unlink(tracer_addr.sun_path);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1276 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * A headless stand-in for a compositor, so that wayland-tracer can be
+ * exercised and benchmarked without a display.  It speaks enough of the
+ * core protocol and xdg-shell for simple clients to run: the registry,
+ * wl_compositor, wl_shm, wl_seat with a pointer, xdg_wm_base, surface
+ * commits with frame callbacks and wl_display.sync.  Nothing is drawn;
+ * shm buffers are released as soon as they are committed.
+ *
+ *	mock-compositor [-s NAME] [-r HZ] [-d MS] [-f EVENTS] [-x] [-q]
+ *
+ * The socket NAME (default mock-0) is created in XDG_RUNTIME_DIR.  Frame
+ * callbacks committed since the last refresh fire HZ times a second
+ * (default 60).  With -d every event goes out MS milliseconds after the
+ * request or refresh that caused it.  With -f every pointer over a mapped
+ * surface gets EVENTS wl_pointer.motion events per refresh.  With -x the
+ * compositor exits once the last client is gone.  On exit it prints how
+ * many requests and events went through, unless -q is given.  The
+ * benchmarks that need an upstream compositor run this one.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include "bench-util.h"
+
+#define MAX_ARGS		64
+#define MAX_FDS			28
+#define MAX_IDS			(1 << 20)
+#define MAX_BACKLOG		(16 * 1024 * 1024)
+#define IN_SIZE			8192
+
+enum object_type {
+	OBJECT_NONE,
+	OBJECT_DISPLAY,
+	OBJECT_REGISTRY,
+	OBJECT_CALLBACK,
+	OBJECT_COMPOSITOR,
+	OBJECT_SURFACE,
+	OBJECT_REGION,
+	OBJECT_SHM,
+	OBJECT_SHM_POOL,
+	OBJECT_BUFFER,
+	OBJECT_SEAT,
+	OBJECT_POINTER,
+	OBJECT_KEYBOARD,
+	OBJECT_TOUCH,
+	OBJECT_WM_BASE,
+	OBJECT_POSITIONER,
+	OBJECT_XDG_SURFACE,
+	OBJECT_TOPLEVEL,
+	OBJECT_POPUP,
+	OBJECT_TYPE_COUNT
+};
+
+/* Requests each type understands at the versions announced below */
+static const struct {
+	const char *name;
+	int requests;
+	int destructor;
+} types[] = {
+	[OBJECT_NONE] =		{ NULL, 0, -1 },
+	[OBJECT_DISPLAY] =	{ "wl_display", 2, -1 },
+	[OBJECT_REGISTRY] =	{ "wl_registry", 1, -1 },
+	[OBJECT_CALLBACK] =	{ "wl_callback", 0, -1 },
+	[OBJECT_COMPOSITOR] =	{ "wl_compositor", 2, -1 },
+	[OBJECT_SURFACE] =	{ "wl_surface", 10, 0 },
+	[OBJECT_REGION] =	{ "wl_region", 3, 0 },
+	[OBJECT_SHM] =		{ "wl_shm", 1, -1 },
+	[OBJECT_SHM_POOL] =	{ "wl_shm_pool", 3, 1 },
+	[OBJECT_BUFFER] =	{ "wl_buffer", 1, 0 },
+	[OBJECT_SEAT] =		{ "wl_seat", 4, 3 },
+	[OBJECT_POINTER] =	{ "wl_pointer", 2, 1 },
+	[OBJECT_KEYBOARD] =	{ "wl_keyboard", 1, 0 },
+	[OBJECT_TOUCH] =	{ "wl_touch", 1, 0 },
+	[OBJECT_WM_BASE] =	{ "xdg_wm_base", 4, 0 },
+	[OBJECT_POSITIONER] =	{ "xdg_positioner", 7, 0 },
+	[OBJECT_XDG_SURFACE] =	{ "xdg_surface", 5, 0 },
+	[OBJECT_TOPLEVEL] =	{ "xdg_toplevel", 14, 0 },
+	[OBJECT_POPUP] =	{ "xdg_popup", 2, 0 },
+};
+
+static const struct {
+	const char *interface;
+	uint32_t version;
+	enum object_type type;
+} globals[] = {
+	{ "wl_compositor", 4, OBJECT_COMPOSITOR },
+	{ "wl_shm", 1, OBJECT_SHM },
+	{ "wl_seat", 5, OBJECT_SEAT },
+	{ "xdg_wm_base", 1, OBJECT_WM_BASE },
+};
+
+#define GLOBAL_COUNT	(sizeof globals / sizeof globals[0])
+
+/* wl_display.error codes */
+#define ERROR_INVALID_OBJECT	0
+#define ERROR_INVALID_METHOD	1
+
+#define SURFACE_MAPPED		(1 << 0)
+#define SURFACE_ATTACHED	(1 << 1)
+#define CALLBACK_COMMITTED	(1 << 0)
+#define XDG_SURFACE_CONFIGURED	(1 << 0)
+
+/*
+ * link: callback -> surface, surface <-> xdg_surface, role -> xdg_surface
+ * pending: surface -> attached buffer, xdg_surface -> role object
+ */
+struct object {
+	uint8_t type;
+	uint8_t flags;
+	uint16_t version;
+	uint32_t link;
+	uint32_t pending;
+};
+
+struct id_array {
+	uint32_t *ids;
+	int count, size;
+};
+
+struct client {
+	int fd;
+	int dead;
+	int dirty;
+	struct client *prev, *next;
+
+	struct object *objects;
+	uint32_t object_count;
+
+	uint32_t in[IN_SIZE / 4];
+	size_t in_len;
+	int fds[MAX_FDS * 2];
+	int fd_count;
+
+	char *out;
+	size_t out_len, out_size;
+	int polling_out;
+
+	struct id_array frames;
+	struct id_array pointers;
+	uint32_t focus;
+};
+
+struct message {
+	uint32_t words[MAX_ARGS + 2];
+	int count;
+};
+
+/* Events held back by -d, in the order they are due */
+struct delayed {
+	struct client *client;
+	uint64_t due;
+	uint32_t size;
+	uint32_t pad;
+};
+
+struct queue {
+	char *data;
+	size_t head, tail, size;
+};
+
+static struct client clients = { .prev = &clients, .next = &clients };
+static struct client **dirty;
+static int dirty_count, dirty_size;
+static struct queue queue;
+static int epollfd;
+static uint32_t next_serial = 1;
+static uint64_t delay_ns;
+static int flood;
+static volatile sig_atomic_t running = 1;
+
+static uint64_t client_count, live_clients;
+static uint64_t request_count, event_count, error_count;
+
+static int
+id_array_add(struct id_array *array, uint32_t id)
+{
+	uint32_t *ids;
+	int size;
+
+	if (array->count == array->size) {
+		size = array->size ? array->size * 2 : 8;
+		ids = realloc(array->ids, size * sizeof *ids);
+		if (ids == NULL)
+			return -1;
+		array->ids = ids;
+		array->size = size;
+	}
+
+	array->ids[array->count++] = id;
+
+	return 0;
+}
+
+static void
+id_array_remove(struct id_array *array, uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < array->count; i++) {
+		if (array->ids[i] == id) {
+			array->ids[i] = array->ids[--array->count];
+			return;
+		}
+	}
+}
+
+static void
+client_mark_dirty(struct client *client)
+{
+	struct client **array;
+	int size;
+
+	if (client->dirty)
+		return;
+
+	if (dirty_count == dirty_size) {
+		size = dirty_size ? dirty_size * 2 : 64;
+		array = realloc(dirty, size * sizeof *array);
+		if (array == NULL) {
+			client->dead = 1;
+			return;
+		}
+		dirty = array;
+		dirty_size = size;
+	}
+
+	dirty[dirty_count++] = client;
+	client->dirty = 1;
+}
+
+static void
+client_append(struct client *client, const void *data, size_t size)
+{
+	size_t new_size;
+	char *out;
+
+	if (client->dead)
+		return;
+
+	if (client->out_len + size > MAX_BACKLOG) {
+		fprintf(stderr, "client %d isn't reading, disconnecting\n",
+			client->fd);
+		client->dead = 1;
+		client_mark_dirty(client);
+		return;
+	}
+
+	if (client->out_len + size > client->out_size) {
+		new_size = client->out_size ? client->out_size : 4096;
+		while (new_size < client->out_len + size)
+			new_size *= 2;
+		out = realloc(client->out, new_size);
+		if (out == NULL) {
+			client->dead = 1;
+			client_mark_dirty(client);
+			return;
+		}
+		client->out = out;
+		client->out_size = new_size;
+	}
+
+	memcpy(client->out + client->out_len, data, size);
+	client->out_len += size;
+	client_mark_dirty(client);
+}
+
+static void
+queue_push(struct client *client, const void *data, uint32_t size)
+{
+	struct delayed *entry;
+	size_t need, new_size;
+	char *buf;
+
+	need = sizeof *entry + ((size + 7) & ~7u);
+	if (queue.tail + need > queue.size && queue.head > 0) {
+		memmove(queue.data, queue.data + queue.head,
+			queue.tail - queue.head);
+		queue.tail -= queue.head;
+		queue.head = 0;
+	}
+
+	if (queue.tail + need > queue.size) {
+		new_size = queue.size ? queue.size : 65536;
+		while (new_size < queue.tail + need)
+			new_size *= 2;
+		buf = realloc(queue.data, new_size);
+		if (buf == NULL) {
+			client->dead = 1;
+			client_mark_dirty(client);
+			return;
+		}
+		queue.data = buf;
+		queue.size = new_size;
+	}
+
+	entry = (struct delayed *) (queue.data + queue.tail);
+	entry->client = client;
+	entry->due = bench_now() + delay_ns;
+	entry->size = size;
+	memcpy(entry + 1, data, size);
+	queue.tail += need;
+}
+
+/* Sends what is due, returns how long until the next event is, in ms */
+static int
+queue_release(void)
+{
+	struct delayed *entry;
+	uint64_t now;
+
+	now = bench_now();
+	while (queue.head < queue.tail) {
+		entry = (struct delayed *) (queue.data + queue.head);
+		if (entry->due > now)
+			return (entry->due - now + 999999) / 1000000;
+
+		if (entry->client != NULL)
+			client_append(entry->client, entry + 1, entry->size);
+		queue.head += sizeof *entry + ((entry->size + 7) & ~7u);
+	}
+
+	queue.head = queue.tail = 0;
+
+	return -1;
+}
+
+static void
+queue_forget(struct client *client)
+{
+	struct delayed *entry;
+	size_t pos;
+
+	for (pos = queue.head; pos < queue.tail;
+	     pos += sizeof *entry + ((entry->size + 7) & ~7u)) {
+		entry = (struct delayed *) (queue.data + pos);
+		if (entry->client == client)
+			entry->client = NULL;
+	}
+}
+
+static void
+message_init(struct message *msg, uint32_t id, uint32_t opcode)
+{
+	msg->words[0] = id;
+	msg->words[1] = opcode;
+	msg->count = 2;
+}
+
+static void
+message_uint(struct message *msg, uint32_t value)
+{
+	if (msg->count < MAX_ARGS + 2)
+		msg->words[msg->count++] = value;
+}
+
+static void
+message_string(struct message *msg, const char *string)
+{
+	uint32_t length = strlen(string) + 1;
+	int words = (length + 3) / 4;
+
+	if (msg->count + 1 + words > MAX_ARGS + 2)
+		return;
+
+	msg->words[msg->count++] = length;
+	msg->words[msg->count + words - 1] = 0;
+	memcpy(&msg->words[msg->count], string, length);
+	msg->count += words;
+}
+
+static void
+message_send(struct client *client, struct message *msg)
+{
+	uint32_t size = msg->count * sizeof(uint32_t);
+
+	msg->words[1] |= size << 16;
+	event_count++;
+
+	if (delay_ns > 0)
+		queue_push(client, msg->words, size);
+	else
+		client_append(client, msg->words, size);
+}
+
+static void
+post(struct client *client, uint32_t id, uint32_t opcode, int count, ...)
+{
+	struct message msg;
+	va_list ap;
+	int i;
+
+	message_init(&msg, id, opcode);
+	va_start(ap, count);
+	for (i = 0; i < count; i++)
+		message_uint(&msg, va_arg(ap, uint32_t));
+	va_end(ap);
+
+	message_send(client, &msg);
+}
+
+static void
+post_error(struct client *client, uint32_t id, uint32_t code,
+	   const char *fmt, ...)
+{
+	struct message msg;
+	char text[200];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(text, sizeof text, fmt, ap);
+	va_end(ap);
+
+	fprintf(stderr, "client %d: %s\n", client->fd, text);
+	error_count++;
+
+	/* wl_display.error goes out right away, the client is done */
+	message_init(&msg, 1, 0);
+	message_uint(&msg, id);
+	message_uint(&msg, code);
+	message_string(&msg, text);
+	msg.words[1] |= (msg.count * sizeof(uint32_t)) << 16;
+	client_append(client, msg.words, msg.count * sizeof(uint32_t));
+	client->dead = 1;
+	client_mark_dirty(client);
+}
+
+static int
+check_args(struct client *client, uint32_t id, int count, int needed)
+{
+	if (count >= needed)
+		return 0;
+
+	post_error(client, id, ERROR_INVALID_METHOD,
+		   "message to %s@%u too short",
+		   types[client->objects[id].type].name, id);
+
+	return -1;
+}
+
+/* Returns the object at id if it has the given type, 0 is fine too */
+static int
+check_object(struct client *client, uint32_t id, enum object_type type)
+{
+	if (id == 0 || (id < client->object_count &&
+			client->objects[id].type == type))
+		return 0;
+
+	post_error(client, id, ERROR_INVALID_OBJECT,
+		   "object %u isn't a %s", id, types[type].name);
+
+	return -1;
+}
+
+/* May move the object table, don't hold on to objects across it */
+static struct object *
+object_create(struct client *client, uint32_t id, enum object_type type,
+	      uint32_t version)
+{
+	struct object *objects, *object;
+	uint32_t count;
+
+	if (id == 0 || id >= MAX_IDS) {
+		post_error(client, id, ERROR_INVALID_OBJECT,
+			   "invalid new id %u", id);
+		return NULL;
+	}
+
+	if (id >= client->object_count) {
+		count = client->object_count * 2;
+		if (count <= id)
+			count = id + 1;
+		objects = realloc(client->objects, count * sizeof *objects);
+		if (objects == NULL) {
+			client->dead = 1;
+			client_mark_dirty(client);
+			return NULL;
+		}
+		memset(objects + client->object_count, 0,
+		       (count - client->object_count) * sizeof *objects);
+		client->objects = objects;
+		client->object_count = count;
+	}
+
+	object = &client->objects[id];
+	if (object->type != OBJECT_NONE) {
+		post_error(client, id, ERROR_INVALID_OBJECT,
+			   "id %u already in use", id);
+		return NULL;
+	}
+
+	object->type = type;
+	object->version = version;
+
+	return object;
+}
+
+static void
+object_release(struct client *client, uint32_t id)
+{
+	memset(&client->objects[id], 0, sizeof client->objects[id]);
+
+	/* wl_display.delete_id */
+	post(client, 1, 1, 1, id);
+}
+
+static void
+object_destroy(struct client *client, uint32_t id)
+{
+	struct object *objects = client->objects;
+	struct object *object = &objects[id];
+	uint32_t other;
+	int i, n;
+
+	switch (object->type) {
+	case OBJECT_SURFACE:
+		if (client->focus == id)
+			client->focus = 0;
+		if (object->link != 0)
+			objects[object->link].link = 0;
+		for (i = 0, n = 0; i < client->frames.count; i++) {
+			other = client->frames.ids[i];
+			if (objects[other].link == id)
+				object_release(client, other);
+			else
+				client->frames.ids[n++] = other;
+		}
+		client->frames.count = n;
+		break;
+	case OBJECT_POINTER:
+		id_array_remove(&client->pointers, id);
+		break;
+	case OBJECT_XDG_SURFACE:
+		if (object->link != 0)
+			objects[object->link].link = 0;
+		if (object->pending != 0)
+			objects[object->pending].link = 0;
+		break;
+	case OBJECT_TOPLEVEL:
+	case OBJECT_POPUP:
+		if (object->link != 0) {
+			objects[object->link].pending = 0;
+			objects[object->link].flags &= ~XDG_SURFACE_CONFIGURED;
+		}
+		break;
+	default:
+		break;
+	}
+
+	object_release(client, id);
+}
+
+static void
+pointer_enter(struct client *client, uint32_t pointer)
+{
+	post(client, pointer, 0, 4, next_serial++, client->focus, 0, 0);
+	if (client->objects[pointer].version >= 5)
+		post(client, pointer, 5, 0);
+}
+
+static void
+pointer_leave(struct client *client, uint32_t pointer)
+{
+	post(client, pointer, 1, 2, next_serial++, client->focus);
+	if (client->objects[pointer].version >= 5)
+		post(client, pointer, 5, 0);
+}
+
+static void
+surface_commit(struct client *client, uint32_t id)
+{
+	struct object *surface = &client->objects[id];
+	struct object *xdg_surface, *role;
+	uint32_t buffer;
+	int i;
+
+	if (surface->flags & SURFACE_ATTACHED) {
+		buffer = surface->pending;
+		surface->flags &= ~SURFACE_ATTACHED;
+
+		/* Pretend to have copied the contents */
+		if (buffer != 0 &&
+		    client->objects[buffer].type == OBJECT_BUFFER)
+			post(client, buffer, 0, 0);
+
+		if (buffer != 0 && !(surface->flags & SURFACE_MAPPED)) {
+			surface->flags |= SURFACE_MAPPED;
+			for (i = 0; i < client->pointers.count &&
+			     client->focus != 0; i++)
+				pointer_leave(client, client->pointers.ids[i]);
+			client->focus = id;
+			for (i = 0; i < client->pointers.count; i++)
+				pointer_enter(client, client->pointers.ids[i]);
+		} else if (buffer == 0 && (surface->flags & SURFACE_MAPPED)) {
+			surface->flags &= ~SURFACE_MAPPED;
+			if (client->focus == id) {
+				for (i = 0; i < client->pointers.count; i++)
+					pointer_leave(client,
+						      client->pointers.ids[i]);
+				client->focus = 0;
+			}
+		}
+	}
+
+	for (i = 0; i < client->frames.count; i++) {
+		if (client->objects[client->frames.ids[i]].link == id)
+			client->objects[client->frames.ids[i]].flags |=
+				CALLBACK_COMMITTED;
+	}
+
+	/* The initial commit of a surface with a role gets configured */
+	if (surface->link == 0)
+		return;
+	xdg_surface = &client->objects[surface->link];
+	if (xdg_surface->pending == 0 ||
+	    (xdg_surface->flags & XDG_SURFACE_CONFIGURED))
+		return;
+
+	role = &client->objects[xdg_surface->pending];
+	if (role->type == OBJECT_TOPLEVEL)
+		post(client, xdg_surface->pending, 0, 3, 0, 0, 0);
+	else
+		post(client, xdg_surface->pending, 0, 4, 0, 0, 0, 0);
+	post(client, surface->link, 0, 1, next_serial++);
+	xdg_surface->flags |= XDG_SURFACE_CONFIGURED;
+}
+
+static void
+registry_bind(struct client *client, uint32_t id, const uint32_t *args,
+	      int count)
+{
+	const char *interface;
+	struct message msg;
+	uint32_t name, length, version, new_id;
+	int words;
+
+	if (check_args(client, id, count, 2) < 0)
+		return;
+
+	name = args[0];
+	length = args[1];
+	words = (length + 3) / 4;
+	if (length == 0 || check_args(client, id, count, 4 + words) < 0)
+		return;
+
+	interface = (const char *) &args[2];
+	version = args[2 + words];
+	new_id = args[3 + words];
+
+	if (name == 0 || name > GLOBAL_COUNT ||
+	    interface[length - 1] != '\0' ||
+	    strcmp(interface, globals[name - 1].interface) != 0 ||
+	    version == 0 || version > globals[name - 1].version) {
+		post_error(client, id, ERROR_INVALID_OBJECT,
+			   "invalid global %.*s (%u) version %u",
+			   (int) length, interface, name, version);
+		return;
+	}
+
+	if (object_create(client, new_id, globals[name - 1].type,
+			  version) == NULL)
+		return;
+
+	switch (globals[name - 1].type) {
+	case OBJECT_SHM:
+		/* argb8888 and xrgb8888 */
+		post(client, new_id, 0, 1, 0);
+		post(client, new_id, 0, 1, 1);
+		break;
+	case OBJECT_SEAT:
+		/* pointer only */
+		post(client, new_id, 0, 1, 1);
+		if (version >= 2) {
+			message_init(&msg, new_id, 1);
+			message_string(&msg, "seat0");
+			message_send(client, &msg);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+dispatch(struct client *client, uint32_t id, uint32_t opcode,
+	 const uint32_t *args, int count)
+{
+	struct message msg;
+	struct object *object;
+	enum object_type type;
+	uint32_t version;
+	int fd;
+	size_t i;
+
+	request_count++;
+
+	if (id >= client->object_count ||
+	    client->objects[id].type == OBJECT_NONE) {
+		post_error(client, id, ERROR_INVALID_OBJECT,
+			   "invalid object %u", id);
+		return;
+	}
+
+	type = client->objects[id].type;
+	version = client->objects[id].version;
+	if (opcode >= (uint32_t) types[type].requests) {
+		post_error(client, id, ERROR_INVALID_METHOD,
+			   "invalid method %u of %s@%u", opcode,
+			   types[type].name, id);
+		return;
+	}
+
+	if ((int) opcode == types[type].destructor) {
+		object_destroy(client, id);
+		return;
+	}
+
+	/* Everything else that creates an object passes its id first */
+	switch (type) {
+	case OBJECT_DISPLAY:
+	case OBJECT_COMPOSITOR:
+	case OBJECT_SHM:
+	case OBJECT_SHM_POOL:
+	case OBJECT_SEAT:
+	case OBJECT_WM_BASE:
+	case OBJECT_XDG_SURFACE:
+		if (check_args(client, id, count, 1) < 0)
+			return;
+		break;
+	default:
+		break;
+	}
+
+	switch (type) {
+	case OBJECT_DISPLAY:
+		if (opcode == 0) {
+			/* sync */
+			if (object_create(client, args[0], OBJECT_CALLBACK,
+					  1) == NULL)
+				return;
+			post(client, args[0], 0, 1, next_serial++);
+			object_release(client, args[0]);
+		} else {
+			/* get_registry */
+			if (object_create(client, args[0], OBJECT_REGISTRY,
+					  1) == NULL)
+				return;
+			for (i = 0; i < GLOBAL_COUNT; i++) {
+				message_init(&msg, args[0], 0);
+				message_uint(&msg, i + 1);
+				message_string(&msg, globals[i].interface);
+				message_uint(&msg, globals[i].version);
+				message_send(client, &msg);
+			}
+		}
+		break;
+
+	case OBJECT_REGISTRY:
+		registry_bind(client, id, args, count);
+		break;
+
+	case OBJECT_COMPOSITOR:
+		object_create(client, args[0], opcode == 0 ?
+			      OBJECT_SURFACE : OBJECT_REGION, version);
+		break;
+
+	case OBJECT_SURFACE:
+		if (opcode == 1) {
+			/* attach */
+			if (check_args(client, id, count, 3) < 0 ||
+			    check_object(client, args[0], OBJECT_BUFFER) < 0)
+				return;
+			client->objects[id].pending = args[0];
+			client->objects[id].flags |= SURFACE_ATTACHED;
+		} else if (opcode == 3) {
+			/* frame */
+			if (check_args(client, id, count, 1) < 0)
+				return;
+			object = object_create(client, args[0],
+					       OBJECT_CALLBACK, 1);
+			if (object == NULL)
+				return;
+			object->link = id;
+			id_array_add(&client->frames, args[0]);
+		} else if (opcode == 6) {
+			surface_commit(client, id);
+		}
+		break;
+
+	case OBJECT_SHM:
+		/* create_pool, the fd is all that matters */
+		if (client->fd_count == 0) {
+			post_error(client, id, ERROR_INVALID_METHOD,
+				   "create_pool without a file descriptor");
+			return;
+		}
+		fd = client->fds[0];
+		memmove(client->fds, client->fds + 1,
+			--client->fd_count * sizeof client->fds[0]);
+		close(fd);
+		object_create(client, args[0], OBJECT_SHM_POOL, 1);
+		break;
+
+	case OBJECT_SHM_POOL:
+		if (opcode == 0)
+			object_create(client, args[0], OBJECT_BUFFER, 1);
+		break;
+
+	case OBJECT_SEAT:
+		if (opcode == 0) {
+			if (object_create(client, args[0], OBJECT_POINTER,
+					  version) == NULL)
+				return;
+			id_array_add(&client->pointers, args[0]);
+			if (client->focus != 0)
+				pointer_enter(client, args[0]);
+		} else {
+			object_create(client, args[0], opcode == 1 ?
+				      OBJECT_KEYBOARD : OBJECT_TOUCH, version);
+		}
+		break;
+
+	case OBJECT_WM_BASE:
+		if (opcode == 1) {
+			object_create(client, args[0], OBJECT_POSITIONER,
+				      version);
+		} else if (opcode == 2) {
+			if (check_args(client, id, count, 2) < 0 ||
+			    args[1] == 0 ||
+			    check_object(client, args[1], OBJECT_SURFACE) < 0)
+				return;
+			object = object_create(client, args[0],
+					       OBJECT_XDG_SURFACE, version);
+			if (object == NULL)
+				return;
+			object->link = args[1];
+			client->objects[args[1]].link = args[0];
+		}
+		break;
+
+	case OBJECT_XDG_SURFACE:
+		if (opcode == 1 || opcode == 2) {
+			if (client->objects[id].pending != 0) {
+				post_error(client, id, ERROR_INVALID_METHOD,
+					   "xdg_surface@%u already has a role",
+					   id);
+				return;
+			}
+			object = object_create(client, args[0], opcode == 1 ?
+					       OBJECT_TOPLEVEL : OBJECT_POPUP,
+					       version);
+			if (object == NULL)
+				return;
+			object->link = id;
+			client->objects[id].pending = args[0];
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void
+client_read(struct client *client)
+{
+	union {
+		char data[CMSG_SPACE(MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint32_t *p, size;
+	size_t pos;
+	ssize_t len;
+	int *fds, i, n;
+
+	iov.iov_base = (char *) client->in + client->in_len;
+	iov.iov_len = sizeof client->in - client->in_len;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof control.data;
+
+	len = recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len <= 0) {
+		client->dead = 1;
+		client_mark_dirty(client);
+		return;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		fds = (int *) CMSG_DATA(cmsg);
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < n; i++) {
+			if (client->fd_count < MAX_FDS * 2)
+				client->fds[client->fd_count++] = fds[i];
+			else
+				close(fds[i]);
+		}
+	}
+
+	client->in_len += len;
+
+	pos = 0;
+	while (!client->dead && client->in_len - pos >= 8) {
+		p = client->in + pos / 4;
+		size = p[1] >> 16;
+		if (size < 8 || size % 4 != 0 || size > sizeof client->in) {
+			post_error(client, p[0], ERROR_INVALID_METHOD,
+				   "bad message size %u", size);
+			return;
+		}
+		if (size > client->in_len - pos)
+			break;
+
+		dispatch(client, p[0], p[1] & 0xffff, p + 2, (size - 8) / 4);
+		pos += size;
+	}
+
+	memmove(client->in, (char *) client->in + pos, client->in_len - pos);
+	client->in_len -= pos;
+}
+
+static void
+client_set_polling(struct client *client, int polling)
+{
+	struct epoll_event ev;
+
+	if (client->polling_out == polling)
+		return;
+
+	ev.events = EPOLLIN | (polling ? EPOLLOUT : 0);
+	ev.data.ptr = client;
+	epoll_ctl(epollfd, EPOLL_CTL_MOD, client->fd, &ev);
+	client->polling_out = polling;
+}
+
+static void
+client_flush(struct client *client)
+{
+	ssize_t len;
+
+	while (client->out_len > 0) {
+		len = send(client->fd, client->out, client->out_len,
+			   MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN) {
+			client_set_polling(client, 1);
+			return;
+		}
+		if (len < 0) {
+			client->dead = 1;
+			return;
+		}
+
+		memmove(client->out, client->out + len, client->out_len - len);
+		client->out_len -= len;
+	}
+
+	client_set_polling(client, 0);
+}
+
+static struct client *
+client_create(int fd)
+{
+	struct client *client;
+	struct epoll_event ev;
+
+	client = calloc(1, sizeof *client);
+	if (client == NULL)
+		return NULL;
+
+	client->fd = fd;
+	client->object_count = 16;
+	client->objects = calloc(client->object_count,
+				 sizeof *client->objects);
+	if (client->objects == NULL) {
+		free(client);
+		return NULL;
+	}
+	client->objects[1].type = OBJECT_DISPLAY;
+	client->objects[1].version = 1;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = client;
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		free(client->objects);
+		free(client);
+		return NULL;
+	}
+
+	client->next = &clients;
+	client->prev = clients.prev;
+	clients.prev->next = client;
+	clients.prev = client;
+
+	client_count++;
+	live_clients++;
+
+	return client;
+}
+
+static void
+client_destroy(struct client *client)
+{
+	int i;
+
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	for (i = 0; i < client->fd_count; i++)
+		close(client->fds[i]);
+
+	queue_forget(client);
+	client->prev->next = client->next;
+	client->next->prev = client->prev;
+	live_clients--;
+
+	free(client->frames.ids);
+	free(client->pointers.ids);
+	free(client->objects);
+	free(client->out);
+	free(client);
+}
+
+static void
+flush_dirty(void)
+{
+	struct client *client;
+	int i;
+
+	for (i = 0; i < dirty_count; i++) {
+		client = dirty[i];
+		client->dirty = 0;
+		client_flush(client);
+		if (client->dead)
+			client_destroy(client);
+	}
+
+	dirty_count = 0;
+}
+
+static void
+refresh(void)
+{
+	struct client *client;
+	struct object *object;
+	uint32_t time, id;
+	int i, j, n;
+
+	time = bench_now() / 1000000;
+
+	for (client = clients.next; client != &clients;
+	     client = client->next) {
+		if (client->dead)
+			continue;
+
+		for (i = 0, n = 0; i < client->frames.count; i++) {
+			id = client->frames.ids[i];
+			if (client->objects[id].flags & CALLBACK_COMMITTED) {
+				post(client, id, 0, 1, time);
+				object_release(client, id);
+			} else {
+				client->frames.ids[n++] = id;
+			}
+		}
+		client->frames.count = n;
+
+		if (flood == 0 || client->focus == 0)
+			continue;
+
+		for (i = 0; i < client->pointers.count; i++) {
+			id = client->pointers.ids[i];
+			object = &client->objects[id];
+			for (j = 0; j < flood; j++) {
+				/* wl_fixed_t coordinates, sweeping along */
+				post(client, id, 2, 3, time, (j % 256) << 8,
+				     (j / 256 % 256) << 8);
+				if (object->version >= 5)
+					post(client, id, 5, 0);
+			}
+		}
+	}
+}
+
+static void
+handle_signal(int signum)
+{
+	running = 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mock-compositor [-s NAME] [-r HZ] [-d MS] "
+		"[-f EVENTS] [-x] [-q]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = "mock-0";
+	struct epoll_event events[64];
+	struct itimerspec interval;
+	struct sigaction sa;
+	struct sockaddr_un addr;
+	struct client *client;
+	uint64_t expirations;
+	int hz = 60, exit_when_idle = 0, quiet = 0;
+	int listenfd, timerfd, fd, opt, i, n;
+	int timeout;
+
+	while ((opt = getopt(argc, argv, "s:r:d:f:xq")) != -1) {
+		switch (opt) {
+		case 's':
+			name = optarg;
+			break;
+		case 'r':
+			hz = atoi(optarg);
+			break;
+		case 'd':
+			delay_ns = (uint64_t) atoi(optarg) * 1000000;
+			break;
+		case 'f':
+			flood = atoi(optarg);
+			break;
+		case 'x':
+			exit_when_idle = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind < argc || hz <= 0 || hz > 1000 || flood < 0)
+		usage();
+
+	if (bench_make_addr(&addr, name) < 0)
+		return EXIT_FAILURE;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	unlink(addr.sun_path);
+	listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			  0);
+	if (listenfd < 0 ||
+	    bind(listenfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+	    listen(listenfd, SOMAXCONN) < 0) {
+		fprintf(stderr, "failed to listen on %s: %s\n",
+			addr.sun_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	interval.it_interval.tv_sec = 1 / hz;
+	interval.it_interval.tv_nsec = 1000000000 / hz % 1000000000;
+	interval.it_value = interval.it_interval;
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (timerfd < 0 || epollfd < 0 ||
+	    timerfd_settime(timerfd, 0, &interval, NULL) < 0) {
+		fprintf(stderr, "failed to set up the main loop: %s\n",
+			strerror(errno));
+		unlink(addr.sun_path);
+		return EXIT_FAILURE;
+	}
+
+	events[0].events = EPOLLIN;
+	events[0].data.ptr = &listenfd;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &events[0]);
+	events[0].events = EPOLLIN;
+	events[0].data.ptr = &timerfd;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &events[0]);
+
+	while (running) {
+		timeout = queue_release();
+		flush_dirty();
+
+		if (exit_when_idle && client_count > 0 && live_clients == 0)
+			break;
+
+		n = epoll_wait(epollfd, events, 64, timeout);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &listenfd) {
+				while ((fd = accept4(listenfd, NULL, NULL,
+						     SOCK_CLOEXEC |
+						     SOCK_NONBLOCK)) >= 0) {
+					if (client_create(fd) == NULL)
+						close(fd);
+				}
+			} else if (events[i].data.ptr == &timerfd) {
+				if (read(timerfd, &expirations,
+					 sizeof expirations) > 0)
+					refresh();
+			} else {
+				client = events[i].data.ptr;
+				if (client->dead)
+					continue;
+				if (events[i].events & EPOLLOUT)
+					client_mark_dirty(client);
+				if (events[i].events & (EPOLLIN | EPOLLHUP |
+							EPOLLERR))
+					client_read(client);
+			}
+		}
+	}
+
+	while (clients.next != &clients)
+		client_destroy(clients.next);
+	close(timerfd);
+	close(listenfd);
+	close(epollfd);
+	unlink(addr.sun_path);
+
+	if (quiet)
+		return EXIT_SUCCESS;
+
+	fprintf(stderr, "%llu clients, %llu requests, %llu events, "
+		"%llu protocol errors\n", (unsigned long long) client_count,
+		(unsigned long long) request_count,
+		(unsigned long long) event_count,
+		(unsigned long long) error_count);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures how long the analyzer takes to load a set of protocol files,
+ * by default the core protocol and everything in wayland-protocols, once
+ * on a single thread and once on THREADS threads (one per CPU if not
+ * given), how much of that is finalizing, and how much heap the result
+ * takes.  Directories are searched for .xml files.
+ *
+ *	protocol-startup [-n RUNS] [-j THREADS] [FILE|DIR]...
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "bench-util.h"
+#include "tracer-analyzer.h"
+
+static const char **files;
+static int file_count, file_alloc;
+static off_t total_size;
+
+static int
+add_file(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	size_t len = strlen(path);
+
+	if (type != FTW_F || len < 4 || strcmp(path + len - 4, ".xml") != 0)
+		return 0;
+
+	if (file_count == file_alloc) {
+		file_alloc = file_alloc ? file_alloc * 2 : 64;
+		files = realloc(files, file_alloc * sizeof *files);
+		if (files == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	files[file_count++] = strdup(path);
+	total_size += st->st_size;
+
+	return 0;
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+static uint64_t finalize_best = UINT64_MAX;
+
+/* Heap in use, including what malloc mapped separately */
+static size_t
+heap_used(void)
+{
+	struct mallinfo2 info = mallinfo2();
+
+	return info.uordblks + info.hblkhd;
+}
+
+/* Returns the time to load and finalize everything, 0 on failure */
+static uint64_t
+load(int threads, int *finalized)
+{
+	struct tracer_analyzer *analyzer;
+	uint64_t start, finalize;
+
+	start = bench_now();
+	analyzer = tracer_analyzer_create();
+	if (analyzer == NULL ||
+	    tracer_analyzer_add_protocols(analyzer, files, file_count,
+					  threads) != 0)
+		return 0;
+	finalize = bench_now();
+	*finalized = tracer_analyzer_finalize(analyzer) == 0;
+	if (bench_now() - finalize < finalize_best)
+		finalize_best = bench_now() - finalize;
+
+	return bench_now() - start;
+}
+
+static uint64_t
+best_of(int runs, int threads, int *finalized)
+{
+	uint64_t best = UINT64_MAX, elapsed;
+	int i;
+
+	for (i = 0; i < runs; i++) {
+		elapsed = load(threads, finalized);
+		if (elapsed == 0) {
+			fprintf(stderr, "failed to load protocols\n");
+			exit(EXIT_FAILURE);
+		}
+		if (elapsed < best)
+			best = elapsed;
+	}
+
+	return best;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: protocol-startup [-n RUNS] [-j THREADS] "
+		"[FILE|DIR]...\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *defaults[] = {
+		"/usr/share/wayland/wayland.xml",
+		"/usr/share/wayland-protocols",
+	};
+	uint64_t serial, parallel;
+	size_t heap;
+	int runs = 5, threads = 0, opt, i, finalized = 0;
+
+	while ((opt = getopt(argc, argv, "n:j:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (runs <= 0 || threads < 0)
+		usage();
+
+	if (optind == argc) {
+		for (i = 0; i < 2; i++)
+			nftw(defaults[i], add_file, 16, FTW_PHYS);
+	} else {
+		for (i = optind; i < argc; i++) {
+			if (nftw(argv[i], add_file, 16, FTW_PHYS) != 0) {
+				fprintf(stderr, "can't read %s: %m\n",
+					argv[i]);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (file_count == 0) {
+		fprintf(stderr, "no protocol files found\n");
+		return EXIT_FAILURE;
+	}
+
+	/* The core protocol, if given first, stays first */
+	qsort(files + 1, file_count - 1, sizeof *files, compare_paths);
+
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/* Analyzers are never freed, so measure a fresh one first */
+	heap = heap_used();
+	best_of(1, 1, &finalized);
+	heap = heap_used() - heap;
+
+	serial = best_of(runs, 1, &finalized);
+	parallel = best_of(runs, threads, &finalized);
+
+	printf("%d files, %lld KiB%s\n", file_count,
+	       (long long) total_size / 1024,
+	       finalized ? "" : " (some interfaces missing, see above)");
+	printf("1 thread:   %8.2f ms\n", serial / 1e6);
+	printf("%d threads: %8.2f ms\n", threads, parallel / 1e6);
+	printf("speedup:    %8.2fx\n", (double) serial / parallel);
+	printf("finalize:   %8.2f ms\n", finalize_best / 1e6);
+	printf("heap:       %8zu KiB\n", heap / 1024);
+
+	return EXIT_SUCCESS;
+}
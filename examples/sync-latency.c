@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Example wayland-tracer plugin: measures how long the compositor takes
+ * to answer wl_display.sync, per client.
+ *
+ *	cc -shared -fPIC -I/path/to/wayland-tracer/headers \
+ *		-o sync-latency.so sync-latency.c
+ *	wayland-tracer -d wayland.xml --plugin ./sync-latency.so -- PROGRAM
+ *
+ * With --plugin ./sync-latency.so=quiet only the summary of each client
+ * is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-tracer-plugin.h>
+
+#define MAX_PENDING 64
+
+struct pending {
+	uint32_t id;
+	uint64_t start;
+};
+
+struct client {
+	uint32_t socket, instance;
+	struct pending pending[MAX_PENDING];
+	int npending;
+	uint64_t count, total, max;
+	struct client *next;
+};
+
+struct sync_latency {
+	struct tracer_plugin_host *host;
+	struct client *clients;
+	int quiet;
+};
+
+static struct client *
+find_client(struct sync_latency *sl, uint32_t socket, uint32_t instance)
+{
+	struct client *client;
+
+	for (client = sl->clients; client != NULL; client = client->next) {
+		if (client->socket == socket && client->instance == instance)
+			return client;
+	}
+
+	return NULL;
+}
+
+static void
+handle_sync(void *data, const struct tracer_plugin_message *message)
+{
+	struct sync_latency *sl = data;
+	struct client *client;
+
+	client = find_client(sl, message->socket, message->instance);
+	if (client == NULL || client->npending == MAX_PENDING)
+		return;
+
+	/* wl_display.sync(new_id callback) */
+	client->pending[client->npending].id = message->args[0];
+	client->pending[client->npending].start = message->timestamp;
+	client->npending++;
+}
+
+static void
+handle_done(void *data, const struct tracer_plugin_message *message)
+{
+	struct sync_latency *sl = data;
+	struct client *client;
+	uint64_t latency;
+	int i;
+
+	client = find_client(sl, message->socket, message->instance);
+	if (client == NULL)
+		return;
+
+	for (i = 0; i < client->npending; i++) {
+		if (client->pending[i].id == message->id)
+			break;
+	}
+	if (i == client->npending)
+		return;
+
+	latency = message->timestamp - client->pending[i].start;
+	client->pending[i] = client->pending[--client->npending];
+	client->count++;
+	client->total += latency;
+	if (latency > client->max)
+		client->max = latency;
+
+	if (!sl->quiet)
+		sl->host->print(sl->host, "sync-latency: client %u: "
+				"wl_callback@%u after %.3f ms\n",
+				message->instance, message->id,
+				latency / 1e6);
+}
+
+static void
+handle_instance(void *data, uint32_t socket, uint32_t instance, int created)
+{
+	struct sync_latency *sl = data;
+	struct client *client, **p;
+
+	if (created) {
+		client = calloc(1, sizeof *client);
+		if (client == NULL)
+			return;
+		client->socket = socket;
+		client->instance = instance;
+		client->next = sl->clients;
+		sl->clients = client;
+		return;
+	}
+
+	for (p = &sl->clients; *p != NULL; p = &(*p)->next) {
+		client = *p;
+		if (client->socket != socket || client->instance != instance)
+			continue;
+
+		if (client->count > 0)
+			sl->host->print(sl->host, "sync-latency: client %u: "
+					"%llu round trips, %.3f ms on "
+					"average, %.3f ms at most\n",
+					instance,
+					(unsigned long long) client->count,
+					client->total / 1e6 / client->count,
+					client->max / 1e6);
+		*p = client->next;
+		free(client);
+		return;
+	}
+}
+
+static int
+sync_latency_init(struct tracer_plugin_host *host, const char *args,
+		  void **data)
+{
+	struct sync_latency *sl;
+	int sync;
+
+	sl = calloc(1, sizeof *sl);
+	if (sl == NULL)
+		return -1;
+	*data = sl;
+	sl->host = host;
+	sl->quiet = args != NULL && !strcmp(args, "quiet");
+
+	sync = host->lookup_opcode(host, "wl_display", TRACER_PLUGIN_REQUEST,
+				   "sync");
+	if (sync < 0 ||
+	    host->subscribe(host, "wl_display", TRACER_PLUGIN_REQUEST, sync,
+			    handle_sync, sl) != 0 ||
+	    host->subscribe(host, "wl_callback", TRACER_PLUGIN_EVENT,
+			    TRACER_PLUGIN_ANY_OPCODE, handle_done, sl) != 0 ||
+	    host->watch_instances(host, handle_instance, sl) != 0) {
+		fprintf(stderr, "sync-latency: needs the core protocol\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+sync_latency_fini(void *data)
+{
+	struct sync_latency *sl = data;
+	struct client *client;
+
+	while ((client = sl->clients) != NULL) {
+		sl->clients = client->next;
+		free(client);
+	}
+	free(sl);
+}
+
+TRACER_PLUGIN_EXPORT const struct tracer_plugin wayland_tracer_plugin = {
+	.abi_version = TRACER_PLUGIN_ABI_VERSION,
+	.name = "sync-latency",
+	.init = sync_latency_init,
+	.fini = sync_latency_fini,
+};
@@ -43,28 +43,129 @@
 
 #define DIV_ROUNDUP(n, a) ( ((n) + ((a) - 1)) / (a) )
 
-#define MASK(i) ((i) & 4095)
+#define MASK(b, i) ((i) & ((b)->size - 1))
+
+/* Buffers start this small, enough for a few fds, and double from there */
+#define WL_BUFFER_MIN	16
+#define POOL_CLASSES	9	/* WL_BUFFER_MIN << 8 == WL_BUFFER_MAX */
+/* Free blocks of each size kept around, the rest go back to malloc */
+#define POOL_KEEP	256
 
 #define MAX_FDS_OUT	28
 #define CLEN		(CMSG_LEN(MAX_FDS_OUT * sizeof(int32_t)))
 
+struct pool_block {
+	struct pool_block *next;
+};
+
+/* Blocks for buffers, one free list per power of two size */
+static struct {
+	struct pool_block *free;
+	int count;
+} pool[POOL_CLASSES];
+
 static int
-wl_buffer_put(struct wl_buffer *b, const void *data, size_t count)
+pool_class(uint32_t size)
 {
-	uint32_t head, size;
+	return __builtin_ctz(size / WL_BUFFER_MIN);
+}
+
+static char *
+pool_get(uint32_t size)
+{
+	struct pool_block *block;
+	int class = pool_class(size);
+
+	block = pool[class].free;
+	if (block == NULL)
+		return malloc(size);
+
+	pool[class].free = block->next;
+	pool[class].count--;
+
+	return (char *) block;
+}
+
+static void
+pool_put(char *data, uint32_t size)
+{
+	struct pool_block *block = (struct pool_block *) data;
+	int class = pool_class(size);
+
+	if (pool[class].count == POOL_KEEP) {
+		free(data);
+		return;
+	}
 
-	if (count > sizeof(b->data)) {
+	block->next = pool[class].free;
+	pool[class].free = block;
+	pool[class].count++;
+}
+
+/* Makes room for count more bytes, keeping what's in the buffer */
+static int
+wl_buffer_reserve(struct wl_buffer *b, size_t count)
+{
+	uint32_t used, size;
+	char *data;
+
+	used = b->head - b->tail;
+	if (used + count > WL_BUFFER_MAX) {
 		wl_log("Data too big for buffer (%d > %d).\n",
-		       count, sizeof(b->data));
+		       used + count, WL_BUFFER_MAX);
 		errno = E2BIG;
 		return -1;
 	}
 
-	head = MASK(b->head);
-	if (head + count <= sizeof b->data) {
+	if (b->data != NULL && used + count <= b->size)
+		return 0;
+
+	size = b->data != NULL ? b->size : WL_BUFFER_MIN;
+	while (size < used + count)
+		size *= 2;
+
+	data = pool_get(size);
+	if (data == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (b->data != NULL) {
+		wl_buffer_copy(b, data, used);
+		pool_put(b->data, b->size);
+	}
+	b->data = data;
+	b->size = size;
+	b->tail = 0;
+	b->head = used;
+
+	return 0;
+}
+
+static void
+wl_buffer_release(struct wl_buffer *b)
+{
+	if (b->data != NULL)
+		pool_put(b->data, b->size);
+	b->data = NULL;
+	b->size = 0;
+	b->head = 0;
+	b->tail = 0;
+}
+
+static int
+wl_buffer_put(struct wl_buffer *b, const void *data, size_t count)
+{
+	uint32_t head, size;
+
+	if (wl_buffer_reserve(b, count) < 0)
+		return -1;
+
+	head = MASK(b, b->head);
+	if (head + count <= b->size) {
 		memcpy(b->data + head, data, count);
 	} else {
-		size = sizeof b->data - head;
+		size = b->size - head;
 		memcpy(b->data + head, data, size);
 		memcpy(b->data, (const char *) data + size, count - size);
 	}
@@ -79,19 +180,19 @@ wl_buffer_put_iov(struct wl_buffer *b, struct iovec *iov, int *count)
 {
 	uint32_t head, tail;
 
-	head = MASK(b->head);
-	tail = MASK(b->tail);
+	head = MASK(b, b->head);
+	tail = MASK(b, b->tail);
 	if (head < tail) {
 		iov[0].iov_base = b->data + head;
 		iov[0].iov_len = tail - head;
 		*count = 1;
 	} else if (tail == 0) {
 		iov[0].iov_base = b->data + head;
-		iov[0].iov_len = sizeof b->data - head;
+		iov[0].iov_len = b->size - head;
 		*count = 1;
 	} else {
 		iov[0].iov_base = b->data + head;
-		iov[0].iov_len = sizeof b->data - head;
+		iov[0].iov_len = b->size - head;
 		iov[1].iov_base = b->data;
 		iov[1].iov_len = tail;
 		*count = 2;
@@ -103,19 +204,19 @@ wl_buffer_get_iov(struct wl_buffer *b, struct iovec *iov, int *count)
 {
 	uint32_t head, tail;
 
-	head = MASK(b->head);
-	tail = MASK(b->tail);
+	head = MASK(b, b->head);
+	tail = MASK(b, b->tail);
 	if (tail < head) {
 		iov[0].iov_base = b->data + tail;
 		iov[0].iov_len = head - tail;
 		*count = 1;
 	} else if (head == 0) {
 		iov[0].iov_base = b->data + tail;
-		iov[0].iov_len = sizeof b->data - tail;
+		iov[0].iov_len = b->size - tail;
 		*count = 1;
 	} else {
 		iov[0].iov_base = b->data + tail;
-		iov[0].iov_len = sizeof b->data - tail;
+		iov[0].iov_len = b->size - tail;
 		iov[1].iov_base = b->data;
 		iov[1].iov_len = head;
 		*count = 2;
@@ -127,11 +228,14 @@ wl_buffer_copy(struct wl_buffer *b, void *data, size_t count)
 {
 	uint32_t tail, size;
 
-	tail = MASK(b->tail);
-	if (tail + count <= sizeof b->data) {
+	if (count == 0)
+		return;
+
+	tail = MASK(b, b->tail);
+	if (tail + count <= b->size) {
 		memcpy(data, b->data + tail, count);
 	} else {
-		size = sizeof b->data - tail;
+		size = b->size - tail;
 		memcpy(data, b->data + tail, size);
 		memcpy((char *) data + size, b->data, count - size);
 	}
@@ -160,7 +264,7 @@ wl_connection_create(int fd)
 static void
 close_fds(struct wl_buffer *buffer, int max)
 {
-	int32_t fds[sizeof(buffer->data) / sizeof(int32_t)], i, count;
+	int32_t fds[WL_BUFFER_MAX / sizeof(int32_t)], i, count;
 	size_t size;
 
 	size = buffer->head - buffer->tail;
@@ -182,9 +286,38 @@ wl_connection_destroy(struct wl_connection *connection)
 	close_fds(&connection->fds_out, -1);
 	close_fds(&connection->fds_in, -1);
 	close(connection->fd);
+	wl_buffer_release(&connection->in);
+	wl_buffer_release(&connection->out);
+	wl_buffer_release(&connection->fds_in);
+	wl_buffer_release(&connection->fds_out);
 	free(connection);
 }
 
+/* Gives the memory of empty buffers back to the pool */
+void
+wl_connection_trim(struct wl_connection *connection)
+{
+	struct wl_buffer *buffers[] = {
+		&connection->in, &connection->out,
+		&connection->fds_in, &connection->fds_out
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(buffers); i++) {
+		if (buffers[i]->head == buffers[i]->tail)
+			wl_buffer_release(buffers[i]);
+	}
+}
+
+/* What the connection takes up, buffers included */
+size_t
+wl_connection_memory(struct wl_connection *connection)
+{
+	return sizeof *connection + connection->in.size +
+	       connection->out.size + connection->fds_in.size +
+	       connection->fds_out.size;
+}
+
 void
 wl_connection_copy(struct wl_connection *connection, void *data, size_t size)
 {
@@ -233,7 +366,7 @@ decode_cmsg(struct wl_buffer *buffer, struct msghdr *msg)
 			continue;
 
 		size = cmsg->cmsg_len - CMSG_LEN(0);
-		max = sizeof(buffer->data) - wl_buffer_size(buffer);
+		max = WL_BUFFER_MAX - wl_buffer_size(buffer);
 		if (size > max || overflow) {
 			overflow = 1;
 			size /= sizeof(int32_t);
@@ -304,11 +437,16 @@ wl_connection_read(struct wl_connection *connection)
 	char cmsg[CLEN];
 	int len, count, ret;
 
-	if (wl_buffer_size(&connection->in) >= sizeof(connection->in.data)) {
+	if (wl_buffer_size(&connection->in) >= WL_BUFFER_MAX) {
 		errno = EOVERFLOW;
 		return -1;
 	}
 
+	/* Offer recvmsg all the room there can be */
+	if (wl_buffer_reserve(&connection->in, WL_BUFFER_MAX -
+			      wl_buffer_size(&connection->in)) < 0)
+		return -1;
+
 	wl_buffer_put_iov(&connection->in, iov, &count);
 
 	msg.msg_name = NULL;
@@ -335,12 +473,37 @@ wl_connection_read(struct wl_connection *connection)
 	return connection->in.head - connection->in.tail;
 }
 
+/*
+ * Makes data and nfds file descriptors, all -1, look as if they had been
+ * read.  Used to decode captures.
+ */
+int
+wl_connection_feed(struct wl_connection *connection,
+		   const void *data, size_t count, int nfds)
+{
+	int32_t fd = -1;
+	int i;
+
+	if (wl_buffer_size(&connection->in) + count > WL_BUFFER_MAX ||
+	    wl_buffer_size(&connection->fds_in) + nfds * sizeof fd >
+	    WL_BUFFER_MAX) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	wl_buffer_put(&connection->in, data, count);
+	for (i = 0; i < nfds; i++)
+		wl_buffer_put(&connection->fds_in, &fd, sizeof fd);
+
+	return 0;
+}
+
 int
 wl_connection_write(struct wl_connection *connection,
 		    const void *data, size_t count)
 {
 	if (connection->out.head - connection->out.tail +
-	    count > ARRAY_LENGTH(connection->out.data)) {
+	    count > WL_BUFFER_MAX) {
 		connection->want_flush = 1;
 		if (wl_connection_flush(connection) < 0)
 			return -1;
@@ -359,7 +522,7 @@ wl_connection_queue(struct wl_connection *connection,
 		    const void *data, size_t count)
 {
 	if (connection->out.head - connection->out.tail +
-	    count > ARRAY_LENGTH(connection->out.data)) {
+	    count > WL_BUFFER_MAX) {
 		connection->want_flush = 1;
 		if (wl_connection_flush(connection) < 0)
 			return -1;
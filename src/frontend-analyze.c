@@ -20,7 +20,10 @@
  * OF THIS SOFTWARE.
  */
 
+#include "../config.h"
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "wayland-private.h"
@@ -28,6 +31,15 @@
 #include "tracer.h"
 #include "frontend-analyze.h"
 #include "tracer-analyzer.h"
+#include "tracer-damage-stats.h"
+#include "tracer-decode.h"
+#include "tracer-fdinfo.h"
+#include "tracer-frame-stats.h"
+#include "tracer-plugin.h"
+#include "tracer-probes.h"
+#include "tracer-profile.h"
+#include "tracer-shm-analytics.h"
+#include "tracer-top.h"
 
 #define DIV_ROUNDUP(n, a) ( ((n) + ((a) - 1)) / (a) )
 
@@ -36,7 +48,10 @@ analyze_init(struct tracer *tracer)
 {
 	struct tracer_analyzer *analyzer;
 	struct protocol_file *file;
+	struct plugin_option *plugin;
 	struct tracer_options *options = tracer->options;
+	const char **filenames;
+	int count = 0;
 
 	analyzer = tracer_analyzer_create();
 	if (analyzer == NULL) {
@@ -44,27 +59,76 @@ analyze_init(struct tracer *tracer)
 		return -1;
 	}
 
-	wl_list_for_each(file, &options->protocol_file_list, link) {
-		if (tracer_analyzer_add_protocol(analyzer,
-						 file->loc) != 0) {
-			fprintf(stderr, "failed to add file %s\n",
-				file->loc);
-			return -1;
-		}
+	filenames = malloc(wl_list_length(&options->protocol_file_list) *
+			   sizeof *filenames);
+	if (filenames == NULL) {
+		fprintf(stderr, "Failed to alloc for protocols: %m\n");
+		return -1;
+	}
+	wl_list_for_each(file, &options->protocol_file_list, link)
+		filenames[count++] = file->loc;
+
+	if (tracer_analyzer_add_protocols(analyzer, filenames, count,
+					  0) != 0) {
+		fprintf(stderr, "failed to add protocol files\n");
+		free(filenames);
+		return -1;
 	}
+	free(filenames);
+
+	if (options->protocol_path != NULL)
+		tracer_analyzer_index(analyzer, options->protocol_path);
 
 	if (tracer_analyzer_finalize(analyzer) != 0)
 		return -1;
 
+	if (options->compiled_decoders)
+		tracer_decode_attach(analyzer);
+
+	if (tracer_fdinfo_watch_pools(tracer, analyzer) != 0)
+		return -1;
+
+	if (options->shm_analytics &&
+	    tracer_shm_analytics_init(tracer, analyzer) != 0)
+		return -1;
+
+	if (options->damage_stats &&
+	    tracer_damage_stats_init(tracer, analyzer) != 0)
+		return -1;
+
+	if (options->frame_stats &&
+	    tracer_frame_stats_init(tracer, analyzer) != 0)
+		return -1;
+
+	/* The top view lays out every interface up front */
+	if (options->top) {
+		tracer_analyzer_load_all(analyzer);
+		if (tracer_top_init(tracer, analyzer) != 0)
+			return -1;
+	}
+
+	wl_list_for_each(plugin, &options->plugin_list, link) {
+		if (tracer_plugin_load(tracer, analyzer, plugin) != 0)
+			return -1;
+	}
+
 	tracer->frontend_data = analyzer;
 
 	return 0;
 }
 
+/* With -q decoded messages aren't printed, hooks still see them */
+#define message_log(...) \
+	do { if (verbose) tracer_log(__VA_ARGS__); } while (0)
+#define message_log_cont(...) \
+	do { if (verbose) tracer_log_cont(__VA_ARGS__); } while (0)
+#define message_log_end() \
+	do { if (verbose) tracer_log_end(); } while (0)
+
 static int
 analyze_protocol(struct tracer_connection *connection,
+		 const uint32_t *data,
 		 uint32_t size,
-		 struct wl_map *objects,
 		 struct tracer_interface *target,
 		 uint32_t id,
 		 struct tracer_message *message)
@@ -74,76 +138,96 @@ analyze_protocol(struct tracer_connection *connection,
 	unsigned int i, count;
 	const char *signature;
 	char *type_name;
-	char buf[4096];
-	uint32_t *p = (uint32_t *) buf + 2;
-	struct tracer_connection *peer = connection->peer;
+	char symbol[264];
+	struct tracer_message_view view;
+	struct tracer_hook *hook;
+	struct tracer_decode decode;
+	const uint32_t *p = data + 2;
 	struct tracer_instance *instance = connection->instance;
 	struct tracer *tracer = connection->instance->tracer;
-	struct tracer_analyzer *analyzer;
-	struct tracer_interface *type;
-	struct tracer_interface **ptype;
+	int verbose = !tracer->options->quiet;
+	int stage;
 
-	analyzer = (struct tracer_analyzer *) tracer->frontend_data;
+	TRACER_PROBE(decode_start, instance->id, connection->side, size,
+		     data[1] & 0xffff);
+
+	decode.nfds = 0;
 
-	wl_connection_copy(connection->wl_conn, buf, size);
 	if (target == NULL)
 		goto finish;
 
+	message->count++;
+	message->bytes += size;
+
+	decode.connection = connection;
+	decode.instance = instance;
+	decode.analyzer = tracer->frontend_data;
+	decode.message = message;
+	decode.arrow = connection->side == TRACER_CLIENT_SIDE ? "<=" : "=>";
+	decode.id = id;
+	decode.verbose = verbose;
+
+	if (message->decode != NULL) {
+		message->decode(&decode, p);
+		goto hooks;
+	}
+
 	count = strlen(message->signature);
 
-	tracer_log("%s %s@%u.%s(",
-		   connection->side == TRACER_CLIENT_SIDE ? "<=" : "=>",
-		   target->name,
-		   id,
-		   message->name);
+	message_log("%s %s@%u.%s(", decode.arrow, target->name, id,
+		    message->name);
 
 	signature = message->signature;
 	for (i = 0; i < count; i++) {
 		if (i != 0)
-			tracer_log_cont(", ");
+			message_log_cont(", ");
 
 		switch (*signature) {
 		case 'u':
-			tracer_log_cont("%u", *p++);
+			message_log_cont("%u%s", *p,
+					 tracer_decode_enum(&decode, i, *p,
+							    symbol,
+							    sizeof symbol));
+			p++;
 			break;
 		case 'i':
-			tracer_log_cont("%i", *p++);
+			message_log_cont("%i%s", *p,
+					 tracer_decode_enum(&decode, i, *p,
+							    symbol,
+							    sizeof symbol));
+			p++;
 			break;
 		case 'f':
-			tracer_log_cont("%lf", wl_fixed_to_double(*p++));
+			message_log_cont("%lf", wl_fixed_to_double(*p));
+			p++;
 			break;
 		case 's':
 			length = *p++;
 
 			if (length == 0)
-				tracer_log_cont("(null)");
+				message_log_cont("(null)");
 			else
-				tracer_log_cont("\"%s\"", (char *) p);
+				message_log_cont("\"%s\"", (char *) p);
 			p = p + DIV_ROUNDUP(length, sizeof *p);
 			break;
 		case 'o':
-			tracer_log_cont("obj %u", *p++);
+			message_log_cont("obj %u", *p);
+			p++;
 			break;
 		case 'n':
 			new_id = *p++;
-			if (new_id != 0) {
-				wl_map_reserve_new(objects, new_id);
-				wl_map_insert_at(objects, 0, new_id, message->types[0]);
-			}
-			tracer_log_cont("new_id %u", new_id);
+			if (new_id != 0)
+				tracer_decode_new_id(&decode, new_id);
+			message_log_cont("new_id %u", new_id);
 			break;
 		case 'a':
 			length = *p++;
-			tracer_log_cont("array: %u", length);
+			message_log_cont("array: %u", length);
 			p = p + DIV_ROUNDUP(length, sizeof *p);
 			break;
 		case 'h':
-			wl_buffer_copy(&connection->wl_conn->fds_in,
-				       &fd,
-				       sizeof fd);
-			connection->wl_conn->fds_in.tail += sizeof fd;
-			tracer_log_cont("fd %d", fd);
-			wl_connection_put_fd(peer->wl_conn, fd);
+			fd = tracer_decode_fd(&decode, symbol, sizeof symbol);
+			message_log_cont("fd %d%s", fd, symbol);
 			break;
 		case 'N': /* N = sun */
 			length = *p++;
@@ -156,70 +240,143 @@ analyze_protocol(struct tracer_connection *connection,
 			name = *p++;
 
 			new_id = *p++;
-			if (new_id != 0) {
-				wl_map_reserve_new(objects, new_id);
-				ptype = tracer_analyzer_lookup_type(analyzer,
-								    type_name);
-				type = ptype == NULL ? NULL : *ptype;
-				wl_map_insert_at(objects, 0, new_id, type);
-			}
-			tracer_log_cont("new_id %u[%s,%u]",
-					new_id, type_name, name);
+			if (new_id != 0)
+				tracer_decode_new_id_typed(&decode, type_name,
+							   new_id);
+			message_log_cont("new_id %u[%s,%u]",
+					 new_id, type_name, name);
 			break;
 		}
 
 		signature++;
 	}
 
-	tracer_log_cont(")");
-	tracer_log_end();
+	message_log_cont(")");
+	message_log_end();
+
+hooks:
+	if (!wl_list_empty(&message->hook_list)) {
+		view.instance = instance;
+		view.side = connection->side;
+		view.id = id;
+		view.size = size;
+		view.interface = target;
+		view.message = message;
+		view.args = data + 2;
+		view.fds = decode.fds;
+		view.nfds = decode.nfds;
+		view.timestamp = connection->timestamp;
+		wl_list_for_each(hook, &message->hook_list, link)
+			hook->func(hook, &view);
+	}
 finish:
-	wl_connection_write(peer->wl_conn, buf, size);
-	wl_connection_consume(connection->wl_conn, size);
+	TRACER_PROBE(decode_done, instance->id, connection->side, size,
+		     data[1] & 0xffff);
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_WRITE);
+	tracer_record_message(connection, data, size, decode.nfds);
+	tracer_profile_leave(tracer, stage);
 
 	return 0;
 }
 
-static int
-analyze_handle_data(struct tracer_connection *connection, int len)
+/*
+ * Decodes every complete message of one read.  Consecutive messages often
+ * go to the same object, so the last lookup is reused until the object
+ * map changes.
+ */
+static void
+analyze_handle_batch(struct tracer_connection *connection,
+		     const uint32_t *data,
+		     const struct tracer_message_desc *messages, int count)
 {
-	uint32_t p[2], id;
-	int opcode, size;
+	const struct tracer_message_desc *m;
+	const uint32_t *msg;
+	uint32_t id, opcode, size, deleted, last_id = 0;
 	struct tracer_instance *instance = connection->instance;
-	struct tracer_interface *interface;
-	struct tracer_message *message;
-
-	wl_connection_copy(connection->wl_conn, p, sizeof p);
-	id = p[0];
-	opcode = p[1] & 0xffff;
-	size = p[1] >> 16;
-	if (len < size)
-		return 0;
-
-	interface = wl_map_lookup(&instance->map, id);
-
-	if (interface != NULL) {
-		if (connection->side == TRACER_SERVER_SIDE)
-			message = interface->events[opcode];
-		else
-			message = interface->methods[opcode];
-	} else {
-		tracer_log("Unknown object %u opcode %u, size %u",
-			   id, opcode, size);
-		tracer_log_cont("\nWarning: we can't guarentee the following result");
-		tracer_log_end();
-	}
+	struct tracer *tracer = instance->tracer;
+	struct tracer_analyzer *analyzer = tracer->frontend_data;
+	struct tracer_profile *profile = tracer->profile;
+	struct tracer_interface *interface = NULL;
+	struct tracer_message *message = NULL;
+	uint64_t start = 0;
+	int verbose = !tracer->options->quiet;
+	int i, known, stage;
+
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_OTHER);
 
-	analyze_protocol(connection, size, &instance->map,
-				interface, id, message);
+	for (i = 0; i < count; i++) {
+		tracer_profile_enter(tracer, TRACER_STAGE_LOOKUP);
+		m = &messages[i];
+		msg = data + m->offset / sizeof *data;
+		id = m->id;
+		opcode = m->opcode;
+		size = m->size;
+		deleted = 0;
 
-	if (interface != NULL && !strcmp(message->name, "destroy"))
-		wl_map_remove(&instance->map, id);
+		if (id != last_id) {
+			interface = wl_map_lookup(&instance->map, id);
+			last_id = interface != NULL ? id : 0;
+		}
+
+		if (interface == NULL) {
+			known = 0;
+		} else if (connection->side == TRACER_SERVER_SIDE) {
+			known = opcode < (uint32_t) interface->event_count;
+			message = known ? interface->events[opcode] : NULL;
+		} else {
+			known = opcode < (uint32_t) interface->method_count;
+			message = known ? interface->methods[opcode] : NULL;
+		}
+
+		if (!known) {
+			message_log("Unknown object %u opcode %u, size %u",
+				    id, opcode, size);
+			message_log_cont("\nWarning: we can't guarentee the following result");
+			message_log_end();
+			tracer_profile_enter(tracer, TRACER_STAGE_DECODE);
+			analyze_protocol(connection, msg, size, NULL, id,
+					 NULL);
+			continue;
+		}
+
+		/*
+		 * The compositor acknowledges every destroyed object,
+		 * including those destroyed by events such as
+		 * wl_callback.done.
+		 */
+		if (interface == analyzer->display_interface &&
+		    connection->side == TRACER_SERVER_SIDE &&
+		    size >= 3 * sizeof *msg &&
+		    !strcmp(message->name, "delete_id"))
+			deleted = msg[2];
+
+		tracer_profile_enter(tracer, TRACER_STAGE_DECODE);
+		if (profile != NULL)
+			start = profile->since;
+		analyze_protocol(connection, msg, size, interface, id,
+				 message);
+		if (profile != NULL) {
+			tracer_profile_leave(tracer, TRACER_STAGE_LOOKUP);
+			message->ticks += profile->since - start;
+		}
+
+		if (message->new_id_count > 0)
+			last_id = 0;
+
+		if (!strcmp(message->name, "destroy")) {
+			wl_map_remove(&instance->map, id);
+			last_id = 0;
+		} else if (deleted != 0 &&
+			   wl_map_lookup(&instance->map, deleted)) {
+			wl_map_remove(&instance->map, deleted);
+			last_id = 0;
+		}
+	}
 
-	return size;
+	tracer_profile_leave(tracer, stage);
 }
 
 struct tracer_frontend_interface tracer_frontend_analyze = {
 	.init = analyze_init,
-	.data = analyze_handle_data
+	.batch = analyze_handle_batch
 };
@@ -22,6 +22,7 @@
 
 #include "wayland-private.h"
 #include "tracer.h"
+#include "tracer-fdinfo.h"
 #include "frontend-bin.h"
 
 static int
@@ -33,8 +34,10 @@ bin_init(struct tracer *tracer)
 static int
 bin_handle_data(struct tracer_connection *connection, int rlen)
 {
-	int i, len, fdlen, fd;
-	char buf[4096];
+	int i, len, fdlen, fd, verbose;
+	char buf[4096], desc[256];
+	int32_t fds[1024];
+	struct tracer_fdinfo *info;
 	struct wl_connection *wl_conn= connection->wl_conn;
 	struct tracer_connection *peer = connection->peer;
 	struct tracer_instance *instance = connection->instance;
@@ -46,31 +49,47 @@ bin_handle_data(struct tracer_connection *connection, int rlen)
 
 	wl_connection_copy(wl_conn, buf, len);
 
-	tracer_log("%s Data dumped: %d bytes:\n",
-	           connection->side == TRACER_SERVER_SIDE ? "=>" : "<=",
-		   len);
-	for (i = 0; i < len; i++)
-		tracer_log_cont("%02x ", (unsigned char)buf[i]);
-	tracer_log_cont("\n");
+	verbose = !tracer->options->quiet;
+	if (verbose) {
+		tracer_log("%s Data dumped: %d bytes:\n",
+			   connection->side == TRACER_SERVER_SIDE ? "=>" : "<=",
+			   len);
+		for (i = 0; i < len; i++)
+			tracer_log_cont("%02x ", (unsigned char)buf[i]);
+		tracer_log_cont("\n");
+	}
 	wl_connection_consume(wl_conn, len);
-	wl_connection_write(peer->wl_conn, buf, len);
+	tracer_record_message(connection, buf, len,
+			      wl_buffer_size(&wl_conn->fds_in) / sizeof(int32_t));
 
+	/* The fds came with this data, so they have to be queued first */
 	fdlen = wl_buffer_size(&wl_conn->fds_in);
 
-	wl_buffer_copy(&wl_conn->fds_in, buf, fdlen);
+	wl_buffer_copy(&wl_conn->fds_in, fds, fdlen);
 	fdlen /= sizeof(int32_t);
 
-	if (fdlen != 0)
+	if (verbose && fdlen != 0)
 		tracer_log_cont("%d Fds in control data:", fdlen);
 
 	for (i = 0; i < fdlen; i++) {
-		fd = ((int *) buf)[i];
-		tracer_log_cont("%d ", fd);
-		wl_connection_put_fd(peer->wl_conn, fd);
+		fd = fds[i];
+		tracer_connection_put_fd(peer, fd);
+		if (!verbose)
+			continue;
+
+		info = tracer_fdinfo_get(tracer->fdinfo, fd);
+		if (info != NULL) {
+			tracer_fdinfo_format(info, desc, sizeof desc);
+			tracer_log_cont("%d (%s) ", fd, desc);
+		} else {
+			tracer_log_cont("%d ", fd);
+		}
 	}
-	tracer_log_end();
+	if (verbose)
+		tracer_log_end();
 
 	wl_conn->fds_in.tail += fdlen * sizeof(int32_t);
+	tracer_connection_write(peer, buf, len);
 
 	return len;
 }
@@ -23,10 +23,16 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <expat.h>
 
 #include "tracer-analyzer.h"
@@ -34,9 +40,13 @@
 
 #define XML_BUFFER_SIZE 4096
 
+/* More than enough to parse all of wayland-protocols at once */
+#define ANALYZER_MAX_THREADS 16
+
 struct tracer_protocol {
-	char *name;
+	const char *name;
 	struct wl_list interface_list;
+	struct tracer_arena arena;
 };
 
 enum arg_type {
@@ -51,9 +61,33 @@ enum arg_type {
 };
 
 struct tracer_arg {
-	char *name;
+	const char *name;
 	enum arg_type type;
-	char *interface_name;
+	const char *interface_name;
+	const char *enum_name;
+};
+
+struct tracer_enum_entry {
+	const char *name;
+	uint32_t value;
+	struct wl_list link;
+};
+
+/* Enums with values up to this get a dense lookup table */
+#define ENUM_DENSE_MAX 256
+
+/*
+ * Messages and arguments are collected in the scratch arena while their
+ * interface is parsed, and packed into arrays once it's complete.
+ */
+struct parse_arg {
+	struct tracer_arg arg;
+	struct wl_list link;
+};
+
+struct parse_message {
+	struct tracer_message message;
+	struct wl_list arg_list;
 	struct wl_list link;
 };
 
@@ -61,10 +95,26 @@ struct parse_context {
 	struct location loc;
 	XML_Parser parser;
 	struct tracer_protocol *protocol;
+	struct tracer_arena *arena;
+	struct tracer_arena scratch;
 	struct tracer_interface *interface;
-	struct tracer_message *message;
+	struct wl_list request_list;
+	struct wl_list event_list;
+	int request_count, event_count, arg_count;
+	struct parse_message *message;
+	struct tracer_enum *enumeration;
 	char character_data[8192];
 	unsigned int character_data_length;
+	int line_base;
+};
+
+/* Where an interface of the search path is, see tracer_analyzer_index() */
+struct protocol_index_entry {
+	char *name;
+	const char *filename;
+	long offset;
+	int seq;
+	int done;		/* loaded, or failed to load */
 };
 
 static void *
@@ -91,6 +141,18 @@ xstrdup(const char *s)
 	return fail_on_null(strdup(s));
 }
 
+static void *
+arena_alloc(struct tracer_arena *arena, size_t size)
+{
+	return fail_on_null(tracer_arena_alloc(arena, size));
+}
+
+static const char *
+intern(struct tracer_arena *arena, const char *s)
+{
+	return fail_on_null((void *) tracer_arena_intern(arena, s));
+}
+
 static void
 fail(struct location *loc, const char *msg, ...)
 {
@@ -110,19 +172,25 @@ start_element(void *data, const char *element_name, const char **atts)
 {
 	struct parse_context *ctx = data;
 	struct tracer_interface *interface;
+	struct parse_message *pm;
 	struct tracer_message *message;
+	struct parse_arg *pa;
 	struct tracer_arg *arg;
-	struct entry *entry;
-	const char *name, *type, *interface_name, *value;
+	struct tracer_enum *enumeration;
+	struct tracer_enum_entry *entry;
+	const char *name, *type, *interface_name, *value, *enum_name;
+	const char *bitfield;
 	char *end;
-	int i, version;
+	int i;
 
-	ctx->loc.line_number = XML_GetCurrentLineNumber(ctx->parser);
+	ctx->loc.line_number = ctx->line_base +
+			       XML_GetCurrentLineNumber(ctx->parser);
 	name = NULL;
 	type = NULL;
-	version = 0;
 	interface_name = NULL;
 	value = NULL;
+	enum_name = NULL;
+	bitfield = NULL;
 	for (i = 0; atts[i]; i += 2) {
 		if (strcmp(atts[i], "name") == 0)
 			name = atts[i + 1];
@@ -132,6 +200,10 @@ start_element(void *data, const char *element_name, const char **atts)
 			value = atts[i + 1];
 		if (strcmp(atts[i], "interface") == 0)
 			interface_name = atts[i + 1];
+		if (strcmp(atts[i], "enum") == 0)
+			enum_name = atts[i + 1];
+		if (strcmp(atts[i], "bitfield") == 0)
+			bitfield = atts[i + 1];
 	}
 
 	ctx->character_data_length = 0;
@@ -139,40 +211,50 @@ start_element(void *data, const char *element_name, const char **atts)
 		if (name == NULL)
 			fail(&ctx->loc, "no protocol name given");
 
-		ctx->protocol->name = xstrdup(name);
+		ctx->protocol->name = intern(ctx->arena, name);
 	} else if (strcmp(element_name, "copyright") == 0) {
 
 	} else if (strcmp(element_name, "interface") == 0) {
 		if (name == NULL)
 			fail(&ctx->loc, "no interface name given");
 
-		interface = xmalloc(sizeof *interface);
+		interface = arena_alloc(ctx->arena, sizeof *interface);
 		interface->loc = ctx->loc;
-		interface->name = xstrdup(name);
-		wl_list_init(&interface->request_list);
-		wl_list_init(&interface->event_list);
+		interface->name = intern(ctx->arena, name);
+		wl_list_init(&interface->enum_list);
 		wl_list_insert(ctx->protocol->interface_list.prev,
 			       &interface->link);
 		ctx->interface = interface;
+		wl_list_init(&ctx->request_list);
+		wl_list_init(&ctx->event_list);
+		ctx->request_count = 0;
+		ctx->event_count = 0;
+		ctx->arg_count = 0;
 	} else if (strcmp(element_name, "request") == 0 ||
 		   strcmp(element_name, "event") == 0) {
 		if (name == NULL)
 			fail(&ctx->loc, "no request name given");
 
-		message = xmalloc(sizeof *message);
+		pm = arena_alloc(&ctx->scratch, sizeof *pm);
+		message = &pm->message;
 		message->loc = ctx->loc;
-		message->name = xstrdup(name);
-		wl_list_init(&message->arg_list);
+		message->name = intern(ctx->arena, name);
+		wl_list_init(&pm->arg_list);
 		message->arg_count = 0;
 		message->new_id_count = 0;
 		message->new_interface_name = NULL;
-
-		if (strcmp(element_name, "request") == 0)
-			wl_list_insert(ctx->interface->request_list.prev,
-				       &message->link);
-		else
-			wl_list_insert(ctx->interface->event_list.prev,
-				       &message->link);
+		message->types = NULL;
+		message->decode = NULL;
+		message->count = 0;
+		message->bytes = 0;
+
+		if (strcmp(element_name, "request") == 0) {
+			wl_list_insert(ctx->request_list.prev, &pm->link);
+			ctx->request_count++;
+		} else {
+			wl_list_insert(ctx->event_list.prev, &pm->link);
+			ctx->event_count++;
+		}
 
 		if (type != NULL && strcmp(type, "destructor") == 0)
 			message->destructor = 1;
@@ -182,13 +264,16 @@ start_element(void *data, const char *element_name, const char **atts)
 		if (strcmp(name, "destroy") == 0 && !message->destructor)
 			fail(&ctx->loc, "destroy request should be destructor type");
 
-		ctx->message = message;
+		ctx->message = pm;
 	} else if (strcmp(element_name, "arg") == 0) {
 		if (name == NULL)
 			fail(&ctx->loc, "no argument name given");
 
-		arg = xmalloc(sizeof *arg);
-		arg->name = xstrdup(name);
+		message = &ctx->message->message;
+		pa = arena_alloc(&ctx->scratch, sizeof *pa);
+		arg = &pa->arg;
+		arg->name = intern(ctx->arena, name);
+		arg->enum_name = enum_name ? intern(ctx->arena, enum_name) : NULL;
 
 		if (strcmp(type, "int") == 0)
 			arg->type = INT;
@@ -212,19 +297,20 @@ start_element(void *data, const char *element_name, const char **atts)
 
 		switch (arg->type) {
 		case NEW_ID:
-			ctx->message->new_id_count++;
-			if (ctx->message->new_id_count > 1)
+			message->new_id_count++;
+			if (message->new_id_count > 1)
 				fail(&ctx->loc, "there can't be more than one new_id's in one message");
 
-			ctx->message->new_interface_name = interface_name ?
-							   xstrdup(interface_name) :
-							   NULL;
+			message->new_interface_name = interface_name ?
+						      intern(ctx->arena, interface_name) :
+						      NULL;
 
 			/* Fall through to OBJECT case. */
 
 		case OBJECT:
 			if (interface_name)
-				arg->interface_name = xstrdup(interface_name);
+				arg->interface_name = intern(ctx->arena,
+							     interface_name);
 			else
 				arg->interface_name = NULL;
 			break;
@@ -234,17 +320,117 @@ start_element(void *data, const char *element_name, const char **atts)
 			break;
 		}
 
-		wl_list_insert(ctx->message->arg_list.prev, &arg->link);
-		ctx->message->arg_count++;
+		wl_list_insert(ctx->message->arg_list.prev, &pa->link);
+		message->arg_count++;
+		ctx->arg_count++;
 	} else if (strcmp(element_name, "enum") == 0) {
-		/* We just omit enum */
+		if (name == NULL)
+			fail(&ctx->loc, "no enum name given");
+
+		enumeration = arena_alloc(ctx->arena, sizeof *enumeration);
+		enumeration->loc = ctx->loc;
+		enumeration->name = intern(ctx->arena, name);
+		enumeration->bitfield = bitfield != NULL &&
+					strcmp(bitfield, "true") == 0;
+		wl_list_init(&enumeration->entry_list);
+		wl_list_insert(ctx->interface->enum_list.prev,
+			       &enumeration->link);
+		ctx->enumeration = enumeration;
 	} else if (strcmp(element_name, "entry") == 0) {
-		/* Enum entry omitted too */
+		if (name == NULL)
+			fail(&ctx->loc, "no entry name given");
+		if (value == NULL)
+			fail(&ctx->loc, "no value given for entry %s", name);
+
+		entry = arena_alloc(ctx->arena, sizeof *entry);
+		entry->name = intern(ctx->arena, name);
+		entry->value = strtoul(value, &end, 0);
+		if (*end != '\0')
+			fail(&ctx->loc, "invalid value (%s)", value);
+		wl_list_insert(ctx->enumeration->entry_list.prev,
+			       &entry->link);
 	} else if (strcmp(element_name, "description") == 0) {
 		/* Description is omitted */
 	}
 }
 
+static void
+generate_signature(struct parse_context *ctx, struct tracer_message *message)
+{
+	char *signature;
+	int i;
+
+	signature = arena_alloc(&ctx->scratch, message->arg_count + 1);
+
+	for (i = 0; i < message->arg_count; i++) {
+		switch (message->args[i].type) {
+		case INT:	signature[i] = 'i'; break;
+		case UNSIGNED:	signature[i] = 'u'; break;
+		case FIXED:	signature[i] = 'f'; break;
+		case STRING:	signature[i] = 's'; break;
+		case OBJECT:	signature[i] = 'o'; break;
+		case ARRAY:	signature[i] = 'a'; break;
+		case FD:	signature[i] = 'h'; break;
+		case NEW_ID:
+			if (message->args[i].interface_name != NULL)
+				signature[i] = 'n';
+			else
+				signature[i] = 'N';
+			break;
+		}
+	}
+	signature[i] = '\0';
+
+	/* Most messages share their signature with others */
+	message->signature = intern(ctx->arena, signature);
+}
+
+static void
+pack_messages(struct parse_context *ctx, struct wl_list *list,
+	      struct tracer_message **messages, struct tracer_message *dst,
+	      struct tracer_arg **args)
+{
+	struct parse_message *pm;
+	struct parse_arg *pa;
+
+	wl_list_for_each(pm, list, link) {
+		*dst = pm->message;
+		wl_list_init(&dst->hook_list);
+		dst->args = *args;
+		wl_list_for_each(pa, &pm->arg_list, link)
+			*(*args)++ = pa->arg;
+		generate_signature(ctx, dst);
+		*messages++ = dst++;
+	}
+}
+
+/* Moves the messages of a complete interface into arrays of their own */
+static void
+pack_interface(struct parse_context *ctx)
+{
+	struct tracer_interface *interface = ctx->interface;
+	struct tracer_message **messages, *storage;
+	struct tracer_arg *args;
+	int count;
+
+	count = ctx->request_count + ctx->event_count;
+	messages = arena_alloc(ctx->arena, count * sizeof *messages);
+	storage = arena_alloc(ctx->arena, count * sizeof *storage);
+	args = arena_alloc(ctx->arena, ctx->arg_count * sizeof *args);
+
+	interface->methods = messages;
+	interface->method_count = ctx->request_count;
+	interface->events = messages + ctx->request_count;
+	interface->event_count = ctx->event_count;
+
+	pack_messages(ctx, &ctx->request_list, interface->methods,
+		      storage, &args);
+	pack_messages(ctx, &ctx->event_list, interface->events,
+		      storage + ctx->request_count, &args);
+
+	tracer_arena_release(&ctx->scratch);
+}
+
 static void
 end_element(void *data, const XML_Char *name)
 {
@@ -254,6 +440,11 @@ end_element(void *data, const XML_Char *name)
 	if (strcmp(name, "request") == 0 ||
 		   strcmp(name, "event") == 0) {
 		ctx->message = NULL;
+	} else if (strcmp(name, "enum") == 0) {
+		ctx->enumeration = NULL;
+	} else if (strcmp(name, "interface") == 0) {
+		pack_interface(ctx);
+		ctx->interface = NULL;
 	}
 }
 
@@ -275,7 +466,6 @@ struct tracer_analyzer *
 tracer_analyzer_create(void)
 {
 	struct tracer_analyzer *analyzer;
-	struct parse_context *ctx;
 
 	analyzer = malloc(sizeof *analyzer);
 	if (analyzer == NULL) {
@@ -283,25 +473,51 @@ tracer_analyzer_create(void)
 		return NULL;
 	}
 
-	ctx = malloc(sizeof *ctx);
-	if (ctx == NULL) {
-		errno = ENOMEM;
-		free(analyzer);
+	memset(analyzer, 0, sizeof *analyzer);
+	wl_list_init(&analyzer->interface_list);
+	tracer_arena_init(&analyzer->arena);
+
+	return analyzer;
+}
+
+static struct parse_context *
+parse_context_create(const char *filename, struct tracer_protocol *protocol)
+{
+	struct parse_context *ctx;
+
+	ctx = xmalloc(sizeof *ctx);
+	memset(ctx, 0, sizeof *ctx);
+	ctx->protocol = protocol;
+	ctx->arena = &protocol->arena;
+	tracer_arena_init(&ctx->scratch);
+
+	ctx->loc.filename = filename;
+	ctx->parser = XML_ParserCreate(NULL);
+	if (ctx->parser == NULL) {
+		fprintf(stderr, "failed to create parser\n");
+		free(ctx);
 		return NULL;
 	}
-	analyzer->ctx = ctx;
+	XML_SetUserData(ctx->parser, ctx);
 
-	wl_list_init(&analyzer->interface_list);
+	XML_SetElementHandler(ctx->parser, start_element, end_element);
+	XML_SetCharacterDataHandler(ctx->parser, character_data);
 
-	return analyzer;
+	return ctx;
 }
 
-int
-tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer,
-			     const char *filename)
+static void
+parse_context_destroy(struct parse_context *ctx)
 {
-	struct tracer_protocol protocol;
-	struct parse_context *ctx = analyzer->ctx;
+	XML_ParserFree(ctx->parser);
+	tracer_arena_release(&ctx->scratch);
+	free(ctx);
+}
+
+static int
+parse_protocol(const char *filename, struct tracer_protocol *protocol)
+{
+	struct parse_context *ctx;
 	void *buf;
 	int len;
 	FILE *fp;
@@ -312,21 +528,12 @@ tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer,
 		return -1;
 	}
 
-	wl_list_init(&protocol.interface_list);
-	memset(ctx, 0, sizeof *ctx);
-	ctx->protocol = &protocol;
-
-	ctx->loc.filename = filename;
-	ctx->parser = XML_ParserCreate(NULL);
-	XML_SetUserData(ctx->parser, ctx);
-	if (ctx->parser == NULL) {
-		fprintf(stderr, "failed to create parser\n");
+	ctx = parse_context_create(filename, protocol);
+	if (ctx == NULL) {
+		fclose(fp);
 		return -1;
 	}
 
-	XML_SetElementHandler(ctx->parser, start_element, end_element);
-	XML_SetCharacterDataHandler(ctx->parser, character_data);
-
 	do {
 		buf = XML_GetBuffer(ctx->parser, XML_BUFFER_SIZE);
 		len = fread(buf, 1, XML_BUFFER_SIZE, fp);
@@ -339,20 +546,122 @@ tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer,
 	} while (len > 0);
 
 	fclose(fp);
-	XML_ParserFree(ctx->parser);
-
-	wl_list_insert_list(analyzer->interface_list.prev,
-			    &protocol.interface_list);
+	parse_context_destroy(ctx);
 
 	return 0;
 }
 
+/* Files are handed out to the loading threads in order */
+struct protocol_loader {
+	const char **filenames;
+	struct tracer_protocol *protocols;
+	int *results;
+	int count;
+	int next;
+};
+
+static void *
+load_protocols(void *data)
+{
+	struct protocol_loader *loader = data;
+	int i;
+
+	while ((i = __atomic_fetch_add(&loader->next, 1,
+				       __ATOMIC_RELAXED)) < loader->count)
+		loader->results[i] = parse_protocol(loader->filenames[i],
+						    &loader->protocols[i]);
+
+	return NULL;
+}
+
+/*
+ * Parses count protocol files on up to threads threads, one per CPU if
+ * threads is 0.  Every file gets a parser of its own; the interfaces are
+ * added in the order of the files whatever order they're parsed in.
+ */
+int
+tracer_analyzer_add_protocols(struct tracer_analyzer *analyzer,
+			      const char **filenames, int count, int threads)
+{
+	struct protocol_loader loader;
+	pthread_t workers[ANALYZER_MAX_THREADS];
+	int i, started = 0, ret = 0;
+
+	if (count == 0)
+		return 0;
+
+	loader.filenames = filenames;
+	loader.count = count;
+	loader.next = 0;
+	loader.protocols = calloc(count, sizeof *loader.protocols);
+	loader.results = calloc(count, sizeof *loader.results);
+	if (loader.protocols == NULL || loader.results == NULL) {
+		free(loader.protocols);
+		free(loader.results);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		wl_list_init(&loader.protocols[i].interface_list);
+		tracer_arena_init(&loader.protocols[i].arena);
+	}
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > count)
+		threads = count;
+	if (threads > ANALYZER_MAX_THREADS)
+		threads = ANALYZER_MAX_THREADS;
+
+	/* This thread is one of them, and does it all if threads fail */
+	while (started < threads - 1 &&
+	       pthread_create(&workers[started], NULL,
+			      load_protocols, &loader) == 0)
+		started++;
+	load_protocols(&loader);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	for (i = 0; i < count; i++) {
+		if (loader.results[i] < 0) {
+			tracer_arena_release(&loader.protocols[i].arena);
+			ret = -1;
+			continue;
+		}
+		wl_list_insert_list(analyzer->interface_list.prev,
+				    &loader.protocols[i].interface_list);
+		tracer_arena_merge(&analyzer->arena,
+				   &loader.protocols[i].arena);
+	}
+
+	free(loader.protocols);
+	free(loader.results);
+
+	return ret;
+}
+
+int
+tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer,
+			     const char *filename)
+{
+	return tracer_analyzer_add_protocols(analyzer, &filename, 1, 1);
+}
+
+static struct tracer_interface **
+load_indexed(struct tracer_analyzer *analyzer, const char *name);
+
+/*
+ * Interfaces from the search path are loaded the first time they're
+ * looked up, once tracer_analyzer_finalize() has begun.
+ */
 struct tracer_interface **
-tracer_analyzer_lookup_type(struct tracer_analyzer *analyzer, char *type_name)
+tracer_analyzer_lookup_type(struct tracer_analyzer *analyzer,
+			    const char *type_name)
 {
 	struct tracer_interface **types = analyzer->interfaces;
 
-	if (type_name == NULL)
+	if (type_name == NULL || types == NULL)
 		return NULL;
 
 	while (*types != NULL) {
@@ -361,58 +670,578 @@ tracer_analyzer_lookup_type(struct tracer_analyzer *analyzer, char *type_name)
 		types++;
 	}
 
+	return load_indexed(analyzer, type_name);
+}
+
+static int
+compare_enum_value(const void *a, const void *b)
+{
+	const struct tracer_enum_value *va = a, *vb = b;
+
+	if (va->value < vb->value)
+		return -1;
+	return va->value > vb->value;
+}
+
+static int
+build_enum_tables(struct tracer_analyzer *analyzer, struct tracer_enum *e)
+{
+	struct tracer_enum_entry *entry;
+	uint32_t max = 0;
+	int count, i;
+
+	count = wl_list_length(&e->entry_list);
+	wl_list_for_each(entry, &e->entry_list, link) {
+		if (entry->value > max)
+			max = entry->value;
+	}
+
+	if (count > 0 && max < ENUM_DENSE_MAX) {
+		e->dense = tracer_arena_alloc(&analyzer->arena,
+					      (max + 1) * sizeof *e->dense);
+		if (e->dense == NULL)
+			return -1;
+		e->dense_count = max + 1;
+		/* First name wins if several entries share a value */
+		wl_list_for_each_reverse(entry, &e->entry_list, link)
+			e->dense[entry->value] = entry->name;
+	} else if (count > 0) {
+		e->sorted = tracer_arena_alloc(&analyzer->arena,
+					       count * sizeof *e->sorted);
+		if (e->sorted == NULL)
+			return -1;
+		i = 0;
+		wl_list_for_each(entry, &e->entry_list, link) {
+			e->sorted[i].value = entry->value;
+			e->sorted[i].name = entry->name;
+			i++;
+		}
+		qsort(e->sorted, count, sizeof *e->sorted, compare_enum_value);
+		e->sorted_count = count;
+	}
+
+	if (e->bitfield) {
+		wl_list_for_each_reverse(entry, &e->entry_list, link) {
+			if (entry->value != 0 &&
+			    (entry->value & (entry->value - 1)) == 0)
+				e->bits[__builtin_ctz(entry->value)] =
+					entry->name;
+		}
+	}
+
+	return 0;
+}
+
+static struct tracer_enum *
+lookup_enum(struct tracer_analyzer *analyzer,
+	    struct tracer_interface *interface, const char *name)
+{
+	struct tracer_interface **ptype;
+	struct tracer_enum *e;
+	const char *dot;
+	char *interface_name;
+
+	dot = strchr(name, '.');
+	if (dot != NULL) {
+		interface_name = strndup(name, dot - name);
+		if (interface_name == NULL)
+			return NULL;
+		ptype = tracer_analyzer_lookup_type(analyzer, interface_name);
+		free(interface_name);
+		if (ptype == NULL)
+			return NULL;
+		interface = *ptype;
+		name = dot + 1;
+	}
+
+	wl_list_for_each(e, &interface->enum_list, link) {
+		if (strcmp(e->name, name) == 0)
+			return e;
+	}
+
 	return NULL;
 }
 
 static int
-generate_signature(struct tracer_message *message)
+resolve_enums(struct tracer_analyzer *analyzer,
+	      struct tracer_interface *interface,
+	      struct tracer_message *message)
 {
-	char *signature;
-	int length, i;
 	struct tracer_arg *arg;
+	int i;
+
+	message->enums = NULL;
+	for (i = 0; i < message->arg_count; i++) {
+		arg = &message->args[i];
+		if (arg->enum_name != NULL) {
+			if (message->enums == NULL) {
+				message->enums =
+					tracer_arena_alloc(&analyzer->arena,
+							   message->arg_count *
+							   sizeof *message->enums);
+				if (message->enums == NULL)
+					return -1;
+			}
+			/* Enums from protocols we don't have stay numbers */
+			message->enums[i] = lookup_enum(analyzer, interface,
+							arg->enum_name);
+		}
+	}
 
-	length = wl_list_length(&message->arg_list);
-	signature = malloc(length);
-	if (signature == NULL) {
-		errno = ENOMEM;
+	return 0;
+}
+
+/* Only valid after tracer_analyzer_finalize() */
+struct tracer_message *
+tracer_analyzer_lookup_message(struct tracer_analyzer *analyzer,
+			       const char *interface_name,
+			       const char *message_name, int event)
+{
+	struct tracer_interface **ptype, *interface;
+	struct tracer_message **messages;
+	int i, count;
+
+	ptype = tracer_analyzer_lookup_type(analyzer, (char *) interface_name);
+	if (ptype == NULL)
+		return NULL;
+
+	interface = *ptype;
+	messages = event ? interface->events : interface->methods;
+	count = event ? interface->event_count : interface->method_count;
+	for (i = 0; i < count; i++) {
+		if (strcmp(messages[i]->name, message_name) == 0)
+			return messages[i];
+	}
+
+	return NULL;
+}
+
+/* Arguments are in signature order */
+const char *
+tracer_message_arg_name(const struct tracer_message *message, int i)
+{
+	return message->args[i].name;
+}
+
+/* The interface of an object or new_id argument, NULL if not given */
+const char *
+tracer_message_arg_interface(const struct tracer_message *message, int i)
+{
+	return message->args[i].interface_name;
+}
+
+void
+tracer_message_add_hook(struct tracer_message *message,
+			struct tracer_hook *hook)
+{
+	wl_list_insert(message->hook_list.prev, &hook->link);
+}
+
+/* Attaches hook to a message looked up by name, fails if there's no such */
+int
+tracer_analyzer_add_hook(struct tracer_analyzer *analyzer,
+			 const char *interface_name, const char *message_name,
+			 int event, struct tracer_hook *hook)
+{
+	struct tracer_message *message;
+
+	message = tracer_analyzer_lookup_message(analyzer, interface_name,
+						 message_name, event);
+	if (message == NULL)
 		return -1;
+
+	tracer_message_add_hook(message, hook);
+
+	return 0;
+}
+
+const char *
+tracer_enum_lookup(const struct tracer_enum *e, uint32_t value)
+{
+	int low, high, mid;
+
+	if (e->dense != NULL)
+		return value < e->dense_count ? e->dense[value] : NULL;
+
+	low = 0;
+	high = e->sorted_count - 1;
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (e->sorted[mid].value == value)
+			return e->sorted[mid].name;
+		if (e->sorted[mid].value < value)
+			low = mid + 1;
+		else
+			high = mid - 1;
 	}
-	message->signature = signature;
 
-	i = 0;
-	wl_list_for_each(arg, &message->arg_list, link) {
-		switch (arg->type) {
-		case INT:	signature[i] = 'i'; break;
-		case UNSIGNED:	signature[i] = 'u'; break;
-		case FIXED:	signature[i] = 'f'; break;
-		case STRING:	signature[i] = 's'; break;
-		case OBJECT:	signature[i] = 'o'; break;
-		case ARRAY:	signature[i] = 'a'; break;
-		case FD:	signature[i] = 'h'; break;
-		case NEW_ID:
-			if (arg->interface_name != NULL)
-				signature[i] = 'n';
-			else
-				signature[i] = 'N';
-			break;
+	return NULL;
+}
+
+/*
+ * Writes the symbolic form of value into buf, "a|b" for bitfields.
+ * Returns 0 if every bit of value has a name, -1 otherwise.
+ */
+int
+tracer_enum_format(const struct tracer_enum *e, uint32_t value,
+		   char *buf, size_t size)
+{
+	const char *name;
+	uint32_t rest;
+	size_t len = 0;
+	int bit;
+
+	name = tracer_enum_lookup(e, value);
+	if (name != NULL || !e->bitfield || value == 0) {
+		if (name == NULL)
+			return -1;
+		snprintf(buf, size, "%s", name);
+		return 0;
+	}
+
+	buf[0] = '\0';
+	for (rest = value; rest != 0; rest &= rest - 1) {
+		bit = __builtin_ctz(rest);
+		if (e->bits[bit] == NULL)
+			return -1;
+		len += snprintf(buf + len, len < size ? size - len : 0,
+				"%s%s", len ? "|" : "", e->bits[bit]);
+	}
+
+	return len < size ? 0 : -1;
+}
+
+/*
+ * Sets up the message tables of an interface.  Types of new objects are
+ * looked up now and must exist, except for interfaces loaded on demand,
+ * where they're left for tracer_decode_new_id() to load when used.
+ */
+static int
+finalize_interface(struct tracer_analyzer *analyzer,
+		   struct tracer_interface *interface, int strict)
+{
+	struct tracer_message *message;
+	int i, count;
+
+	/* Events follow the requests, see pack_interface() */
+	count = interface->method_count + interface->event_count;
+	for (i = 0; i < count; i++) {
+		message = interface->methods[i];
+		if (strict)
+			message->types = tracer_analyzer_lookup_type(analyzer, message->new_interface_name);
+		if (strict && message->new_interface_name != NULL &&
+		    message->types == NULL) {
+			fprintf(stderr, "interface %s not found\n",
+				message->new_interface_name);
+			return -1;
+		}
+		if (resolve_enums(analyzer, interface, message) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+build_interface_enums(struct tracer_analyzer *analyzer,
+		      struct tracer_interface *interface)
+{
+	struct tracer_enum *e;
+
+	wl_list_for_each(e, &interface->enum_list, link) {
+		if (build_enum_tables(analyzer, e) < 0) {
+			errno = ENOMEM;
+			return -1;
 		}
-		i++;
 	}
-	signature[length] = '\0';
+
+	return 0;
+}
+
+static int
+compare_index_entries(const void *a, const void *b)
+{
+	const struct protocol_index_entry *ea = a, *eb = b;
+	int ret;
+
+	ret = strcmp(ea->name, eb->name);
+	if (ret != 0)
+		return ret;
+
+	return ea->seq - eb->seq;
+}
+
+static int
+compare_index_name(const void *key, const void *entry)
+{
+	return strcmp(key, ((const struct protocol_index_entry *) entry)->name);
+}
+
+static char *
+read_file(const char *filename, size_t *size)
+{
+	char *data = NULL, *p;
+	size_t len = 0, alloc = 0, n;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL)
+		return NULL;
+
+	do {
+		if (alloc - len < XML_BUFFER_SIZE + 1) {
+			alloc = alloc ? alloc * 2 : 4 * XML_BUFFER_SIZE;
+			p = realloc(data, alloc);
+			if (p == NULL) {
+				free(data);
+				fclose(fp);
+				return NULL;
+			}
+			data = p;
+		}
+		n = fread(data + len, 1, XML_BUFFER_SIZE, fp);
+		len += n;
+	} while (n > 0);
+
+	fclose(fp);
+	data[len] = '\0';
+	*size = len;
+
+	return data;
+}
+
+static void
+index_add(struct tracer_analyzer *analyzer, const char *name, size_t length,
+	  const char *filename, long offset)
+{
+	struct protocol_index_entry *entry;
+	int alloc;
+
+	if (analyzer->index_count == analyzer->index_alloc) {
+		alloc = analyzer->index_alloc ? analyzer->index_alloc * 2 : 256;
+		analyzer->index = fail_on_null(realloc(analyzer->index,
+						       alloc * sizeof *entry));
+		analyzer->index_alloc = alloc;
+	}
+
+	entry = &analyzer->index[analyzer->index_count];
+	entry->name = fail_on_null(tracer_arena_strndup(&analyzer->arena,
+							 name, length));
+	entry->filename = filename;
+	entry->offset = offset;
+	entry->seq = analyzer->index_count++;
+	entry->done = 0;
+}
+
+/* Notes where the interfaces of a protocol file start, without parsing it */
+static void
+index_file(struct tracer_analyzer *analyzer, const char *path)
+{
+	const char *p, *tag_end, *name, *name_end;
+	const char *filename = NULL;
+	char *data;
+	size_t size;
+
+	data = read_file(path, &size);
+	if (data == NULL)
+		return;
+
+	for (p = strstr(data, "<interface"); p != NULL;
+	     p = strstr(p + 1, "<interface")) {
+		if (!isspace((unsigned char) p[10]))
+			continue;
+		tag_end = strchr(p, '>');
+		name = strstr(p, "name=\"");
+		if (tag_end == NULL || name == NULL || name > tag_end)
+			continue;
+		name += 6;
+		name_end = strchr(name, '"');
+		if (name_end == NULL || name_end > tag_end)
+			continue;
+
+		if (filename == NULL)
+			filename = intern(&analyzer->arena, path);
+		index_add(analyzer, name, name_end - name, filename, p - data);
+	}
+
+	free(data);
+}
+
+static void
+index_directory(struct tracer_analyzer *analyzer, const char *path)
+{
+	struct dirent *dirent;
+	struct stat st;
+	char *child;
+	size_t len;
+	DIR *dir;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	while ((dirent = readdir(dir)) != NULL) {
+		if (dirent->d_name[0] == '.')
+			continue;
+		len = strlen(dirent->d_name);
+		child = xmalloc(strlen(path) + len + 2);
+		sprintf(child, "%s/%s", path, dirent->d_name);
+
+		if (stat(child, &st) == 0 && S_ISDIR(st.st_mode))
+			index_directory(analyzer, child);
+		else if (len > 4 && !strcmp(dirent->d_name + len - 4, ".xml"))
+			index_file(analyzer, child);
+		free(child);
+	}
+
+	closedir(dir);
+}
+
+/*
+ * Indexes every protocol file under the directories of the colon
+ * separated path, noting only which interface is where.  Interfaces the
+ * files given with tracer_analyzer_add_protocol() don't have are then
+ * parsed when first needed.  Earlier directories win.
+ */
+void
+tracer_analyzer_index(struct tracer_analyzer *analyzer, const char *path)
+{
+	char *dirs, *dir, *saveptr;
+	int i, j;
+
+	dirs = xstrdup(path);
+	for (dir = strtok_r(dirs, ":", &saveptr); dir != NULL;
+	     dir = strtok_r(NULL, ":", &saveptr))
+		index_directory(analyzer, dir);
+	free(dirs);
+
+	qsort(analyzer->index, analyzer->index_count,
+	      sizeof *analyzer->index, compare_index_entries);
+
+	for (i = 0, j = 0; i < analyzer->index_count; i++) {
+		if (j > 0 && !strcmp(analyzer->index[j - 1].name,
+				     analyzer->index[i].name)) {
+			continue;
+		}
+		analyzer->index[j++] = analyzer->index[i];
+	}
+	analyzer->index_count = j;
+}
+
+static int
+parse_indexed(struct protocol_index_entry *entry,
+	      struct tracer_protocol *protocol)
+{
+	static const char head[] = "<protocol name=\"indexed\">";
+	static const char tail[] = "</protocol>";
+	struct parse_context *ctx;
+	char *data, *end;
+	size_t size;
+	long i;
+	int ret = -1;
+
+	data = read_file(entry->filename, &size);
+	if (data == NULL || (size_t) entry->offset >= size) {
+		fprintf(stderr, "Unable to read protocol file: %s\n",
+			entry->filename);
+		free(data);
+		return -1;
+	}
+
+	end = strstr(data + entry->offset, "</interface>");
+	ctx = parse_context_create(entry->filename, protocol);
+	if (end == NULL || ctx == NULL)
+		goto out;
+	end += strlen("</interface>");
+
+	for (i = 0; i < entry->offset; i++)
+		ctx->line_base += data[i] == '\n';
+
+	if (XML_Parse(ctx->parser, head, strlen(head), 0) != XML_STATUS_ERROR &&
+	    XML_Parse(ctx->parser, data + entry->offset,
+		      end - data - entry->offset, 0) != XML_STATUS_ERROR &&
+	    XML_Parse(ctx->parser, tail, strlen(tail), 1) != XML_STATUS_ERROR &&
+	    !wl_list_empty(&protocol->interface_list))
+		ret = 0;
+	else
+		fprintf(stderr, "%s: failed to parse interface %s\n",
+			entry->filename, entry->name);
+
+out:
+	if (ctx != NULL)
+		parse_context_destroy(ctx);
+	free(data);
+
+	return ret;
+}
+
+static struct tracer_interface **
+load_indexed(struct tracer_analyzer *analyzer, const char *name)
+{
+	struct protocol_index_entry *entry;
+	struct tracer_protocol protocol;
+	struct tracer_interface *interface, **ptype;
+
+	entry = bsearch(name, analyzer->index, analyzer->index_count,
+			sizeof *analyzer->index, compare_index_name);
+	if (entry == NULL || entry->done)
+		return NULL;
+
+	/* Room for everything in the index was made by finalize */
+	assert(analyzer->interface_count < analyzer->interface_alloc);
+
+	wl_list_init(&protocol.interface_list);
+	tracer_arena_init(&protocol.arena);
+	if (parse_indexed(entry, &protocol) < 0) {
+		tracer_arena_release(&protocol.arena);
+		entry->done = 1;
+		return NULL;
+	}
+	tracer_arena_merge(&analyzer->arena, &protocol.arena);
+
+	/* Listed before being finalized, for interfaces referring back */
+	interface = wl_container_of(protocol.interface_list.next, interface,
+				    link);
+	wl_list_remove(&interface->link);
+	wl_list_insert(analyzer->interface_list.prev, &interface->link);
+	ptype = &analyzer->interfaces[analyzer->interface_count++];
+	*ptype = interface;
+	entry->done = 1;
+
+	if (build_interface_enums(analyzer, interface) < 0 ||
+	    finalize_interface(analyzer, interface, 0) < 0)
+		return NULL;
+
+	if (analyzer->interface_loaded != NULL)
+		analyzer->interface_loaded(analyzer, interface);
+
+	return ptype;
+}
+
+/* Loads all of the index, for analyses that want to see everything */
+void
+tracer_analyzer_load_all(struct tracer_analyzer *analyzer)
+{
+	int i;
+
+	for (i = 0; i < analyzer->index_count; i++)
+		tracer_analyzer_lookup_type(analyzer, analyzer->index[i].name);
 }
 
 int
 tracer_analyzer_finalize(struct tracer_analyzer *analyzer)
 {
-	int count, message_count, i, j;
+	int count, i;
 	struct tracer_interface *interface;
 	struct tracer_interface **interfaces;
 	struct tracer_interface **display_type;
-	struct tracer_message **messages;
-	struct tracer_message *message;
 
+	/* Never reallocated, lookups hand out pointers into it */
 	count = wl_list_length(&analyzer->interface_list);
-	interfaces = calloc(count + 1, sizeof *interfaces);
+	analyzer->interface_alloc = count + analyzer->index_count;
+	interfaces = tracer_arena_alloc(&analyzer->arena,
+					(analyzer->interface_alloc + 1) *
+					sizeof *interfaces);
 	if (interfaces == NULL) {
 		errno = ENOMEM;
 		return -1;
@@ -424,54 +1253,16 @@ tracer_analyzer_finalize(struct tracer_analyzer *analyzer)
 		interfaces[i] = interface;
 		i++;
 	}
+	analyzer->interface_count = count;
 
 	for (i = 0; i < count; i++) {
-		interface = interfaces[i];
-		message_count = wl_list_length(&interface->request_list);
-		messages = calloc(message_count, sizeof *messages);
-		if (messages == NULL) {
-			errno = ENOMEM;
+		if (build_interface_enums(analyzer, interfaces[i]) < 0)
 			return -1;
-		}
-		interface->method_count = message_count;
-		interface->methods = messages;
-		j = 0;
-		wl_list_for_each(message, &interface->request_list, link) {
-			messages[j] = message;
-			message->types = tracer_analyzer_lookup_type(analyzer, message->new_interface_name);
-			if (message->new_interface_name != NULL &&
-			    message->types == NULL) {
-				fprintf(stderr, "interface %s not found\n",
-					message->new_interface_name);
-				return -1;
-			}
-			if (generate_signature(message) < 0)
-				return -1;
-			j++;
-		}
+	}
 
-		message_count = wl_list_length(&interface->event_list);
-		messages = calloc(message_count, sizeof *messages);
-		if (messages == NULL) {
-			errno = ENOMEM;
+	for (i = 0; i < count; i++) {
+		if (finalize_interface(analyzer, interfaces[i], 1) < 0)
 			return -1;
-		}
-		interface->event_count = message_count;
-		interface->events = messages;
-		j = 0;
-		wl_list_for_each(message, &interface->event_list, link) {
-			messages[j] = message;
-			message->types = tracer_analyzer_lookup_type(analyzer, message->new_interface_name);
-			if (message->new_interface_name != NULL &&
-			    message->types == NULL) {
-				fprintf(stderr, "interface %s not found\n",
-					message->new_interface_name);
-				return -1;
-			}
-			if (generate_signature(message) < 0)
-				return -1;
-			j++;
-		}
 	}
 
 	display_type = tracer_analyzer_lookup_type(analyzer, "wl_display");
@@ -481,7 +1272,5 @@ tracer_analyzer_finalize(struct tracer_analyzer *analyzer)
 	}
 	analyzer->display_interface = *display_type;
 
-	free(analyzer->ctx);
-
 	return 0;
 }
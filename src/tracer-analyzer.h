@@ -24,6 +24,7 @@
 #define TRACER_ANALYZER_H
 
 #include "wayland-util.h"
+#include "tracer-arena.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -36,13 +37,20 @@ struct location {
 };
 
 struct tracer_message;
+struct tracer_arg;
+struct tracer_instance;
+struct tracer_decode;
 
+/*
+ * Everything below is allocated from the analyzer's arena.  The messages
+ * of an interface, requests first, sit next to each other in memory, as
+ * do the arguments of all of them.
+ */
 struct tracer_interface {
 	struct location loc;
-	char *name;
+	const char *name;
 	int type_index;
-	struct wl_list request_list;
-	struct wl_list event_list;
+	struct wl_list enum_list;
 	struct wl_list link;
 	struct tracer_message **methods;
 	struct tracer_message **events;
@@ -51,24 +59,89 @@ struct tracer_interface {
 
 struct tracer_message {
 	struct location loc;
-	char *name;
-	struct wl_list arg_list;
-	struct wl_list link;
+	const char *name;
+	struct tracer_arg *args;
 	int arg_count;
 	int new_id_count;
 	int destructor;
-	char *new_interface_name;
+	const char *new_interface_name;
 	struct tracer_interface **types;
-	char *signature;
+	const char *signature;
+	struct tracer_enum **enums;
+	struct wl_list hook_list;
+	/* Generated from the protocol XML at build time, if it was */
+	void (*decode)(struct tracer_decode *decode, const uint32_t *args);
+	/* How often the message went through, over all instances */
+	uint64_t count;
+	uint64_t bytes;
+	/* What decoding it cost, with --profile */
+	uint64_t ticks;
 };
 
-struct parse_context;
+/*
+ * What a hook gets to see of a message.  Everything points into the
+ * tracer's buffers and is only valid during the call.
+ */
+struct tracer_message_view {
+	struct tracer_instance *instance;
+	int side;
+	uint32_t id;
+	uint32_t size;
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+	const uint32_t *args;
+	const int *fds;
+	int nfds;
+	uint64_t timestamp;
+};
+
+/* Called for every occurrence of the message it's attached to */
+struct tracer_hook {
+	void (*func)(struct tracer_hook *hook,
+		     struct tracer_message_view *view);
+	struct wl_list link;
+};
+
+struct tracer_enum_value {
+	uint32_t value;
+	const char *name;
+};
+
+/*
+ * Lookup tables are built by tracer_analyzer_finalize.  Enums whose values
+ * are small enough get a dense value -> name array, the rest a table
+ * sorted by value.  Bitfields additionally get one name per bit so that
+ * masks can be taken apart without searching.
+ */
+struct tracer_enum {
+	struct location loc;
+	const char *name;
+	int bitfield;
+	struct wl_list entry_list;
+	struct wl_list link;
+	const char **dense;
+	uint32_t dense_count;
+	struct tracer_enum_value *sorted;
+	int sorted_count;
+	const char *bits[32];
+};
+
+struct protocol_index_entry;
 
 struct tracer_analyzer {
 	struct tracer_interface **interfaces;
 	struct tracer_interface *display_interface;
-	struct parse_context *ctx;
 	struct wl_list interface_list;
+	struct tracer_arena arena;
+	int interface_count, interface_alloc;
+
+	/* Interfaces known from the search path but not loaded yet */
+	struct protocol_index_entry *index;
+	int index_count, index_alloc;
+
+	/* Called for each interface loaded after finalizing */
+	void (*interface_loaded)(struct tracer_analyzer *analyzer,
+				 struct tracer_interface *interface);
 };
 
 struct tracer_analyzer *tracer_analyzer_create(void);
@@ -76,11 +149,43 @@ struct tracer_analyzer *tracer_analyzer_create(void);
 int tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer,
 				 const char *filename);
 
+int tracer_analyzer_add_protocols(struct tracer_analyzer *analyzer,
+				  const char **filenames, int count,
+				  int threads);
+
 struct tracer_interface **
-tracer_analyzer_lookup_type(struct tracer_analyzer *analyzer, char *type_name);
+tracer_analyzer_lookup_type(struct tracer_analyzer *analyzer,
+			    const char *type_name);
+
+void tracer_analyzer_index(struct tracer_analyzer *analyzer, const char *path);
 
 int tracer_analyzer_finalize(struct tracer_analyzer *analyzer);
 
+void tracer_analyzer_load_all(struct tracer_analyzer *analyzer);
+
+struct tracer_message *
+tracer_analyzer_lookup_message(struct tracer_analyzer *analyzer,
+			       const char *interface_name,
+			       const char *message_name, int event);
+
+const char *tracer_message_arg_name(const struct tracer_message *message,
+				    int i);
+const char *tracer_message_arg_interface(const struct tracer_message *message,
+					 int i);
+
+void tracer_message_add_hook(struct tracer_message *message,
+			     struct tracer_hook *hook);
+
+int tracer_analyzer_add_hook(struct tracer_analyzer *analyzer,
+			     const char *interface_name,
+			     const char *message_name, int event,
+			     struct tracer_hook *hook);
+
+const char *tracer_enum_lookup(const struct tracer_enum *e, uint32_t value);
+
+int tracer_enum_format(const struct tracer_enum *e, uint32_t value,
+		       char *buf, size_t size);
+
 
 #ifdef __cplusplus
 }
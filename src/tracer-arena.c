@@ -0,0 +1,234 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tracer-arena.h"
+
+/* Chunks start small, for arenas that hold little, and double up to this */
+#define ARENA_MIN_CHUNK		1024
+#define ARENA_MAX_CHUNK		(64 * 1024)
+
+#define ARENA_ALIGN		16
+
+struct tracer_arena_chunk {
+	struct tracer_arena_chunk *next;
+	size_t size;
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+void
+tracer_arena_init(struct tracer_arena *arena)
+{
+	memset(arena, 0, sizeof *arena);
+}
+
+void
+tracer_arena_release(struct tracer_arena *arena)
+{
+	struct tracer_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena->strings);
+	tracer_arena_init(arena);
+}
+
+static struct tracer_arena_chunk *
+add_chunk(struct tracer_arena *arena, size_t size)
+{
+	struct tracer_arena_chunk *chunk;
+
+	chunk = malloc(sizeof *chunk + size);
+	if (chunk == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	chunk->size = size;
+	arena->size += sizeof *chunk + size;
+
+	return chunk;
+}
+
+void *
+tracer_arena_alloc(struct tracer_arena *arena, size_t size)
+{
+	struct tracer_arena_chunk *chunk;
+	char *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+	if ((size_t) (arena->end - arena->next) < size) {
+		/*
+		 * Big ones get a chunk of their own behind the current
+		 * one, whose remaining space is still good for small ones.
+		 */
+		if (size > ARENA_MAX_CHUNK / 4 && arena->chunks != NULL) {
+			chunk = add_chunk(arena, size);
+			if (chunk == NULL)
+				return NULL;
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+			memset(chunk->data, 0, size);
+
+			return chunk->data;
+		}
+
+		arena->chunk_size = arena->chunk_size ?
+			arena->chunk_size * 2 : ARENA_MIN_CHUNK;
+		if (arena->chunk_size > ARENA_MAX_CHUNK)
+			arena->chunk_size = ARENA_MAX_CHUNK;
+
+		chunk = add_chunk(arena, size > arena->chunk_size ?
+				  size : arena->chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->next = chunk->data;
+		arena->end = chunk->data + chunk->size;
+	}
+
+	p = arena->next;
+	arena->next += size;
+	memset(p, 0, size);
+
+	return p;
+}
+
+char *
+tracer_arena_strndup(struct tracer_arena *arena, const char *s, size_t length)
+{
+	char *p;
+
+	p = tracer_arena_alloc(arena, length + 1);
+	if (p == NULL)
+		return NULL;
+	memcpy(p, s, length);
+
+	return p;
+}
+
+char *
+tracer_arena_strdup(struct tracer_arena *arena, const char *s)
+{
+	return tracer_arena_strndup(arena, s, strlen(s));
+}
+
+static uint32_t
+hash_string(const char *s)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*s != '\0')
+		hash = (hash ^ (unsigned char) *s++) * 16777619u;
+
+	return hash;
+}
+
+static int
+grow_strings(struct tracer_arena *arena)
+{
+	const char **strings;
+	uint32_t alloc, i, j;
+
+	alloc = arena->string_alloc ? arena->string_alloc * 2 : 256;
+	strings = calloc(alloc, sizeof *strings);
+	if (strings == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < arena->string_alloc; i++) {
+		if (arena->strings[i] == NULL)
+			continue;
+		j = hash_string(arena->strings[i]) & (alloc - 1);
+		while (strings[j] != NULL)
+			j = (j + 1) & (alloc - 1);
+		strings[j] = arena->strings[i];
+	}
+
+	free(arena->strings);
+	arena->strings = strings;
+	arena->string_alloc = alloc;
+
+	return 0;
+}
+
+/* Returns the arena's copy of s, making one if there's none yet */
+const char *
+tracer_arena_intern(struct tracer_arena *arena, const char *s)
+{
+	uint32_t i;
+
+	if (arena->string_count * 2 >= arena->string_alloc &&
+	    grow_strings(arena) < 0)
+		return NULL;
+
+	i = hash_string(s) & (arena->string_alloc - 1);
+	while (arena->strings[i] != NULL) {
+		if (strcmp(arena->strings[i], s) == 0)
+			return arena->strings[i];
+		i = (i + 1) & (arena->string_alloc - 1);
+	}
+
+	arena->strings[i] = tracer_arena_strdup(arena, s);
+	if (arena->strings[i] == NULL)
+		return NULL;
+	arena->string_count++;
+
+	return arena->strings[i];
+}
+
+/*
+ * Makes arena own everything other holds, leaving other empty.  Strings
+ * interned in other stay valid but aren't known to arena's table.
+ */
+void
+tracer_arena_merge(struct tracer_arena *arena, struct tracer_arena *other)
+{
+	struct tracer_arena_chunk *last;
+
+	if (other->chunks != NULL) {
+		for (last = other->chunks; last->next != NULL;
+		     last = last->next)
+			;
+		/* Behind the current chunk, which keeps being filled */
+		if (arena->chunks != NULL) {
+			last->next = arena->chunks->next;
+			arena->chunks->next = other->chunks;
+		} else {
+			arena->chunks = other->chunks;
+			arena->next = other->next;
+			arena->end = other->end;
+			arena->chunk_size = other->chunk_size;
+		}
+		arena->size += other->size;
+	}
+
+	free(other->strings);
+	tracer_arena_init(other);
+}
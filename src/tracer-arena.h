@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_ARENA_H
+#define TRACER_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Bump allocator for data that lives and dies together.  Allocations are
+ * zeroed and can't be freed one by one; tracer_arena_release() returns
+ * everything at once.  Strings can be interned so that equal ones share
+ * storage and compare equal by pointer.  An arena isn't thread safe, but
+ * arenas filled on different threads can be merged afterwards.
+ */
+struct tracer_arena_chunk;
+
+struct tracer_arena {
+	struct tracer_arena_chunk *chunks;
+	char *next, *end;
+	size_t chunk_size;
+	size_t size;			/* taken from malloc */
+	const char **strings;		/* interned, open addressing */
+	uint32_t string_count, string_alloc;
+};
+
+void tracer_arena_init(struct tracer_arena *arena);
+
+void tracer_arena_release(struct tracer_arena *arena);
+
+void *tracer_arena_alloc(struct tracer_arena *arena, size_t size);
+
+char *tracer_arena_strndup(struct tracer_arena *arena, const char *s,
+			   size_t length);
+
+char *tracer_arena_strdup(struct tracer_arena *arena, const char *s);
+
+const char *tracer_arena_intern(struct tracer_arena *arena, const char *s);
+
+void tracer_arena_merge(struct tracer_arena *arena, struct tracer_arena *other);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "wayland-private.h"
+#include "tracer-capture.h"
+
+/* Anything bigger can't be a single read from a wayland socket */
+#define CAPTURE_MAX_PAYLOAD	(64 * 1024)
+
+struct tracer_capture {
+	FILE *fp;
+	int failed;
+};
+
+struct tracer_capture *
+tracer_capture_create(const char *path)
+{
+	struct tracer_capture *capture;
+	struct tracer_capture_header header;
+
+	capture = malloc(sizeof *capture);
+	if (capture == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	capture->fp = fopen(path, "w");
+	if (capture->fp == NULL) {
+		free(capture);
+		return NULL;
+	}
+	capture->failed = 0;
+
+	memset(&header, 0, sizeof header);
+	header.magic = TRACER_CAPTURE_MAGIC;
+	header.version = TRACER_CAPTURE_VERSION;
+	header.start = tracer_now();
+
+	if (fwrite(&header, sizeof header, 1, capture->fp) != 1) {
+		fclose(capture->fp);
+		free(capture);
+		return NULL;
+	}
+
+	return capture;
+}
+
+void
+tracer_capture_destroy(struct tracer_capture *capture)
+{
+	fclose(capture->fp);
+	free(capture);
+}
+
+void
+tracer_capture_write(struct tracer_capture *capture,
+		     const struct tracer_record *record,
+		     const void *payload)
+{
+	static const char padding[TRACER_RECORD_ALIGN];
+	size_t pad = record->size - sizeof *record - record->length;
+
+	if (capture->failed)
+		return;
+
+	if (fwrite(record, sizeof *record, 1, capture->fp) != 1 ||
+	    fwrite(payload, 1, record->length, capture->fp) != record->length ||
+	    fwrite(padding, 1, pad, capture->fp) != pad) {
+		fprintf(stderr, "Failed to write capture, stopping it: %m\n");
+		capture->failed = 1;
+	}
+}
+
+void
+tracer_capture_flush(struct tracer_capture *capture)
+{
+	if (!capture->failed)
+		fflush(capture->fp);
+}
+
+/* Lets decoding name instances the way the live output did */
+void
+tracer_capture_socket(struct tracer *tracer, int index, const char *name)
+{
+	struct tracer_record record;
+
+	memset(&record, 0, sizeof record);
+	record.length = strlen(name) + 1;
+	record.size = tracer_record_size(record.length);
+	record.type = TRACER_RECORD_SOCKET;
+	record.socket = index;
+	record.seq = tracer->next_seq++;
+	record.timestamp = tracer_now();
+
+	tracer_capture_write(tracer->capture, &record, name);
+}
+
+static struct tracer_instance *
+capture_find_instance(struct tracer *tracer, const struct tracer_record *record)
+{
+	struct tracer_instance *instance;
+
+	wl_list_for_each(instance, &tracer->instance_list, link) {
+		if (instance->socket == (int) record->socket &&
+		    instance->id == (int) record->instance)
+			return instance;
+	}
+
+	return NULL;
+}
+
+/*
+ * Calls func for every record of a capture, whether written by --capture
+ * or by the preload library, and stops if it returns a negative value.
+ */
+int
+tracer_capture_read(const char *path, tracer_capture_func_t func, void *data)
+{
+	struct tracer_capture_header header;
+	struct tracer_record record;
+	char *payload;
+	size_t n;
+	FILE *fp;
+	int ret = -1;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open capture %s: %m\n", path);
+		return -1;
+	}
+
+	payload = malloc(CAPTURE_MAX_PAYLOAD + TRACER_RECORD_ALIGN);
+	if (payload == NULL) {
+		fprintf(stderr, "Failed to alloc for capture: %m\n");
+		fclose(fp);
+		return -1;
+	}
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != TRACER_CAPTURE_MAGIC ||
+	    header.version != TRACER_CAPTURE_VERSION) {
+		fprintf(stderr, "%s is not a capture\n", path);
+		goto out;
+	}
+
+	if (header.pid != 0)
+		fprintf(stderr, "Capture of process %u\n", header.pid);
+
+	while ((n = fread(&record, 1, sizeof record, fp)) > 0) {
+		if (n != sizeof record ||
+		    record.size != tracer_record_size(record.length) ||
+		    record.length > CAPTURE_MAX_PAYLOAD ||
+		    fread(payload, 1, record.size - sizeof record, fp) !=
+		    record.size - sizeof record) {
+			fprintf(stderr, "Capture %s is truncated or corrupt\n",
+				path);
+			goto out;
+		}
+
+		if (func(&record, payload, data) < 0)
+			goto out;
+	}
+
+	if (ferror(fp))
+		fprintf(stderr, "Failed to read capture %s: %m\n", path);
+	else
+		ret = 0;
+
+out:
+	free(payload);
+	fclose(fp);
+
+	return ret;
+}
+
+struct capture_decode {
+	struct tracer *tracer;
+	const char *path;
+	struct wl_array socket_names;
+};
+
+static const char *
+capture_socket_name(struct capture_decode *decode, uint32_t socket)
+{
+	char **names = decode->socket_names.data;
+
+	if (socket >= decode->socket_names.size / sizeof *names)
+		return NULL;
+
+	return names[socket];
+}
+
+static int
+capture_add_socket(struct capture_decode *decode,
+		   const struct tracer_record *record, const char *payload)
+{
+	size_t count = decode->socket_names.size / sizeof(char *);
+	char **names;
+
+	if (record->length == 0 || payload[record->length - 1] != '\0' ||
+	    record->socket > 255) {
+		fprintf(stderr, "Capture %s has a bad socket record\n",
+			decode->path);
+		return -1;
+	}
+
+	while (count++ <= record->socket) {
+		names = wl_array_add(&decode->socket_names, sizeof *names);
+		if (names == NULL)
+			return -1;
+		*names = NULL;
+	}
+
+	names = decode->socket_names.data;
+	free(names[record->socket]);
+	names[record->socket] = strdup(payload);
+
+	return names[record->socket] != NULL ? 0 : -1;
+}
+
+static int
+capture_decode_record(const struct tracer_record *record, const void *payload,
+		      void *data)
+{
+	struct capture_decode *decode = data;
+	struct tracer *tracer = decode->tracer;
+	struct tracer_instance *instance;
+
+	if ((int) record->socket >= tracer->socket_count)
+		tracer->socket_count = record->socket + 1;
+
+	if (record->type == TRACER_RECORD_SOCKET)
+		return capture_add_socket(decode, record, payload);
+	if (record->type != TRACER_RECORD_MESSAGE)
+		return 0;
+
+	/* Single mode captures have no sockets, nor prefixes on lines */
+	instance = capture_find_instance(tracer, record);
+	if (instance == NULL)
+		instance = tracer_instance_create_offline(tracer,
+				capture_socket_name(decode, record->socket),
+				record->socket, record->instance);
+	if (instance == NULL) {
+		fprintf(stderr, "Failed to create instance\n");
+		return -1;
+	}
+
+	return tracer_instance_feed(instance, record->side, payload,
+				    record->length, record->nfds,
+				    record->timestamp);
+}
+
+/* Runs a capture through the frontend as if the traffic was going on now */
+int
+tracer_capture_decode(struct tracer *tracer, const char *path)
+{
+	struct capture_decode decode = { tracer, path };
+	char **name;
+	int ret;
+
+	wl_array_init(&decode.socket_names);
+	ret = tracer_capture_read(path, capture_decode_record, &decode);
+	tracer_instance_destroy_all(tracer);
+
+	wl_array_for_each(name, &decode.socket_names)
+		free(*name);
+	wl_array_release(&decode.socket_names);
+
+	return ret;
+}
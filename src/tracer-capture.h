@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_CAPTURE_H
+#define TRACER_CAPTURE_H
+
+#include "tracer.h"
+#include "wayland-tracer-record.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct tracer_capture;
+
+struct tracer_capture *tracer_capture_create(const char *path);
+
+void tracer_capture_destroy(struct tracer_capture *capture);
+
+void tracer_capture_write(struct tracer_capture *capture,
+			  const struct tracer_record *record,
+			  const void *payload);
+
+void tracer_capture_flush(struct tracer_capture *capture);
+
+void tracer_capture_socket(struct tracer *tracer, int index, const char *name);
+
+typedef int (*tracer_capture_func_t)(const struct tracer_record *record,
+				     const void *payload, void *data);
+
+int tracer_capture_read(const char *path, tracer_capture_func_t func,
+			void *data);
+
+int tracer_capture_decode(struct tracer *tracer, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,566 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-damage-stats.h"
+#include "tracer-side-table.h"
+
+/*
+ * Accounts damage from protocol data alone.  Everything is measured in
+ * buffer pixels, so wl_surface.damage rectangles are scaled by the buffer
+ * scale taking effect with the same commit.  The size of a buffer is only
+ * known for wl_shm buffers; commits of other buffers aren't accounted.
+ *
+ * Like compositors do, damage beyond DAMAGE_MAX_RECTS rectangles per
+ * commit is folded into the bounding box of the excess.
+ */
+#define DAMAGE_MAX_RECTS 32
+
+struct damage_rect {
+	int64_t x1, y1, x2, y2;
+};
+
+struct damage_list {
+	struct damage_rect rects[DAMAGE_MAX_RECTS];
+	int count;
+};
+
+struct damage_totals {
+	uint32_t commits;
+	uint32_t full_commits;
+	uint64_t damaged_pixels;
+	uint64_t surface_pixels;
+	uint64_t start;		/* timestamp of the first commit */
+};
+
+struct damage_buffer {
+	int32_t width, height;
+};
+
+struct damage_surface {
+	uint32_t id;
+	int32_t width, height;
+	int32_t scale;
+	int32_t pending_width, pending_height;
+	int32_t pending_scale;
+	int attached;
+	int scale_set;
+	struct damage_list surface_damage;
+	struct damage_list buffer_damage;
+	struct damage_totals totals;
+};
+
+struct damage_client {
+	struct tracer_side_table buffers;
+	struct tracer_side_table surfaces;
+	struct damage_totals totals;
+	uint64_t last;		/* timestamp of the latest request */
+};
+
+struct damage_stats {
+	struct tracer_hook create_buffer;
+	struct tracer_hook destroy_buffer;
+	struct tracer_hook attach;
+	struct tracer_hook damage;
+	struct tracer_hook damage_buffer;
+	struct tracer_hook set_buffer_scale;
+	struct tracer_hook commit;
+	struct tracer_hook destroy_surface;
+	struct tracer_instance_listener listener;
+	int slot;
+};
+
+static void
+damage_list_add(struct damage_list *list, int32_t x, int32_t y,
+		int32_t width, int32_t height)
+{
+	struct damage_rect *r;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (list->count < DAMAGE_MAX_RECTS) {
+		r = &list->rects[list->count++];
+		r->x1 = x;
+		r->y1 = y;
+		r->x2 = (int64_t) x + width;
+		r->y2 = (int64_t) y + height;
+		return;
+	}
+
+	r = &list->rects[DAMAGE_MAX_RECTS - 1];
+	if (x < r->x1)
+		r->x1 = x;
+	if (y < r->y1)
+		r->y1 = y;
+	if ((int64_t) x + width > r->x2)
+		r->x2 = (int64_t) x + width;
+	if ((int64_t) y + height > r->y2)
+		r->y2 = (int64_t) y + height;
+}
+
+/* Appends the rectangles of list, scaled and clipped, to out */
+static int
+damage_list_clip(struct damage_list *list, int32_t scale,
+		 int32_t width, int32_t height, struct damage_rect *out)
+{
+	struct damage_rect r;
+	int i, n = 0;
+
+	for (i = 0; i < list->count; i++) {
+		r.x1 = list->rects[i].x1 * scale;
+		r.y1 = list->rects[i].y1 * scale;
+		r.x2 = list->rects[i].x2 * scale;
+		r.y2 = list->rects[i].y2 * scale;
+
+		if (r.x1 < 0)
+			r.x1 = 0;
+		if (r.y1 < 0)
+			r.y1 = 0;
+		if (r.x2 > width)
+			r.x2 = width;
+		if (r.y2 > height)
+			r.y2 = height;
+
+		if (r.x1 < r.x2 && r.y1 < r.y2)
+			out[n++] = r;
+	}
+
+	list->count = 0;
+
+	return n;
+}
+
+static int
+compare_coord(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int
+compare_span(const void *a, const void *b)
+{
+	const struct damage_rect *r = a, *s = b;
+
+	return compare_coord(&r->y1, &s->y1);
+}
+
+/* Area of the union of n rectangles, by sweeping over x */
+static uint64_t
+union_area(const struct damage_rect *rects, int n)
+{
+	int64_t xs[4 * DAMAGE_MAX_RECTS];
+	struct damage_rect spans[2 * DAMAGE_MAX_RECTS];
+	int64_t top, bottom;
+	uint64_t area = 0;
+	int i, j, nx, nspans;
+
+	for (i = 0; i < n; i++) {
+		xs[2 * i] = rects[i].x1;
+		xs[2 * i + 1] = rects[i].x2;
+	}
+	nx = 2 * n;
+	qsort(xs, nx, sizeof xs[0], compare_coord);
+
+	for (i = 0; i + 1 < nx; i++) {
+		if (xs[i] == xs[i + 1])
+			continue;
+
+		nspans = 0;
+		for (j = 0; j < n; j++) {
+			if (rects[j].x1 <= xs[i] && rects[j].x2 >= xs[i + 1])
+				spans[nspans++] = rects[j];
+		}
+		if (nspans == 0)
+			continue;
+
+		qsort(spans, nspans, sizeof spans[0], compare_span);
+		top = spans[0].y1;
+		bottom = spans[0].y2;
+		for (j = 1; j < nspans; j++) {
+			if (spans[j].y1 > bottom) {
+				area += (bottom - top) * (xs[i + 1] - xs[i]);
+				top = spans[j].y1;
+			}
+			if (spans[j].y2 > bottom)
+				bottom = spans[j].y2;
+		}
+		area += (bottom - top) * (xs[i + 1] - xs[i]);
+	}
+
+	return area;
+}
+
+static void
+totals_add(struct damage_totals *totals, uint64_t damaged, uint64_t pixels,
+	   uint64_t timestamp)
+{
+	if (totals->commits == 0)
+		totals->start = timestamp;
+
+	totals->commits++;
+	totals->damaged_pixels += damaged;
+	totals->surface_pixels += pixels;
+	if (damaged == pixels)
+		totals->full_commits++;
+}
+
+static void
+totals_report(struct tracer_instance *instance, const char *what,
+	      uint32_t id, struct damage_totals *totals, uint64_t now)
+{
+	double elapsed;
+
+	if (totals->commits == 0)
+		return;
+
+	/* Message timestamps, so that decoded captures agree with live */
+	elapsed = (now - totals->start) / 1e9;
+
+	tracer_log("damage: %s", what);
+	if (id != 0)
+		tracer_log_cont("@%u", id);
+	tracer_log_cont(": %u commits, %llu of %llu pixels damaged "
+			"(%.1f%%), %u with full damage",
+			totals->commits,
+			(unsigned long long) totals->damaged_pixels,
+			(unsigned long long) totals->surface_pixels,
+			totals->surface_pixels ? 100.0 *
+			totals->damaged_pixels / totals->surface_pixels : 0.0,
+			totals->full_commits);
+	if (elapsed > 0)
+		tracer_log_cont(", %.0f pixels/s",
+				totals->damaged_pixels / elapsed);
+	tracer_log_end();
+}
+
+static struct damage_client *
+get_client(struct damage_stats *stats, struct tracer_message_view *view)
+{
+	struct damage_client *client;
+
+	if (view->side != TRACER_CLIENT_SIDE)
+		return NULL;
+
+	client = view->instance->slots[stats->slot];
+	if (client != NULL)
+		client->last = view->timestamp;
+
+	return client;
+}
+
+static struct damage_surface *
+get_surface(struct damage_client *client, uint32_t id)
+{
+	struct damage_surface *surface;
+
+	surface = tracer_side_table_get(&client->surfaces, id);
+	if (surface != NULL)
+		return surface;
+
+	surface = calloc(1, sizeof *surface);
+	if (surface == NULL)
+		return NULL;
+
+	surface->id = id;
+	surface->scale = 1;
+	if (tracer_side_table_set(&client->surfaces, id, surface) < 0) {
+		free(surface);
+		return NULL;
+	}
+
+	return surface;
+}
+
+static void
+handle_create_buffer(struct tracer_hook *hook,
+		     struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, create_buffer);
+	struct damage_client *client = get_client(stats, view);
+	struct damage_buffer *buffer;
+
+	if (client == NULL)
+		return;
+
+	buffer = malloc(sizeof *buffer);
+	if (buffer == NULL)
+		return;
+
+	buffer->width = view->args[2];
+	buffer->height = view->args[3];
+	free(tracer_side_table_remove(&client->buffers, view->args[0]));
+	if (tracer_side_table_set(&client->buffers, view->args[0], buffer) < 0)
+		free(buffer);
+}
+
+static void
+handle_destroy_buffer(struct tracer_hook *hook,
+		      struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, destroy_buffer);
+	struct damage_client *client = get_client(stats, view);
+
+	if (client == NULL)
+		return;
+
+	free(tracer_side_table_remove(&client->buffers, view->id));
+}
+
+static void
+handle_attach(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, attach);
+	struct damage_client *client = get_client(stats, view);
+	struct damage_surface *surface;
+	struct damage_buffer *buffer;
+
+	if (client == NULL || (surface = get_surface(client, view->id)) == NULL)
+		return;
+
+	buffer = tracer_side_table_get(&client->buffers, view->args[0]);
+	surface->pending_width = buffer ? buffer->width : 0;
+	surface->pending_height = buffer ? buffer->height : 0;
+	surface->attached = 1;
+}
+
+static void
+handle_damage(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, damage);
+	struct damage_client *client = get_client(stats, view);
+	struct damage_surface *surface;
+
+	if (client == NULL || (surface = get_surface(client, view->id)) == NULL)
+		return;
+
+	damage_list_add(&surface->surface_damage, view->args[0],
+			view->args[1], view->args[2], view->args[3]);
+}
+
+static void
+handle_damage_buffer(struct tracer_hook *hook,
+		     struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, damage_buffer);
+	struct damage_client *client = get_client(stats, view);
+	struct damage_surface *surface;
+
+	if (client == NULL || (surface = get_surface(client, view->id)) == NULL)
+		return;
+
+	damage_list_add(&surface->buffer_damage, view->args[0],
+			view->args[1], view->args[2], view->args[3]);
+}
+
+static void
+handle_set_buffer_scale(struct tracer_hook *hook,
+			struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, set_buffer_scale);
+	struct damage_client *client = get_client(stats, view);
+	struct damage_surface *surface;
+
+	if (client == NULL || (surface = get_surface(client, view->id)) == NULL)
+		return;
+
+	surface->pending_scale = view->args[0];
+	surface->scale_set = 1;
+}
+
+static void
+handle_commit(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, commit);
+	struct damage_client *client = get_client(stats, view);
+	struct tracer_instance *instance = view->instance;
+	struct damage_surface *surface;
+	struct damage_rect rects[2 * DAMAGE_MAX_RECTS];
+	uint64_t damaged, pixels;
+	int n;
+
+	if (client == NULL || (surface = get_surface(client, view->id)) == NULL)
+		return;
+
+	if (surface->attached) {
+		surface->width = surface->pending_width;
+		surface->height = surface->pending_height;
+		surface->attached = 0;
+	}
+	if (surface->scale_set) {
+		if (surface->pending_scale > 0)
+			surface->scale = surface->pending_scale;
+		surface->scale_set = 0;
+	}
+
+	n = damage_list_clip(&surface->surface_damage, surface->scale,
+			     surface->width, surface->height, rects);
+	n += damage_list_clip(&surface->buffer_damage, 1,
+			      surface->width, surface->height, rects + n);
+
+	if (surface->width <= 0 || surface->height <= 0)
+		return;
+
+	damaged = union_area(rects, n);
+	pixels = (uint64_t) surface->width * surface->height;
+	totals_add(&surface->totals, damaged, pixels, view->timestamp);
+	totals_add(&client->totals, damaged, pixels, view->timestamp);
+
+	tracer_log("damage: wl_surface@%u commit: %llu of %llu pixels "
+		   "damaged (%.1f%%)", surface->id,
+		   (unsigned long long) damaged, (unsigned long long) pixels,
+		   100.0 * damaged / pixels);
+	tracer_log_end();
+}
+
+static void
+handle_destroy_surface(struct tracer_hook *hook,
+		       struct tracer_message_view *view)
+{
+	struct damage_stats *stats =
+		container_of(hook, struct damage_stats, destroy_surface);
+	struct damage_client *client = get_client(stats, view);
+	struct damage_surface *surface;
+
+	if (client == NULL)
+		return;
+
+	surface = tracer_side_table_remove(&client->surfaces, view->id);
+	if (surface == NULL)
+		return;
+
+	totals_report(view->instance, "wl_surface", surface->id,
+		      &surface->totals, view->timestamp);
+	free(surface);
+}
+
+static void
+damage_instance_created(struct tracer_instance_listener *listener,
+			struct tracer_instance *instance)
+{
+	struct damage_stats *stats =
+		container_of(listener, struct damage_stats, listener);
+	struct damage_client *client;
+
+	client = tracer_instance_alloc(instance, sizeof *client);
+	if (client == NULL)
+		return;
+
+	tracer_side_table_init(&client->buffers);
+	tracer_side_table_init(&client->surfaces);
+	instance->slots[stats->slot] = client;
+}
+
+static void
+damage_instance_destroyed(struct tracer_instance_listener *listener,
+			  struct tracer_instance *instance)
+{
+	struct damage_stats *stats =
+		container_of(listener, struct damage_stats, listener);
+	struct damage_client *client = instance->slots[stats->slot];
+	struct damage_surface **p;
+
+	if (client == NULL)
+		return;
+
+	wl_array_for_each(p, &client->surfaces.client_entries) {
+		if (*p != NULL)
+			totals_report(instance, "wl_surface", (*p)->id,
+				      &(*p)->totals, client->last);
+	}
+	totals_report(instance, "client", 0, &client->totals, client->last);
+
+	tracer_side_table_release(&client->surfaces, free);
+	tracer_side_table_release(&client->buffers, free);
+	instance->slots[stats->slot] = NULL;
+}
+
+int
+tracer_damage_stats_init(struct tracer *tracer,
+			 struct tracer_analyzer *analyzer)
+{
+	struct damage_stats *stats;
+
+	stats = malloc(sizeof *stats);
+	if (stats == NULL)
+		return -1;
+
+	stats->create_buffer.func = handle_create_buffer;
+	stats->destroy_buffer.func = handle_destroy_buffer;
+	stats->attach.func = handle_attach;
+	stats->damage.func = handle_damage;
+	stats->damage_buffer.func = handle_damage_buffer;
+	stats->set_buffer_scale.func = handle_set_buffer_scale;
+	stats->commit.func = handle_commit;
+	stats->destroy_surface.func = handle_destroy_surface;
+
+	if (tracer_analyzer_add_hook(analyzer, "wl_shm_pool", "create_buffer",
+				     0, &stats->create_buffer) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_buffer", "destroy", 0,
+				     &stats->destroy_buffer) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "attach", 0,
+				     &stats->attach) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "damage", 0,
+				     &stats->damage) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "commit", 0,
+				     &stats->commit) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "destroy", 0,
+				     &stats->destroy_surface) < 0) {
+		fprintf(stderr, "damage statistics need wl_shm_pool, "
+			"wl_buffer and wl_surface from the core protocol\n");
+		return -1;
+	}
+
+	/* Both appeared in later versions of wl_surface */
+	tracer_analyzer_add_hook(analyzer, "wl_surface", "set_buffer_scale", 0,
+				 &stats->set_buffer_scale);
+	tracer_analyzer_add_hook(analyzer, "wl_surface", "damage_buffer", 0,
+				 &stats->damage_buffer);
+
+	stats->slot = tracer_allocate_slot(tracer);
+	if (stats->slot < 0) {
+		fprintf(stderr, "Too many analyses enabled\n");
+		return -1;
+	}
+
+	stats->listener.created = damage_instance_created;
+	stats->listener.destroyed = damage_instance_destroyed;
+	tracer_add_instance_listener(tracer, &stats->listener);
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-decode.h"
+#include "tracer-fdinfo.h"
+
+static int
+attach_interface(struct tracer_interface *interface)
+{
+	const struct tracer_decoder *decoder;
+	struct tracer_message **messages;
+	int i, count, attached = 0;
+
+	for (decoder = tracer_decoders; decoder->interface != NULL; decoder++) {
+		if (strcmp(decoder->interface, interface->name) != 0)
+			continue;
+
+		messages = decoder->event ? interface->events :
+					    interface->methods;
+		count = decoder->event ? interface->event_count :
+					 interface->method_count;
+		for (i = 0; i < count; i++) {
+			if (strcmp(messages[i]->name, decoder->message) != 0)
+				continue;
+			if (strcmp(messages[i]->signature,
+				   decoder->signature) == 0) {
+				messages[i]->decode = decoder->func;
+				attached++;
+			}
+			break;
+		}
+	}
+
+	return attached;
+}
+
+static void
+interface_loaded(struct tracer_analyzer *analyzer,
+		 struct tracer_interface *interface)
+{
+	attach_interface(interface);
+}
+
+/*
+ * Hands the generated decoders to the messages they were generated for,
+ * now and as interfaces get loaded from the search path.
+ * Returns how many found their message.
+ */
+int
+tracer_decode_attach(struct tracer_analyzer *analyzer)
+{
+	struct tracer_interface *interface;
+	int count = 0;
+
+	/* Not through lookups, they'd load the whole search path */
+	wl_list_for_each(interface, &analyzer->interface_list, link)
+		count += attach_interface(interface);
+
+	analyzer->interface_loaded = interface_loaded;
+
+	return count;
+}
+
+void
+tracer_decode_new_id(struct tracer_decode *decode, uint32_t id)
+{
+	struct tracer_message *message = decode->message;
+	struct wl_map *objects = &decode->instance->map;
+
+	/* Interfaces loaded on demand look their types up when first used */
+	if (message->types == NULL)
+		message->types =
+			tracer_analyzer_lookup_type(decode->analyzer,
+						    message->new_interface_name);
+
+	wl_map_reserve_new(objects, id);
+	wl_map_insert_at(objects, 0, id,
+			 message->types == NULL ? NULL : message->types[0]);
+}
+
+void
+tracer_decode_new_id_typed(struct tracer_decode *decode,
+			   const char *type_name, uint32_t id)
+{
+	struct wl_map *objects = &decode->instance->map;
+	struct tracer_interface **ptype;
+
+	ptype = tracer_analyzer_lookup_type(decode->analyzer,
+					    (char *) type_name);
+	wl_map_reserve_new(objects, id);
+	wl_map_insert_at(objects, 0, id, ptype == NULL ? NULL : *ptype);
+}
+
+/*
+ * Takes the next fd that came with the message and passes it on.  When
+ * printing, buf gets " (what it is)" if that's known, "" otherwise.
+ */
+int
+tracer_decode_fd(struct tracer_decode *decode, char *buf, size_t size)
+{
+	struct tracer_connection *connection = decode->connection;
+	struct tracer *tracer = decode->instance->tracer;
+	struct tracer_fdinfo *info;
+	char symbol[256];
+	int fd;
+
+	wl_buffer_copy(&connection->wl_conn->fds_in, &fd, sizeof fd);
+	connection->wl_conn->fds_in.tail += sizeof fd;
+
+	buf[0] = '\0';
+	info = decode->verbose ? tracer_fdinfo_get(tracer->fdinfo, fd) : NULL;
+	if (info != NULL) {
+		tracer_fdinfo_format(info, symbol, sizeof symbol);
+		snprintf(buf, size, " (%s)", symbol);
+	}
+
+	tracer_connection_put_fd(connection->peer, fd);
+	decode->fds[decode->nfds++] = fd;
+
+	return fd;
+}
+
+/* " (name)" if arg has an enum that knows value, "" otherwise */
+const char *
+tracer_decode_enum(struct tracer_decode *decode, int arg, uint32_t value,
+		   char *buf, size_t size)
+{
+	struct tracer_message *message = decode->message;
+	char symbol[256];
+
+	if (message->enums == NULL || message->enums[arg] == NULL ||
+	    tracer_enum_format(message->enums[arg], value,
+			       symbol, sizeof symbol) != 0)
+		return "";
+
+	snprintf(buf, size, " (%s)", symbol);
+
+	return buf;
+}
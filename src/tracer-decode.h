@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_DECODE_H
+#define TRACER_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * State of decoding one message, shared by the interpreting decoder in
+ * frontend-analyze.c and the ones wayland-tracer-scanner generates from
+ * protocol XML.  Generated decoders read their arguments at offsets
+ * known at build time and print a message with a single tracer_log();
+ * the helpers below do what needs the tracer's state.
+ */
+struct tracer_decode {
+	struct tracer_connection *connection;
+	struct tracer_instance *instance;
+	struct tracer_analyzer *analyzer;
+	struct tracer_message *message;
+	const char *arrow;
+	uint32_t id;
+	int verbose;
+	int fds[WL_CLOSURE_MAX_ARGS];
+	int nfds;
+};
+
+typedef void (*tracer_decode_func_t)(struct tracer_decode *decode,
+				     const uint32_t *args);
+
+/* What a generated decoder is for, it's only used if signature matches */
+struct tracer_decoder {
+	const char *interface;
+	const char *message;
+	int event;
+	const char *signature;
+	tracer_decode_func_t func;
+};
+
+/* Generated, ends with an all NULL entry */
+extern const struct tracer_decoder tracer_decoders[];
+
+int tracer_decode_attach(struct tracer_analyzer *analyzer);
+
+void tracer_decode_new_id(struct tracer_decode *decode, uint32_t id);
+
+void tracer_decode_new_id_typed(struct tracer_decode *decode,
+				const char *type_name, uint32_t id);
+
+int tracer_decode_fd(struct tracer_decode *decode, char *buf, size_t size);
+
+const char *tracer_decode_enum(struct tracer_decode *decode, int arg,
+			       uint32_t value, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
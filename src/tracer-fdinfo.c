@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-fdinfo.h"
+#include "tracer-side-table.h"
+
+/*
+ * Classifying an fd takes a readlink() on /proc, which is much more
+ * expensive than the fstat() needed to find it in the cache.  Entries are
+ * keyed by (dev, inode), so every buffer coming from the same pool hits
+ * the same entry.  Entries belonging to a wl_shm_pool go away with the
+ * pool, the others are recycled least recently used first.
+ */
+#define FDINFO_BUCKETS	256
+#define FDINFO_MAX	1024
+
+struct tracer_fdinfo_cache {
+	struct tracer_fdinfo *buckets[FDINFO_BUCKETS];
+	struct wl_list lru;
+	int count;
+};
+
+struct fdinfo_pools {
+	struct tracer_fdinfo_cache *cache;
+	struct tracer_hook create_pool;
+	struct tracer_hook destroy_pool;
+	struct tracer_instance_listener listener;
+	int slot;
+};
+
+static const char *type_names[] = {
+	[TRACER_FD_UNKNOWN] = "unknown",
+	[TRACER_FD_MEMFD] = "memfd",
+	[TRACER_FD_SHM] = "shm",
+	[TRACER_FD_FILE] = "file",
+	[TRACER_FD_DMABUF] = "dmabuf",
+	[TRACER_FD_SYNC_FILE] = "sync_file",
+	[TRACER_FD_PIPE] = "pipe",
+	[TRACER_FD_SOCKET] = "socket",
+	[TRACER_FD_DEVICE] = "device",
+};
+
+struct tracer_fdinfo_cache *
+tracer_fdinfo_cache_create(void)
+{
+	struct tracer_fdinfo_cache *cache;
+
+	cache = malloc(sizeof *cache);
+	if (cache == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memset(cache->buckets, 0, sizeof cache->buckets);
+	wl_list_init(&cache->lru);
+	cache->count = 0;
+
+	return cache;
+}
+
+static unsigned int
+fdinfo_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = (uint64_t) ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t) dev;
+
+	return (h >> 32) % FDINFO_BUCKETS;
+}
+
+static void
+fdinfo_evict(struct tracer_fdinfo_cache *cache, struct tracer_fdinfo *info)
+{
+	struct tracer_fdinfo **p;
+
+	p = &cache->buckets[fdinfo_hash(info->dev, info->ino)];
+	while (*p != info)
+		p = &(*p)->next;
+	*p = info->next;
+
+	wl_list_remove(&info->link);
+	cache->count--;
+	free(info->name);
+	free(info);
+}
+
+static void
+fdinfo_classify(struct tracer_fdinfo *info, int fd, struct stat *st)
+{
+	char path[64], target[256];
+	const char *name = NULL;
+	ssize_t len;
+	off_t size;
+
+	info->size = st->st_size;
+
+	if (S_ISSOCK(st->st_mode)) {
+		info->type = TRACER_FD_SOCKET;
+		return;
+	} else if (S_ISFIFO(st->st_mode)) {
+		info->type = TRACER_FD_PIPE;
+		return;
+	}
+
+	snprintf(path, sizeof path, "/proc/self/fd/%d", fd);
+	len = readlink(path, target, sizeof target - 1);
+	if (len < 0) {
+		info->type = TRACER_FD_UNKNOWN;
+		return;
+	}
+	target[len] = '\0';
+
+	if (S_ISCHR(st->st_mode)) {
+		info->type = TRACER_FD_DEVICE;
+		name = target;
+	} else if (!strncmp(target, "/memfd:", 7)) {
+		info->type = TRACER_FD_MEMFD;
+		name = target + 7;
+	} else if (!strncmp(target, "/dev/shm/", 9)) {
+		info->type = TRACER_FD_SHM;
+		name = target + 9;
+	} else if (!strncmp(target, "/dmabuf:", 8) ||
+		   !strcmp(target, "anon_inode:dmabuf")) {
+		info->type = TRACER_FD_DMABUF;
+		/* dma-bufs don't report their size through fstat */
+		size = lseek(fd, 0, SEEK_END);
+		if (size >= 0) {
+			info->size = size;
+			lseek(fd, 0, SEEK_SET);
+		}
+	} else if (!strcmp(target, "anon_inode:sync_file")) {
+		info->type = TRACER_FD_SYNC_FILE;
+	} else if (S_ISREG(st->st_mode)) {
+		info->type = TRACER_FD_FILE;
+		name = target;
+	} else {
+		info->type = TRACER_FD_UNKNOWN;
+		name = target;
+	}
+
+	if (name != NULL && *name != '\0') {
+		info->name = strdup(name);
+		/* Everything passed around is usually unlinked already */
+		if (info->name != NULL &&
+		    (len = strlen(info->name)) > 10 &&
+		    !strcmp(info->name + len - 10, " (deleted)"))
+			info->name[len - 10] = '\0';
+	}
+}
+
+struct tracer_fdinfo *
+tracer_fdinfo_get(struct tracer_fdinfo_cache *cache, int fd)
+{
+	struct tracer_fdinfo *info, *victim;
+	struct stat st;
+	unsigned int hash;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	hash = fdinfo_hash(st.st_dev, st.st_ino);
+	for (info = cache->buckets[hash]; info != NULL; info = info->next) {
+		if (info->dev == st.st_dev && info->ino == st.st_ino) {
+			/* Pools can be resized, everything else is fixed */
+			if (info->type != TRACER_FD_DMABUF)
+				info->size = st.st_size;
+			wl_list_remove(&info->link);
+			wl_list_insert(&cache->lru, &info->link);
+			return info;
+		}
+	}
+
+	if (cache->count >= FDINFO_MAX) {
+		wl_list_for_each_reverse(victim, &cache->lru, link) {
+			if (victim->refcount == 0) {
+				fdinfo_evict(cache, victim);
+				break;
+			}
+		}
+	}
+
+	info = malloc(sizeof *info);
+	if (info == NULL)
+		return NULL;
+
+	info->dev = st.st_dev;
+	info->ino = st.st_ino;
+	info->name = NULL;
+	info->refcount = 0;
+	fdinfo_classify(info, fd, &st);
+
+	info->next = cache->buckets[hash];
+	cache->buckets[hash] = info;
+	wl_list_insert(&cache->lru, &info->link);
+	cache->count++;
+
+	return info;
+}
+
+void
+tracer_fdinfo_format(struct tracer_fdinfo *info, char *buf, size_t size)
+{
+	switch (info->type) {
+	case TRACER_FD_PIPE:
+	case TRACER_FD_SOCKET:
+	case TRACER_FD_SYNC_FILE:
+		snprintf(buf, size, "%s, ino %lu", type_names[info->type],
+			 (unsigned long) info->ino);
+		break;
+	default:
+		snprintf(buf, size, "%s%s%s, %lld bytes, ino %lu",
+			 type_names[info->type],
+			 info->name ? ":" : "", info->name ? info->name : "",
+			 (long long) info->size, (unsigned long) info->ino);
+		break;
+	}
+}
+
+static void
+pools_release(struct fdinfo_pools *pools, struct tracer_fdinfo *info)
+{
+	if (--info->refcount == 0)
+		fdinfo_evict(pools->cache, info);
+}
+
+static void
+pools_handle_create(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct fdinfo_pools *pools =
+		container_of(hook, struct fdinfo_pools, create_pool);
+	struct tracer_side_table *table = view->instance->slots[pools->slot];
+	struct tracer_fdinfo *info, *old;
+	uint32_t id = view->args[0];
+
+	if (table == NULL || view->nfds != 1)
+		return;
+
+	info = tracer_fdinfo_get(pools->cache, view->fds[0]);
+	if (info == NULL)
+		return;
+
+	old = tracer_side_table_remove(table, id);
+	if (old != NULL)
+		pools_release(pools, old);
+
+	if (tracer_side_table_set(table, id, info) == 0)
+		info->refcount++;
+}
+
+static void
+pools_handle_destroy(struct tracer_hook *hook,
+		     struct tracer_message_view *view)
+{
+	struct fdinfo_pools *pools =
+		container_of(hook, struct fdinfo_pools, destroy_pool);
+	struct tracer_side_table *table = view->instance->slots[pools->slot];
+	struct tracer_fdinfo *info;
+
+	if (table == NULL)
+		return;
+
+	info = tracer_side_table_remove(table, view->id);
+	if (info != NULL)
+		pools_release(pools, info);
+}
+
+static void
+pools_instance_created(struct tracer_instance_listener *listener,
+		       struct tracer_instance *instance)
+{
+	struct fdinfo_pools *pools =
+		container_of(listener, struct fdinfo_pools, listener);
+	struct tracer_side_table *table;
+
+	table = tracer_instance_alloc(instance, sizeof *table);
+	if (table == NULL)
+		return;
+
+	tracer_side_table_init(table);
+	instance->slots[pools->slot] = table;
+}
+
+static void
+pools_instance_destroyed(struct tracer_instance_listener *listener,
+			 struct tracer_instance *instance)
+{
+	struct fdinfo_pools *pools =
+		container_of(listener, struct fdinfo_pools, listener);
+	struct tracer_side_table *table = instance->slots[pools->slot];
+	struct tracer_fdinfo **p;
+
+	if (table == NULL)
+		return;
+
+	wl_array_for_each(p, &table->client_entries) {
+		if (*p != NULL)
+			pools_release(pools, *p);
+	}
+	tracer_side_table_release(table, NULL);
+	instance->slots[pools->slot] = NULL;
+}
+
+/* Expire cache entries together with the wl_shm_pool they belong to */
+int
+tracer_fdinfo_watch_pools(struct tracer *tracer,
+			  struct tracer_analyzer *analyzer)
+{
+	struct tracer_message *create_pool, *destroy_pool;
+	struct fdinfo_pools *pools;
+
+	create_pool = tracer_analyzer_lookup_message(analyzer, "wl_shm",
+						     "create_pool", 0);
+	destroy_pool = tracer_analyzer_lookup_message(analyzer, "wl_shm_pool",
+						      "destroy", 0);
+	if (create_pool == NULL || destroy_pool == NULL)
+		return 0;
+
+	pools = malloc(sizeof *pools);
+	if (pools == NULL)
+		return -1;
+
+	pools->slot = tracer_allocate_slot(tracer);
+	if (pools->slot < 0) {
+		free(pools);
+		return -1;
+	}
+
+	pools->cache = tracer->fdinfo;
+	pools->create_pool.func = pools_handle_create;
+	pools->destroy_pool.func = pools_handle_destroy;
+	tracer_message_add_hook(create_pool, &pools->create_pool);
+	tracer_message_add_hook(destroy_pool, &pools->destroy_pool);
+
+	pools->listener.created = pools_instance_created;
+	pools->listener.destroyed = pools_instance_destroyed;
+	tracer_add_instance_listener(tracer, &pools->listener);
+
+	return 0;
+}
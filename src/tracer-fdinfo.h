@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_FDINFO_H
+#define TRACER_FDINFO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "tracer.h"
+#include "tracer-analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+enum tracer_fd_type {
+	TRACER_FD_UNKNOWN,
+	TRACER_FD_MEMFD,
+	TRACER_FD_SHM,
+	TRACER_FD_FILE,
+	TRACER_FD_DMABUF,
+	TRACER_FD_SYNC_FILE,
+	TRACER_FD_PIPE,
+	TRACER_FD_SOCKET,
+	TRACER_FD_DEVICE
+};
+
+struct tracer_fdinfo {
+	dev_t dev;
+	ino_t ino;
+	enum tracer_fd_type type;
+	off_t size;
+	char *name;
+	int refcount;
+	struct tracer_fdinfo *next;
+	struct wl_list link;
+};
+
+struct tracer_fdinfo_cache *tracer_fdinfo_cache_create(void);
+
+struct tracer_fdinfo *
+tracer_fdinfo_get(struct tracer_fdinfo_cache *cache, int fd);
+
+void tracer_fdinfo_format(struct tracer_fdinfo *info, char *buf, size_t size);
+
+int tracer_fdinfo_watch_pools(struct tracer *tracer,
+			      struct tracer_analyzer *analyzer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,452 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-frame-stats.h"
+#include "tracer-side-table.h"
+
+/*
+ * Follows the frame callback cycle of every surface: a commit carrying a
+ * wl_surface.frame request, the wl_callback.done answering it and the
+ * commit the client makes next.  Commits which come right after a done
+ * event are the ones paced by the compositor; only those are held
+ * against the target refresh rate and feed the jitter score, so that
+ * idle surfaces don't count as stuttering.
+ *
+ * Jitter is the RFC 3550 estimator applied to commit intervals: a moving
+ * average, with gain 1/16, of how much each interval differs from the
+ * previous one.
+ */
+#define FRAME_REPORT_INTERVAL	5000	/* ms */
+#define FRAME_BUCKETS		10
+
+static const uint32_t bucket_limits[FRAME_BUCKETS - 1] = {
+	4, 8, 12, 17, 25, 34, 50, 100, 250	/* ms */
+};
+
+struct frame_window {
+	uint32_t commits;
+	uint32_t paced;
+	uint32_t missed;
+	uint32_t callbacks;
+	uint64_t latency_sum;
+	uint64_t latency_max;
+	uint32_t intervals[FRAME_BUCKETS];
+};
+
+struct frame_surface {
+	uint32_t id;
+	uint32_t pending_callback;
+	int done_since_commit;
+	uint64_t last_commit;
+	uint64_t last_interval;
+	double jitter;
+	uint64_t commits;
+	uint64_t missed;
+	struct frame_window window;
+};
+
+struct frame_callback {
+	uint32_t surface;
+	uint64_t committed;
+};
+
+struct frame_client {
+	struct tracer_side_table surfaces;
+	struct tracer_side_table callbacks;
+};
+
+struct frame_stats {
+	struct tracer *tracer;
+	struct tracer_hook frame;
+	struct tracer_hook commit;
+	struct tracer_hook done;
+	struct tracer_hook destroy_surface;
+	struct tracer_instance_listener listener;
+	struct tracer_timer *timer;
+	uint64_t period;	/* ns */
+	uint64_t window_start;	/* message time, ns */
+	int slot;
+};
+
+static int
+bucket_index(uint64_t interval)
+{
+	int i;
+
+	for (i = 0; i < FRAME_BUCKETS - 1; i++) {
+		if (interval <= bucket_limits[i] * 1000000ULL)
+			break;
+	}
+
+	return i;
+}
+
+static struct frame_surface *
+get_surface(struct frame_client *client, uint32_t id)
+{
+	struct frame_surface *surface;
+
+	surface = tracer_side_table_get(&client->surfaces, id);
+	if (surface != NULL)
+		return surface;
+
+	surface = calloc(1, sizeof *surface);
+	if (surface == NULL)
+		return NULL;
+
+	surface->id = id;
+	if (tracer_side_table_set(&client->surfaces, id, surface) < 0) {
+		free(surface);
+		return NULL;
+	}
+
+	return surface;
+}
+
+static void
+surface_report(struct tracer_instance *instance, struct frame_surface *surface,
+	       double seconds)
+{
+	struct frame_window *w = &surface->window;
+	int i;
+
+	if (w->commits == 0 && w->callbacks == 0)
+		return;
+
+	tracer_log("frame: wl_surface@%u: %.1f commits/s, %u paced, "
+		   "%u missed, jitter %.2f ms",
+		   surface->id, w->commits / seconds, w->paced, w->missed,
+		   surface->jitter / 1e6);
+	if (w->callbacks != 0)
+		tracer_log_cont(", callback latency %.2f ms avg %.2f ms max",
+				w->latency_sum / 1e6 / w->callbacks,
+				w->latency_max / 1e6);
+
+	tracer_log_cont(", intervals");
+	for (i = 0; i < FRAME_BUCKETS; i++) {
+		if (w->intervals[i] == 0)
+			continue;
+		if (i < FRAME_BUCKETS - 1)
+			tracer_log_cont(" <=%ums:%u", bucket_limits[i],
+					w->intervals[i]);
+		else
+			tracer_log_cont(" >%ums:%u", bucket_limits[i - 1],
+					w->intervals[i]);
+	}
+	tracer_log_end();
+
+	memset(w, 0, sizeof *w);
+}
+
+static void
+surface_final_report(struct tracer_instance *instance,
+		     struct frame_surface *surface)
+{
+	if (surface->commits == 0)
+		return;
+
+	tracer_log("frame: wl_surface@%u: %llu commits, %llu missed frames "
+		   "in total", surface->id,
+		   (unsigned long long) surface->commits,
+		   (unsigned long long) surface->missed);
+	tracer_log_end();
+}
+
+/*
+ * Report windows follow message timestamps rather than the clock, so that
+ * decoding a capture reports the same windows as tracing live did.
+ */
+static void
+frame_advance(struct frame_stats *stats, uint64_t now)
+{
+	const uint64_t interval = FRAME_REPORT_INTERVAL * 1000000ULL;
+	struct tracer_instance *instance;
+	struct frame_client *client;
+	struct frame_surface **p;
+
+	if (stats->window_start == 0) {
+		stats->window_start = now;
+		return;
+	}
+	if (now < stats->window_start + interval)
+		return;
+
+	stats->window_start += (now - stats->window_start) / interval *
+			       interval;
+
+	wl_list_for_each(instance, &stats->tracer->instance_list, link) {
+		client = instance->slots[stats->slot];
+		if (client == NULL)
+			continue;
+
+		wl_array_for_each(p, &client->surfaces.client_entries) {
+			if (*p != NULL)
+				surface_report(instance, *p,
+					       FRAME_REPORT_INTERVAL / 1000.0);
+		}
+	}
+}
+
+/* Closes the window when tracing live and clients are idle */
+static void
+frame_report(void *data)
+{
+	struct frame_stats *stats = data;
+
+	frame_advance(stats, tracer_now());
+}
+
+static void
+handle_frame(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct frame_stats *stats =
+		container_of(hook, struct frame_stats, frame);
+	struct frame_client *client = view->instance->slots[stats->slot];
+	struct frame_surface *surface;
+	struct frame_callback *callback;
+
+	frame_advance(stats, view->timestamp);
+
+	if (client == NULL || (surface = get_surface(client, view->id)) == NULL)
+		return;
+
+	callback = calloc(1, sizeof *callback);
+	if (callback == NULL)
+		return;
+
+	callback->surface = view->id;
+	free(tracer_side_table_remove(&client->callbacks, view->args[0]));
+	if (tracer_side_table_set(&client->callbacks, view->args[0],
+				  callback) < 0) {
+		free(callback);
+		return;
+	}
+
+	surface->pending_callback = view->args[0];
+}
+
+static void
+handle_commit(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct frame_stats *stats =
+		container_of(hook, struct frame_stats, commit);
+	struct frame_client *client = view->instance->slots[stats->slot];
+	struct frame_surface *surface;
+	struct frame_callback *callback;
+	uint64_t now, interval, delta, frames;
+
+	frame_advance(stats, view->timestamp);
+
+	if (client == NULL || (surface = get_surface(client, view->id)) == NULL)
+		return;
+
+	now = view->timestamp;
+
+	if (surface->pending_callback != 0) {
+		callback = tracer_side_table_get(&client->callbacks,
+						 surface->pending_callback);
+		if (callback != NULL)
+			callback->committed = now;
+		surface->pending_callback = 0;
+	}
+
+	surface->commits++;
+	surface->window.commits++;
+
+	if (surface->last_commit != 0) {
+		interval = now - surface->last_commit;
+		surface->window.intervals[bucket_index(interval)]++;
+
+		if (surface->done_since_commit) {
+			surface->window.paced++;
+
+			/* Anything later than half a period is a miss */
+			frames = (interval + stats->period / 2) / stats->period;
+			if (frames > 1) {
+				surface->missed += frames - 1;
+				surface->window.missed += frames - 1;
+			}
+
+			if (surface->last_interval != 0) {
+				delta = interval > surface->last_interval ?
+					interval - surface->last_interval :
+					surface->last_interval - interval;
+				surface->jitter +=
+					(delta - surface->jitter) / 16.0;
+			}
+			surface->last_interval = interval;
+		}
+	}
+
+	surface->last_commit = now;
+	surface->done_since_commit = 0;
+}
+
+static void
+handle_done(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct frame_stats *stats =
+		container_of(hook, struct frame_stats, done);
+	struct frame_client *client = view->instance->slots[stats->slot];
+	struct frame_surface *surface;
+	struct frame_callback *callback;
+	uint64_t latency;
+
+	frame_advance(stats, view->timestamp);
+
+	if (client == NULL)
+		return;
+
+	/* wl_callback.done is a destructor event */
+	callback = tracer_side_table_remove(&client->callbacks, view->id);
+	if (callback == NULL)
+		return;
+
+	surface = tracer_side_table_get(&client->surfaces, callback->surface);
+	if (surface != NULL && callback->committed != 0) {
+		latency = view->timestamp - callback->committed;
+		surface->window.callbacks++;
+		surface->window.latency_sum += latency;
+		if (latency > surface->window.latency_max)
+			surface->window.latency_max = latency;
+		surface->done_since_commit = 1;
+	}
+
+	free(callback);
+}
+
+static void
+handle_destroy_surface(struct tracer_hook *hook,
+		       struct tracer_message_view *view)
+{
+	struct frame_stats *stats =
+		container_of(hook, struct frame_stats, destroy_surface);
+	struct frame_client *client = view->instance->slots[stats->slot];
+	struct frame_surface *surface;
+
+	if (client == NULL)
+		return;
+
+	surface = tracer_side_table_remove(&client->surfaces, view->id);
+	if (surface == NULL)
+		return;
+
+	surface_final_report(view->instance, surface);
+	free(surface);
+}
+
+static void
+frame_instance_created(struct tracer_instance_listener *listener,
+		       struct tracer_instance *instance)
+{
+	struct frame_stats *stats =
+		container_of(listener, struct frame_stats, listener);
+	struct frame_client *client;
+
+	client = tracer_instance_alloc(instance, sizeof *client);
+	if (client == NULL)
+		return;
+
+	tracer_side_table_init(&client->surfaces);
+	tracer_side_table_init(&client->callbacks);
+	instance->slots[stats->slot] = client;
+}
+
+static void
+frame_instance_destroyed(struct tracer_instance_listener *listener,
+			 struct tracer_instance *instance)
+{
+	struct frame_stats *stats =
+		container_of(listener, struct frame_stats, listener);
+	struct frame_client *client = instance->slots[stats->slot];
+	struct frame_surface **p;
+
+	if (client == NULL)
+		return;
+
+	wl_array_for_each(p, &client->surfaces.client_entries) {
+		if (*p != NULL)
+			surface_final_report(instance, *p);
+	}
+
+	tracer_side_table_release(&client->surfaces, free);
+	tracer_side_table_release(&client->callbacks, free);
+	instance->slots[stats->slot] = NULL;
+}
+
+int
+tracer_frame_stats_init(struct tracer *tracer,
+			struct tracer_analyzer *analyzer)
+{
+	struct frame_stats *stats;
+
+	stats = malloc(sizeof *stats);
+	if (stats == NULL)
+		return -1;
+
+	stats->tracer = tracer;
+	stats->period = 1000000000ULL / tracer->options->refresh_rate;
+	stats->frame.func = handle_frame;
+	stats->commit.func = handle_commit;
+	stats->done.func = handle_done;
+	stats->destroy_surface.func = handle_destroy_surface;
+
+	if (tracer_analyzer_add_hook(analyzer, "wl_surface", "frame", 0,
+				     &stats->frame) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "commit", 0,
+				     &stats->commit) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "destroy", 0,
+				     &stats->destroy_surface) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_callback", "done", 1,
+				     &stats->done) < 0) {
+		fprintf(stderr, "frame statistics need wl_surface and "
+			"wl_callback from the core protocol\n");
+		return -1;
+	}
+
+	stats->slot = tracer_allocate_slot(tracer);
+	if (stats->slot < 0) {
+		fprintf(stderr, "Too many analyses enabled\n");
+		return -1;
+	}
+
+	stats->listener.created = frame_instance_created;
+	stats->listener.destroyed = frame_instance_destroyed;
+	tracer_add_instance_listener(tracer, &stats->listener);
+
+	stats->timer = tracer_timer_create(tracer, FRAME_REPORT_INTERVAL,
+					   frame_report, stats);
+	if (stats->timer == NULL) {
+		fprintf(stderr, "Failed to create timer: %m\n");
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,469 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "wayland-os.h"
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-metrics.h"
+
+/*
+ * Counters in the Prometheus text exposition format, written to a file
+ * every few seconds and handed to whoever connects to the metrics
+ * socket.  The tracer is single threaded, so the counters are plain
+ * fields only ever touched by the main loop; rendering reads them in the
+ * same thread and no locking is needed anywhere.
+ */
+
+static const double latency_buckets[] = {
+	5e-6, 10e-6, 25e-6, 50e-6, 100e-6, 250e-6, 500e-6,
+	1e-3, 2.5e-3, 5e-3, 10e-3
+};
+
+#define LATENCY_BUCKETS \
+	(sizeof latency_buckets / sizeof latency_buckets[0])
+
+/* Scrapes still being written, the oldest is dropped beyond this */
+#define METRICS_MAX_CLIENTS 16
+
+struct tracer_metrics {
+	struct tracer *tracer;
+	struct tracer_analyzer *analyzer;
+	struct tracer_timer *timer;
+	struct tracer_event_source source;
+	struct wl_list client_list;
+	int client_count;
+	char *tmp_path;
+
+	/* Forwarding latency, non-cumulative buckets plus +Inf */
+	uint64_t latency_counts[LATENCY_BUCKETS + 1];
+	uint64_t latency_count;
+	uint64_t latency_sum;	/* ns */
+	uint64_t decode_time;	/* ns */
+};
+
+struct metrics_client {
+	struct tracer_event_source source;
+	struct tracer_metrics *metrics;
+	struct wl_list link;
+	char *text;
+	size_t length, offset;
+};
+
+void
+tracer_metrics_observe(struct tracer_metrics *metrics, uint64_t start,
+		       uint64_t decoded, uint64_t end)
+{
+	double latency = (end - start) / 1e9;
+	unsigned int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (latency <= latency_buckets[i])
+			break;
+	}
+
+	metrics->latency_counts[i]++;
+	metrics->latency_count++;
+	metrics->latency_sum += end - start;
+	metrics->decode_time += decoded - start;
+}
+
+static void
+count_object(void *element, void *data)
+{
+	(*(int *) data)++;
+}
+
+/* Labels telling an instance apart, socket first when there's one */
+static const char *
+instance_labels(struct tracer_instance *instance, char *buf, size_t size)
+{
+	if (instance->socket_name != NULL)
+		snprintf(buf, size, "socket=\"%s\",instance=\"%d\"",
+			 instance->socket_name, instance->id);
+	else
+		snprintf(buf, size, "instance=\"%d\"", instance->id);
+
+	return buf;
+}
+
+static void
+render_instances(struct tracer *tracer, FILE *fp)
+{
+	struct tracer_instance *instance;
+	struct tracer_connection *conn[2];
+	char labels[256];
+	int i, objects;
+
+	fprintf(fp, "# HELP wayland_tracer_instances Traced clients.\n"
+		"# TYPE wayland_tracer_instances gauge\n"
+		"wayland_tracer_instances %d\n",
+		wl_list_length(&tracer->instance_list));
+
+	fprintf(fp, "# HELP wayland_tracer_messages_total Messages forwarded.\n"
+		"# TYPE wayland_tracer_messages_total counter\n");
+	wl_list_for_each(instance, &tracer->instance_list, link)
+		fprintf(fp, "wayland_tracer_messages_total{%s} %llu\n",
+			instance_labels(instance, labels, sizeof labels),
+			(unsigned long long) instance->counters.messages);
+
+	fprintf(fp, "# HELP wayland_tracer_bytes_total Bytes forwarded.\n"
+		"# TYPE wayland_tracer_bytes_total counter\n");
+	wl_list_for_each(instance, &tracer->instance_list, link)
+		fprintf(fp, "wayland_tracer_bytes_total{%s} %llu\n",
+			instance_labels(instance, labels, sizeof labels),
+			(unsigned long long) instance->counters.bytes);
+
+	fprintf(fp, "# HELP wayland_tracer_fds_total File descriptors "
+		"forwarded.\n"
+		"# TYPE wayland_tracer_fds_total counter\n");
+	wl_list_for_each(instance, &tracer->instance_list, link)
+		fprintf(fp, "wayland_tracer_fds_total{%s} %llu\n",
+			instance_labels(instance, labels, sizeof labels),
+			(unsigned long long) instance->counters.fds);
+
+	fprintf(fp, "# HELP wayland_tracer_objects Live protocol objects.\n"
+		"# TYPE wayland_tracer_objects gauge\n");
+	wl_list_for_each(instance, &tracer->instance_list, link) {
+		objects = 0;
+		wl_map_for_each(&instance->map, count_object, &objects);
+		fprintf(fp, "wayland_tracer_objects{%s} %d\n",
+			instance_labels(instance, labels, sizeof labels),
+			objects);
+	}
+
+	fprintf(fp, "# HELP wayland_tracer_buffered_bytes Bytes waiting in "
+		"the buffers of the connection to each side.\n"
+		"# TYPE wayland_tracer_buffered_bytes gauge\n");
+	wl_list_for_each(instance, &tracer->instance_list, link) {
+		instance_labels(instance, labels, sizeof labels);
+		conn[0] = instance->client_conn;
+		conn[1] = instance->server_conn;
+		for (i = 0; i < 2; i++) {
+			fprintf(fp, "wayland_tracer_buffered_bytes{%s,"
+				"side=\"%s\",buffer=\"in\"} %u\n",
+				labels, i ? "server" : "client",
+				wl_buffer_size(&conn[i]->wl_conn->in));
+			fprintf(fp, "wayland_tracer_buffered_bytes{%s,"
+				"side=\"%s\",buffer=\"out\"} %zu\n",
+				labels, i ? "server" : "client",
+				tracer_connection_pending(conn[i]));
+		}
+	}
+
+	fprintf(fp, "# HELP wayland_tracer_memory_bytes Memory the tracer "
+		"holds for each client, not counting analyses.\n"
+		"# TYPE wayland_tracer_memory_bytes gauge\n");
+	wl_list_for_each(instance, &tracer->instance_list, link)
+		fprintf(fp, "wayland_tracer_memory_bytes{%s} %zu\n",
+			instance_labels(instance, labels, sizeof labels),
+			tracer_instance_memory(instance));
+
+	fprintf(fp, "# HELP wayland_tracer_stalls_total Times reading from a "
+		"side was paused because the other side was backed up.\n"
+		"# TYPE wayland_tracer_stalls_total counter\n");
+	wl_list_for_each(instance, &tracer->instance_list, link) {
+		instance_labels(instance, labels, sizeof labels);
+		conn[0] = instance->client_conn;
+		conn[1] = instance->server_conn;
+		for (i = 0; i < 2; i++)
+			fprintf(fp, "wayland_tracer_stalls_total{%s,"
+				"side=\"%s\"} %llu\n",
+				labels, i ? "server" : "client",
+				(unsigned long long) conn[i]->stalls);
+	}
+}
+
+static void
+render_messages(struct tracer_analyzer *analyzer, FILE *fp, int bytes)
+{
+	struct tracer_interface *interface;
+	struct tracer_message **messages;
+	int i, j, count;
+
+	wl_list_for_each(interface, &analyzer->interface_list, link) {
+		for (j = 0; j < 2; j++) {
+			messages = j ? interface->events : interface->methods;
+			count = j ? interface->event_count :
+				    interface->method_count;
+			for (i = 0; i < count; i++) {
+				if (messages[i]->count == 0)
+					continue;
+				fprintf(fp, "wayland_tracer_interface_%s_total"
+					"{interface=\"%s\",message=\"%s\"} "
+					"%llu\n", bytes ? "bytes" : "messages",
+					interface->name, messages[i]->name,
+					(unsigned long long) (bytes ?
+					messages[i]->bytes :
+					messages[i]->count));
+			}
+		}
+	}
+}
+
+static void
+render(struct tracer_metrics *metrics, FILE *fp)
+{
+	struct tracer *tracer = metrics->tracer;
+	struct rusage usage;
+	uint64_t cumulative = 0;
+	unsigned int i;
+
+	render_instances(tracer, fp);
+
+	if (metrics->analyzer != NULL) {
+		fprintf(fp, "# HELP wayland_tracer_interface_messages_total "
+			"Messages forwarded, by interface and message.\n"
+			"# TYPE wayland_tracer_interface_messages_total "
+			"counter\n");
+		render_messages(metrics->analyzer, fp, 0);
+		fprintf(fp, "# HELP wayland_tracer_interface_bytes_total "
+			"Bytes forwarded, by interface and message.\n"
+			"# TYPE wayland_tracer_interface_bytes_total "
+			"counter\n");
+		render_messages(metrics->analyzer, fp, 1);
+	}
+
+	fprintf(fp, "# HELP wayland_tracer_forward_latency_seconds Time from "
+		"reading data to flushing it to the peer.\n"
+		"# TYPE wayland_tracer_forward_latency_seconds histogram\n");
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		cumulative += metrics->latency_counts[i];
+		fprintf(fp, "wayland_tracer_forward_latency_seconds_bucket"
+			"{le=\"%g\"} %llu\n", latency_buckets[i],
+			(unsigned long long) cumulative);
+	}
+	fprintf(fp, "wayland_tracer_forward_latency_seconds_bucket"
+		"{le=\"+Inf\"} %llu\n"
+		"wayland_tracer_forward_latency_seconds_sum %.9f\n"
+		"wayland_tracer_forward_latency_seconds_count %llu\n",
+		(unsigned long long) metrics->latency_count,
+		metrics->latency_sum / 1e9,
+		(unsigned long long) metrics->latency_count);
+
+	fprintf(fp, "# HELP wayland_tracer_decode_seconds_total Time spent "
+		"decoding and printing messages.\n"
+		"# TYPE wayland_tracer_decode_seconds_total counter\n"
+		"wayland_tracer_decode_seconds_total %.9f\n",
+		metrics->decode_time / 1e9);
+
+	fprintf(fp, "# HELP wayland_tracer_records_dropped_total Records "
+		"subscribers were too slow for.\n"
+		"# TYPE wayland_tracer_records_dropped_total counter\n"
+		"wayland_tracer_records_dropped_total %llu\n",
+		(unsigned long long) tracer->dropped_records);
+
+	fprintf(fp, "# HELP wayland_tracer_records_total Records published.\n"
+		"# TYPE wayland_tracer_records_total counter\n"
+		"wayland_tracer_records_total %llu\n",
+		(unsigned long long) tracer->next_seq);
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		fprintf(fp, "# HELP process_cpu_seconds_total User and "
+			"system CPU time.\n"
+			"# TYPE process_cpu_seconds_total counter\n"
+			"process_cpu_seconds_total %.6f\n",
+			usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+			(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) /
+			1e6);
+}
+
+/* Replaces the metrics file atomically, scrapers never see half of it */
+static void
+metrics_write(void *data)
+{
+	struct tracer_metrics *metrics = data;
+	const char *path = metrics->tracer->options->metrics_file;
+	FILE *fp;
+
+	fp = fopen(metrics->tmp_path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s: %m\n", metrics->tmp_path);
+		return;
+	}
+
+	render(metrics, fp);
+
+	if (fclose(fp) != 0 || rename(metrics->tmp_path, path) < 0) {
+		fprintf(stderr, "Failed to write %s: %m\n", path);
+		unlink(metrics->tmp_path);
+	}
+}
+
+static void
+metrics_client_destroy(struct metrics_client *client)
+{
+	tracer_epoll_remove(client->metrics->tracer, &client->source);
+	close(client->source.fd);
+	wl_list_remove(&client->link);
+	client->metrics->client_count--;
+	free(client->text);
+	free(client);
+}
+
+/* Returns 1 once everything is sent, 0 if the socket is full, -1 on error */
+static int
+metrics_client_write(struct metrics_client *client)
+{
+	ssize_t len;
+
+	while (client->offset < client->length) {
+		len = send(client->source.fd, client->text + client->offset,
+			   client->length - client->offset,
+			   MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			return errno == EAGAIN ? 0 : -1;
+		client->offset += len;
+	}
+
+	return 1;
+}
+
+static void
+metrics_client_dispatch(struct tracer_event_source *source, uint32_t mask)
+{
+	struct metrics_client *client =
+		container_of(source, struct metrics_client, source);
+
+	if ((mask & (EPOLLHUP | EPOLLERR)) ||
+	    metrics_client_write(client) != 0)
+		metrics_client_destroy(client);
+}
+
+/*
+ * Every connection gets the current metrics, then the socket is closed.
+ * What doesn't fit in the socket buffer right away is sent as the
+ * scraper reads, so the text is never cut short.
+ */
+static void
+metrics_socket_dispatch(struct tracer_event_source *source, uint32_t mask)
+{
+	struct tracer_metrics *metrics =
+		container_of(source, struct tracer_metrics, source);
+	struct metrics_client *client;
+	FILE *fp;
+	int fd;
+
+	fd = wl_os_accept_cloexec(source->fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	client = calloc(1, sizeof *client);
+	if (client == NULL) {
+		close(fd);
+		return;
+	}
+
+	fp = open_memstream(&client->text, &client->length);
+	if (fp == NULL) {
+		free(client);
+		close(fd);
+		return;
+	}
+	render(metrics, fp);
+	fclose(fp);
+
+	client->source.fd = fd;
+	client->source.dispatch = metrics_client_dispatch;
+	client->metrics = metrics;
+	wl_list_insert(metrics->client_list.prev, &client->link);
+	metrics->client_count++;
+
+	if (metrics_client_write(client) != 0 ||
+	    tracer_epoll_add(metrics->tracer, &client->source, EPOLLOUT) < 0) {
+		metrics_client_destroy(client);
+		return;
+	}
+
+	/* A scraper that stopped reading makes room for the new one */
+	if (metrics->client_count > METRICS_MAX_CLIENTS) {
+		client = container_of(metrics->client_list.next,
+				      struct metrics_client, link);
+		metrics_client_destroy(client);
+	}
+}
+
+struct tracer_metrics *
+tracer_metrics_create(struct tracer *tracer)
+{
+	struct tracer_options *options = tracer->options;
+	struct tracer_metrics *metrics;
+	struct sockaddr_un addr;
+
+	metrics = calloc(1, sizeof *metrics);
+	if (metrics == NULL)
+		return NULL;
+
+	metrics->tracer = tracer;
+	wl_list_init(&metrics->client_list);
+	if (options->output_format == TRACER_OUTPUT_INTERPRET)
+		metrics->analyzer = tracer->frontend_data;
+
+	if (options->metrics_file != NULL) {
+		if (asprintf(&metrics->tmp_path, "%s.tmp",
+			     options->metrics_file) < 0) {
+			free(metrics);
+			return NULL;
+		}
+
+		metrics->timer = tracer_timer_create(tracer,
+						     options->metrics_interval,
+						     metrics_write, metrics);
+		if (metrics->timer == NULL) {
+			fprintf(stderr, "Failed to create timer: %m\n");
+			free(metrics->tmp_path);
+			free(metrics);
+			return NULL;
+		}
+	}
+
+	if (options->metrics_socket != NULL) {
+		metrics->source.fd = tracer_listen_unix(options->metrics_socket,
+							16, &addr);
+		if (metrics->source.fd < 0) {
+			if (metrics->timer != NULL)
+				tracer_timer_destroy(metrics->timer);
+			free(metrics->tmp_path);
+			free(metrics);
+			return NULL;
+		}
+		metrics->source.dispatch = metrics_socket_dispatch;
+		tracer_epoll_add(tracer, &metrics->source, EPOLLIN);
+	}
+
+	return metrics;
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-plugin.h"
+#include "wayland-tracer-plugin.h"
+
+/*
+ * Plugins see messages through ordinary hooks, one per subscribed
+ * message, which translate the tracer_message_view into the stable
+ * tracer_plugin_message.  Both only point into the frontend's buffer.
+ */
+struct plugin {
+	struct tracer_plugin_host host;
+	struct tracer *tracer;
+	struct tracer_analyzer *analyzer;
+	const struct tracer_plugin *desc;
+	void *handle;
+	void *data;
+	struct wl_list hook_list;
+	struct wl_list watch_list;
+	struct wl_list link;
+};
+
+struct plugin_hook {
+	struct tracer_hook hook;
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+	uint32_t opcode;
+	tracer_plugin_message_func_t func;
+	void *data;
+	struct wl_list link;
+};
+
+struct plugin_watch {
+	struct tracer_instance_listener listener;
+	tracer_plugin_instance_func_t func;
+	void *data;
+	struct wl_list link;
+};
+
+static struct tracer_interface *
+find_interface(struct tracer_analyzer *analyzer, const char *name)
+{
+	struct tracer_interface **ptype;
+
+	/* Loads it from the search path if need be */
+	ptype = tracer_analyzer_lookup_type(analyzer, (char *) name);
+
+	return ptype ? *ptype : NULL;
+}
+
+static void
+plugin_hook_func(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct plugin_hook *ph = container_of(hook, struct plugin_hook, hook);
+	struct tracer_plugin_message message;
+
+	message.timestamp = view->timestamp;
+	message.socket = view->instance->socket;
+	message.instance = view->instance->id;
+	message.side = view->side;
+	message.id = view->id;
+	message.opcode = ph->opcode;
+	message.size = view->size;
+	message.interface = ph->interface->name;
+	message.message = ph->message->name;
+	message.signature = ph->message->signature;
+	message.args = view->args;
+	message.fds = view->fds;
+	message.nfds = view->nfds;
+
+	ph->func(ph->data, &message);
+}
+
+static int
+plugin_add_hook(struct plugin *plugin, struct tracer_interface *interface,
+		struct tracer_message *message, int opcode,
+		tracer_plugin_message_func_t func, void *data)
+{
+	struct plugin_hook *ph;
+
+	ph = malloc(sizeof *ph);
+	if (ph == NULL)
+		return -1;
+
+	ph->hook.func = plugin_hook_func;
+	ph->interface = interface;
+	ph->message = message;
+	ph->opcode = opcode;
+	ph->func = func;
+	ph->data = data;
+	tracer_message_add_hook(message, &ph->hook);
+	wl_list_insert(&plugin->hook_list, &ph->link);
+
+	return 0;
+}
+
+static int
+host_subscribe(struct tracer_plugin_host *host, const char *interface_name,
+	       int side, int opcode, tracer_plugin_message_func_t func,
+	       void *data)
+{
+	struct plugin *plugin = container_of(host, struct plugin, host);
+	struct tracer_interface *interface;
+	struct tracer_message **messages;
+	int i, count;
+
+	interface = find_interface(plugin->analyzer, interface_name);
+	if (interface == NULL)
+		return -1;
+
+	if (side == TRACER_PLUGIN_EVENT) {
+		messages = interface->events;
+		count = interface->event_count;
+	} else {
+		messages = interface->methods;
+		count = interface->method_count;
+	}
+
+	if (opcode != TRACER_PLUGIN_ANY_OPCODE)
+		return opcode >= 0 && opcode < count ?
+		       plugin_add_hook(plugin, interface, messages[opcode],
+				       opcode, func, data) : -1;
+
+	for (i = 0; i < count; i++) {
+		if (plugin_add_hook(plugin, interface, messages[i], i,
+				    func, data) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+host_lookup_opcode(struct tracer_plugin_host *host, const char *interface_name,
+		   int side, const char *message_name)
+{
+	struct plugin *plugin = container_of(host, struct plugin, host);
+	struct tracer_interface *interface;
+	struct tracer_message **messages;
+	int i, count;
+
+	interface = find_interface(plugin->analyzer, interface_name);
+	if (interface == NULL)
+		return -1;
+
+	if (side == TRACER_PLUGIN_EVENT) {
+		messages = interface->events;
+		count = interface->event_count;
+	} else {
+		messages = interface->methods;
+		count = interface->method_count;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!strcmp(messages[i]->name, message_name))
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+watch_created(struct tracer_instance_listener *listener,
+	      struct tracer_instance *instance)
+{
+	struct plugin_watch *watch =
+		container_of(listener, struct plugin_watch, listener);
+
+	watch->func(watch->data, instance->socket, instance->id, 1);
+}
+
+static void
+watch_destroyed(struct tracer_instance_listener *listener,
+		struct tracer_instance *instance)
+{
+	struct plugin_watch *watch =
+		container_of(listener, struct plugin_watch, listener);
+
+	watch->func(watch->data, instance->socket, instance->id, 0);
+}
+
+static int
+host_watch_instances(struct tracer_plugin_host *host,
+		     tracer_plugin_instance_func_t func, void *data)
+{
+	struct plugin *plugin = container_of(host, struct plugin, host);
+	struct plugin_watch *watch;
+
+	watch = malloc(sizeof *watch);
+	if (watch == NULL)
+		return -1;
+
+	watch->listener.created = watch_created;
+	watch->listener.destroyed = watch_destroyed;
+	watch->func = func;
+	watch->data = data;
+	tracer_add_instance_listener(plugin->tracer, &watch->listener);
+	wl_list_insert(&plugin->watch_list, &watch->link);
+
+	return 0;
+}
+
+static void
+host_print(struct tracer_plugin_host *host, const char *fmt, ...)
+{
+	struct plugin *plugin = container_of(host, struct plugin, host);
+	va_list ap;
+
+	va_start(ap, fmt);
+	tracer_vprint(plugin->tracer, fmt, ap);
+	va_end(ap);
+	fflush(plugin->tracer->outfp);
+}
+
+int
+tracer_plugin_load(struct tracer *tracer, struct tracer_analyzer *analyzer,
+		   struct plugin_option *option)
+{
+	struct plugin *plugin;
+
+	plugin = calloc(1, sizeof *plugin);
+	if (plugin == NULL) {
+		fprintf(stderr, "Failed to alloc for plugin: %m\n");
+		return -1;
+	}
+
+	plugin->handle = dlopen(option->path, RTLD_NOW | RTLD_LOCAL);
+	if (plugin->handle == NULL) {
+		fprintf(stderr, "Failed to load plugin: %s\n", dlerror());
+		free(plugin);
+		return -1;
+	}
+
+	plugin->desc = dlsym(plugin->handle, TRACER_PLUGIN_SYMBOL);
+	if (plugin->desc == NULL) {
+		fprintf(stderr, "%s is not a wayland-tracer plugin\n",
+			option->path);
+		goto err;
+	}
+
+	if (plugin->desc->abi_version == 0 ||
+	    plugin->desc->abi_version > TRACER_PLUGIN_ABI_VERSION) {
+		fprintf(stderr, "Plugin %s needs plugin ABI version %u, "
+			"this is version %u\n", option->path,
+			plugin->desc->abi_version, TRACER_PLUGIN_ABI_VERSION);
+		goto err;
+	}
+
+	plugin->host.abi_version = TRACER_PLUGIN_ABI_VERSION;
+	plugin->host.subscribe = host_subscribe;
+	plugin->host.lookup_opcode = host_lookup_opcode;
+	plugin->host.watch_instances = host_watch_instances;
+	plugin->host.print = host_print;
+	plugin->tracer = tracer;
+	plugin->analyzer = analyzer;
+	wl_list_init(&plugin->hook_list);
+	wl_list_init(&plugin->watch_list);
+
+	if (plugin->desc->init(&plugin->host, option->args,
+			       &plugin->data) != 0) {
+		fprintf(stderr, "Plugin %s failed to initialize\n",
+			plugin->desc->name ? plugin->desc->name :
+			option->path);
+		/* Whatever it subscribed to goes away with the tracer */
+		return -1;
+	}
+
+	wl_list_insert(tracer->plugin_list.prev, &plugin->link);
+
+	return 0;
+
+err:
+	dlclose(plugin->handle);
+	free(plugin);
+	return -1;
+}
+
+void
+tracer_plugin_unload_all(struct tracer *tracer)
+{
+	struct plugin *plugin, *next;
+	struct plugin_hook *ph, *ph_next;
+	struct plugin_watch *watch, *watch_next;
+
+	wl_list_for_each_safe(plugin, next, &tracer->plugin_list, link) {
+		if (plugin->desc->fini)
+			plugin->desc->fini(plugin->data);
+
+		wl_list_for_each_safe(ph, ph_next, &plugin->hook_list, link) {
+			wl_list_remove(&ph->hook.link);
+			free(ph);
+		}
+		wl_list_for_each_safe(watch, watch_next,
+				      &plugin->watch_list, link) {
+			wl_list_remove(&watch->listener.link);
+			free(watch);
+		}
+
+		wl_list_remove(&plugin->link);
+		dlclose(plugin->handle);
+		free(plugin);
+	}
+}
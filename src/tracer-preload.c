@@ -0,0 +1,480 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Preloaded into a client by wayland-tracer --preload, this captures the
+ * client's wayland traffic from inside the process, so that it doesn't
+ * pay for a trip through the proxy.  sendmsg() and recvmsg() on the
+ * wayland socket copy what went through into an in-memory ring, which a
+ * background thread writes to the file named by WAYLAND_TRACER_CAPTURE
+ * in the format of wayland-tracer-record.h.  Decoding is left to
+ * wayland-tracer --decode.
+ *
+ * Wrapper scripts and helpers inherit the variable too, so the file is
+ * only created once a process connects to the compositor, and then only
+ * if it doesn't exist yet: the first client gets it.  "%p" in the name
+ * stands for the pid, giving every client a capture of its own.
+ *
+ * A full ring makes the client wait for the writer rather than lose
+ * data: a torn stream can't be decoded anyway.
+ */
+
+#define _GNU_SOURCE
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "wayland-util.h"
+#include "wayland-tracer-record.h"
+
+#define CAPTURE_RING_SIZE	(4 * 1024 * 1024)
+#define CAPTURE_MAX_FD		4096
+
+static ssize_t (*real_sendmsg)(int, const struct msghdr *, int);
+static ssize_t (*real_recvmsg)(int, struct msghdr *, int);
+static int (*real_connect)(int, const struct sockaddr *, socklen_t);
+static int (*real_close)(int);
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t more;	/* data for the writer */
+	pthread_cond_t space;	/* room for producers */
+	pthread_t thread;
+	int enabled;
+	int started;
+	int stop;
+	int fd;
+	char template[PATH_MAX];
+	char *ring;
+	uint64_t head, tail;
+	uint64_t seq;
+	uint32_t next_instance;
+	/* Instance id + 1 of wayland sockets, by fd */
+	uint32_t sockets[CAPTURE_MAX_FD];
+} capture = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.more = PTHREAD_COND_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+
+static void
+resolve(void)
+{
+	if (real_sendmsg != NULL)
+		return;
+
+	real_recvmsg = dlsym(RTLD_NEXT, "recvmsg");
+	real_connect = dlsym(RTLD_NEXT, "connect");
+	real_close = dlsym(RTLD_NEXT, "close");
+	__atomic_store_n(&real_sendmsg, dlsym(RTLD_NEXT, "sendmsg"),
+			 __ATOMIC_RELEASE);
+}
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t
+socket_instance(int fd)
+{
+	if (fd < 0 || fd >= CAPTURE_MAX_FD)
+		return 0;
+
+	return __atomic_load_n(&capture.sockets[fd], __ATOMIC_RELAXED);
+}
+
+static void
+mark_socket(int fd)
+{
+	if (fd < 0 || fd >= CAPTURE_MAX_FD)
+		return;
+
+	pthread_mutex_lock(&capture.mutex);
+	__atomic_store_n(&capture.sockets[fd], ++capture.next_instance,
+			 __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&capture.mutex);
+}
+
+/* The path libwayland-client connects to, see wl_display_connect() */
+static int
+is_display_address(const struct sockaddr *addr, socklen_t len)
+{
+	const struct sockaddr_un *sun = (const struct sockaddr_un *) addr;
+	const char *display, *runtime_dir;
+	char path[sizeof sun->sun_path + 1];
+	size_t n;
+
+	if (addr == NULL || addr->sa_family != AF_UNIX ||
+	    len <= offsetof(struct sockaddr_un, sun_path))
+		return 0;
+
+	display = getenv("WAYLAND_DISPLAY");
+	if (display == NULL)
+		display = "wayland-0";
+
+	if (display[0] == '/') {
+		n = snprintf(path, sizeof path, "%s", display);
+	} else {
+		runtime_dir = getenv("XDG_RUNTIME_DIR");
+		if (runtime_dir == NULL)
+			return 0;
+		n = snprintf(path, sizeof path, "%s/%s", runtime_dir, display);
+	}
+
+	return n < sizeof sun->sun_path &&
+	       strncmp(sun->sun_path, path, sizeof sun->sun_path) == 0;
+}
+
+static int
+open_capture(void)
+{
+	struct tracer_capture_header header;
+	char path[PATH_MAX], pid[16];
+	const char *p;
+	size_t n = 0, len;
+	int flags;
+
+	snprintf(pid, sizeof pid, "%d", getpid());
+	for (p = capture.template; *p != '\0' && n < sizeof path - 1; p++) {
+		if (p[0] == '%' && p[1] == 'p') {
+			len = strlen(pid);
+			if (n + len >= sizeof path)
+				break;
+			memcpy(path + n, pid, len);
+			n += len;
+			p++;
+		} else {
+			path[n++] = *p;
+		}
+	}
+	path[n] = '\0';
+
+	flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+	if (strstr(capture.template, "%p") != NULL)
+		flags |= O_TRUNC;
+	else
+		flags |= O_EXCL;
+
+	capture.fd = open(path, flags, 0644);
+	if (capture.fd < 0 && errno == EEXIST)
+		return -1;
+	if (capture.fd < 0) {
+		fprintf(stderr, "wayland-tracer: failed to open capture %s: "
+			"%m\n", path);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof header);
+	header.magic = TRACER_CAPTURE_MAGIC;
+	header.version = TRACER_CAPTURE_VERSION;
+	header.pid = getpid();
+	header.start = now();
+	if (write(capture.fd, &header, sizeof header) != sizeof header) {
+		real_close(capture.fd);
+		capture.fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *
+writer_thread(void *data)
+{
+	uint64_t offset, count;
+	ssize_t len;
+
+	pthread_mutex_lock(&capture.mutex);
+	for (;;) {
+		while (capture.head == capture.tail && !capture.stop)
+			pthread_cond_wait(&capture.more, &capture.mutex);
+		if (capture.head == capture.tail)
+			break;
+
+		offset = capture.tail & (CAPTURE_RING_SIZE - 1);
+		count = capture.head - capture.tail;
+		if (count > CAPTURE_RING_SIZE - offset)
+			count = CAPTURE_RING_SIZE - offset;
+		pthread_mutex_unlock(&capture.mutex);
+
+		do {
+			len = write(capture.fd, capture.ring + offset, count);
+		} while (len < 0 && errno == EINTR);
+
+		pthread_mutex_lock(&capture.mutex);
+		if (len <= 0) {
+			fprintf(stderr, "wayland-tracer: failed to write "
+				"capture, stopping it: %m\n");
+			capture.enabled = 0;
+			capture.tail = capture.head;
+		} else {
+			capture.tail += len;
+		}
+		pthread_cond_broadcast(&capture.space);
+	}
+	pthread_mutex_unlock(&capture.mutex);
+
+	return NULL;
+}
+
+/* With the mutex held */
+static int
+start_writer(void)
+{
+	capture.ring = malloc(CAPTURE_RING_SIZE);
+	if (capture.ring == NULL || open_capture() < 0)
+		goto err;
+
+	if (pthread_create(&capture.thread, NULL, writer_thread, NULL) != 0) {
+		real_close(capture.fd);
+		capture.fd = -1;
+		goto err;
+	}
+
+	capture.started = 1;
+	return 0;
+
+err:
+	free(capture.ring);
+	capture.ring = NULL;
+	capture.enabled = 0;
+	return -1;
+}
+
+static void
+ring_put(const void *data, size_t size)
+{
+	uint64_t offset = capture.head & (CAPTURE_RING_SIZE - 1);
+	size_t first = CAPTURE_RING_SIZE - offset;
+
+	if (first > size)
+		first = size;
+	memcpy(capture.ring + offset, data, first);
+	memcpy(capture.ring, (const char *) data + first, size - first);
+	capture.head += size;
+}
+
+static void
+capture_message(int fd, int side, const struct msghdr *msg, size_t length)
+{
+	static const char padding[TRACER_RECORD_ALIGN];
+	struct tracer_record record;
+	struct cmsghdr *cmsg;
+	size_t i, left, n;
+	uint32_t nfds = 0;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR((struct msghdr *) msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			nfds += (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	}
+
+	memset(&record, 0, sizeof record);
+	record.type = TRACER_RECORD_MESSAGE;
+	record.side = side;
+	record.instance = socket_instance(fd) - 1;
+	record.length = length;
+	record.size = tracer_record_size(length);
+	record.nfds = nfds;
+	record.timestamp = now();
+
+	if (record.size > CAPTURE_RING_SIZE)
+		return;
+
+	pthread_mutex_lock(&capture.mutex);
+	if (capture.enabled && !capture.started)
+		start_writer();
+
+	while (capture.enabled &&
+	       CAPTURE_RING_SIZE - (capture.head - capture.tail) < record.size)
+		pthread_cond_wait(&capture.space, &capture.mutex);
+
+	if (!capture.enabled) {
+		pthread_mutex_unlock(&capture.mutex);
+		return;
+	}
+
+	record.seq = capture.seq++;
+	ring_put(&record, sizeof record);
+	for (i = 0, left = length; left > 0; i++) {
+		n = msg->msg_iov[i].iov_len < left ?
+		    msg->msg_iov[i].iov_len : left;
+		ring_put(msg->msg_iov[i].iov_base, n);
+		left -= n;
+	}
+	ring_put(padding, record.size - sizeof record - length);
+
+	pthread_cond_signal(&capture.more);
+	pthread_mutex_unlock(&capture.mutex);
+}
+
+WL_EXPORT ssize_t
+sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	ssize_t ret;
+
+	resolve();
+	ret = real_sendmsg(fd, msg, flags);
+	if (ret > 0 && socket_instance(fd) != 0)
+		capture_message(fd, TRACER_RECORD_FROM_CLIENT, msg, ret);
+
+	return ret;
+}
+
+WL_EXPORT ssize_t
+recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	ssize_t ret;
+
+	resolve();
+	ret = real_recvmsg(fd, msg, flags);
+	if (ret > 0 && socket_instance(fd) != 0 && !(flags & MSG_PEEK))
+		capture_message(fd, TRACER_RECORD_FROM_SERVER, msg, ret);
+
+	return ret;
+}
+
+WL_EXPORT int
+connect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+	int ret;
+
+	resolve();
+	ret = real_connect(fd, addr, len);
+	if ((ret == 0 || errno == EINPROGRESS) && capture.enabled &&
+	    is_display_address(addr, len))
+		mark_socket(fd);
+
+	return ret;
+}
+
+WL_EXPORT int
+close(int fd)
+{
+	resolve();
+	if (socket_instance(fd) != 0)
+		__atomic_store_n(&capture.sockets[fd], 0, __ATOMIC_RELAXED);
+
+	return real_close(fd);
+}
+
+static void
+capture_prepare_fork(void)
+{
+	pthread_mutex_lock(&capture.mutex);
+}
+
+static void
+capture_parent_fork(void)
+{
+	pthread_mutex_unlock(&capture.mutex);
+}
+
+/* The writer doesn't survive fork, and what's in the ring is the parent's */
+static void
+capture_child_fork(void)
+{
+	pthread_mutex_init(&capture.mutex, NULL);
+	pthread_cond_init(&capture.more, NULL);
+	pthread_cond_init(&capture.space, NULL);
+
+	if (capture.started) {
+		free(capture.ring);
+		capture.ring = NULL;
+		if (capture.fd >= 0)
+			real_close(capture.fd);
+		capture.fd = -1;
+	}
+
+	capture.started = 0;
+	capture.stop = 0;
+	capture.head = capture.tail = 0;
+	capture.seq = 0;
+	capture.next_instance = 0;
+	memset(capture.sockets, 0, sizeof capture.sockets);
+	capture.enabled = capture.template[0] != '\0';
+}
+
+static void __attribute__((constructor))
+capture_init(void)
+{
+	const char *path, *socket;
+	int fd;
+
+	resolve();
+
+	path = getenv("WAYLAND_TRACER_CAPTURE");
+	if (path == NULL || strlen(path) >= sizeof capture.template)
+		return;
+
+	strcpy(capture.template, path);
+	capture.enabled = 1;
+
+	socket = getenv("WAYLAND_SOCKET");
+	if (socket != NULL) {
+		fd = atoi(socket);
+		mark_socket(fd);
+	}
+
+	pthread_atfork(capture_prepare_fork, capture_parent_fork,
+		       capture_child_fork);
+}
+
+static void __attribute__((destructor))
+capture_fini(void)
+{
+	pthread_mutex_lock(&capture.mutex);
+	if (!capture.started) {
+		pthread_mutex_unlock(&capture.mutex);
+		return;
+	}
+	capture.stop = 1;
+	pthread_cond_signal(&capture.more);
+	pthread_mutex_unlock(&capture.mutex);
+
+	pthread_join(capture.thread, NULL);
+	real_close(capture.fd);
+	free(capture.ring);
+	capture.started = 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_PROBES_H
+#define TRACER_PROBES_H
+
+/*
+ * USDT probes in the wayland_tracer provider, for watching the tracer
+ * itself with perf or bpftrace.  They are built in when sys/sdt.h is
+ * found at configure time and cost a nop each until someone attaches.
+ *
+ * All probes take the same arguments: instance id, side the data comes
+ * from (TRACER_*_SIDE, -1 if none), size in bytes and opcode (-1 if
+ * none).
+ *
+ *	read_start, read_done		reading from a connection, size is
+ *					what was read
+ *	message				a complete message found in what
+ *					was read, in either output mode
+ *	decode_start, decode_done	decoding one message
+ *	output_flush_start,
+ *	output_flush_done		flushing the decoded output of a batch
+ *	flush_start, flush_done		sending queued data to the peer,
+ *					size is what's still waiting
+ *	instance_create,
+ *	instance_destroy		a client came or went
+ *
+ * e.g. bpftrace -e 'usdt:./wayland-tracer:decode_start
+ *	{ @[arg3] = count(); }'
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define TRACER_PROBE(name, instance, side, size, opcode) \
+	DTRACE_PROBE4(wayland_tracer, name, instance, side, size, opcode)
+#else
+#define TRACER_PROBE(name, instance, side, size, opcode) ((void) 0)
+#endif
+
+#endif
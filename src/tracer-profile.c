@@ -0,0 +1,161 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-profile.h"
+
+static const char *stage_names[TRACER_STAGE_COUNT] = {
+	[TRACER_STAGE_IDLE] = "idle",
+	[TRACER_STAGE_OTHER] = "other",
+	[TRACER_STAGE_READ] = "read",
+	[TRACER_STAGE_FRAME] = "framing",
+	[TRACER_STAGE_LOOKUP] = "lookup",
+	[TRACER_STAGE_DECODE] = "decode",
+	[TRACER_STAGE_FORMAT] = "format",
+	[TRACER_STAGE_WRITE] = "write",
+	[TRACER_STAGE_FLUSH] = "flush",
+};
+
+struct profile_interface {
+	const char *name;
+	uint64_t count;
+	uint64_t ticks;
+};
+
+struct tracer_profile *
+tracer_profile_create(void)
+{
+	struct tracer_profile *profile;
+
+	profile = calloc(1, sizeof *profile);
+	if (profile == NULL)
+		return NULL;
+
+	profile->stage = TRACER_STAGE_OTHER;
+	profile->start_time = tracer_now();
+	profile->start_ticks = tracer_profile_ticks();
+	profile->since = profile->start_ticks;
+
+	return profile;
+}
+
+void
+tracer_profile_destroy(struct tracer_profile *profile)
+{
+	free(profile);
+}
+
+static int
+compare_interfaces(const void *a, const void *b)
+{
+	const struct profile_interface *ia = a, *ib = b;
+
+	if (ia->ticks != ib->ticks)
+		return ia->ticks < ib->ticks ? 1 : -1;
+
+	return strcmp(ia->name, ib->name);
+}
+
+static void
+report_interfaces(struct tracer_analyzer *analyzer, double ns_per_tick,
+		  FILE *fp)
+{
+	struct profile_interface *interfaces;
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+	int i, j, count = 0;
+
+	interfaces = calloc(analyzer->interface_count, sizeof *interfaces);
+	if (interfaces == NULL)
+		return;
+
+	for (i = 0; i < analyzer->interface_count; i++) {
+		interface = analyzer->interfaces[i];
+		interfaces[count].name = interface->name;
+		for (j = 0; j < interface->method_count + interface->event_count;
+		     j++) {
+			message = j < interface->method_count ?
+				  interface->methods[j] :
+				  interface->events[j - interface->method_count];
+			interfaces[count].count += message->count;
+			interfaces[count].ticks += message->ticks;
+		}
+		if (interfaces[count].count > 0)
+			count++;
+	}
+
+	qsort(interfaces, count, sizeof *interfaces, compare_interfaces);
+
+	fprintf(fp, "\n%-32s %10s %10s %8s\n",
+		"interface", "messages", "ms", "ns/msg");
+	for (i = 0; i < count; i++)
+		fprintf(fp, "%-32s %10llu %10.3f %8.0f\n",
+			interfaces[i].name,
+			(unsigned long long) interfaces[i].count,
+			interfaces[i].ticks * ns_per_tick / 1e6,
+			interfaces[i].ticks * ns_per_tick /
+			interfaces[i].count);
+
+	free(interfaces);
+}
+
+void
+tracer_profile_report(struct tracer *tracer, FILE *fp)
+{
+	struct tracer_profile *profile = tracer->profile;
+	uint64_t elapsed, busy = 0;
+	double ns_per_tick;
+	int i;
+
+	/* Close the running stage */
+	tracer_profile_switch(profile, profile->stage);
+
+	elapsed = tracer_now() - profile->start_time;
+	ns_per_tick = profile->since > profile->start_ticks ?
+		      (double) elapsed / (profile->since - profile->start_ticks) :
+		      0.0;
+
+	for (i = TRACER_STAGE_OTHER; i < TRACER_STAGE_COUNT; i++)
+		busy += profile->ticks[i];
+
+	fprintf(fp, "\nwayland-tracer profile: %.3f s, %.3f ms busy\n\n",
+		elapsed / 1e9, busy * ns_per_tick / 1e6);
+	fprintf(fp, "%-10s %10s %10s %7s\n", "stage", "calls", "ms", "share");
+	for (i = TRACER_STAGE_READ; i < TRACER_STAGE_COUNT; i++)
+		fprintf(fp, "%-10s %10llu %10.3f %6.1f%%\n", stage_names[i],
+			(unsigned long long) profile->calls[i],
+			profile->ticks[i] * ns_per_tick / 1e6,
+			busy ? 100.0 * profile->ticks[i] / busy : 0.0);
+	fprintf(fp, "%-10s %10s %10.3f %6.1f%%\n",
+		stage_names[TRACER_STAGE_OTHER], "",
+		profile->ticks[TRACER_STAGE_OTHER] * ns_per_tick / 1e6,
+		busy ? 100.0 * profile->ticks[TRACER_STAGE_OTHER] / busy : 0.0);
+
+	if (tracer->frontend_data != NULL)
+		report_interfaces(tracer->frontend_data, ns_per_tick, fp);
+}
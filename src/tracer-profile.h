@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_PROFILE_H
+#define TRACER_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "tracer.h"
+
+/*
+ * --profile charges the tracer's own time to the stage of the pipeline
+ * it is in.  Stages nest (formatting happens while decoding), time is
+ * always charged to the innermost one:
+ *
+ *	prev = tracer_profile_enter(tracer, TRACER_STAGE_DECODE);
+ *	...
+ *	tracer_profile_leave(tracer, prev);
+ *
+ * Both are a pointer test when profiling is off.
+ */
+enum tracer_stage {
+	TRACER_STAGE_IDLE,	/* waiting in epoll, not reported */
+	TRACER_STAGE_OTHER,	/* anything not below */
+	TRACER_STAGE_READ,
+	TRACER_STAGE_FRAME,
+	TRACER_STAGE_LOOKUP,
+	TRACER_STAGE_DECODE,
+	TRACER_STAGE_FORMAT,
+	TRACER_STAGE_WRITE,
+	TRACER_STAGE_FLUSH,
+	TRACER_STAGE_COUNT
+};
+
+struct tracer_profile {
+	int stage;
+	uint64_t since;
+	uint64_t ticks[TRACER_STAGE_COUNT];
+	uint64_t calls[TRACER_STAGE_COUNT];
+	/* To convert ticks to time once we're done */
+	uint64_t start_ticks;
+	uint64_t start_time;
+};
+
+/* A cycle counter where there's a cheap one, the monotonic clock if not */
+static inline uint64_t
+tracer_profile_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (ticks));
+	return ticks;
+#else
+	return tracer_now();
+#endif
+}
+
+static inline void
+tracer_profile_switch(struct tracer_profile *profile, int stage)
+{
+	uint64_t now = tracer_profile_ticks();
+
+	profile->ticks[profile->stage] += now - profile->since;
+	profile->since = now;
+	profile->stage = stage;
+}
+
+static inline int
+tracer_profile_enter(struct tracer *tracer, int stage)
+{
+	struct tracer_profile *profile = tracer->profile;
+	int prev;
+
+	if (profile == NULL)
+		return 0;
+
+	prev = profile->stage;
+	tracer_profile_switch(profile, stage);
+	profile->calls[stage]++;
+
+	return prev;
+}
+
+static inline void
+tracer_profile_leave(struct tracer *tracer, int prev)
+{
+	if (tracer->profile != NULL)
+		tracer_profile_switch(tracer->profile, prev);
+}
+
+struct tracer_profile *tracer_profile_create(void);
+void tracer_profile_destroy(struct tracer_profile *profile);
+void tracer_profile_report(struct tracer *tracer, FILE *fp);
+
+#endif
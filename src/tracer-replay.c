@@ -0,0 +1,1375 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "wayland-private.h"
+#include "wayland-util.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-arena.h"
+#include "tracer-capture.h"
+#include "tracer-replay.h"
+
+/*
+ * Replaying a capture: every client found in it connects to the
+ * compositor again and resends what it sent back then.
+ *
+ * Capture and compositor won't agree on much but the protocol, so
+ * everything the compositor hands out is paired up with what it handed
+ * out in the capture: events are matched to the recorded ones in order
+ * per message, which maps the ids of objects created by events and the
+ * serials events carry, and globals are matched by interface.  Ids of
+ * objects the client creates are allocated afresh.  fds are replaced by
+ * new memfds of the size the request mentions, if any.
+ *
+ * The client waits where it waited back then: a request that was sent
+ * after n wl_callback.done events is held back until n have arrived,
+ * which covers both round trips and frame callbacks.  Recorded pacing
+ * additionally waits until the request is as far into the replay as it
+ * was into the capture.
+ *
+ * Latency of a request type is the time from such a request to the
+ * event that answered it, taken to be the first one the compositor sent
+ * after it in the capture.
+ */
+
+#define DIV_ROUNDUP(n, a) ( ((n) + ((a) - 1)) / (a) )
+
+/* How long to wait for an event the capture had before giving up, ns */
+#define REPLAY_TIMEOUT		(1000 * 1000000ULL)
+#define REPLAY_FD_SIZE		4096
+#define REPLAY_MAX_ARGS		20
+
+/* Objects without an interface, e.g. destroyed ones, are NULL */
+struct replay_ids {
+	struct wl_array client;
+	struct wl_array server;
+};
+
+struct replay_request {
+	uint64_t timestamp;
+	uint32_t offset;	/* into replay_client.request_data */
+	uint32_t size;
+	uint32_t syncs;		/* wl_callback.done seen before it */
+	int answered;
+	uint64_t sent;
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+};
+
+/* An event from the capture, to be paired with a live one */
+struct replay_event {
+	uint32_t new_id;
+	uint32_t serial;
+	int cause;		/* index of the request before it, or -1 */
+};
+
+struct replay_track {
+	struct tracer_message *message;
+	struct wl_array events;
+	size_t next;
+};
+
+struct replay_global {
+	uint32_t name;
+	uint32_t version;
+	const char *interface;
+};
+
+struct replay_serial {
+	uint32_t recorded;
+	uint32_t live;
+};
+
+struct replay_pool {
+	uint32_t id;
+	int fd;
+};
+
+struct replay_stat {
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+	uint64_t sent;
+	struct wl_array latencies;
+};
+
+enum replay_state {
+	REPLAY_WAITING,		/* not connected yet */
+	REPLAY_RUNNING,
+	REPLAY_FINISHING,	/* waiting for the last round trip */
+	REPLAY_DONE
+};
+
+struct replay;
+
+struct replay_client {
+	struct replay *replay;
+	uint32_t socket, instance;
+	uint64_t first;
+
+	/* From the capture */
+	struct wl_array partial[2];
+	struct wl_array request_data;
+	struct wl_array requests;
+	struct wl_array tracks;
+	struct wl_array recorded_globals;
+	struct replay_ids recorded;
+	uint32_t recorded_dones;
+
+	/* Against the compositor */
+	enum replay_state state;
+	struct wl_connection *connection;
+	struct replay_ids live;
+	struct replay_ids ids;
+	struct wl_array free_ids;
+	uint32_t next_id;
+	struct wl_array globals;
+	struct wl_array serials;
+	struct wl_array pools;
+	uint32_t dones;
+	uint32_t last_callback;
+	size_t next;
+	uint64_t wait_since;
+	int want_out;
+	struct wl_list link;
+};
+
+struct replay {
+	struct tracer *tracer;
+	struct tracer_analyzer *analyzer;
+	struct tracer_arena arena;
+	struct wl_list client_list;
+	struct wl_array stats;
+	int fast;
+	uint64_t capture_start;
+	uint64_t start;
+
+	/* Messages the replay has to understand */
+	struct tracer_message *display_error;
+	struct tracer_message *display_delete_id;
+	struct tracer_message *registry_global;
+	struct tracer_message *registry_bind;
+	struct tracer_message *callback_done;
+	struct tracer_message *shm_create_pool;
+	struct tracer_message *shm_pool_resize;
+
+	uint64_t requests, skipped, syncs, timeouts;
+	int failed;
+};
+
+static struct wl_array *
+ids_array(struct replay_ids *ids, uint32_t *id)
+{
+	if (*id < WL_SERVER_ID_START)
+		return &ids->client;
+
+	*id -= WL_SERVER_ID_START;
+	return &ids->server;
+}
+
+static void *
+ids_get(struct replay_ids *ids, uint32_t id)
+{
+	struct wl_array *array = ids_array(ids, &id);
+
+	if (id >= array->size / sizeof(void *))
+		return NULL;
+
+	return ((void **) array->data)[id];
+}
+
+static int
+ids_set(struct replay_ids *ids, uint32_t id, void *value)
+{
+	struct wl_array *array = ids_array(ids, &id);
+	size_t count = array->size / sizeof(void *);
+	void *p;
+
+	if (id >= count) {
+		p = wl_array_add(array, (id + 1 - count) * sizeof(void *));
+		if (p == NULL)
+			return -1;
+		memset(p, 0, (id + 1 - count) * sizeof(void *));
+	}
+
+	((void **) array->data)[id] = value;
+
+	return 0;
+}
+
+static void
+ids_release(struct replay_ids *ids)
+{
+	wl_array_release(&ids->client);
+	wl_array_release(&ids->server);
+}
+
+static uint32_t
+live_id(struct replay_client *client, uint32_t recorded)
+{
+	return (uint32_t) (uintptr_t) ids_get(&client->ids, recorded);
+}
+
+static struct replay_track *
+find_track(struct replay_client *client, struct tracer_message *message)
+{
+	struct replay_track *track;
+
+	wl_array_for_each(track, &client->tracks) {
+		if (track->message == message)
+			return track;
+	}
+
+	track = wl_array_add(&client->tracks, sizeof *track);
+	if (track == NULL)
+		return NULL;
+
+	track->message = message;
+	wl_array_init(&track->events);
+	track->next = 0;
+
+	return track;
+}
+
+static struct replay_stat *
+find_stat(struct replay *replay, struct tracer_interface *interface,
+	  struct tracer_message *message)
+{
+	struct replay_stat *stat;
+
+	wl_array_for_each(stat, &replay->stats) {
+		if (stat->message == message)
+			return stat;
+	}
+
+	stat = wl_array_add(&replay->stats, sizeof *stat);
+	if (stat == NULL)
+		return NULL;
+
+	stat->interface = interface;
+	stat->message = message;
+	stat->sent = 0;
+	wl_array_init(&stat->latencies);
+
+	return stat;
+}
+
+static struct replay_client *
+find_client(struct replay *replay, const struct tracer_record *record)
+{
+	struct replay_client *client;
+
+	wl_list_for_each(client, &replay->client_list, link) {
+		if (client->socket == record->socket &&
+		    client->instance == record->instance)
+			return client;
+	}
+
+	client = tracer_arena_alloc(&replay->arena, sizeof *client);
+	if (client == NULL)
+		return NULL;
+
+	client->replay = replay;
+	client->socket = record->socket;
+	client->instance = record->instance;
+	client->first = record->timestamp;
+	client->state = REPLAY_WAITING;
+	client->next_id = 2;
+	ids_set(&client->recorded, 1, replay->analyzer->display_interface);
+	wl_list_insert(replay->client_list.prev, &client->link);
+
+	return client;
+}
+
+static struct tracer_interface *
+lookup_interface(struct replay *replay, const char *name)
+{
+	struct tracer_interface **type;
+
+	if (name == NULL)
+		return NULL;
+
+	type = tracer_analyzer_lookup_type(replay->analyzer, name);
+
+	return type != NULL ? *type : NULL;
+}
+
+static struct tracer_message *
+lookup_message(struct replay_ids *objects, const uint32_t *p, int event,
+	       struct tracer_interface **interface)
+{
+	uint32_t opcode = p[1] & 0xffff;
+
+	*interface = ids_get(objects, p[0]);
+	if (*interface == NULL)
+		return NULL;
+
+	if (event)
+		return opcode < (uint32_t) (*interface)->event_count ?
+		       (*interface)->events[opcode] : NULL;
+
+	return opcode < (uint32_t) (*interface)->method_count ?
+	       (*interface)->methods[opcode] : NULL;
+}
+
+/*
+ * Walks the arguments of a message, filling in where each starts.
+ * Returns -1 if the message is shorter than its signature.
+ */
+static int
+parse_args(struct tracer_message *message, const uint32_t *p,
+	   const uint32_t *end, const uint32_t **args)
+{
+	const char *signature;
+	uint32_t length;
+	int i;
+
+	p += 2;
+	for (i = 0, signature = message->signature; *signature;
+	     signature++, i++) {
+		if (i == REPLAY_MAX_ARGS)
+			return -1;
+		args[i] = p;
+
+		switch (*signature) {
+		case 'h':
+			break;
+		case 's':
+		case 'a':
+			if (p >= end)
+				return -1;
+			length = *p++;
+			p += DIV_ROUNDUP(length, sizeof *p);
+			break;
+		case 'N':
+			/* interface name, version, id */
+			if (p >= end)
+				return -1;
+			length = *p++;
+			p += DIV_ROUNDUP(length, sizeof *p) + 2;
+			break;
+		default:
+			p++;
+			break;
+		}
+
+		if (p > end)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+is_arg(struct tracer_message *message, int i, const char *name)
+{
+	const char *arg = tracer_message_arg_name(message, i);
+
+	return arg != NULL && strcmp(arg, name) == 0;
+}
+
+static const char *
+string_arg(const uint32_t *p)
+{
+	return p[0] != 0 ? (const char *) (p + 1) : "";
+}
+
+/* Returns the id a 'N' argument creates, and its interface name */
+static uint32_t
+untyped_new_id(const uint32_t *p, const char **name)
+{
+	*name = string_arg(p);
+
+	return p[1 + DIV_ROUNDUP(p[0], sizeof *p) + 1];
+}
+
+static int
+load_request(struct replay_client *client, const uint32_t *p, uint32_t size,
+	     uint64_t timestamp)
+{
+	struct replay *replay = client->replay;
+	struct replay_request *request;
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+	const uint32_t *args[REPLAY_MAX_ARGS];
+	const char *signature, *name;
+	uint32_t id;
+	void *data;
+	int i;
+
+	message = lookup_message(&client->recorded, p, 0, &interface);
+	if (message == NULL ||
+	    parse_args(message, p, p + size / sizeof *p, args) < 0) {
+		replay->skipped++;
+		return 0;
+	}
+
+	for (i = 0, signature = message->signature; *signature;
+	     signature++, i++) {
+		if (*signature == 'n') {
+			name = tracer_message_arg_interface(message, i);
+			ids_set(&client->recorded, *args[i],
+				lookup_interface(replay, name));
+		} else if (*signature == 'N') {
+			id = untyped_new_id(args[i], &name);
+			ids_set(&client->recorded, id,
+				lookup_interface(replay, name));
+		}
+	}
+
+	data = wl_array_add(&client->request_data, size);
+	request = wl_array_add(&client->requests, sizeof *request);
+	if (data == NULL || request == NULL)
+		return -1;
+
+	memcpy(data, p, size);
+	memset(request, 0, sizeof *request);
+	request->timestamp = timestamp;
+	request->offset = client->request_data.size - size;
+	request->size = size;
+	request->syncs = client->recorded_dones;
+	request->interface = interface;
+	request->message = message;
+
+	return 0;
+}
+
+static int
+load_event(struct replay_client *client, const uint32_t *p, uint32_t size)
+{
+	struct replay *replay = client->replay;
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+	struct replay_track *track;
+	struct replay_event *event;
+	struct replay_global *global;
+	const uint32_t *args[REPLAY_MAX_ARGS];
+	const char *signature, *name;
+	int i;
+
+	message = lookup_message(&client->recorded, p, 1, &interface);
+	if (message == NULL ||
+	    parse_args(message, p, p + size / sizeof *p, args) < 0)
+		return 0;
+
+	track = find_track(client, message);
+	event = track ? wl_array_add(&track->events, sizeof *event) : NULL;
+	if (event == NULL)
+		return -1;
+
+	event->new_id = 0;
+	event->serial = 0;
+	event->cause = (int) (client->requests.size /
+			      sizeof(struct replay_request)) - 1;
+
+	for (i = 0, signature = message->signature; *signature;
+	     signature++, i++) {
+		if (*signature == 'n') {
+			event->new_id = *args[i];
+			name = tracer_message_arg_interface(message, i);
+			ids_set(&client->recorded, event->new_id,
+				lookup_interface(replay, name));
+		} else if (*signature == 'u' && is_arg(message, i, "serial")) {
+			event->serial = *args[i];
+		}
+	}
+
+	if (message == replay->display_delete_id) {
+		ids_set(&client->recorded, *args[0], NULL);
+	} else if (message == replay->callback_done) {
+		client->recorded_dones++;
+	} else if (message == replay->registry_global) {
+		global = wl_array_add(&client->recorded_globals,
+				      sizeof *global);
+		if (global == NULL)
+			return -1;
+		global->name = *args[0];
+		global->interface = tracer_arena_strdup(&replay->arena,
+							string_arg(args[1]));
+		global->version = *args[2];
+	}
+
+	return 0;
+}
+
+static int
+load_record(const struct tracer_record *record, const void *payload,
+	    void *data)
+{
+	struct replay *replay = data;
+	struct replay_client *client;
+	struct wl_array *partial;
+	const uint32_t *p;
+	uint32_t size, offset;
+	int side, ret = 0;
+	void *dst;
+
+	if (record->type != TRACER_RECORD_MESSAGE)
+		return 0;
+
+	if (wl_list_empty(&replay->client_list))
+		replay->capture_start = record->timestamp;
+
+	client = find_client(replay, record);
+	if (client == NULL)
+		return -1;
+
+	/* Raw captures may split messages or carry several at once */
+	side = record->side == TRACER_RECORD_FROM_CLIENT;
+	partial = &client->partial[side];
+	dst = wl_array_add(partial, record->length);
+	if (dst == NULL)
+		return -1;
+	memcpy(dst, payload, record->length);
+
+	for (offset = 0; partial->size - offset >= 8 && ret == 0;
+	     offset += size) {
+		p = (const uint32_t *) ((char *) partial->data + offset);
+		size = p[1] >> 16;
+		if (size < 8 || size % 4 != 0) {
+			fprintf(stderr, "Broken message in capture\n");
+			return -1;
+		}
+		if (size > partial->size - offset)
+			break;
+
+		if (side)
+			ret = load_request(client, p, size, record->timestamp);
+		else
+			ret = load_event(client, p, size);
+	}
+
+	memmove(partial->data, (char *) partial->data + offset,
+		partial->size - offset);
+	partial->size -= offset;
+
+	return ret;
+}
+
+static int
+create_buffer_fd(off_t size)
+{
+	int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("wayland-tracer-replay", MFD_CLOEXEC);
+#else
+	char template[] = "/tmp/wayland-tracer-replay-XXXXXX";
+
+	fd = mkostemp(template, O_CLOEXEC);
+	if (fd >= 0)
+		unlink(template);
+#endif
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static uint32_t
+alloc_id(struct replay_client *client)
+{
+	uint32_t *id;
+
+	if (client->free_ids.size > 0) {
+		client->free_ids.size -= sizeof *id;
+		id = (uint32_t *) ((char *) client->free_ids.data +
+				   client->free_ids.size);
+		return *id;
+	}
+
+	return client->next_id++;
+}
+
+static const struct replay_global *
+live_global(struct replay_client *client, uint32_t name)
+{
+	const struct replay_global *recorded = NULL, *global;
+	int n = 0;
+
+	wl_array_for_each(global, &client->recorded_globals) {
+		if (global->name == name) {
+			recorded = global;
+			break;
+		}
+	}
+	if (recorded == NULL)
+		return NULL;
+
+	/* The n-th recorded global of an interface is the n-th live one */
+	wl_array_for_each(global, &client->recorded_globals) {
+		if (global == recorded)
+			break;
+		if (strcmp(global->interface, recorded->interface) == 0)
+			n++;
+	}
+
+	wl_array_for_each(global, &client->globals) {
+		if (strcmp(global->interface, recorded->interface) == 0 &&
+		    n-- == 0)
+			return global;
+	}
+
+	return NULL;
+}
+
+static uint32_t
+live_serial(struct replay_client *client, uint32_t recorded)
+{
+	struct replay_serial *serial;
+
+	/* Recent serials are the likely ones */
+	for (serial = (struct replay_serial *)
+		      ((char *) client->serials.data + client->serials.size);
+	     (void *) serial > client->serials.data;) {
+		serial--;
+		if (serial->recorded == recorded)
+			return serial->live;
+	}
+
+	return recorded;
+}
+
+static struct replay_pool *
+find_pool(struct replay_client *client, uint32_t id)
+{
+	struct replay_pool *pool;
+
+	wl_array_for_each(pool, &client->pools) {
+		if (pool->id == id)
+			return pool;
+	}
+
+	return NULL;
+}
+
+/* Whether the connection can take size bytes and some fds without waiting */
+static int
+has_room(struct replay_client *client, uint32_t size, int nfds)
+{
+	struct wl_connection *connection = client->connection;
+
+	if (wl_buffer_size(&connection->out) + size <= WL_BUFFER_MAX &&
+	    (nfds == 0 || wl_buffer_size(&connection->fds_out) == 0))
+		return 1;
+
+	if (wl_connection_flush(connection) < 0 && errno != EAGAIN)
+		return -1;
+
+	if (wl_buffer_size(&connection->out) == 0 &&
+	    wl_buffer_size(&connection->fds_out) == 0)
+		return 1;
+
+	client->want_out = 1;
+
+	return 0;
+}
+
+/*
+ * Sends a request from the capture with everything translated.  Returns
+ * 1 if it was sent or skipped for good, 0 if it has to wait for the
+ * compositor, -1 if the connection failed.
+ */
+static int
+send_request(struct replay_client *client, struct replay_request *request)
+{
+	struct replay *replay = client->replay;
+	struct tracer_message *message = request->message;
+	struct tracer_interface *interface;
+	const struct replay_global *global;
+	const uint32_t *args[REPLAY_MAX_ARGS];
+	uint32_t data[WL_BUFFER_MAX / sizeof(uint32_t)];
+	uint32_t *p, *end, id, *new_ids[REPLAY_MAX_ARGS];
+	struct tracer_interface *new_types[REPLAY_MAX_ARGS];
+	const char *signature, *name;
+	struct replay_pool *pool;
+	struct replay_stat *stat;
+	int i, nfds = 0, new_count = 0, fd, ret;
+	int32_t fd_size = REPLAY_FD_SIZE;
+
+	memcpy(data, (char *) client->request_data.data + request->offset,
+	       request->size);
+	end = data + request->size / sizeof *data;
+	parse_args(message, data, end, args);
+
+	data[0] = live_id(client, data[0]);
+	if (data[0] == 0)
+		goto skip;
+
+	for (i = 0, signature = message->signature; *signature;
+	     signature++, i++) {
+		p = (uint32_t *) args[i];
+
+		switch (*signature) {
+		case 'o':
+			if (*p != 0 && (*p = live_id(client, *p)) == 0)
+				goto skip;
+			break;
+		case 'n':
+			name = tracer_message_arg_interface(message, i);
+			new_types[new_count] = lookup_interface(replay, name);
+			new_ids[new_count++] = p;
+			break;
+		case 'N':
+			untyped_new_id(p, &name);
+			new_types[new_count] = lookup_interface(replay, name);
+			new_ids[new_count++] = p + 1 +
+				DIV_ROUNDUP(p[0], sizeof *p) + 1;
+			break;
+		case 'u':
+			if (message == replay->registry_bind && i == 0) {
+				global = live_global(client, *p);
+				if (global == NULL)
+					return 0;
+				*p = global->name;
+				/* The version comes right before the id */
+				p = (uint32_t *) args[1] + 1 +
+				    DIV_ROUNDUP(args[1][0], sizeof *p);
+				if (*p > global->version)
+					*p = global->version;
+			} else if (is_arg(message, i, "serial")) {
+				*p = live_serial(client, *p);
+			} else if (is_arg(message, i, "size")) {
+				fd_size = *p;
+			}
+			break;
+		case 'i':
+			if (is_arg(message, i, "size"))
+				fd_size = *p;
+			break;
+		case 'h':
+			nfds++;
+			break;
+		}
+	}
+
+	ret = has_room(client, request->size, nfds);
+	if (ret <= 0)
+		return ret;
+
+	for (i = 0; i < new_count; i++) {
+		id = alloc_id(client);
+		if (ids_set(&client->ids, *new_ids[i],
+			    (void *) (uintptr_t) id) < 0 ||
+		    ids_set(&client->live, id, new_types[i]) < 0)
+			return -1;
+		*new_ids[i] = id;
+	}
+
+	if (message == replay->shm_pool_resize &&
+	    (pool = find_pool(client, data[0])) != NULL &&
+	    ftruncate(pool->fd, fd_size) < 0)
+		fprintf(stderr, "Failed to resize pool: %m\n");
+
+	for (i = 0; i < nfds; i++) {
+		fd = create_buffer_fd(fd_size > 0 ? fd_size : REPLAY_FD_SIZE);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to create buffer: %m\n");
+			return -1;
+		}
+
+		/* Pools may be resized later, which needs the fd */
+		if (message == replay->shm_create_pool &&
+		    (pool = wl_array_add(&client->pools, sizeof *pool))) {
+			pool->id = *new_ids[0];
+			pool->fd = dup(fd);
+		}
+
+		if (wl_connection_put_fd(client->connection, fd) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (wl_connection_write(client->connection, data, request->size) < 0)
+		return -1;
+
+	/* Objects from the compositor go away without delete_id */
+	interface = ids_get(&client->live, data[0]);
+	if (message->destructor && data[0] >= WL_SERVER_ID_START &&
+	    interface != NULL)
+		ids_set(&client->live, data[0], NULL);
+
+	request->sent = tracer_now();
+	replay->requests++;
+	stat = find_stat(replay, request->interface, message);
+	if (stat != NULL)
+		stat->sent++;
+
+	return 1;
+
+skip:
+	replay->skipped++;
+	return 1;
+}
+
+static void
+client_close(struct replay_client *client)
+{
+	struct replay_pool *pool;
+
+	if (client->connection != NULL) {
+		wl_connection_destroy(client->connection);
+		client->connection = NULL;
+	}
+
+	wl_array_for_each(pool, &client->pools)
+		close(pool->fd);
+	client->pools.size = 0;
+
+	client->state = REPLAY_DONE;
+}
+
+/* Clients that don't make it to their last round trip failed */
+static void
+client_fail(struct replay_client *client)
+{
+	client->replay->failed++;
+	client_close(client);
+}
+
+static int
+client_start(struct replay_client *client)
+{
+	int fd;
+
+	fd = tracer_connect_to_socket(NULL, NULL);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to connect to the compositor: %m\n");
+		return -1;
+	}
+
+	client->connection = wl_connection_create(fd);
+	if (client->connection == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	ids_set(&client->live, 1, client->replay->analyzer->display_interface);
+	ids_set(&client->ids, 1, (void *) (uintptr_t) 1);
+	client->state = REPLAY_RUNNING;
+
+	return 0;
+}
+
+/* Ends with a round trip, so that the last requests get answered */
+static int
+client_finish(struct replay_client *client)
+{
+	uint32_t data[3];
+
+	client->last_callback = alloc_id(client);
+	data[0] = 1;
+	data[1] = (sizeof data << 16) | 0;	/* wl_display.sync */
+	data[2] = client->last_callback;
+
+	if (ids_set(&client->live, client->last_callback,
+		    lookup_interface(client->replay, "wl_callback")) < 0 ||
+	    wl_connection_write(client->connection, data, sizeof data) < 0)
+		return -1;
+
+	client->state = REPLAY_FINISHING;
+
+	return 0;
+}
+
+static void
+pair_event(struct replay_client *client, struct tracer_message *message,
+	   uint32_t new_id, uint32_t serial, uint64_t now)
+{
+	struct replay *replay = client->replay;
+	struct replay_track *track;
+	struct replay_event *event;
+	struct replay_request *request;
+	struct replay_serial *pair;
+	struct replay_stat *stat;
+	uint64_t *latency;
+
+	track = find_track(client, message);
+	if (track == NULL ||
+	    track->next >= track->events.size / sizeof *event)
+		return;
+
+	event = (struct replay_event *) track->events.data + track->next++;
+
+	if (event->new_id != 0 && new_id != 0)
+		ids_set(&client->ids, event->new_id,
+			(void *) (uintptr_t) new_id);
+
+	if (event->serial != 0 &&
+	    (pair = wl_array_add(&client->serials, sizeof *pair))) {
+		pair->recorded = event->serial;
+		pair->live = serial;
+	}
+
+	if (event->cause < 0)
+		return;
+
+	request = (struct replay_request *) client->requests.data +
+		  event->cause;
+	if (request->answered || request->sent == 0)
+		return;
+
+	request->answered = 1;
+	stat = find_stat(replay, request->interface, request->message);
+	latency = stat ? wl_array_add(&stat->latencies, sizeof *latency) : NULL;
+	if (latency != NULL)
+		*latency = now - request->sent;
+}
+
+static int
+handle_event(struct replay_client *client, const uint32_t *p, uint32_t size,
+	     uint64_t now)
+{
+	struct replay *replay = client->replay;
+	struct wl_connection *connection = client->connection;
+	struct tracer_interface *interface;
+	struct tracer_message *message;
+	struct replay_global *global;
+	const uint32_t *args[REPLAY_MAX_ARGS];
+	const char *signature, *name;
+	uint32_t new_id = 0, serial = 0, *id;
+	int i, fd;
+
+	message = lookup_message(&client->live, p, 1, &interface);
+	if (message == NULL ||
+	    parse_args(message, p, p + size / sizeof *p, args) < 0)
+		return 0;
+
+	for (i = 0, signature = message->signature; *signature;
+	     signature++, i++) {
+		if (*signature == 'n') {
+			new_id = *args[i];
+			name = tracer_message_arg_interface(message, i);
+			ids_set(&client->live, new_id,
+				lookup_interface(replay, name));
+		} else if (*signature == 'u' && is_arg(message, i, "serial")) {
+			serial = *args[i];
+		} else if (*signature == 'h' &&
+			   wl_buffer_size(&connection->fds_in) >= sizeof fd) {
+			wl_buffer_copy(&connection->fds_in, &fd, sizeof fd);
+			connection->fds_in.tail += sizeof fd;
+			close(fd);
+		}
+	}
+
+	pair_event(client, message, new_id, serial, now);
+
+	if (message == replay->display_error) {
+		fprintf(stderr, "Client %u: error %u on object %u: %s\n",
+			client->instance, *args[1], *args[0],
+			string_arg(args[2]));
+		return -1;
+	} else if (message == replay->display_delete_id) {
+		ids_set(&client->live, *args[0], NULL);
+		if (*args[0] < WL_SERVER_ID_START &&
+		    (id = wl_array_add(&client->free_ids, sizeof *id)))
+			*id = *args[0];
+	} else if (message == replay->callback_done) {
+		client->dones++;
+		if (p[0] == client->last_callback &&
+		    client->state == REPLAY_FINISHING)
+			client_close(client);
+	} else if (message == replay->registry_global) {
+		global = wl_array_add(&client->globals, sizeof *global);
+		if (global == NULL)
+			return -1;
+		global->name = *args[0];
+		global->interface = tracer_arena_strdup(&replay->arena,
+							string_arg(args[1]));
+		global->version = *args[2];
+	}
+
+	return 0;
+}
+
+static void
+client_read(struct replay_client *client)
+{
+	struct wl_connection *connection = client->connection;
+	uint32_t data[WL_BUFFER_MAX / sizeof(uint32_t)];
+	uint32_t size;
+	uint64_t now;
+	int len, fd;
+
+	len = wl_connection_read(connection);
+	if (len < 0 && errno == EAGAIN)
+		return;
+	if (len <= 0) {
+		fprintf(stderr, "Client %u: the compositor hung up\n",
+			client->instance);
+		client_fail(client);
+		return;
+	}
+
+	now = tracer_now();
+	while (len >= 8) {
+		wl_connection_copy(connection, data, 8);
+		size = data[1] >> 16;
+		if (size < 8 || size > (uint32_t) len)
+			break;
+
+		wl_connection_copy(connection, data, size);
+		wl_connection_consume(connection, size);
+		len -= size;
+
+		if (handle_event(client, data, size, now) < 0) {
+			client_fail(client);
+			return;
+		}
+		if (client->state == REPLAY_DONE)
+			return;
+	}
+
+	/* fds of events we couldn't make sense of */
+	if (len == 0) {
+		while (wl_buffer_size(&connection->fds_in) >= sizeof fd) {
+			wl_buffer_copy(&connection->fds_in, &fd, sizeof fd);
+			connection->fds_in.tail += sizeof fd;
+			close(fd);
+		}
+	}
+}
+
+/*
+ * Sends what the client may send by now.  Returns when it should be
+ * looked at again, 0 if only the compositor can move it on.
+ */
+static uint64_t
+client_advance(struct replay_client *client, uint64_t now)
+{
+	struct replay *replay = client->replay;
+	struct replay_request *request;
+	size_t count = client->requests.size / sizeof *request;
+	uint64_t due;
+	int ret;
+
+	if (client->state == REPLAY_WAITING) {
+		due = replay->start + (client->first - replay->capture_start);
+		if (!replay->fast && now < due)
+			return due;
+		if (client_start(client) < 0) {
+			client_fail(client);
+			return 0;
+		}
+	}
+
+	client->want_out = 0;
+
+	while (client->state == REPLAY_RUNNING && client->next < count) {
+		request = (struct replay_request *) client->requests.data +
+			  client->next;
+
+		due = replay->start + (request->timestamp -
+				       replay->capture_start);
+		if (!replay->fast && now < due)
+			goto flush;
+
+		if (client->dones < request->syncs) {
+			if (client->wait_since == 0) {
+				client->wait_since = now;
+				replay->syncs++;
+			}
+			if (now - client->wait_since < REPLAY_TIMEOUT) {
+				due = client->wait_since + REPLAY_TIMEOUT;
+				goto flush;
+			}
+			replay->timeouts++;
+			client->dones = request->syncs;
+		}
+
+		ret = send_request(client, request);
+		if (ret < 0)
+			goto fail;
+		if (ret == 0 && client->want_out)
+			return 0;
+		if (ret == 0) {
+			/* A global it binds hasn't been announced yet */
+			if (client->wait_since == 0)
+				client->wait_since = now;
+			if (now - client->wait_since < REPLAY_TIMEOUT) {
+				due = client->wait_since + REPLAY_TIMEOUT;
+				goto flush;
+			}
+			replay->timeouts++;
+			replay->skipped++;
+		}
+
+		client->wait_since = 0;
+		client->next++;
+	}
+
+	if (client->state == REPLAY_RUNNING) {
+		if (client_finish(client) < 0)
+			goto fail;
+		client->wait_since = now;
+	}
+
+	due = client->wait_since + REPLAY_TIMEOUT;
+	if (now >= due) {
+		replay->timeouts++;
+		client_fail(client);
+		return 0;
+	}
+
+flush:
+	if (wl_connection_flush(client->connection) < 0) {
+		if (errno != EAGAIN)
+			goto fail;
+		client->want_out = 1;
+	}
+
+	return due;
+
+fail:
+	fprintf(stderr, "Client %u: failed to send: %m\n", client->instance);
+	client_fail(client);
+	return 0;
+}
+
+static int
+run(struct replay *replay)
+{
+	struct replay_client *client, **clients;
+	struct pollfd *pfds;
+	uint64_t now, due, next;
+	int count, n, i, timeout;
+
+	count = wl_list_length(&replay->client_list) + 1;
+	pfds = calloc(count, sizeof *pfds);
+	clients = calloc(count, sizeof *clients);
+	if (pfds == NULL || clients == NULL) {
+		free(pfds);
+		free(clients);
+		return -1;
+	}
+
+	replay->start = tracer_now();
+
+	for (;;) {
+		now = tracer_now();
+		next = 0;
+		n = 0;
+		wl_list_for_each(client, &replay->client_list, link) {
+			if (client->state == REPLAY_DONE)
+				continue;
+
+			due = client_advance(client, now);
+			if (due != 0 && (next == 0 || due < next))
+				next = due;
+			if (client->state == REPLAY_DONE ||
+			    client->connection == NULL)
+				continue;
+
+			pfds[n].fd = client->connection->fd;
+			pfds[n].events = POLLIN;
+			if (client->want_out)
+				pfds[n].events |= POLLOUT;
+			clients[n++] = client;
+		}
+
+		if (n == 0 && next == 0)
+			break;
+
+		now = tracer_now();
+		timeout = next == 0 ? -1 :
+			  next <= now ? 0 : (int) DIV_ROUNDUP(next - now, 1000000);
+		if (poll(pfds, n, timeout) < 0 && errno != EINTR) {
+			fprintf(stderr, "Failed to poll: %m\n");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				client_read(clients[i]);
+		}
+	}
+
+	free(pfds);
+	free(clients);
+
+	return 0;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+	uint64_t la = *(const uint64_t *) a, lb = *(const uint64_t *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static int
+compare_stats(const void *a, const void *b)
+{
+	const struct replay_stat *sa = a, *sb = b;
+
+	if (sa->sent != sb->sent)
+		return sa->sent < sb->sent ? 1 : -1;
+
+	return 0;
+}
+
+static void
+report(struct replay *replay, const char *path, uint64_t elapsed)
+{
+	struct tracer *tracer = replay->tracer;
+	struct replay_stat *stat;
+	uint64_t *latencies;
+	size_t count;
+	char name[128];
+
+	tracer_print(tracer, "Replayed %d clients of %s in %.3f s: "
+		     "%llu requests, %llu skipped, %llu of %llu waits "
+		     "timed out, %d clients failed\n\n",
+		     wl_list_length(&replay->client_list), path,
+		     elapsed / 1e9, (unsigned long long) replay->requests,
+		     (unsigned long long) replay->skipped,
+		     (unsigned long long) replay->timeouts,
+		     (unsigned long long) replay->syncs, replay->failed);
+
+	if (replay->stats.size > 0)
+		qsort(replay->stats.data,
+		      replay->stats.size / sizeof(struct replay_stat),
+		      sizeof(struct replay_stat), compare_stats);
+
+	tracer_print(tracer, "%-40s %8s %8s %9s %9s %9s\n", "request", "sent",
+		     "answered", "p50 ms", "p99 ms", "max ms");
+	wl_array_for_each(stat, &replay->stats) {
+		snprintf(name, sizeof name, "%s.%s", stat->interface->name,
+			 stat->message->name);
+		latencies = stat->latencies.data;
+		count = stat->latencies.size / sizeof *latencies;
+		if (count == 0) {
+			tracer_print(tracer, "%-40s %8llu %8s\n", name,
+				     (unsigned long long) stat->sent, "-");
+			continue;
+		}
+
+		qsort(latencies, count, sizeof *latencies, compare_latency);
+		tracer_print(tracer, "%-40s %8llu %8zu %9.3f %9.3f %9.3f\n",
+			     name, (unsigned long long) stat->sent, count,
+			     latencies[count / 2] / 1e6,
+			     latencies[count * 99 / 100] / 1e6,
+			     latencies[count - 1] / 1e6);
+	}
+
+	fflush(tracer->outfp);
+}
+
+static void
+client_release(struct replay_client *client)
+{
+	struct replay_track *track;
+	int i;
+
+	if (client->connection != NULL)
+		client_close(client);
+
+	for (i = 0; i < 2; i++)
+		wl_array_release(&client->partial[i]);
+	wl_array_release(&client->request_data);
+	wl_array_release(&client->requests);
+	wl_array_for_each(track, &client->tracks)
+		wl_array_release(&track->events);
+	wl_array_release(&client->tracks);
+	wl_array_release(&client->recorded_globals);
+	ids_release(&client->recorded);
+	ids_release(&client->live);
+	ids_release(&client->ids);
+	wl_array_release(&client->free_ids);
+	wl_array_release(&client->globals);
+	wl_array_release(&client->serials);
+	wl_array_release(&client->pools);
+}
+
+int
+tracer_replay(struct tracer *tracer, const char *path)
+{
+	struct replay replay;
+	struct replay_client *client;
+	struct replay_stat *stat;
+	struct tracer_analyzer *analyzer = tracer->frontend_data;
+	int ret;
+
+	memset(&replay, 0, sizeof replay);
+	replay.tracer = tracer;
+	replay.analyzer = analyzer;
+	replay.fast = tracer->options->replay_fast;
+	tracer_arena_init(&replay.arena);
+	wl_list_init(&replay.client_list);
+	wl_array_init(&replay.stats);
+
+	replay.display_error = tracer_analyzer_lookup_message(analyzer,
+		"wl_display", "error", 1);
+	replay.display_delete_id = tracer_analyzer_lookup_message(analyzer,
+		"wl_display", "delete_id", 1);
+	replay.registry_global = tracer_analyzer_lookup_message(analyzer,
+		"wl_registry", "global", 1);
+	replay.registry_bind = tracer_analyzer_lookup_message(analyzer,
+		"wl_registry", "bind", 0);
+	replay.callback_done = tracer_analyzer_lookup_message(analyzer,
+		"wl_callback", "done", 1);
+	replay.shm_create_pool = tracer_analyzer_lookup_message(analyzer,
+		"wl_shm", "create_pool", 0);
+	replay.shm_pool_resize = tracer_analyzer_lookup_message(analyzer,
+		"wl_shm_pool", "resize", 0);
+	if (replay.display_error == NULL || replay.registry_global == NULL ||
+	    replay.callback_done == NULL) {
+		fprintf(stderr, "Replaying needs the core protocol\n");
+		return -1;
+	}
+
+	ret = tracer_capture_read(path, load_record, &replay);
+	if (ret == 0)
+		ret = run(&replay);
+	if (ret == 0)
+		report(&replay, path, tracer_now() - replay.start);
+	if (replay.failed > 0)
+		ret = -1;
+
+	wl_list_for_each(client, &replay.client_list, link)
+		client_release(client);
+	wl_array_for_each(stat, &replay.stats)
+		wl_array_release(&stat->latencies);
+	wl_array_release(&replay.stats);
+	tracer_arena_release(&replay.arena);
+
+	return ret;
+}
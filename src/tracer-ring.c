@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "tracer-ring.h"
+#include "wayland-tracer-ring.h"
+
+#define RING_DATA_OFFSET	4096
+#define RING_MIN_SIZE		(64 * 1024)
+
+struct tracer_ring {
+	int fd;
+	struct tracer_ring_header *header;
+	char *data;
+	uint64_t size;
+	size_t map_size;
+};
+
+static int
+create_anonymous_file(off_t size)
+{
+	int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("wayland-tracer-ring", MFD_CLOEXEC);
+#else
+	char template[] = "/tmp/wayland-tracer-ring-XXXXXX";
+
+	fd = mkostemp(template, O_CLOEXEC);
+	if (fd >= 0)
+		unlink(template);
+#endif
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct tracer_ring *
+tracer_ring_create(size_t size)
+{
+	struct tracer_ring *ring;
+	void *map;
+
+	if (size < RING_MIN_SIZE)
+		size = RING_MIN_SIZE;
+
+	/* Round up to a power of two so that positions can be masked */
+	while (size & (size - 1))
+		size = (size | (size - 1)) + 1;
+
+	ring = malloc(sizeof *ring);
+	if (ring == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ring->size = size;
+	ring->map_size = RING_DATA_OFFSET + size;
+	ring->fd = create_anonymous_file(ring->map_size);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   ring->fd, 0);
+	if (map == MAP_FAILED) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	ring->header = map;
+	ring->data = (char *) map + RING_DATA_OFFSET;
+
+	memset(ring->header, 0, sizeof *ring->header);
+	ring->header->data_offset = RING_DATA_OFFSET;
+	ring->header->data_size = size;
+	ring->header->version = TRACER_RING_VERSION;
+	__atomic_store_n(&ring->header->magic, TRACER_RING_MAGIC,
+			 __ATOMIC_RELEASE);
+
+	return ring;
+}
+
+void
+tracer_ring_destroy(struct tracer_ring *ring)
+{
+	munmap(ring->header, ring->map_size);
+	close(ring->fd);
+	free(ring);
+}
+
+int
+tracer_ring_get_fd(struct tracer_ring *ring)
+{
+	return ring->fd;
+}
+
+uint64_t
+tracer_ring_get_size(struct tracer_ring *ring)
+{
+	return ring->size;
+}
+
+static void
+ring_reserve(struct tracer_ring *ring, uint64_t end)
+{
+	__atomic_store_n(&ring->header->reserve, end, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+ring_commit(struct tracer_ring *ring, uint64_t end)
+{
+	__atomic_store_n(&ring->header->head, end, __ATOMIC_RELEASE);
+}
+
+void
+tracer_ring_publish(struct tracer_ring *ring,
+		    const struct tracer_record *record,
+		    const void *payload)
+{
+	struct tracer_record *dst;
+	uint64_t head, offset, left;
+
+	if (record->size > ring->size / 2)
+		return;
+
+	head = ring->header->head;
+	offset = head & (ring->size - 1);
+	left = ring->size - offset;
+
+	/* Records never wrap, fill up the end of the ring instead */
+	if (left < record->size) {
+		ring_reserve(ring, head + left);
+		if (left >= sizeof *record) {
+			dst = (struct tracer_record *) (ring->data + offset);
+			memset(dst, 0, sizeof *dst);
+			dst->size = left;
+			dst->type = TRACER_RECORD_PADDING;
+		}
+		head += left;
+		ring_commit(ring, head);
+		offset = 0;
+	}
+
+	ring_reserve(ring, head + record->size);
+
+	dst = (struct tracer_record *) (ring->data + offset);
+	memcpy(dst, record, sizeof *record);
+	memcpy(dst + 1, payload, record->length);
+	memset((char *) (dst + 1) + record->length, 0,
+	       record->size - sizeof *record - record->length);
+
+	ring_commit(ring, head + record->size);
+}
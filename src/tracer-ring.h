@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_RING_H
+#define TRACER_RING_H
+
+#include <stddef.h>
+#include "wayland-tracer-record.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct tracer_ring;
+
+struct tracer_ring *tracer_ring_create(size_t size);
+
+void tracer_ring_destroy(struct tracer_ring *ring);
+
+int tracer_ring_get_fd(struct tracer_ring *ring);
+
+uint64_t tracer_ring_get_size(struct tracer_ring *ring);
+
+void tracer_ring_publish(struct tracer_ring *ring,
+			 const struct tracer_record *record,
+			 const void *payload);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Turns protocol XML into C decoders for wayland-tracer, one function per
+ * message that reads the arguments at offsets fixed at build time and
+ * prints the message with a single tracer_log(), followed by a table
+ * tracer_decode_attach() uses to find them.  Like at run time, the
+ * protocols given must include every interface they refer to.
+ *
+ *	wayland-tracer-scanner [PROTOCOL.xml]... > tracer-decoders.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "wayland-util.h"
+#include "tracer-analyzer.h"
+
+#define SCANNER_BUFFER_SIZE 8192
+
+/* Where the next argument is: base pointer plus a constant offset */
+struct position {
+	char base[16];
+	int offset;
+};
+
+struct emitter {
+	char decls[SCANNER_BUFFER_SIZE];
+	char stmts[SCANNER_BUFFER_SIZE];
+	char enums[SCANNER_BUFFER_SIZE];
+	char format[SCANNER_BUFFER_SIZE];
+	char args[SCANNER_BUFFER_SIZE];
+};
+
+static void
+append(char *buf, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void
+append(char *buf, const char *fmt, ...)
+{
+	size_t len = strlen(buf);
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (vsnprintf(buf + len, SCANNER_BUFFER_SIZE - len, fmt, ap) >=
+	    (int) (SCANNER_BUFFER_SIZE - len)) {
+		fprintf(stderr, "message too large to generate\n");
+		exit(EXIT_FAILURE);
+	}
+	va_end(ap);
+}
+
+/* Skips past a length-prefixed string or array starting at pos */
+static void
+skip_variable(struct emitter *e, struct position *pos, int i, int last)
+{
+	if (last)
+		return;
+
+	append(e->decls, "\tconst uint32_t *p%d = %s + %d + ((l%d + 3) >> 2);\n",
+	       i, pos->base, pos->offset + 1, i);
+	snprintf(pos->base, sizeof pos->base, "p%d", i);
+	pos->offset = 0;
+}
+
+static void
+emit_arg(struct emitter *e, struct tracer_message *message, int i, int last,
+	 struct position *pos)
+{
+	int has_enum = message->enums != NULL && message->enums[i] != NULL;
+	const char *base = pos->base;
+	int k = pos->offset;
+
+	if (i != 0)
+		append(e->format, ", ");
+
+	switch (message->signature[i]) {
+	case 'u':
+	case 'i':
+		append(e->decls, "\t%s a%d = %s[%d];\n",
+		       message->signature[i] == 'u' ? "uint32_t" : "int32_t",
+		       i, base, k);
+		append(e->format, message->signature[i] == 'u' ? "%%u" : "%%i");
+		append(e->args, ", a%d", i);
+		if (has_enum) {
+			append(e->enums, "\t\tchar e%d[264];\n", i);
+			append(e->format, "%%s");
+			append(e->args, ",\n\t\t\t   tracer_decode_enum(d, %d, a%d, "
+			       "e%d, sizeof e%d)", i, i, i, i);
+		}
+		pos->offset++;
+		break;
+	case 'f':
+		append(e->decls, "\twl_fixed_t a%d = %s[%d];\n", i, base, k);
+		append(e->format, "%%lf");
+		append(e->args, ", wl_fixed_to_double(a%d)", i);
+		pos->offset++;
+		break;
+	case 'o':
+		append(e->decls, "\tuint32_t a%d = %s[%d];\n", i, base, k);
+		append(e->format, "obj %%u");
+		append(e->args, ", a%d", i);
+		pos->offset++;
+		break;
+	case 'n':
+		append(e->decls, "\tuint32_t a%d = %s[%d];\n", i, base, k);
+		append(e->stmts, "\tif (a%d != 0)\n"
+		       "\t\ttracer_decode_new_id(d, a%d);\n", i, i);
+		append(e->format, "new_id %%u");
+		append(e->args, ", a%d", i);
+		pos->offset++;
+		break;
+	case 's':
+		append(e->decls, "\tuint32_t l%d = %s[%d];\n", i, base, k);
+		append(e->decls, "\tconst char *a%d = l%d ? "
+		       "(const char *) (%s + %d) : \"(null)\";\n",
+		       i, i, base, k + 1);
+		append(e->decls, "\tconst char *q%d = l%d ? \"\\\"\" : \"\";\n",
+		       i, i);
+		append(e->format, "%%s%%s%%s");
+		append(e->args, ", q%d, a%d, q%d", i, i, i);
+		skip_variable(e, pos, i, last);
+		break;
+	case 'a':
+		append(e->decls, "\tuint32_t l%d = %s[%d];\n", i, base, k);
+		append(e->format, "array: %%u");
+		append(e->args, ", l%d", i);
+		skip_variable(e, pos, i, last);
+		break;
+	case 'h':
+		append(e->decls, "\tchar f%d[264];\n", i);
+		append(e->decls, "\tint a%d = tracer_decode_fd(d, f%d, "
+		       "sizeof f%d);\n", i, i, i);
+		append(e->format, "fd %%d%%s");
+		append(e->args, ", a%d, f%d", i, i);
+		break;
+	case 'N':
+		append(e->decls, "\tuint32_t l%d = %s[%d];\n", i, base, k);
+		append(e->decls, "\tconst char *t%d = l%d ? "
+		       "(const char *) (%s + %d) : NULL;\n", i, i, base, k + 1);
+		skip_variable(e, pos, i, 0);
+		append(e->decls, "\tuint32_t n%d = p%d[0];\n", i, i);
+		append(e->decls, "\tuint32_t a%d = p%d[1];\n", i, i);
+		append(e->stmts, "\tif (a%d != 0)\n"
+		       "\t\ttracer_decode_new_id_typed(d, t%d, a%d);\n",
+		       i, i, i);
+		append(e->format, "new_id %%u[%%s,%%u]");
+		append(e->args, ", a%d, t%d ? t%d : \"(null)\", n%d",
+		       i, i, i, i);
+		pos->offset = 2;
+		break;
+	}
+}
+
+static void
+emit_message(struct tracer_interface *interface,
+	     struct tracer_message *message, int event)
+{
+	struct emitter *e;
+	struct position pos;
+	int i, count;
+
+	e = calloc(1, sizeof *e);
+	if (e == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	strcpy(pos.base, "p");
+	pos.offset = 0;
+	count = strlen(message->signature);
+	for (i = 0; i < count; i++)
+		emit_arg(e, message, i, i == count - 1, &pos);
+
+	printf("static void\n"
+	       "decode_%s_%s_%s(struct tracer_decode *d, const uint32_t *p)\n"
+	       "{\n"
+	       "%s",
+	       interface->name, event ? "event" : "request", message->name,
+	       e->decls);
+	if (e->decls[0] != '\0')
+		printf("\n");
+	printf("%s", e->stmts);
+	if (e->stmts[0] != '\0')
+		printf("\n");
+	printf("\tif (d->verbose) {\n"
+	       "\t\tstruct tracer_instance *instance = d->instance;\n"
+	       "%s\n"
+	       "\t\ttracer_log(\"%%s %s@%%u.%s(%s)\",\n"
+	       "\t\t\t   d->arrow, d->id%s);\n"
+	       "\t\ttracer_log_end();\n"
+	       "\t}\n"
+	       "}\n\n",
+	       e->enums, interface->name, message->name, e->format, e->args);
+
+	free(e);
+}
+
+static void
+emit_entries(struct tracer_interface *interface,
+	     struct tracer_message **messages, int count, int event)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		printf("\t{ \"%s\", \"%s\", %d, \"%s\",\n"
+		       "\t  decode_%s_%s_%s },\n",
+		       interface->name, messages[i]->name, event,
+		       messages[i]->signature, interface->name,
+		       event ? "event" : "request", messages[i]->name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct tracer_analyzer *analyzer;
+	struct tracer_interface **interfaces = NULL, *interface;
+	int i, j;
+
+	if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+		fprintf(stderr, "Usage: wayland-tracer-scanner "
+			"[PROTOCOL.xml]... > decoders.c\n");
+		return EXIT_SUCCESS;
+	}
+
+	if (argc > 1) {
+		analyzer = tracer_analyzer_create();
+		if (analyzer == NULL) {
+			fprintf(stderr, "Failed to create analyzer: %m\n");
+			return EXIT_FAILURE;
+		}
+
+		if (tracer_analyzer_add_protocols(analyzer,
+						  (const char **) &argv[1],
+						  argc - 1, 0) != 0)
+			return EXIT_FAILURE;
+
+		if (tracer_analyzer_finalize(analyzer) != 0)
+			return EXIT_FAILURE;
+		interfaces = analyzer->interfaces;
+	}
+
+	printf("/* Generated by wayland-tracer-scanner, do not edit */\n\n"
+	       "#include \"tracer-decode.h\"\n\n");
+
+	for (i = 0; interfaces != NULL && interfaces[i] != NULL; i++) {
+		interface = interfaces[i];
+		for (j = 0; j < interface->method_count; j++)
+			emit_message(interface, interface->methods[j], 0);
+		for (j = 0; j < interface->event_count; j++)
+			emit_message(interface, interface->events[j], 1);
+	}
+
+	printf("const struct tracer_decoder tracer_decoders[] = {\n");
+	for (i = 0; interfaces != NULL && interfaces[i] != NULL; i++) {
+		interface = interfaces[i];
+		emit_entries(interface, interface->methods,
+			     interface->method_count, 0);
+		emit_entries(interface, interface->events,
+			     interface->event_count, 1);
+	}
+	printf("\t{ NULL, NULL, 0, NULL, NULL }\n"
+	       "};\n");
+
+	return EXIT_SUCCESS;
+}
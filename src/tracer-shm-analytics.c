@@ -0,0 +1,612 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "wayland-os.h"
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-shm-analytics.h"
+#include "tracer-side-table.h"
+
+/*
+ * Keeps the fd of every wl_shm_pool and, whenever a surface commits a
+ * newly attached shm buffer, reads it and compares it with a copy of what
+ * the surface showed before.  The comparison and the update of the copy
+ * are done in one pass by a vectorized kernel.
+ *
+ * Pools are read with pread() rather than mapped: a client may shrink its
+ * file at any time, and touching a mapping past the new end would raise
+ * SIGBUS and take the tracer down with every client it proxies.
+ */
+
+struct shm_pool {
+	int fd;
+	size_t size;
+	int refcount;
+};
+
+struct shm_buffer {
+	struct shm_pool *pool;
+	int32_t offset, width, height, stride;
+};
+
+struct shm_surface {
+	uint32_t id;
+	uint32_t pending;
+	int attached;
+	uint8_t *prev;
+	size_t prev_size;
+	uint32_t commits;
+	uint32_t identical;
+	uint64_t committed_bytes;
+	uint64_t changed_bytes;
+};
+
+struct shm_client {
+	struct tracer_side_table pools;
+	struct tracer_side_table buffers;
+	struct tracer_side_table surfaces;
+};
+
+struct shm_analytics {
+	struct tracer_hook create_pool;
+	struct tracer_hook resize_pool;
+	struct tracer_hook destroy_pool;
+	struct tracer_hook create_buffer;
+	struct tracer_hook destroy_buffer;
+	struct tracer_hook attach;
+	struct tracer_hook commit;
+	struct tracer_hook destroy_surface;
+	struct tracer_instance_listener listener;
+	uint8_t *scratch;
+	size_t scratch_size;
+	int slot;
+};
+
+typedef size_t (*diff_func_t)(uint8_t *prev, const uint8_t *cur, size_t len);
+
+/*
+ * All kernels return the number of bytes in which prev and cur differ
+ * and leave prev equal to cur.
+ */
+static size_t
+diff_update_scalar(uint8_t *prev, const uint8_t *cur, size_t len)
+{
+	const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t a, b, x;
+	size_t i, changed = 0;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&a, prev + i, sizeof a);
+		memcpy(&b, cur + i, sizeof b);
+		x = a ^ b;
+		if (x == 0)
+			continue;
+
+		/* Set the top bit of every nonzero byte, clear the rest */
+		x = (((x & low7) + low7) | x) & ~low7;
+		changed += __builtin_popcountll(x);
+		memcpy(prev + i, &b, sizeof b);
+	}
+
+	for (; i < len; i++) {
+		if (prev[i] != cur[i]) {
+			prev[i] = cur[i];
+			changed++;
+		}
+	}
+
+	return changed;
+}
+
+#ifdef __SSE2__
+static size_t
+diff_update_sse2(uint8_t *prev, const uint8_t *cur, size_t len)
+{
+	__m128i a, b;
+	unsigned int mask;
+	size_t i, changed = 0;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		a = _mm_loadu_si128((const __m128i *) (prev + i));
+		b = _mm_loadu_si128((const __m128i *) (cur + i));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if (mask == 0xffff)
+			continue;
+
+		changed += 16 - __builtin_popcount(mask);
+		_mm_storeu_si128((__m128i *) (prev + i), b);
+	}
+
+	return changed + diff_update_scalar(prev + i, cur + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+diff_update_avx2(uint8_t *prev, const uint8_t *cur, size_t len)
+{
+	__m256i a, b;
+	unsigned int mask;
+	size_t i, changed = 0;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		a = _mm256_loadu_si256((const __m256i *) (prev + i));
+		b = _mm256_loadu_si256((const __m256i *) (cur + i));
+		mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+		if (mask == 0xffffffff)
+			continue;
+
+		changed += 32 - __builtin_popcount(mask);
+		_mm256_storeu_si256((__m256i *) (prev + i), b);
+	}
+
+	return changed + diff_update_sse2(prev + i, cur + i, len - i);
+}
+#endif
+
+static diff_func_t diff_update = diff_update_scalar;
+
+static void
+select_diff_kernel(void)
+{
+#ifdef __SSE2__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		diff_update = diff_update_avx2;
+	else
+		diff_update = diff_update_sse2;
+#endif
+}
+
+static void
+pool_unref(void *data)
+{
+	struct shm_pool *pool = data;
+
+	if (--pool->refcount > 0)
+		return;
+
+	close(pool->fd);
+	free(pool);
+}
+
+static void
+buffer_destroy(void *data)
+{
+	struct shm_buffer *buffer = data;
+
+	pool_unref(buffer->pool);
+	free(buffer);
+}
+
+static void
+surface_report(struct tracer_instance *instance, struct shm_surface *surface)
+{
+	if (surface->commits == 0)
+		return;
+
+	tracer_log("shm: wl_surface@%u: %u commits, %llu of %llu bytes "
+		   "changed (%.1f%%), %u identical frames",
+		   surface->id, surface->commits,
+		   (unsigned long long) surface->changed_bytes,
+		   (unsigned long long) surface->committed_bytes,
+		   surface->committed_bytes ? 100.0 * surface->changed_bytes /
+		   surface->committed_bytes : 0.0,
+		   surface->identical);
+	tracer_log_end();
+}
+
+static void
+surface_destroy(void *data)
+{
+	struct shm_surface *surface = data;
+
+	free(surface->prev);
+	free(surface);
+}
+
+static struct shm_client *
+get_client(struct shm_analytics *shm, struct tracer_message_view *view)
+{
+	if (view->side != TRACER_CLIENT_SIDE)
+		return NULL;
+
+	return view->instance->slots[shm->slot];
+}
+
+static void
+handle_create_pool(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, create_pool);
+	struct shm_client *client = get_client(shm, view);
+	struct shm_pool *pool;
+	uint32_t id = view->args[0];
+	int32_t size = view->args[1];
+
+	if (client == NULL || view->nfds != 1)
+		return;
+
+	pool = malloc(sizeof *pool);
+	if (pool == NULL)
+		return;
+
+	pool->fd = wl_os_dupfd_cloexec(view->fds[0], 0);
+	if (pool->fd < 0) {
+		free(pool);
+		return;
+	}
+	pool->size = size > 0 ? size : 0;
+	pool->refcount = 1;
+
+	if (tracer_side_table_set(&client->pools, id, pool) < 0)
+		pool_unref(pool);
+}
+
+static void
+handle_resize_pool(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, resize_pool);
+	struct shm_client *client = get_client(shm, view);
+	struct shm_pool *pool;
+
+	if (client == NULL)
+		return;
+
+	pool = tracer_side_table_get(&client->pools, view->id);
+	if (pool != NULL && (int32_t) view->args[0] > 0)
+		pool->size = (int32_t) view->args[0];
+}
+
+static void
+handle_destroy_pool(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, destroy_pool);
+	struct shm_client *client = get_client(shm, view);
+	struct shm_pool *pool;
+
+	if (client == NULL)
+		return;
+
+	/* Buffers keep the memory alive after the pool is gone */
+	pool = tracer_side_table_remove(&client->pools, view->id);
+	if (pool != NULL)
+		pool_unref(pool);
+}
+
+static void
+handle_create_buffer(struct tracer_hook *hook,
+		     struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, create_buffer);
+	struct shm_client *client = get_client(shm, view);
+	struct shm_pool *pool;
+	struct shm_buffer *buffer;
+	uint32_t id = view->args[0];
+
+	if (client == NULL)
+		return;
+
+	pool = tracer_side_table_get(&client->pools, view->id);
+	if (pool == NULL)
+		return;
+
+	buffer = malloc(sizeof *buffer);
+	if (buffer == NULL)
+		return;
+
+	buffer->pool = pool;
+	buffer->offset = view->args[1];
+	buffer->width = view->args[2];
+	buffer->height = view->args[3];
+	buffer->stride = view->args[4];
+	pool->refcount++;
+
+	if (tracer_side_table_set(&client->buffers, id, buffer) < 0)
+		buffer_destroy(buffer);
+}
+
+static void
+handle_destroy_buffer(struct tracer_hook *hook,
+		      struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, destroy_buffer);
+	struct shm_client *client = get_client(shm, view);
+	struct shm_buffer *buffer;
+
+	if (client == NULL)
+		return;
+
+	buffer = tracer_side_table_remove(&client->buffers, view->id);
+	if (buffer != NULL)
+		buffer_destroy(buffer);
+}
+
+static struct shm_surface *
+get_surface(struct shm_client *client, uint32_t id)
+{
+	struct shm_surface *surface;
+
+	surface = tracer_side_table_get(&client->surfaces, id);
+	if (surface != NULL)
+		return surface;
+
+	surface = calloc(1, sizeof *surface);
+	if (surface == NULL)
+		return NULL;
+
+	surface->id = id;
+	if (tracer_side_table_set(&client->surfaces, id, surface) < 0) {
+		free(surface);
+		return NULL;
+	}
+
+	return surface;
+}
+
+static void
+handle_attach(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, attach);
+	struct shm_client *client = get_client(shm, view);
+	struct shm_surface *surface;
+
+	if (client == NULL)
+		return;
+
+	surface = get_surface(client, view->id);
+	if (surface == NULL)
+		return;
+
+	surface->pending = view->args[0];
+	surface->attached = 1;
+}
+
+/*
+ * Reads the buffer contents into the scratch buffer.  Returns NULL if
+ * they don't lie inside the pool or the file, which the client may have
+ * shrunk behind our back.
+ */
+static const uint8_t *
+buffer_contents(struct shm_analytics *shm, struct shm_buffer *buffer,
+		size_t *length)
+{
+	struct shm_pool *pool = buffer->pool;
+	uint8_t *scratch;
+	size_t done;
+	ssize_t len;
+
+	if (buffer->offset < 0 || buffer->stride <= 0 || buffer->height <= 0)
+		return NULL;
+
+	*length = (size_t) buffer->stride * buffer->height;
+	if (buffer->offset + *length > pool->size)
+		return NULL;
+
+	if (shm->scratch_size < *length) {
+		scratch = realloc(shm->scratch, *length);
+		if (scratch == NULL)
+			return NULL;
+		shm->scratch = scratch;
+		shm->scratch_size = *length;
+	}
+
+	for (done = 0; done < *length; done += len) {
+		len = pread(pool->fd, shm->scratch + done, *length - done,
+			    buffer->offset + done);
+		if (len < 0 && errno == EINTR) {
+			len = 0;
+			continue;
+		}
+		if (len <= 0)
+			return NULL;
+	}
+
+	return shm->scratch;
+}
+
+static void
+handle_commit(struct tracer_hook *hook, struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, commit);
+	struct shm_client *client = get_client(shm, view);
+	struct tracer_instance *instance = view->instance;
+	struct shm_surface *surface;
+	struct shm_buffer *buffer;
+	const uint8_t *data;
+	size_t length, changed;
+	uint8_t *prev;
+
+	if (client == NULL)
+		return;
+
+	surface = tracer_side_table_get(&client->surfaces, view->id);
+	if (surface == NULL || !surface->attached)
+		return;
+
+	surface->attached = 0;
+	buffer = tracer_side_table_get(&client->buffers, surface->pending);
+	if (buffer == NULL)
+		return;
+
+	data = buffer_contents(shm, buffer, &length);
+	if (data == NULL)
+		return;
+
+	if (surface->prev_size == length) {
+		changed = diff_update(surface->prev, data, length);
+	} else {
+		prev = realloc(surface->prev, length);
+		if (prev == NULL)
+			return;
+		surface->prev = prev;
+		surface->prev_size = length;
+		memcpy(prev, data, length);
+		changed = length;
+	}
+
+	surface->commits++;
+	surface->committed_bytes += length;
+	surface->changed_bytes += changed;
+	if (changed == 0)
+		surface->identical++;
+
+	tracer_log("shm: wl_surface@%u commit of wl_buffer@%u: "
+		   "%zu of %zu bytes changed%s",
+		   surface->id, surface->pending, changed, length,
+		   changed == 0 ? ", identical to previous frame" : "");
+	tracer_log_end();
+}
+
+static void
+handle_destroy_surface(struct tracer_hook *hook,
+		       struct tracer_message_view *view)
+{
+	struct shm_analytics *shm =
+		container_of(hook, struct shm_analytics, destroy_surface);
+	struct shm_client *client = get_client(shm, view);
+	struct shm_surface *surface;
+
+	if (client == NULL)
+		return;
+
+	surface = tracer_side_table_remove(&client->surfaces, view->id);
+	if (surface == NULL)
+		return;
+
+	surface_report(view->instance, surface);
+	surface_destroy(surface);
+}
+
+static void
+shm_instance_created(struct tracer_instance_listener *listener,
+		     struct tracer_instance *instance)
+{
+	struct shm_analytics *shm =
+		container_of(listener, struct shm_analytics, listener);
+	struct shm_client *client;
+
+	client = tracer_instance_alloc(instance, sizeof *client);
+	if (client == NULL)
+		return;
+
+	tracer_side_table_init(&client->pools);
+	tracer_side_table_init(&client->buffers);
+	tracer_side_table_init(&client->surfaces);
+	instance->slots[shm->slot] = client;
+}
+
+static void
+shm_instance_destroyed(struct tracer_instance_listener *listener,
+		       struct tracer_instance *instance)
+{
+	struct shm_analytics *shm =
+		container_of(listener, struct shm_analytics, listener);
+	struct shm_client *client = instance->slots[shm->slot];
+	struct shm_surface **p;
+
+	if (client == NULL)
+		return;
+
+	wl_array_for_each(p, &client->surfaces.client_entries) {
+		if (*p != NULL)
+			surface_report(instance, *p);
+	}
+
+	tracer_side_table_release(&client->surfaces, surface_destroy);
+	tracer_side_table_release(&client->buffers, buffer_destroy);
+	tracer_side_table_release(&client->pools, pool_unref);
+	instance->slots[shm->slot] = NULL;
+}
+
+int
+tracer_shm_analytics_init(struct tracer *tracer,
+			  struct tracer_analyzer *analyzer)
+{
+	struct shm_analytics *shm;
+
+	shm = calloc(1, sizeof *shm);
+	if (shm == NULL)
+		return -1;
+
+	shm->create_pool.func = handle_create_pool;
+	shm->resize_pool.func = handle_resize_pool;
+	shm->destroy_pool.func = handle_destroy_pool;
+	shm->create_buffer.func = handle_create_buffer;
+	shm->destroy_buffer.func = handle_destroy_buffer;
+	shm->attach.func = handle_attach;
+	shm->commit.func = handle_commit;
+	shm->destroy_surface.func = handle_destroy_surface;
+
+	if (tracer_analyzer_add_hook(analyzer, "wl_shm", "create_pool", 0,
+				     &shm->create_pool) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_shm_pool", "resize", 0,
+				     &shm->resize_pool) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_shm_pool", "destroy", 0,
+				     &shm->destroy_pool) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_shm_pool", "create_buffer",
+				     0, &shm->create_buffer) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_buffer", "destroy", 0,
+				     &shm->destroy_buffer) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "attach", 0,
+				     &shm->attach) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "commit", 0,
+				     &shm->commit) < 0 ||
+	    tracer_analyzer_add_hook(analyzer, "wl_surface", "destroy", 0,
+				     &shm->destroy_surface) < 0) {
+		fprintf(stderr, "shm analytics need wl_shm, wl_shm_pool, "
+			"wl_buffer and wl_surface from the core protocol\n");
+		return -1;
+	}
+
+	shm->slot = tracer_allocate_slot(tracer);
+	if (shm->slot < 0) {
+		fprintf(stderr, "Too many analyses enabled\n");
+		return -1;
+	}
+
+	shm->listener.created = shm_instance_created;
+	shm->listener.destroyed = shm_instance_destroyed;
+	tracer_add_instance_listener(tracer, &shm->listener);
+
+	select_diff_kernel();
+
+	return 0;
+}
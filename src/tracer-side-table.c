@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "wayland-private.h"
+#include "tracer-side-table.h"
+
+/* Ids far beyond anything allocated so far are bogus, don't grow for them */
+#define SIDE_TABLE_MAX_GROWTH 65536
+
+void
+tracer_side_table_init(struct tracer_side_table *table)
+{
+	wl_array_init(&table->client_entries);
+	wl_array_init(&table->server_entries);
+}
+
+static void
+release_entries(struct wl_array *entries, tracer_side_table_free_func_t func)
+{
+	void **p;
+
+	if (func != NULL) {
+		wl_array_for_each(p, entries) {
+			if (*p != NULL)
+				func(*p);
+		}
+	}
+
+	wl_array_release(entries);
+}
+
+void
+tracer_side_table_release(struct tracer_side_table *table,
+			  tracer_side_table_free_func_t func)
+{
+	release_entries(&table->client_entries, func);
+	release_entries(&table->server_entries, func);
+}
+
+static struct wl_array *
+table_entries(struct tracer_side_table *table, uint32_t *id)
+{
+	if (*id < WL_SERVER_ID_START)
+		return &table->client_entries;
+
+	*id -= WL_SERVER_ID_START;
+	return &table->server_entries;
+}
+
+int
+tracer_side_table_set(struct tracer_side_table *table, uint32_t id,
+		      void *data)
+{
+	struct wl_array *entries;
+	size_t count, grow;
+	void **p;
+
+	entries = table_entries(table, &id);
+	count = entries->size / sizeof *p;
+
+	if (id >= count) {
+		grow = id + 1 - count;
+		if (grow > SIDE_TABLE_MAX_GROWTH) {
+			errno = EINVAL;
+			return -1;
+		}
+		p = wl_array_add(entries, grow * sizeof *p);
+		if (p == NULL)
+			return -1;
+		memset(p, 0, grow * sizeof *p);
+	}
+
+	p = entries->data;
+	p[id] = data;
+
+	return 0;
+}
+
+void *
+tracer_side_table_get(struct tracer_side_table *table, uint32_t id)
+{
+	struct wl_array *entries;
+	void **p;
+
+	entries = table_entries(table, &id);
+	if (id >= entries->size / sizeof *p)
+		return NULL;
+
+	p = entries->data;
+	return p[id];
+}
+
+void *
+tracer_side_table_remove(struct tracer_side_table *table, uint32_t id)
+{
+	struct wl_array *entries;
+	void **p, *data;
+
+	entries = table_entries(table, &id);
+	if (id >= entries->size / sizeof *p)
+		return NULL;
+
+	p = entries->data;
+	data = p[id];
+	p[id] = NULL;
+
+	return data;
+}
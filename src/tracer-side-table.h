@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_SIDE_TABLE_H
+#define TRACER_SIDE_TABLE_H
+
+#include "wayland-util.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Per-object data kept next to an instance's object map, indexed by the
+ * same ids.  Client and server allocated ids are both dense, so each
+ * range is a plain array of pointers.
+ */
+struct tracer_side_table {
+	struct wl_array client_entries;
+	struct wl_array server_entries;
+};
+
+typedef void (*tracer_side_table_free_func_t)(void *data);
+
+void tracer_side_table_init(struct tracer_side_table *table);
+
+void tracer_side_table_release(struct tracer_side_table *table,
+			       tracer_side_table_free_func_t func);
+
+int tracer_side_table_set(struct tracer_side_table *table, uint32_t id,
+			  void *data);
+
+void *tracer_side_table_get(struct tracer_side_table *table, uint32_t id);
+
+void *tracer_side_table_remove(struct tracer_side_table *table, uint32_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
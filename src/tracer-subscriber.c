@@ -0,0 +1,452 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "wayland-os.h"
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-ring.h"
+#include "tracer-subscriber.h"
+
+/*
+ * Every subscriber has its own bounded queue.  The tracer never waits for
+ * a subscriber: records that don't fit are dropped and the subscriber is
+ * told how many it missed once it catches up.  A subscriber that doesn't
+ * read anything for too long is disconnected.
+ */
+#define SUBSCRIBER_QUEUE_SIZE	(256 * 1024)
+#define SUBSCRIBER_MASK(i)	((i) & (SUBSCRIBER_QUEUE_SIZE - 1))
+#define SUBSCRIBER_MAX_DROPS	65536
+
+#define FILTER_ANY -1
+
+struct tracer_subscriber_socket {
+	struct tracer_event_source source;
+	struct sockaddr_un addr;
+	struct tracer *tracer;
+};
+
+struct tracer_subscriber {
+	struct tracer_event_source source;
+	struct tracer *tracer;
+	struct wl_list link;
+	char *queue;
+	uint32_t head, tail;
+	uint32_t mask;
+	uint64_t dropped;
+	uint32_t stalled;
+	int pending_fd;
+	int filter_instance;
+	int filter_socket;
+	int filter_side;
+	char command[256];
+	int command_length;
+};
+
+static void
+subscriber_destroy(struct tracer_subscriber *subscriber)
+{
+	tracer_epoll_remove(subscriber->tracer, &subscriber->source);
+	close(subscriber->source.fd);
+	wl_list_remove(&subscriber->link);
+	free(subscriber->queue);
+	free(subscriber);
+}
+
+static uint32_t
+subscriber_space(struct tracer_subscriber *subscriber)
+{
+	return SUBSCRIBER_QUEUE_SIZE - (subscriber->head - subscriber->tail);
+}
+
+static void
+subscriber_put(struct tracer_subscriber *subscriber,
+	       const void *data, uint32_t count)
+{
+	uint32_t head, size;
+
+	head = SUBSCRIBER_MASK(subscriber->head);
+	if (head + count <= SUBSCRIBER_QUEUE_SIZE) {
+		memcpy(subscriber->queue + head, data, count);
+	} else {
+		size = SUBSCRIBER_QUEUE_SIZE - head;
+		memcpy(subscriber->queue + head, data, size);
+		memcpy(subscriber->queue, (const char *) data + size,
+		       count - size);
+	}
+
+	subscriber->head += count;
+}
+
+static void
+subscriber_put_record(struct tracer_subscriber *subscriber,
+		      const struct tracer_record *record,
+		      const void *payload)
+{
+	static const char padding[TRACER_RECORD_ALIGN];
+
+	subscriber_put(subscriber, record, sizeof *record);
+	subscriber_put(subscriber, payload, record->length);
+	subscriber_put(subscriber, padding,
+		       record->size - sizeof *record - record->length);
+}
+
+static void
+subscriber_set_mask(struct tracer_subscriber *subscriber, uint32_t mask)
+{
+	if (subscriber->mask == mask)
+		return;
+
+	subscriber->mask = mask;
+	tracer_epoll_modify(subscriber->tracer, &subscriber->source, mask);
+}
+
+/* Returns -1 if the subscriber went away */
+static int
+subscriber_write(struct tracer_subscriber *subscriber)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		char data[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	uint32_t head, tail;
+	int len;
+
+	while (subscriber->head != subscriber->tail) {
+		head = SUBSCRIBER_MASK(subscriber->head);
+		tail = SUBSCRIBER_MASK(subscriber->tail);
+
+		iov[0].iov_base = subscriber->queue + tail;
+		if (tail < head) {
+			iov[0].iov_len = head - tail;
+			msg.msg_iovlen = 1;
+		} else {
+			iov[0].iov_len = SUBSCRIBER_QUEUE_SIZE - tail;
+			iov[1].iov_base = subscriber->queue;
+			iov[1].iov_len = head;
+			msg.msg_iovlen = head == 0 ? 1 : 2;
+		}
+
+		msg.msg_name = NULL;
+		msg.msg_namelen = 0;
+		msg.msg_iov = iov;
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+		msg.msg_flags = 0;
+
+		if (subscriber->pending_fd >= 0) {
+			msg.msg_control = control.data;
+			msg.msg_controllen = sizeof control.data;
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &subscriber->pending_fd,
+			       sizeof(int));
+		}
+
+		do {
+			len = sendmsg(subscriber->source.fd, &msg,
+				      MSG_NOSIGNAL | MSG_DONTWAIT);
+		} while (len < 0 && errno == EINTR);
+
+		if (len < 0) {
+			if (errno != EAGAIN)
+				return -1;
+
+			subscriber_set_mask(subscriber, EPOLLIN | EPOLLOUT);
+			return 0;
+		}
+
+		subscriber->tail += len;
+		subscriber->stalled = 0;
+		subscriber->pending_fd = -1;
+	}
+
+	subscriber_set_mask(subscriber, EPOLLIN);
+
+	return 0;
+}
+
+/* The ring fd goes along with the record announcing it */
+static void
+subscriber_send_ring(struct tracer_subscriber *subscriber)
+{
+	struct tracer *tracer = subscriber->tracer;
+	struct tracer_record record;
+	uint64_t size;
+
+	if (tracer->ring == NULL || subscriber->pending_fd >= 0)
+		return;
+
+	memset(&record, 0, sizeof record);
+	record.type = TRACER_RECORD_RING;
+	record.length = sizeof size;
+	record.size = tracer_record_size(sizeof size);
+	record.nfds = 1;
+	if (subscriber_space(subscriber) < record.size)
+		return;
+
+	size = tracer_ring_get_size(tracer->ring);
+	subscriber_put_record(subscriber, &record, &size);
+	subscriber->pending_fd = tracer_ring_get_fd(tracer->ring);
+}
+
+static void
+subscriber_handle_command(struct tracer_subscriber *subscriber, char *line)
+{
+	char *arg;
+
+	arg = strchr(line, ' ');
+	if (arg != NULL)
+		*arg++ = '\0';
+
+	if (!strcmp(line, "instance") && arg != NULL) {
+		if (!strcmp(arg, "any"))
+			subscriber->filter_instance = FILTER_ANY;
+		else
+			subscriber->filter_instance = atoi(arg);
+	} else if (!strcmp(line, "socket") && arg != NULL) {
+		if (!strcmp(arg, "any"))
+			subscriber->filter_socket = FILTER_ANY;
+		else
+			subscriber->filter_socket = atoi(arg);
+	} else if (!strcmp(line, "side") && arg != NULL) {
+		if (!strcmp(arg, "client"))
+			subscriber->filter_side = TRACER_CLIENT_SIDE;
+		else if (!strcmp(arg, "server"))
+			subscriber->filter_side = TRACER_SERVER_SIDE;
+		else
+			subscriber->filter_side = FILTER_ANY;
+	} else if (!strcmp(line, "ring")) {
+		subscriber_send_ring(subscriber);
+	}
+}
+
+static int
+subscriber_read(struct tracer_subscriber *subscriber)
+{
+	char *line, *end;
+	int len;
+
+	len = read(subscriber->source.fd,
+		   subscriber->command + subscriber->command_length,
+		   sizeof subscriber->command - subscriber->command_length - 1);
+	if (len <= 0)
+		return len < 0 && errno == EAGAIN ? 0 : -1;
+
+	subscriber->command_length += len;
+	subscriber->command[subscriber->command_length] = '\0';
+
+	line = subscriber->command;
+	while ((end = strchr(line, '\n')) != NULL) {
+		*end = '\0';
+		subscriber_handle_command(subscriber, line);
+		line = end + 1;
+	}
+
+	subscriber->command_length -= line - subscriber->command;
+	memmove(subscriber->command, line, subscriber->command_length);
+
+	/* A line that doesn't fit is garbage anyway */
+	if (subscriber->command_length == sizeof subscriber->command - 1)
+		subscriber->command_length = 0;
+
+	return 0;
+}
+
+static void
+subscriber_dispatch(struct tracer_event_source *source, uint32_t mask)
+{
+	struct tracer_subscriber *subscriber =
+		container_of(source, struct tracer_subscriber, source);
+
+	if (mask & (EPOLLHUP | EPOLLERR)) {
+		subscriber_destroy(subscriber);
+		return;
+	}
+
+	if ((mask & EPOLLIN) && subscriber_read(subscriber) < 0) {
+		subscriber_destroy(subscriber);
+		return;
+	}
+
+	if (subscriber->pending_fd >= 0)
+		mask |= EPOLLOUT;
+
+	if ((mask & EPOLLOUT) && subscriber_write(subscriber) < 0)
+		subscriber_destroy(subscriber);
+}
+
+static void
+subscriber_socket_dispatch(struct tracer_event_source *source, uint32_t mask)
+{
+	struct tracer_subscriber_socket *s =
+		container_of(source, struct tracer_subscriber_socket, source);
+	struct tracer *tracer = s->tracer;
+	struct tracer_subscriber *subscriber;
+	int fd;
+
+	fd = wl_os_accept_cloexec(source->fd, NULL, NULL);
+	if (fd < 0) {
+		fprintf(stderr, "failed to accept() subscriber: %m\n");
+		return;
+	}
+
+	subscriber = malloc(sizeof *subscriber);
+	if (subscriber == NULL) {
+		close(fd);
+		return;
+	}
+
+	subscriber->queue = malloc(SUBSCRIBER_QUEUE_SIZE);
+	if (subscriber->queue == NULL) {
+		free(subscriber);
+		close(fd);
+		return;
+	}
+
+	subscriber->source.fd = fd;
+	subscriber->source.dispatch = subscriber_dispatch;
+	subscriber->tracer = tracer;
+	subscriber->head = 0;
+	subscriber->tail = 0;
+	subscriber->mask = EPOLLIN;
+	subscriber->dropped = 0;
+	subscriber->stalled = 0;
+	subscriber->pending_fd = -1;
+	subscriber->filter_instance = FILTER_ANY;
+	subscriber->filter_socket = FILTER_ANY;
+	subscriber->filter_side = FILTER_ANY;
+	subscriber->command_length = 0;
+
+	if (tracer_epoll_add(tracer, &subscriber->source, EPOLLIN) < 0) {
+		free(subscriber->queue);
+		free(subscriber);
+		close(fd);
+		return;
+	}
+
+	wl_list_insert(tracer->subscriber_list.prev, &subscriber->link);
+}
+
+void
+tracer_subscriber_publish(struct tracer *tracer,
+			  const struct tracer_record *record,
+			  const void *payload)
+{
+	struct tracer_subscriber *subscriber, *next;
+	struct tracer_record drop;
+	uint64_t count;
+	uint32_t needed;
+
+	wl_list_for_each_safe(subscriber, next, &tracer->subscriber_list, link) {
+		if (subscriber->filter_instance != FILTER_ANY &&
+		    subscriber->filter_instance != (int) record->instance)
+			continue;
+		if (subscriber->filter_socket != FILTER_ANY &&
+		    subscriber->filter_socket != (int) record->socket)
+			continue;
+		if (subscriber->filter_side != FILTER_ANY &&
+		    subscriber->filter_side != record->side)
+			continue;
+
+		needed = record->size;
+		if (subscriber->dropped)
+			needed += tracer_record_size(sizeof count);
+
+		if (subscriber_space(subscriber) < needed) {
+			subscriber->dropped++;
+			tracer->dropped_records++;
+			if (++subscriber->stalled > SUBSCRIBER_MAX_DROPS) {
+				fprintf(stderr, "subscriber stalled, "
+					"disconnecting\n");
+				subscriber_destroy(subscriber);
+			}
+			continue;
+		}
+
+		/* Takes the seq of the record it precedes, see the header */
+		if (subscriber->dropped) {
+			count = subscriber->dropped;
+			drop = *record;
+			drop.type = TRACER_RECORD_DROPPED;
+			drop.length = sizeof count;
+			drop.size = tracer_record_size(sizeof count);
+			drop.nfds = 0;
+			subscriber_put_record(subscriber, &drop, &count);
+			subscriber->dropped = 0;
+		}
+
+		subscriber_put_record(subscriber, record, payload);
+	}
+}
+
+void
+tracer_subscriber_flush(struct tracer *tracer)
+{
+	struct tracer_subscriber *subscriber, *next;
+
+	wl_list_for_each_safe(subscriber, next, &tracer->subscriber_list, link) {
+		/* Already waiting for EPOLLOUT, nothing to do until then */
+		if (subscriber->mask & EPOLLOUT)
+			continue;
+		if (subscriber_write(subscriber) < 0)
+			subscriber_destroy(subscriber);
+	}
+}
+
+int
+tracer_subscriber_socket_create(struct tracer *tracer, const char *name)
+{
+	struct tracer_subscriber_socket *s;
+
+	s = malloc(sizeof *s);
+	if (s == NULL)
+		return -1;
+
+	s->source.fd = tracer_listen_unix(name, 16, &s->addr);
+	if (s->source.fd < 0) {
+		free(s);
+		return -1;
+	}
+
+	s->tracer = tracer;
+	s->source.dispatch = subscriber_socket_dispatch;
+	tracer_epoll_add(tracer, &s->source, EPOLLIN);
+	tracer->subscriber_socket = s;
+
+	return 0;
+}
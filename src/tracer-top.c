@@ -0,0 +1,377 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-top.h"
+
+/*
+ * A top(1) like view.  All counting is done where messages are forwarded
+ * (tracer_instance.counters, tracer_message.count); every refresh only
+ * takes the difference to the previous snapshot.
+ */
+#define TOP_INTERVAL	1000	/* ms */
+#define TOP_ROWS	10
+
+struct top_instance {
+	struct tracer_instance *instance;
+	struct tracer_counters last;
+	double rate, byte_rate, fd_rate;
+	int objects;
+};
+
+struct top_message {
+	struct tracer_message *message;
+	struct tracer_interface *interface;
+	struct top_interface *parent;
+	int event;
+	uint64_t last_count, last_bytes;
+	double rate, byte_rate;
+};
+
+struct top_interface {
+	struct tracer_interface *interface;
+	double rate, byte_rate;
+};
+
+struct top {
+	struct tracer *tracer;
+	struct tracer_instance_listener listener;
+	struct tracer_timer *timer;
+	int slot;
+	struct timespec last;
+
+	struct top_message *messages;
+	struct top_interface *interfaces;
+	int message_count, interface_count;
+
+	/* Scratch space for sorting */
+	struct top_instance **instance_order;
+	int instance_order_size;
+	struct top_message **message_order;
+	struct top_interface **interface_order;
+};
+
+static void
+format_rate(char *buf, size_t size, double rate)
+{
+	if (rate >= 1e6)
+		snprintf(buf, size, "%.1fM", rate / 1e6);
+	else if (rate >= 1e4)
+		snprintf(buf, size, "%.1fK", rate / 1e3);
+	else
+		snprintf(buf, size, "%.0f", rate);
+}
+
+static void
+count_object(void *element, void *data)
+{
+	(*(int *) data)++;
+}
+
+/* The comparison functions sort by rate, descending */
+static int
+compare_top_instance(const void *a, const void *b)
+{
+	const struct top_instance *x = *(struct top_instance * const *) a;
+	const struct top_instance *y = *(struct top_instance * const *) b;
+
+	return (x->rate < y->rate) - (x->rate > y->rate);
+}
+
+static int
+compare_top_message(const void *a, const void *b)
+{
+	const struct top_message *x = *(struct top_message * const *) a;
+	const struct top_message *y = *(struct top_message * const *) b;
+
+	return (x->rate < y->rate) - (x->rate > y->rate);
+}
+
+static int
+compare_top_interface(const void *a, const void *b)
+{
+	const struct top_interface *x = *(struct top_interface * const *) a;
+	const struct top_interface *y = *(struct top_interface * const *) b;
+
+	return (x->rate < y->rate) - (x->rate > y->rate);
+}
+
+static int
+update_instances(struct top *top, double seconds, double *totals)
+{
+	struct tracer_instance *instance;
+	struct top_instance *t, **order;
+	struct tracer_counters *c;
+	int n = 0, count;
+
+	totals[0] = totals[1] = totals[2] = 0;
+
+	count = wl_list_length(&top->tracer->instance_list);
+	if (count > top->instance_order_size) {
+		order = realloc(top->instance_order, count * sizeof *order);
+		if (order == NULL)
+			return 0;
+		top->instance_order = order;
+		top->instance_order_size = count;
+	}
+
+	wl_list_for_each(instance, &top->tracer->instance_list, link) {
+		t = instance->slots[top->slot];
+		if (t == NULL)
+			continue;
+
+		c = &instance->counters;
+		t->rate = (c->messages - t->last.messages) / seconds;
+		t->byte_rate = (c->bytes - t->last.bytes) / seconds;
+		t->fd_rate = (c->fds - t->last.fds) / seconds;
+		t->last = *c;
+
+		t->objects = 0;
+		wl_map_for_each(&instance->map, count_object, &t->objects);
+
+		totals[0] += t->rate;
+		totals[1] += t->byte_rate;
+		totals[2] += t->fd_rate;
+		top->instance_order[n++] = t;
+	}
+
+	qsort(top->instance_order, n, sizeof *top->instance_order,
+	      compare_top_instance);
+
+	return n;
+}
+
+static void
+update_messages(struct top *top, double seconds)
+{
+	struct top_message *m;
+	int i;
+
+	for (i = 0; i < top->interface_count; i++) {
+		top->interfaces[i].rate = 0;
+		top->interfaces[i].byte_rate = 0;
+		top->interface_order[i] = &top->interfaces[i];
+	}
+
+	for (i = 0; i < top->message_count; i++) {
+		m = &top->messages[i];
+		m->rate = (m->message->count - m->last_count) / seconds;
+		m->byte_rate = (m->message->bytes - m->last_bytes) / seconds;
+		m->last_count = m->message->count;
+		m->last_bytes = m->message->bytes;
+		m->parent->rate += m->rate;
+		m->parent->byte_rate += m->byte_rate;
+		top->message_order[i] = m;
+	}
+
+	qsort(top->interface_order, top->interface_count,
+	      sizeof *top->interface_order, compare_top_interface);
+	qsort(top->message_order, top->message_count,
+	      sizeof *top->message_order, compare_top_message);
+}
+
+static void
+top_refresh(void *data)
+{
+	struct top *top = data;
+	struct tracer *tracer = top->tracer;
+	struct top_instance *t;
+	struct top_interface *interface;
+	struct top_message *m;
+	struct timespec now;
+	char rate[3][16], name[256], client[64];
+	double seconds, totals[3];
+	int i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seconds = (now.tv_sec - top->last.tv_sec) +
+		  (now.tv_nsec - top->last.tv_nsec) / 1e9;
+	top->last = now;
+	if (seconds <= 0)
+		return;
+
+	n = update_instances(top, seconds, totals);
+	update_messages(top, seconds);
+
+	format_rate(rate[0], sizeof rate[0], totals[0]);
+	format_rate(rate[1], sizeof rate[1], totals[1]);
+	format_rate(rate[2], sizeof rate[2], totals[2]);
+
+	/* Home the cursor and clear the screen */
+	tracer_print(tracer, "\033[H\033[2J");
+	tracer_print(tracer, "wayland-tracer: %d clients, %s msgs/s, "
+		     "%s bytes/s, %s fds/s\n\n", n, rate[0], rate[1], rate[2]);
+
+	tracer_print(tracer, "%8s %9s %9s %9s %9s\n",
+		     "CLIENT", "MSGS/S", "BYTES/S", "FDS/S", "OBJECTS");
+	for (i = 0; i < n && i < TOP_ROWS; i++) {
+		t = top->instance_order[i];
+		format_rate(rate[0], sizeof rate[0], t->rate);
+		format_rate(rate[1], sizeof rate[1], t->byte_rate);
+		format_rate(rate[2], sizeof rate[2], t->fd_rate);
+		if (tracer->socket_count > 1)
+			snprintf(client, sizeof client, "%s %d",
+				 t->instance->socket_name, t->instance->id);
+		else
+			snprintf(client, sizeof client, "%d", t->instance->id);
+		tracer_print(tracer, "%8s %9s %9s %9s %9d\n",
+			     client, rate[0], rate[1], rate[2], t->objects);
+	}
+
+	tracer_print(tracer, "\n%-40s %9s %9s\n",
+		     "INTERFACE", "MSGS/S", "BYTES/S");
+	for (i = 0; i < top->interface_count && i < TOP_ROWS; i++) {
+		interface = top->interface_order[i];
+		if (interface->rate == 0)
+			break;
+		format_rate(rate[0], sizeof rate[0], interface->rate);
+		format_rate(rate[1], sizeof rate[1], interface->byte_rate);
+		tracer_print(tracer, "%-40s %9s %9s\n",
+			     interface->interface->name, rate[0], rate[1]);
+	}
+
+	tracer_print(tracer, "\n%-40s %9s %9s\n",
+		     "MESSAGE", "MSGS/S", "BYTES/S");
+	for (i = 0; i < top->message_count && i < TOP_ROWS; i++) {
+		m = top->message_order[i];
+		if (m->rate == 0)
+			break;
+		snprintf(name, sizeof name, "%s %s.%s",
+			 m->event ? "=>" : "<=", m->interface->name,
+			 m->message->name);
+		format_rate(rate[0], sizeof rate[0], m->rate);
+		format_rate(rate[1], sizeof rate[1], m->byte_rate);
+		tracer_print(tracer, "%-40s %9s %9s\n", name, rate[0], rate[1]);
+	}
+
+	fflush(tracer->outfp);
+}
+
+static void
+top_instance_created(struct tracer_instance_listener *listener,
+		     struct tracer_instance *instance)
+{
+	struct top *top = container_of(listener, struct top, listener);
+	struct top_instance *t;
+
+	t = tracer_instance_alloc(instance, sizeof *t);
+	if (t == NULL)
+		return;
+
+	t->instance = instance;
+	instance->slots[top->slot] = t;
+}
+
+static void
+top_instance_destroyed(struct tracer_instance_listener *listener,
+		       struct tracer_instance *instance)
+{
+	struct top *top = container_of(listener, struct top, listener);
+
+	instance->slots[top->slot] = NULL;
+}
+
+static void
+add_messages(struct top *top, struct top_interface *parent,
+	     struct tracer_message **messages, int count, int event)
+{
+	struct top_message *m;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		m = &top->messages[top->message_count++];
+		memset(m, 0, sizeof *m);
+		m->message = messages[i];
+		m->interface = parent->interface;
+		m->parent = parent;
+		m->event = event;
+	}
+}
+
+int
+tracer_top_init(struct tracer *tracer, struct tracer_analyzer *analyzer)
+{
+	struct tracer_interface *interface;
+	struct top_interface *parent;
+	struct top *top;
+	int interfaces = 0, messages = 0;
+
+	top = calloc(1, sizeof *top);
+	if (top == NULL)
+		return -1;
+
+	wl_list_for_each(interface, &analyzer->interface_list, link) {
+		interfaces++;
+		messages += interface->method_count + interface->event_count;
+	}
+
+	top->tracer = tracer;
+	top->interfaces = calloc(interfaces, sizeof *top->interfaces);
+	top->interface_order = calloc(interfaces,
+				      sizeof *top->interface_order);
+	top->messages = calloc(messages, sizeof *top->messages);
+	top->message_order = calloc(messages, sizeof *top->message_order);
+	if ((interfaces && (top->interfaces == NULL ||
+			    top->interface_order == NULL)) ||
+	    (messages && (top->messages == NULL ||
+			  top->message_order == NULL))) {
+		fprintf(stderr, "Failed to set up top view: %m\n");
+		return -1;
+	}
+
+	wl_list_for_each(interface, &analyzer->interface_list, link) {
+		parent = &top->interfaces[top->interface_count++];
+		parent->interface = interface;
+		add_messages(top, parent, interface->methods,
+			     interface->method_count, 0);
+		add_messages(top, parent, interface->events,
+			     interface->event_count, 1);
+	}
+
+	top->slot = tracer_allocate_slot(tracer);
+	if (top->slot < 0) {
+		fprintf(stderr, "Too many analyses enabled\n");
+		return -1;
+	}
+
+	top->listener.created = top_instance_created;
+	top->listener.destroyed = top_instance_destroyed;
+	tracer_add_instance_listener(tracer, &top->listener);
+
+	clock_gettime(CLOCK_MONOTONIC, &top->last);
+	top->timer = tracer_timer_create(tracer, TOP_INTERVAL,
+					 top_refresh, top);
+	if (top->timer == NULL) {
+		fprintf(stderr, "Failed to create timer: %m\n");
+		return -1;
+	}
+
+	return 0;
+}
@@ -20,6 +20,8 @@
  * OF THIS SOFTWARE.
  */
 
+#include "../config.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -32,9 +34,13 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <stdint.h>
 #include <time.h>
+#include <signal.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -43,8 +49,18 @@
 #include "wayland-util.h"
 #include "tracer.h"
 #include "tracer-analyzer.h"
+#include "tracer-capture.h"
 #include "frontend-analyze.h"
 #include "frontend-bin.h"
+#include "tracer-fdinfo.h"
+#include "tracer-metrics.h"
+#include "tracer-plugin.h"
+#include "tracer-probes.h"
+#include "tracer-profile.h"
+#include "tracer-replay.h"
+#include "tracer-ring.h"
+#include "tracer-subscriber.h"
+#include "wayland-tracer-record.h"
 
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX 108
@@ -53,12 +69,63 @@
 #define LOCK_SUFFIX ".lock"
 #define LOCK_SUFFIXLEN 5
 
+#define TRACER_DEFAULT_BACKLOG 128
+
+#define TRACER_DEFAULT_PROTOCOL_PATH "/usr/share/wayland:/usr/share/wayland-protocols"
+
+#define TRACER_PRELOAD_LIBRARY PKGLIBDIR "/wayland-tracer-preload.so"
+
+/* The most a single read can return, the size of wl_connection's buffer */
+#define TRACER_BATCH_SIZE	4096
+
+/* Bounds of the data waiting for one side, see tracer_connection_flush() */
+#define TRACER_QUEUE_HIGH	(256 * 1024)
+#define TRACER_QUEUE_LOW	(64 * 1024)
+#define TRACER_QUEUE_KEEP	(64 * 1024)
+#define TRACER_MAX_FDS_OUT	28
+
+struct tracer_queued_fd {
+	int32_t fd;
+	uint64_t position;
+};
+
 /* A simple copy of wl_socket in wayland-server.c */
 struct tracer_socket {
+	struct tracer_event_source source;
 	int fd;
 	int fd_lock;
 	struct sockaddr_un addr;
 	char lock_addr[UNIX_PATH_MAX + LOCK_SUFFIXLEN];
+	struct tracer *tracer;
+	struct socket_option *option;
+	FILE *outfp;
+	int index;
+	int next_id;
+	struct wl_list retry_list;
+	struct tracer_timer *retry_timer;
+	struct wl_list link;
+};
+
+/*
+ * A client that has been accepted but whose connection to the upstream
+ * compositor isn't established yet.  Connecting never blocks the main
+ * loop: it either completes through EPOLLOUT, or, if the compositor's
+ * listen backlog is full, is retried every UPSTREAM_RETRY_INTERVAL ms.
+ */
+#define UPSTREAM_RETRY_INTERVAL	10
+#define UPSTREAM_MAX_RETRIES	200
+
+struct tracer_upstream {
+	struct tracer_event_source source;
+	struct tracer_socket *socket;
+	int clientfd;
+	int retries;
+	struct wl_list link;
+};
+
+struct tracer_signal {
+	struct tracer_event_source source;
+	struct tracer *tracer;
 };
 
 void
@@ -84,62 +151,96 @@ tracer_log_impl(struct tracer_instance *instance, const char *fmt, ...)
 	unsigned int time;
 	struct tracer *tracer = instance->tracer;
 	va_list ap;
+	int stage;
+
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_FORMAT);
 
 	clock_gettime(CLOCK_REALTIME, &tp);
 	time = (tp.tv_sec * 1000000L) + (tp.tv_nsec / 1000);
 
-	tracer_print(tracer, "[%10.3f] ", time / 1000.0);
+	fprintf(instance->outfp, "[%10.3f] ", time / 1000.0);
 
-	if (tracer->socket != NULL)
-		tracer_print(tracer, "%d: ", instance->id);
+	/* Ids are per socket */
+	if (instance->socket_name != NULL && tracer->socket_count > 1)
+		fprintf(instance->outfp, "%s %d: ",
+			instance->socket_name, instance->id);
+	else if (instance->socket_name != NULL)
+		fprintf(instance->outfp, "%d: ", instance->id);
 
 	va_start(ap, fmt);
-	tracer_vprint(tracer, fmt, ap);
+	vfprintf(instance->outfp, fmt, ap);
 	va_end(ap);
+
+	tracer_profile_leave(tracer, stage);
 }
 
 void
 tracer_log_cont_impl(struct tracer_instance *instance, const char *fmt, ...)
 {
 	va_list ap;
+	int stage;
+
+	stage = tracer_profile_enter(instance->tracer, TRACER_STAGE_FORMAT);
 
 	va_start(ap, fmt);
-	tracer_vprint(instance->tracer, fmt, ap);
+	vfprintf(instance->outfp, fmt, ap);
 	va_end(ap);
+
+	tracer_profile_leave(instance->tracer, stage);
 }
 
 void
 tracer_log_end_impl(struct tracer_instance *instance)
 {
 	struct tracer *tracer = instance->tracer;
+	int stage;
+
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_FORMAT);
+	fprintf(instance->outfp, "\n");
 
-	tracer_print(tracer, "\n");
-	fflush(tracer->outfp);
+	/* Batches are flushed as a whole */
+	if (!tracer->in_batch) {
+		tracer_profile_enter(tracer, TRACER_STAGE_WRITE);
+		fflush(instance->outfp);
+	}
+
+	tracer_profile_leave(tracer, stage);
 }
 
 /* The following two functions are taken from wayland-client.c*/
-static int
-tracer_connect_to_socket(const char *name)
+/*
+ * With in_progress set, the socket is non-blocking: a connect that can't
+ * complete right away sets *in_progress and the fd becomes writable once
+ * it's done, one refused because the listen backlog is full fails with
+ * EAGAIN.
+ */
+int
+tracer_connect_to_socket(const char *name, int *in_progress)
 {
 	struct sockaddr_un addr;
 	socklen_t size;
 	const char *runtime_dir;
 	int name_size, fd;
 
-	runtime_dir = getenv("XDG_RUNTIME_DIR");
-	if (!runtime_dir) {
-		fprintf(stderr, "error: XDG_RUNTIME_DIR not set in the environment.\n");
-		/* to prevent programs reporting
-		 * "failed to create display: Success" */
-		errno = ENOENT;
-		return -1;
-	}
-
 	if (name == NULL)
 		name = getenv("WAYLAND_DISPLAY");
 	if (name == NULL)
 		name = "wayland-0";
 
+	/* Upstream compositors given with -S may be absolute paths */
+	if (name[0] == '/') {
+		runtime_dir = "";
+	} else {
+		runtime_dir = getenv("XDG_RUNTIME_DIR");
+		if (!runtime_dir) {
+			fprintf(stderr, "error: XDG_RUNTIME_DIR not set in the environment.\n");
+			/* to prevent programs reporting
+			 * "failed to create display: Success" */
+			errno = ENOENT;
+			return -1;
+		}
+	}
+
 	fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
 	if (fd < 0)
 		return -1;
@@ -148,7 +249,8 @@ tracer_connect_to_socket(const char *name)
 	addr.sun_family = AF_LOCAL;
 	name_size =
 		snprintf(addr.sun_path, sizeof addr.sun_path,
-			 "%s/%s", runtime_dir, name) + 1;
+			 "%s%s%s", runtime_dir, name[0] == '/' ? "" : "/",
+			 name) + 1;
 
 	assert(name_size > 0);
 	if (name_size > (int)sizeof addr.sun_path) {
@@ -163,7 +265,19 @@ tracer_connect_to_socket(const char *name)
 
 	size = offsetof (struct sockaddr_un, sun_path) + name_size;
 
+	if (in_progress != NULL) {
+		*in_progress = 0;
+		if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
 	if (connect(fd, (struct sockaddr *) &addr, size) < 0) {
+		if (in_progress != NULL && errno == EINPROGRESS) {
+			*in_progress = 1;
+			return fd;
+		}
 		close(fd);
 		return -1;
 	}
@@ -188,92 +302,590 @@ tracer_connect_server(const char *name)
 			fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
 		unsetenv("WAYLAND_SOCKET");
 	} else
-		fd = tracer_connect_to_socket(name);
+		fd = tracer_connect_to_socket(name, NULL);
 
 	return fd;
 }
 
+int
+tracer_allocate_slot(struct tracer *tracer)
+{
+	if (tracer->next_slot == TRACER_INSTANCE_SLOTS)
+		return -1;
+
+	return tracer->next_slot++;
+}
+
+/* What the tracer itself keeps for an instance, analyses aside */
+size_t
+tracer_instance_memory(struct tracer_instance *instance)
+{
+	struct tracer_connection *conn[2];
+	size_t size;
+	int i;
+
+	size = sizeof *instance + instance->arena.size +
+	       instance->map.client_entries.alloc +
+	       instance->map.server_entries.alloc;
+
+	conn[0] = instance->client_conn;
+	conn[1] = instance->server_conn;
+	for (i = 0; i < 2; i++)
+		size += wl_connection_memory(conn[i]->wl_conn) +
+			conn[i]->out.data.alloc + conn[i]->out.fds.alloc;
+
+	return size;
+}
+
+/*
+ * Zeroed memory that is freed together with the instance, for state that
+ * lives as long as it does, such as what analyses keep in their slots.
+ */
+void *
+tracer_instance_alloc(struct tracer_instance *instance, size_t size)
+{
+	return tracer_arena_alloc(&instance->arena, size);
+}
+
+void
+tracer_add_instance_listener(struct tracer *tracer,
+			     struct tracer_instance_listener *listener)
+{
+	wl_list_insert(tracer->instance_listener_list.prev, &listener->link);
+}
+
+static void
+tracer_connection_dispatch(struct tracer_event_source *source, uint32_t mask);
+
 static struct tracer_connection*
-tracer_connection_create(int fd, int side)
+tracer_connection_create(struct tracer_instance *instance, int fd, int side)
 {
 	struct tracer_connection *connection;
 
-	connection = malloc(sizeof *connection);
-	if (connection == NULL) {
-		errno = ENOMEM;
+	connection = tracer_instance_alloc(instance, sizeof *connection);
+	if (connection == NULL)
 		return NULL;
-	}
 
 	connection->wl_conn = wl_connection_create(fd);
 	if (connection->wl_conn == NULL)
 		return NULL;
 
+	connection->instance = instance;
 	connection->side = side;
+	connection->source.fd = fd;
+	connection->source.dispatch = tracer_connection_dispatch;
+	connection->mask = EPOLLIN;
+	connection->blocked = 0;
+	connection->hup = 0;
+	connection->stalls = 0;
+
+	memset(&connection->out, 0, sizeof connection->out);
+	wl_array_init(&connection->out.data);
+	wl_array_init(&connection->out.fds);
 
 	return connection;
 }
 
+/* Forgets what hasn't been sent yet */
+static void
+tracer_queue_drop(struct tracer_queue *queue)
+{
+	struct tracer_queued_fd *qfd;
+
+	for (qfd = (void *) ((char *) queue->fds.data + queue->fd_tail);
+	     (char *) qfd < (char *) queue->fds.data + queue->fds.size; qfd++)
+		close(qfd->fd);
+	queue->fd_tail = queue->fds.size;
+	queue->tail = queue->data.size;
+}
+
 static void
 tracer_connection_destroy(struct tracer_connection *connection)
 {
-	struct wl_connection *wl_conn = connection->wl_conn;
 	struct tracer *tracer = connection->instance->tracer;
+	struct tracer_queue *queue = &connection->out;
 
-	epoll_ctl(tracer->epollfd, EPOLL_CTL_DEL, wl_conn->fd, NULL);
+	tracer_queue_drop(queue);
+	wl_array_release(&queue->fds);
+	wl_array_release(&queue->data);
+
+	tracer_epoll_remove(tracer, &connection->source);
 	wl_connection_destroy(connection->wl_conn);
-	free(connection);
+}
+
+size_t
+tracer_connection_pending(struct tracer_connection *connection)
+{
+	return connection->out.data.size - connection->out.tail;
+}
+
+/*
+ * Queues data for the other side, it goes out once the socket takes it.
+ * The queue is bounded by not reading from the connection feeding it
+ * while it's above TRACER_QUEUE_HIGH, see tracer_connection_flush().
+ */
+int
+tracer_connection_write(struct tracer_connection *connection,
+			const void *data, size_t count)
+{
+	void *p;
+
+	p = wl_array_add(&connection->out.data, count);
+	if (p == NULL) {
+		fprintf(stderr, "Failed to queue %zu bytes: %m\n", count);
+		return -1;
+	}
+	memcpy(p, data, count);
+
+	return 0;
+}
+
+/* The fd goes out with the data written after it, and is closed then */
+int
+tracer_connection_put_fd(struct tracer_connection *connection, int fd)
+{
+	struct tracer_queue *queue = &connection->out;
+	struct tracer_queued_fd *qfd;
+
+	qfd = wl_array_add(&queue->fds, sizeof *qfd);
+	if (qfd == NULL) {
+		fprintf(stderr, "Failed to queue fd: %m\n");
+		close(fd);
+		return -1;
+	}
+	qfd->fd = fd;
+	qfd->position = queue->base + queue->data.size;
+
+	return 0;
+}
+
+/* Drops what has been sent, and gives memory back after a burst */
+static void
+tracer_queue_compact(struct tracer_queue *queue)
+{
+	if (queue->tail == queue->data.size) {
+		queue->base += queue->tail;
+		queue->tail = 0;
+		queue->data.size = 0;
+		if (queue->data.alloc > TRACER_QUEUE_KEEP) {
+			wl_array_release(&queue->data);
+			wl_array_init(&queue->data);
+		}
+	} else if (queue->tail > queue->data.size / 2) {
+		memmove(queue->data.data,
+			(char *) queue->data.data + queue->tail,
+			queue->data.size - queue->tail);
+		queue->base += queue->tail;
+		queue->data.size -= queue->tail;
+		queue->tail = 0;
+	}
+
+	if (queue->fd_tail == queue->fds.size) {
+		queue->fds.size = 0;
+		queue->fd_tail = 0;
+	} else if (queue->fd_tail > queue->fds.size / 2) {
+		memmove(queue->fds.data,
+			(char *) queue->fds.data + queue->fd_tail,
+			queue->fds.size - queue->fd_tail);
+		queue->fds.size -= queue->fd_tail;
+		queue->fd_tail = 0;
+	}
 }
 
 static int
-tracer_epoll_add_fd(struct tracer *tracer, int fd, void *userdata)
+tracer_queue_send(struct tracer_queue *queue, int fd)
+{
+	struct tracer_queued_fd *qfd, *end;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		char data[CMSG_SPACE(TRACER_MAX_FDS_OUT * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	uint64_t position;
+	size_t len;
+	ssize_t sent;
+	int i, nfds;
+
+	while (queue->tail < queue->data.size) {
+		position = queue->base + queue->tail;
+		len = queue->data.size - queue->tail;
+
+		/* Take the fds of the messages starting in what we send */
+		qfd = (void *) ((char *) queue->fds.data + queue->fd_tail);
+		end = (void *) ((char *) queue->fds.data + queue->fds.size);
+		for (nfds = 0; qfd + nfds < end; nfds++) {
+			if (qfd[nfds].position >= position + len)
+				break;
+			if (nfds == TRACER_MAX_FDS_OUT) {
+				/* The rest goes with the next sendmsg */
+				len = qfd[nfds].position > position ?
+				      qfd[nfds].position - position : 1;
+				break;
+			}
+		}
+
+		iov.iov_base = (char *) queue->data.data + queue->tail;
+		iov.iov_len = len;
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (nfds > 0) {
+			msg.msg_control = control.data;
+			msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+			for (i = 0; i < nfds; i++)
+				memcpy(CMSG_DATA(cmsg) + i * sizeof(int),
+				       &qfd[i].fd, sizeof(int));
+		}
+
+		do {
+			sent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		} while (sent < 0 && errno == EINTR);
+
+		if (sent < 0)
+			return errno == EAGAIN ? 0 : -1;
+
+		for (i = 0; i < nfds; i++)
+			close(qfd[i].fd);
+		queue->fd_tail += nfds * sizeof *qfd;
+		queue->tail += sent;
+	}
+
+	return 0;
+}
+
+static void
+tracer_connection_update(struct tracer_connection *connection)
+{
+	struct tracer *tracer = connection->instance->tracer;
+	uint32_t mask = 0;
+
+	/* Hung up and out of the epoll set, only waiting to be destroyed */
+	if (connection->hup)
+		return;
+
+	if (!connection->blocked)
+		mask |= EPOLLIN;
+	if (tracer_connection_pending(connection) > 0)
+		mask |= EPOLLOUT;
+
+	if (mask != connection->mask &&
+	    tracer_epoll_modify(tracer, &connection->source, mask) == 0)
+		connection->mask = mask;
+}
+
+/*
+ * Sends as much queued data as the socket takes and waits for EPOLLOUT
+ * for the rest.  While more than TRACER_QUEUE_HIGH bytes are waiting we
+ * stop reading from the peer, until it drains below TRACER_QUEUE_LOW, so
+ * that a side that doesn't keep up slows the other down rather than
+ * making the tracer buffer without end.
+ */
+static void
+tracer_connection_flush(struct tracer_connection *connection)
+{
+	struct tracer_connection *peer = connection->peer;
+	size_t pending;
+
+	/* Decoding a capture, there's nobody to send to */
+	if (connection->source.fd < 0) {
+		tracer_queue_drop(&connection->out);
+		tracer_queue_compact(&connection->out);
+		return;
+	}
+
+	TRACER_PROBE(flush_start, connection->instance->id, connection->side,
+		     tracer_connection_pending(connection), -1);
+	if (tracer_queue_send(&connection->out, connection->source.fd) < 0) {
+		/* The hangup will be reported through epoll */
+		return;
+	}
+	tracer_queue_compact(&connection->out);
+
+	pending = tracer_connection_pending(connection);
+	TRACER_PROBE(flush_done, connection->instance->id, connection->side,
+		     pending, -1);
+	if (!peer->blocked && pending > TRACER_QUEUE_HIGH) {
+		peer->blocked = 1;
+		peer->stalls++;
+	} else if (peer->blocked && pending <= TRACER_QUEUE_LOW) {
+		peer->blocked = 0;
+	}
+
+	tracer_connection_update(connection);
+	tracer_connection_update(peer);
+}
+
+int
+tracer_epoll_add(struct tracer *tracer, struct tracer_event_source *source,
+		 uint32_t mask)
 {
 	struct epoll_event ev;
 
-	ev.events = EPOLLIN;
-	ev.data.ptr = userdata;
+	ev.events = mask;
+	ev.data.ptr = source;
 
-	return epoll_ctl(tracer->epollfd, EPOLL_CTL_ADD, fd, &ev);
+	return epoll_ctl(tracer->epollfd, EPOLL_CTL_ADD, source->fd, &ev);
+}
+
+int
+tracer_epoll_modify(struct tracer *tracer, struct tracer_event_source *source,
+		    uint32_t mask)
+{
+	struct epoll_event ev;
+
+	ev.events = mask;
+	ev.data.ptr = source;
+
+	return epoll_ctl(tracer->epollfd, EPOLL_CTL_MOD, source->fd, &ev);
+}
+
+void
+tracer_epoll_remove(struct tracer *tracer, struct tracer_event_source *source)
+{
+	epoll_ctl(tracer->epollfd, EPOLL_CTL_DEL, source->fd, NULL);
 }
 
 static int
-tracer_instance_create(struct tracer *tracer, int clientfd)
+unix_socket_is_stale(struct sockaddr_un *addr, socklen_t size)
+{
+	int fd, ret;
+
+	fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
+	if (fd < 0)
+		return 0;
+
+	ret = connect(fd, (struct sockaddr *) addr, size) < 0 &&
+	      errno == ECONNREFUSED;
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Listens on a unix socket named name, relative to XDG_RUNTIME_DIR
+ * unless it is an absolute path, replacing a stale socket left behind
+ * by a dead process.  Returns the listening fd with its address in addr.
+ */
+int
+tracer_listen_unix(const char *name, int backlog, struct sockaddr_un *addr)
+{
+	const char *runtime_dir;
+	socklen_t size;
+	int fd, name_size;
+
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_LOCAL;
+
+	if (name[0] == '/') {
+		name_size = snprintf(addr->sun_path, sizeof addr->sun_path,
+				     "%s", name) + 1;
+	} else {
+		runtime_dir = getenv("XDG_RUNTIME_DIR");
+		if (!runtime_dir) {
+			fprintf(stderr, "error: XDG_RUNTIME_DIR not set "
+				"in the environment\n");
+			return -1;
+		}
+		name_size = snprintf(addr->sun_path, sizeof addr->sun_path,
+				     "%s/%s", runtime_dir, name) + 1;
+	}
+
+	if (name_size > (int) sizeof addr->sun_path) {
+		fprintf(stderr, "error: socket path for \"%s\" "
+			"exceeds 108 bytes\n", name);
+		return -1;
+	}
+
+	size = offsetof (struct sockaddr_un, sun_path) + name_size;
+
+	if (unix_socket_is_stale(addr, size))
+		unlink(addr->sun_path);
+
+	fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *) addr, size) < 0) {
+		fprintf(stderr, "bind() failed with error: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, backlog) < 0) {
+		fprintf(stderr, "listen() failed with error: %m\n");
+		unlink(addr->sun_path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct tracer_timer {
+	struct tracer_event_source source;
+	struct tracer *tracer;
+	tracer_timer_func_t func;
+	void *data;
+};
+
+static void
+tracer_timer_dispatch(struct tracer_event_source *source, uint32_t mask)
+{
+	struct tracer_timer *timer =
+		container_of(source, struct tracer_timer, source);
+	uint64_t expirations;
+
+	if (read(source->fd, &expirations, sizeof expirations) !=
+	    sizeof expirations)
+		return;
+
+	timer->func(timer->data);
+}
+
+/* Calls func every interval milliseconds from the main loop */
+struct tracer_timer *
+tracer_timer_create(struct tracer *tracer, uint32_t interval,
+		    tracer_timer_func_t func, void *data)
+{
+	struct tracer_timer *timer;
+	struct itimerspec its;
+
+	timer = malloc(sizeof *timer);
+	if (timer == NULL)
+		return NULL;
+
+	timer->source.fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timer->source.fd < 0) {
+		free(timer);
+		return NULL;
+	}
+
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = (interval % 1000) * 1000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(timer->source.fd, 0, &its, NULL) < 0) {
+		close(timer->source.fd);
+		free(timer);
+		return NULL;
+	}
+
+	timer->source.dispatch = tracer_timer_dispatch;
+	timer->tracer = tracer;
+	timer->func = func;
+	timer->data = data;
+
+	if (tracer_epoll_add(tracer, &timer->source, EPOLLIN) < 0) {
+		close(timer->source.fd);
+		free(timer);
+		return NULL;
+	}
+
+	return timer;
+}
+
+void
+tracer_timer_destroy(struct tracer_timer *timer)
+{
+	tracer_epoll_remove(timer->tracer, &timer->source);
+	close(timer->source.fd);
+	free(timer);
+}
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t
+tracer_now(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+void
+tracer_record_message(struct tracer_connection *connection,
+		      const void *data, uint32_t length, int nfds)
+{
+	struct tracer_instance *instance = connection->instance;
+	struct tracer *tracer = instance->tracer;
+	struct tracer_record record;
+
+	/* In raw mode a "message" is whatever came in one read */
+	instance->counters.messages++;
+	instance->counters.bytes += length;
+	instance->counters.fds += nfds;
+
+	/* Nobody's listening, don't bother building the record */
+	if (wl_list_empty(&tracer->subscriber_list) && tracer->ring == NULL &&
+	    tracer->capture == NULL)
+		return;
+
+	memset(&record, 0, sizeof record);
+	record.size = tracer_record_size(length);
+	record.length = length;
+	record.type = TRACER_RECORD_MESSAGE;
+	record.side = connection->side;
+	record.instance = instance->id;
+	record.socket = instance->socket;
+	record.nfds = nfds;
+	record.seq = tracer->next_seq++;
+	record.timestamp = connection->timestamp;
+
+	if (tracer->ring != NULL)
+		tracer_ring_publish(tracer->ring, &record, data);
+	if (tracer->capture != NULL)
+		tracer_capture_write(tracer->capture, &record, data);
+	tracer_subscriber_publish(tracer, &record, data);
+}
+
+/* Takes ownership of both fds, they are closed on failure */
+static int
+tracer_instance_create(struct tracer *tracer, struct tracer_socket *socket,
+		       int clientfd, int serverfd)
 {
-	int serverfd;
 	struct tracer_instance *instance;
+	struct tracer_instance_listener *listener;
 	/* XXX: Dirty hack, remove it later */
 	struct tracer_analyzer *analyzer;
 
 	analyzer = (struct tracer_analyzer *) tracer->frontend_data;
 	instance = malloc(sizeof *instance);
 	if (instance == NULL) {
+		close(clientfd);
+		close(serverfd);
 		errno = ENOMEM;
 		return -1;
 	}
+	memset(instance->slots, 0, sizeof instance->slots);
+	memset(&instance->counters, 0, sizeof instance->counters);
+	tracer_arena_init(&instance->arena);
+	instance->tracer = tracer;
 
-	if (tracer->socket == NULL)
-		serverfd = tracer_connect_server(NULL);
-	else
-		serverfd = tracer_connect_to_socket(NULL);
-
-	if (serverfd < 0)
-		goto err_server;
-
-	instance->server_conn = tracer_connection_create(serverfd,
+	instance->server_conn = tracer_connection_create(instance, serverfd,
 							 TRACER_SERVER_SIDE);
 	if (instance->server_conn == NULL)
 		goto err_conn;
 
-	instance->client_conn = tracer_connection_create(clientfd,
+	instance->client_conn = tracer_connection_create(instance, clientfd,
 							 TRACER_CLIENT_SIDE);
-	if (instance->client_conn == NULL)
-		goto err_conn;
+	if (instance->client_conn == NULL) {
+		tracer_connection_destroy(instance->server_conn);
+		close(clientfd);
+		tracer_arena_release(&instance->arena);
+		free(instance);
+		return -1;
+	}
 
 	instance->server_conn->peer = instance->client_conn;
 	instance->client_conn->peer = instance->server_conn;
 
-	instance->server_conn->instance = instance;
-	instance->client_conn->instance = instance;
-
 	wl_map_init(&instance->map, WL_MAP_CLIENT_SIDE);
 
 	if (analyzer != NULL) {
@@ -282,117 +894,615 @@ tracer_instance_create(struct tracer *tracer, int clientfd)
 				  analyzer->display_interface);
 	}
 
-	tracer_epoll_add_fd(tracer, serverfd, instance->server_conn);
-	tracer_epoll_add_fd(tracer, clientfd, instance->client_conn);
+	tracer_epoll_add(tracer, &instance->server_conn->source, EPOLLIN);
+	tracer_epoll_add(tracer, &instance->client_conn->source, EPOLLIN);
 
-	instance->tracer = tracer;
-	instance->id = tracer->next_id;
-	tracer->next_id++;
+	if (socket != NULL) {
+		instance->id = socket->next_id++;
+		instance->socket = socket->index;
+		instance->socket_name = socket->option->name;
+		instance->outfp = socket->outfp;
+	} else {
+		instance->id = tracer->next_id++;
+		instance->socket = 0;
+		instance->socket_name = NULL;
+		instance->outfp = tracer->outfp;
+	}
 
 	wl_list_insert(&tracer->instance_list, &instance->link);
-	return 0;
+	TRACER_PROBE(instance_create, instance->id, -1, 0, -1);
 
-err_server:
-	close(clientfd);
-	free(instance);
-	return -1;
+	wl_list_for_each(listener, &tracer->instance_listener_list, link) {
+		if (listener->created)
+			listener->created(listener, instance);
+	}
+
+	return 0;
 
 err_conn:
 	close(clientfd);
 	close(serverfd);
+	tracer_arena_release(&instance->arena);
 	free(instance);
 	return -1;
 }
 
 static void
-tracer_instance_destroy(struct tracer_instance *instance)
+tracer_instance_destroy(struct tracer_instance *instance)
+{
+	struct tracer_instance_listener *listener;
+	struct tracer *tracer = instance->tracer;
+
+	TRACER_PROBE(instance_destroy, instance->id, -1, 0, -1);
+
+	wl_list_for_each(listener, &tracer->instance_listener_list, link) {
+		if (listener->destroyed)
+			listener->destroyed(listener, instance);
+	}
+
+	tracer_connection_destroy(instance->server_conn);
+	tracer_connection_destroy(instance->client_conn);
+
+	wl_list_remove(&instance->link);
+
+	/* Server mode may see thousands of clients, leave nothing behind */
+	wl_map_release(&instance->map);
+	tracer_arena_release(&instance->arena);
+	free(instance);
+}
+
+static void
+tracer_instance_close(struct tracer_instance *instance)
+{
+	struct tracer *tracer = instance->tracer;
+	int single = instance->socket_name == NULL;
+
+	tracer_instance_destroy(instance);
+
+	if (single) {
+		fprintf(stderr, "Child hups, exiting\n");
+		tracer->running = 0;
+	}
+}
+
+static int
+tracer_handle_data(struct tracer_connection *connection);
+
+static void
+tracer_handle_hup(struct tracer_connection *connection)
+{
+	struct tracer *tracer = connection->instance->tracer;
+	struct tracer_connection *peer = connection->peer;
+
+	/*
+	 * Forward whatever this side sent before hanging up, even if the
+	 * other side is backed up, and only close once it took it all.
+	 */
+	if (!connection->hup && !peer->hup) {
+		connection->hup = 1;
+		while (tracer_handle_data(connection) > 0)
+			;
+		if (tracer_connection_pending(peer) > 0) {
+			tracer_epoll_remove(tracer, &connection->source);
+			return;
+		}
+	}
+
+	tracer_instance_close(connection->instance);
+}
+
+/*
+ * Finds the complete messages in what has been read in a single pass over
+ * the headers and hands them to the frontend at once.
+ */
+static void
+tracer_handle_batch(struct tracer_connection *connection, int len)
+{
+	struct tracer_instance *instance = connection->instance;
+	struct tracer *tracer = instance->tracer;
+	uint32_t data[TRACER_BATCH_SIZE / sizeof(uint32_t)];
+	struct tracer_message_desc messages[TRACER_BATCH_SIZE / 8];
+	uint32_t offset, size;
+	int count = 0, stage;
+
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_FRAME);
+
+	wl_connection_copy(connection->wl_conn, data, len);
+
+	for (offset = 0; len - offset >= 8; offset += size) {
+		size = data[offset / 4 + 1] >> 16;
+		if (size < 8 || size % 4 != 0 || size > len - offset)
+			break;
+
+		messages[count].offset = offset;
+		messages[count].size = size;
+		messages[count].id = data[offset / 4];
+		messages[count].opcode = data[offset / 4 + 1] & 0xffff;
+		TRACER_PROBE(message, instance->id, connection->side, size,
+			     messages[count].opcode);
+		count++;
+	}
+
+	if (count == 0) {
+		tracer_profile_leave(tracer, stage);
+		return;
+	}
+
+	/* The frontend enters the stages it goes through itself */
+	tracer_profile_leave(tracer, stage);
+	tracer->in_batch = 1;
+	tracer->frontend->batch(connection, data, messages, count);
+	tracer->in_batch = 0;
+
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_WRITE);
+	TRACER_PROBE(output_flush_start, instance->id, connection->side,
+		     offset, -1);
+	fflush(instance->outfp);
+	TRACER_PROBE(output_flush_done, instance->id, connection->side,
+		     offset, -1);
+
+	tracer_profile_enter(tracer, TRACER_STAGE_FLUSH);
+	tracer_connection_write(connection->peer, data, offset);
+	wl_connection_consume(connection->wl_conn, offset);
+	tracer_profile_leave(tracer, stage);
+}
+
+/* Runs what came in, total bytes are waiting, through the frontend */
+static void
+tracer_process_input(struct tracer_connection *connection, int total)
+{
+	int rem, size;
+	struct tracer *tracer = connection->instance->tracer;
+	struct tracer_connection *peer = connection->peer;
+	uint32_t header[2];
+	uint64_t decoded = 0;
+	int stage;
+
+	if (tracer->frontend->batch != NULL) {
+		if (total >= 8)
+			tracer_handle_batch(connection, total);
+	} else {
+		stage = tracer_profile_enter(tracer, TRACER_STAGE_FRAME);
+		for (rem = total; rem >= 8; rem -= size) {
+			wl_connection_copy(connection->wl_conn, header,
+					   sizeof header);
+			size = tracer->frontend->data(connection, rem);
+			if (size == 0)
+				break;
+			TRACER_PROBE(message, connection->instance->id,
+				     connection->side, size,
+				     header[1] & 0xffff);
+		}
+		tracer_profile_leave(tracer, stage);
+	}
+
+	if (tracer->metrics != NULL)
+		decoded = tracer_now();
+
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_FLUSH);
+	tracer_connection_flush(peer);
+	tracer_profile_enter(tracer, TRACER_STAGE_WRITE);
+	tracer_subscriber_flush(tracer);
+	if (tracer->capture != NULL)
+		tracer_capture_flush(tracer->capture);
+	tracer_profile_leave(tracer, stage);
+
+	/* Idle connections keep no buffer memory */
+	wl_connection_trim(connection->wl_conn);
+
+	if (tracer->metrics != NULL)
+		tracer_metrics_observe(tracer->metrics, connection->timestamp,
+				       decoded, tracer_now());
+}
+
+static int
+tracer_handle_data(struct tracer_connection *connection)
+{
+	struct tracer *tracer = connection->instance->tracer;
+	int total, stage;
+
+	connection->timestamp = tracer_now();
+	stage = tracer_profile_enter(tracer, TRACER_STAGE_READ);
+	TRACER_PROBE(read_start, connection->instance->id, connection->side,
+		     0, -1);
+	total = wl_connection_read(connection->wl_conn);
+	TRACER_PROBE(read_done, connection->instance->id, connection->side,
+		     total, -1);
+	tracer_profile_leave(tracer, stage);
+	tracer_process_input(connection, total);
+
+	return total;
+}
+
+/*
+ * Instances decoded from a capture have no sockets; their data is fed in
+ * with tracer_instance_feed() and what they'd forward is dropped.
+ */
+struct tracer_instance *
+tracer_instance_create_offline(struct tracer *tracer, const char *name,
+			       uint32_t socket, uint32_t id)
+{
+	struct tracer_instance *instance;
+	struct tracer_instance_listener *listener;
+	struct tracer_analyzer *analyzer = tracer->frontend_data;
+
+	instance = calloc(1, sizeof *instance);
+	if (instance == NULL)
+		return NULL;
+
+	tracer_arena_init(&instance->arena);
+	instance->server_conn = tracer_connection_create(instance, -1,
+							 TRACER_SERVER_SIDE);
+	instance->client_conn = tracer_connection_create(instance, -1,
+							 TRACER_CLIENT_SIDE);
+	if (instance->server_conn == NULL || instance->client_conn == NULL) {
+		if (instance->server_conn != NULL)
+			wl_connection_destroy(instance->server_conn->wl_conn);
+		if (instance->client_conn != NULL)
+			wl_connection_destroy(instance->client_conn->wl_conn);
+		tracer_arena_release(&instance->arena);
+		free(instance);
+		return NULL;
+	}
+
+	instance->server_conn->peer = instance->client_conn;
+	instance->client_conn->peer = instance->server_conn;
+
+	wl_map_init(&instance->map, WL_MAP_CLIENT_SIDE);
+	if (analyzer != NULL) {
+		wl_map_insert_new(&instance->map, 0, NULL);
+		wl_map_insert_new(&instance->map, 0,
+				  analyzer->display_interface);
+	}
+
+	instance->tracer = tracer;
+	instance->id = id;
+	instance->socket = socket;
+	instance->socket_name = name;
+	instance->outfp = tracer->outfp;
+
+	wl_list_insert(tracer->instance_list.prev, &instance->link);
+
+	wl_list_for_each(listener, &tracer->instance_listener_list, link) {
+		if (listener->created)
+			listener->created(listener, instance);
+	}
+
+	return instance;
+}
+
+/* Handles data as if it had been read at timestamp from side */
+int
+tracer_instance_feed(struct tracer_instance *instance, int side,
+		     const void *data, uint32_t length, int nfds,
+		     uint64_t timestamp)
+{
+	struct tracer_connection *connection;
+	struct wl_connection *wl_conn;
+	uint32_t chunk, space;
+
+	connection = side == TRACER_CLIENT_SIDE ?
+		     instance->client_conn : instance->server_conn;
+	wl_conn = connection->wl_conn;
+	connection->timestamp = timestamp;
+
+	do {
+		space = WL_BUFFER_MAX - wl_buffer_size(&wl_conn->in);
+		chunk = length < space ? length : space;
+		if (chunk == 0 || wl_connection_feed(wl_conn, data, chunk,
+						     nfds) < 0) {
+			fprintf(stderr, "Capture has a message that doesn't "
+				"fit into the input buffer\n");
+			return -1;
+		}
+
+		tracer_process_input(connection, wl_buffer_size(&wl_conn->in));
+		data = (const char *) data + chunk;
+		length -= chunk;
+		nfds = 0;
+	} while (length > 0);
+
+	return 0;
+}
+
+void
+tracer_instance_destroy_all(struct tracer *tracer)
+{
+	struct tracer_instance *instance, *next;
+
+	wl_list_for_each_safe(instance, next, &tracer->instance_list, link)
+		tracer_instance_destroy(instance);
+}
+
+static void
+tracer_connection_dispatch(struct tracer_event_source *source, uint32_t mask)
+{
+	struct tracer_connection *connection =
+		container_of(source, struct tracer_connection, source);
+	struct tracer *tracer = connection->instance->tracer;
+	int stage;
+
+	if (mask & EPOLLOUT) {
+		stage = tracer_profile_enter(tracer, TRACER_STAGE_FLUSH);
+		tracer_connection_flush(connection);
+		tracer_profile_leave(tracer, stage);
+		if (connection->peer->hup &&
+		    tracer_connection_pending(connection) == 0) {
+			tracer_instance_close(connection->instance);
+			return;
+		}
+	}
+
+	if (mask & EPOLLIN)
+		tracer_handle_data(connection);
+
+	if (mask & EPOLLHUP)
+		tracer_handle_hup(connection);
+}
+
+static void
+tracer_upstream_connect(struct tracer_upstream *upstream);
+
+static void
+tracer_upstream_done(struct tracer_upstream *upstream, int serverfd)
+{
+	struct tracer_socket *s = upstream->socket;
+
+	if (serverfd < 0) {
+		fprintf(stderr, "failed to connect to compositor: %m\n");
+		close(upstream->clientfd);
+	} else if (tracer_instance_create(s->tracer, s, upstream->clientfd,
+					  serverfd) < 0) {
+		fprintf(stderr, "failed to create instance\n");
+	}
+
+	free(upstream);
+}
+
+static void
+tracer_upstream_dispatch(struct tracer_event_source *source, uint32_t mask)
+{
+	struct tracer_upstream *upstream =
+		container_of(source, struct tracer_upstream, source);
+	socklen_t len;
+	int fd = source->fd, err;
+
+	tracer_epoll_remove(upstream->socket->tracer, source);
+
+	len = sizeof err;
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if (err != 0) {
+		close(fd);
+		errno = err;
+		fd = -1;
+	}
+
+	tracer_upstream_done(upstream, fd);
+}
+
+static void
+tracer_upstream_retry(void *data)
 {
-	tracer_connection_destroy(instance->server_conn);
-	tracer_connection_destroy(instance->client_conn);
+	struct tracer_socket *s = data;
+	struct tracer_upstream *upstream, *next;
+	struct wl_list list;
 
-	wl_list_remove(&instance->link);
+	/* Whatever still doesn't get through goes back on the list */
+	wl_list_init(&list);
+	wl_list_insert_list(&list, &s->retry_list);
+	wl_list_init(&s->retry_list);
 
-	free(instance);
+	wl_list_for_each_safe(upstream, next, &list, link)
+		tracer_upstream_connect(upstream);
+
+	if (wl_list_empty(&s->retry_list)) {
+		tracer_timer_destroy(s->retry_timer);
+		s->retry_timer = NULL;
+	}
 }
 
 static void
-tracer_handle_hup(struct tracer_connection *connection)
+tracer_upstream_connect(struct tracer_upstream *upstream)
 {
-	tracer_instance_destroy(connection->instance);
+	struct tracer_socket *s = upstream->socket;
+	int fd, in_progress;
+
+	fd = tracer_connect_to_socket(s->option->upstream, &in_progress);
+	if (fd < 0 && errno == EAGAIN &&
+	    upstream->retries++ < UPSTREAM_MAX_RETRIES) {
+		if (s->retry_timer == NULL)
+			s->retry_timer = tracer_timer_create(s->tracer,
+						UPSTREAM_RETRY_INTERVAL,
+						tracer_upstream_retry, s);
+		if (s->retry_timer != NULL) {
+			wl_list_insert(s->retry_list.prev, &upstream->link);
+			return;
+		}
+	}
+
+	if (fd >= 0 && in_progress) {
+		upstream->source.fd = fd;
+		upstream->source.dispatch = tracer_upstream_dispatch;
+		if (tracer_epoll_add(s->tracer, &upstream->source,
+				     EPOLLOUT) == 0)
+			return;
+		close(fd);
+		fd = -1;
+	}
+
+	tracer_upstream_done(upstream, fd);
 }
 
 static void
-tracer_handle_data(struct tracer_connection *connection)
+tracer_handle_client(struct tracer_event_source *source, uint32_t mask)
 {
-	int total, rem, size;
-	struct tracer *tracer = connection->instance->tracer;
-	struct tracer_connection *peer = connection->peer;
+	struct tracer_socket *s =
+		container_of(source, struct tracer_socket, source);
+	struct tracer_upstream *upstream;
+	struct sockaddr_un name;
+	socklen_t length;
+	int clientfd;
 
-	total = wl_connection_read(connection->wl_conn);
+	/* The listening socket is non-blocking, take everything queued */
+	for (;;) {
+		length = sizeof name;
+		clientfd = wl_os_accept_cloexec(s->fd,
+						 (struct sockaddr *) &name,
+						 &length);
+		if (clientfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				fprintf(stderr, "failed to accept(): %m\n");
+			return;
+		}
 
-	for (rem = total; rem >= 8; rem -= size) {
-		size = tracer->frontend->data(connection, rem);
-		if (size == 0)
-			break;
+		upstream = malloc(sizeof *upstream);
+		if (upstream == NULL) {
+			fprintf(stderr, "failed to create instance\n");
+			close(clientfd);
+			continue;
+		}
+
+		upstream->socket = s;
+		upstream->clientfd = clientfd;
+		upstream->retries = 0;
+		tracer_upstream_connect(upstream);
 	}
-	wl_connection_flush(peer->wl_conn);
 }
 
 static void
-tracer_handle_client(struct tracer *tracer)
+tracer_signal_dispatch(struct tracer_event_source *source, uint32_t mask)
 {
-	struct tracer_socket *s = tracer->socket;
-	struct sockaddr_un name;
-	socklen_t length;
-	int clientfd;
+	struct tracer_signal *signal =
+		container_of(source, struct tracer_signal, source);
+	struct signalfd_siginfo info;
 
-	length = sizeof name;
-	clientfd = wl_os_accept_cloexec(s->fd, (struct sockaddr *) &name,
-					 &length);
+	if (read(source->fd, &info, sizeof info) == sizeof info)
+		signal->tracer->running = 0;
+}
 
-	if (clientfd < 0)
-		fprintf(stderr, "failed to accept(): %m\n");
-	else if (tracer_instance_create(tracer, clientfd) < 0) {
-		fprintf(stderr, "failed to create instance\n");
-		close(clientfd);
+/*
+ * SIGINT and SIGTERM end the main loop rather than the process, so that
+ * what is reported at exit still gets printed.  The child in single mode
+ * has been spawned already and keeps the default handling.
+ */
+static int
+tracer_add_signal_source(struct tracer *tracer, struct tracer_signal *signal)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+
+	signal->source.fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (signal->source.fd < 0)
+		return -1;
+
+	signal->source.dispatch = tracer_signal_dispatch;
+	signal->tracer = tracer;
+	if (tracer_epoll_add(tracer, &signal->source, EPOLLIN) < 0) {
+		close(signal->source.fd);
+		return -1;
 	}
+
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	return 0;
 }
 
 static int
 tracer_run(struct tracer *tracer)
 {
 	struct epoll_event ev;
-	struct tracer_connection *connection;
+	struct tracer_event_source *source;
+	struct tracer_signal signal;
 	int nfds;
 
-	for (;;) {
+	if (tracer_add_signal_source(tracer, &signal) < 0)
+		fprintf(stderr, "Failed to watch signals: %m\n");
+
+	tracer->running = 1;
+	while (tracer->running) {
+		tracer_profile_enter(tracer, TRACER_STAGE_IDLE);
 		nfds = epoll_wait(tracer->epollfd, &ev, 1, -1);
+		tracer_profile_enter(tracer, TRACER_STAGE_OTHER);
 
 		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
 			fprintf(stderr, "Failed to poll: %m\n");
 			return -1;
 		}
 
-		connection = (struct tracer_connection *) ev.data.ptr;
+		source = ev.data.ptr;
+		source->dispatch(source, ev.events);
+	}
+
+	return 0;
+}
+
+/*
+ * Runs the client with the capture library preloaded instead of through
+ * the proxy, then decodes what it captured.
+ */
+static int
+tracer_run_preload(struct tracer *tracer)
+{
+	struct tracer_options *options = tracer->options;
+	const char *library, *preload;
+	char *value;
+	size_t len;
+	pid_t pid;
+	int status;
+
+	library = getenv("WAYLAND_TRACER_PRELOAD");
+	if (library == NULL)
+		library = TRACER_PRELOAD_LIBRARY;
+
+	/* The first client to connect creates it */
+	if (unlink(options->capture_file) < 0 && errno != ENOENT) {
+		fprintf(stderr, "Failed to remove old capture %s: %m\n",
+			options->capture_file);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "Failed to fork: %m\n");
+		return -1;
+	}
 
-		if (ev.events & EPOLLIN) {
-			if (connection == NULL)
-				tracer_handle_client(tracer);
-			else
-				tracer_handle_data(connection);
+	if (pid == 0) {
+		preload = getenv("LD_PRELOAD");
+		if (preload != NULL && preload[0] != '\0') {
+			len = strlen(library) + strlen(preload) + 2;
+			value = malloc(len);
+			if (value == NULL)
+				exit(EXIT_FAILURE);
+			snprintf(value, len, "%s:%s", library, preload);
+			setenv("LD_PRELOAD", value, 1);
+		} else {
+			setenv("LD_PRELOAD", library, 1);
 		}
+		setenv("WAYLAND_TRACER_CAPTURE", options->capture_file, 1);
 
-		if (ev.events & EPOLLHUP) {
-			tracer_handle_hup(connection);
+		execvp(options->spawn_args[0], options->spawn_args);
+		fprintf(stderr, "Failed to run %s: %m\n",
+			options->spawn_args[0]);
+		exit(EXIT_FAILURE);
+	}
 
-			if (tracer->socket == NULL) {
-				fprintf(stderr, "Child hups, exiting\n");
-				break;
-			}
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			fprintf(stderr, "Failed to wait for child: %m\n");
+			return -1;
 		}
 	}
 
-	return 0;
+	return tracer_capture_decode(tracer, options->capture_file);
 }
 
 /* Following two functions adapted from wayland-server.c */
@@ -437,12 +1547,12 @@ get_socket_lock(struct tracer_socket *socket)
 }
 
 static int
-tracer_create_socket(struct tracer *tracer, const char *name)
+tracer_create_socket(struct tracer *tracer, struct socket_option *option)
 {
 	struct tracer_socket *s;
 	socklen_t size;
 	int name_size;
-	const char *runtime_dir;
+	const char *runtime_dir, *name = option->name;
 
 	s = malloc(sizeof *s);
 	if (s == NULL)
@@ -451,6 +1561,7 @@ tracer_create_socket(struct tracer *tracer, const char *name)
 	runtime_dir = getenv("XDG_RUNTIME_DIR");
 	if (!runtime_dir) {
 		wl_log("error: XDG_RUNTIME_DIR not set in the environment\n");
+		free(s);
 
 		/* to prevent programs reporting
 		 * "failed to add socket: Success" */
@@ -459,13 +1570,10 @@ tracer_create_socket(struct tracer *tracer, const char *name)
 	}
 
 	s->fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
-	if (s->fd < 0)
+	if (s->fd < 0) {
+		free(s);
 		return -1;
-
-	if (name == NULL)
-		name = getenv("WAYLAND_DISPLAY");
-	if (name == NULL)
-		name = "wayland-0";
+	}
 
 	memset(&s->addr, 0, sizeof s->addr);
 	s->addr.sun_family = AF_LOCAL;
@@ -501,7 +1609,8 @@ tracer_create_socket(struct tracer *tracer, const char *name)
 		return -1;
 	}
 
-	if (listen(s->fd, 1) < 0) {
+	if (fcntl(s->fd, F_SETFL, O_NONBLOCK) < 0 ||
+	    listen(s->fd, tracer->options->backlog) < 0) {
 		fprintf(stderr, "listen() failed with error: %m\n");
 		unlink(s->addr.sun_path);
 		close(s->fd);
@@ -511,8 +1620,33 @@ tracer_create_socket(struct tracer *tracer, const char *name)
 		return -1;
 	}
 
-	tracer_epoll_add_fd(tracer, s->fd, NULL);
-	tracer->socket = s;
+	s->outfp = tracer->outfp;
+	if (option->output != NULL) {
+		s->outfp = fopen(option->output, "w");
+		if (s->outfp == NULL) {
+			fprintf(stderr, "Failed to open output file %s: %m\n",
+				option->output);
+			unlink(s->addr.sun_path);
+			close(s->fd);
+			unlink(s->lock_addr);
+			close(s->fd_lock);
+			free(s);
+			return -1;
+		}
+	}
+
+	s->tracer = tracer;
+	s->option = option;
+	s->index = tracer->socket_count++;
+	if (tracer->capture != NULL)
+		tracer_capture_socket(tracer, s->index, option->name);
+	s->next_id = 0;
+	wl_list_init(&s->retry_list);
+	s->retry_timer = NULL;
+	s->source.fd = s->fd;
+	s->source.dispatch = tracer_handle_client;
+	tracer_epoll_add(tracer, &s->source, EPOLLIN);
+	wl_list_insert(tracer->socket_list.prev, &s->link);
 
 	return 0;
 }
@@ -522,15 +1656,69 @@ usage(void)
 {
 	fprintf(stderr, "wayland-tracer: a wayland protocol dumper\n"
 		"Usage:\twayland-tracer [OPTIONS] -- file ...\n"
-		"\twayland-tracer -S NAME [OPTIONS]\n\n"
+		"\twayland-tracer -S NAME[=UPSTREAM][,output=FILE]... [OPTIONS]\n"
+		"\twayland-tracer --decode FILE [OPTIONS]\n"
+		"\twayland-tracer --replay FILE [--replay-fast] [OPTIONS]\n\n"
 		"Options:\n\n"
-		"  -S NAME\t\tMake wayland-tracer run under server mode\n"
+		"  -S NAME[=UPSTREAM][,output=FILE]\n"
+		"\t\t\tMake wayland-tracer run under server mode\n"
 		"\t\t\tand make the name of server socket NAME (such as\n"
-		"\t\t\twayland-0)\n"
+		"\t\t\twayland-1), forwarding clients to UPSTREAM, or\n"
+		"\t\t\tto $WAYLAND_DISPLAY if not given. Clients of\n"
+		"\t\t\tthis socket are traced to FILE if given. Can be\n"
+		"\t\t\trepeated\n"
+		"  --backlog N\t\tQueue up to N connecting clients on each\n"
+		"\t\t\tsocket, 128 by default\n"
 		"  -o FILE\t\tDump output to FILE\n"
 		"  -d FILE\t\tAdd an xml protocol file\n"
 		"\t\t\twayland-tracer will output readable format according\n"
 		"\t\t\tto the protocols given if -d is specified\n"
+		"  --protocol-path[=PATH]\n"
+		"\t\t\tAlso interpret interfaces found in the xml files\n"
+		"\t\t\tunder the colon separated directories of PATH,\n"
+		"\t\t\tloading each when a client first binds it.\n"
+		"\t\t\t/usr/share/wayland and /usr/share/wayland-protocols\n"
+		"\t\t\tby default. Works instead of -d as well\n"
+		"  --subscriber-socket NAME\n"
+		"\t\t\tStream binary trace records to any client\n"
+		"\t\t\tconnecting to socket NAME\n"
+		"  --ring SIZE\t\tPublish binary trace records in a shared\n"
+		"\t\t\tmemory ring of SIZE bytes (K and M suffixes work)\n"
+		"  --shm-analytics\tReport how much of each committed shm\n"
+		"\t\t\tbuffer actually changed (needs -d)\n"
+		"  --damage-stats\tAccount damage and pixel throughput per\n"
+		"\t\t\tsurface and client (needs -d)\n"
+		"  --frame-stats[=HZ]\tReport frame pacing and jitter per surface\n"
+		"\t\t\tagainst a refresh rate of HZ, 60 by default\n"
+		"\t\t\t(needs -d)\n"
+		"  -q\t\t\tDon't print messages, only what analyses say\n"
+		"  --top\t\t\tShow a live view of the busiest clients,\n"
+		"\t\t\tinterfaces and messages instead of messages\n"
+		"\t\t\t(needs -d)\n"
+		"  --metrics FILE\tWrite counters in Prometheus text format\n"
+		"\t\t\tto FILE periodically\n"
+		"  --metrics-interval SECONDS\n"
+		"\t\t\tHow often to write the metrics file, 10 by\n"
+		"\t\t\tdefault\n"
+		"  --metrics-socket NAME\n"
+		"\t\t\tServe the same counters to anyone connecting to\n"
+		"\t\t\tsocket NAME\n"
+		"  --plugin PATH[=ARGS]\tLoad an analyzer plugin from the shared\n"
+		"\t\t\tobject PATH and pass it ARGS (needs -d)\n"
+		"  --capture FILE\tSave the traffic to FILE in binary form\n"
+		"  --preload\t\tCapture from inside the client instead of\n"
+		"\t\t\tproxying it, then print the capture (needs\n"
+		"\t\t\t--capture, not with -S)\n"
+		"  --decode FILE\t\tPrint a capture instead of tracing\n"
+		"  --replay FILE\t\tPlay the clients of a capture against the\n"
+		"\t\t\tcompositor and report its latency per request\n"
+		"\t\t\t(needs -d)\n"
+		"  --replay-fast\t\tDon't keep the pacing of the capture\n"
+		"  --no-compiled-decoders\n"
+		"\t\t\tDecode every protocol from its xml, even those\n"
+		"\t\t\tdecoders were built in for\n"
+		"  --profile\t\tReport where the tracer spent its time at\n"
+		"\t\t\texit, by stage and by interface decoded\n"
 		"  -h\t\t\tThis help message\n\n");
 }
 
@@ -551,6 +1739,124 @@ tracer_add_protocol(struct tracer_options *options, const char *file)
 	return 0;
 }
 
+/* Parses PATH[=ARGS] as given to --plugin */
+static int
+tracer_add_plugin(struct tracer_options *options, const char *arg)
+{
+	struct plugin_option *option;
+	char *path, *args;
+
+	option = malloc(sizeof *option);
+	path = strdup(arg);
+	if (option == NULL || path == NULL) {
+		fprintf(stderr, "Failed to alloc for plugin: %m\n");
+		free(option);
+		free(path);
+		return -1;
+	}
+
+	args = strchr(path, '=');
+	if (args != NULL)
+		*args++ = '\0';
+
+	option->path = path;
+	option->args = args;
+	wl_list_insert(options->plugin_list.prev, &option->link);
+
+	return 0;
+}
+
+/* Parses LISTEN[=UPSTREAM][,output=FILE] as given to -S */
+static int
+tracer_add_socket(struct tracer_options *options, const char *arg)
+{
+	struct socket_option *option, *other;
+	char *spec, *p, *next;
+
+	option = calloc(1, sizeof *option);
+	spec = strdup(arg);
+	if (option == NULL || spec == NULL) {
+		fprintf(stderr, "Failed to alloc for socket: %m\n");
+		free(option);
+		free(spec);
+		return -1;
+	}
+
+	next = strchr(spec, ',');
+	if (next != NULL)
+		*next++ = '\0';
+
+	option->name = spec;
+	p = strchr(spec, '=');
+	if (p != NULL) {
+		*p++ = '\0';
+		option->upstream = p;
+	}
+
+	for (p = next; p != NULL; p = next) {
+		next = strchr(p, ',');
+		if (next != NULL)
+			*next++ = '\0';
+
+		if (!strncmp(p, "output=", 7)) {
+			option->output = p + 7;
+		} else {
+			fprintf(stderr, "Unknown socket option '%s'\n", p);
+			return -1;
+		}
+	}
+
+	if (option->name[0] == '\0' || strchr(option->name, '/') != NULL ||
+	    (option->upstream != NULL && option->upstream[0] == '\0')) {
+		fprintf(stderr, "Invalid socket '%s'\n", arg);
+		return -1;
+	}
+
+	if (option->upstream != NULL &&
+	    !strcmp(option->name, option->upstream)) {
+		fprintf(stderr, "Socket %s would forward to itself\n",
+			option->name);
+		return -1;
+	}
+
+	wl_list_for_each(other, &options->socket_list, link) {
+		if (!strcmp(other->name, option->name)) {
+			fprintf(stderr, "Socket %s given twice\n",
+				option->name);
+			return -1;
+		}
+	}
+
+	wl_list_insert(options->socket_list.prev, &option->link);
+
+	return 0;
+}
+
+static int
+parse_size(const char *s, size_t *size)
+{
+	char *end;
+	unsigned long value;
+
+	value = strtoul(s, &end, 0);
+	if (end == s)
+		return -1;
+
+	if (*end == 'K' || *end == 'k') {
+		value *= 1024;
+		end++;
+	} else if (*end == 'M' || *end == 'm') {
+		value *= 1024 * 1024;
+		end++;
+	}
+
+	if (*end != '\0' || value == 0)
+		return -1;
+
+	*size = value;
+	return 0;
+}
+
 static struct tracer_options*
 tracer_parse_args(int argc, char *argv[])
 {
@@ -564,8 +1870,31 @@ tracer_parse_args(int argc, char *argv[])
 	}
 
 	options->spawn_args = NULL;
+	options->backlog = TRACER_DEFAULT_BACKLOG;
+	options->outfile = NULL;
+	options->subscriber_socket = NULL;
+	options->ring_size = 0;
+	options->shm_analytics = 0;
+	options->damage_stats = 0;
+	options->frame_stats = 0;
+	options->refresh_rate = 60;
+	options->quiet = 0;
+	options->top = 0;
+	options->metrics_file = NULL;
+	options->metrics_socket = NULL;
+	options->metrics_interval = 10000;
+	options->capture_file = NULL;
+	options->decode_file = NULL;
+	options->replay_file = NULL;
+	options->replay_fast = 0;
+	options->preload = 0;
+	options->compiled_decoders = 1;
+	options->protocol_path = NULL;
+	options->profile = 0;
 	options->mode = TRACER_MODE_SINGLE;
 	wl_list_init(&options->protocol_file_list);
+	wl_list_init(&options->socket_list);
+	wl_list_init(&options->plugin_list);
 	options->output_format = TRACER_OUTPUT_RAW;
 
 	if (argc == 1) {
@@ -584,7 +1913,8 @@ tracer_parse_args(int argc, char *argv[])
 				exit(EXIT_FAILURE);
 			}
 			options->mode = TRACER_MODE_SERVER;
-			options->socket = argv[i];
+			if (tracer_add_socket(options, argv[i]) != 0)
+				exit(EXIT_FAILURE);
 		} else if (!strcmp(argv[i], "--")) {
 			i++;
 			if (i == argc) {
@@ -609,6 +1939,114 @@ tracer_parse_args(int argc, char *argv[])
 			if (tracer_add_protocol(options, argv[i]) != 0)
 				exit(EXIT_FAILURE);
 			options->output_format = TRACER_OUTPUT_INTERPRET;
+		} else if (!strcmp(argv[i], "--protocol-path")) {
+			options->protocol_path = TRACER_DEFAULT_PROTOCOL_PATH;
+			options->output_format = TRACER_OUTPUT_INTERPRET;
+		} else if (!strncmp(argv[i], "--protocol-path=", 16)) {
+			options->protocol_path = argv[i] + 16;
+			options->output_format = TRACER_OUTPUT_INTERPRET;
+		} else if (!strcmp(argv[i], "--subscriber-socket")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Subscriber socket not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			options->subscriber_socket = argv[i];
+		} else if (!strcmp(argv[i], "--ring")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Ring size not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			if (parse_size(argv[i], &options->ring_size) < 0) {
+				fprintf(stderr, "Invalid ring size '%s'\n",
+					argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		} else if (!strcmp(argv[i], "--shm-analytics")) {
+			options->shm_analytics = 1;
+		} else if (!strcmp(argv[i], "--damage-stats")) {
+			options->damage_stats = 1;
+		} else if (!strcmp(argv[i], "--frame-stats")) {
+			options->frame_stats = 1;
+		} else if (!strncmp(argv[i], "--frame-stats=", 14)) {
+			options->frame_stats = 1;
+			options->refresh_rate = atoi(argv[i] + 14);
+			if (options->refresh_rate <= 0) {
+				fprintf(stderr, "Invalid refresh rate '%s'\n",
+					argv[i] + 14);
+				exit(EXIT_FAILURE);
+			}
+		} else if (!strcmp(argv[i], "-q")) {
+			options->quiet = 1;
+		} else if (!strcmp(argv[i], "--metrics")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Metrics file not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			options->metrics_file = argv[i];
+		} else if (!strcmp(argv[i], "--metrics-interval")) {
+			i++;
+			if (i == argc || atoi(argv[i]) <= 0) {
+				fprintf(stderr, "Invalid metrics interval\n");
+				exit(EXIT_FAILURE);
+			}
+			options->metrics_interval = atoi(argv[i]) * 1000;
+		} else if (!strcmp(argv[i], "--metrics-socket")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Metrics socket not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			options->metrics_socket = argv[i];
+		} else if (!strcmp(argv[i], "--backlog")) {
+			i++;
+			if (i == argc || atoi(argv[i]) <= 0) {
+				fprintf(stderr, "Invalid backlog\n");
+				exit(EXIT_FAILURE);
+			}
+			options->backlog = atoi(argv[i]);
+		} else if (!strcmp(argv[i], "--plugin")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Plugin not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			if (tracer_add_plugin(options, argv[i]) != 0)
+				exit(EXIT_FAILURE);
+		} else if (!strcmp(argv[i], "--capture")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Capture file not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			options->capture_file = argv[i];
+		} else if (!strcmp(argv[i], "--decode")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Capture file not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			options->decode_file = argv[i];
+		} else if (!strcmp(argv[i], "--replay")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "Capture file not specified\n");
+				exit(EXIT_FAILURE);
+			}
+			options->replay_file = argv[i];
+		} else if (!strcmp(argv[i], "--replay-fast")) {
+			options->replay_fast = 1;
+		} else if (!strcmp(argv[i], "--preload")) {
+			options->preload = 1;
+		} else if (!strcmp(argv[i], "--no-compiled-decoders")) {
+			options->compiled_decoders = 0;
+		} else if (!strcmp(argv[i], "--profile")) {
+			options->profile = 1;
+		} else if (!strcmp(argv[i], "--top")) {
+			options->top = 1;
+			options->quiet = 1;
 		} else {
 			fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
 			usage();
@@ -616,11 +2054,70 @@ tracer_parse_args(int argc, char *argv[])
 		}
 	}
 
+	if (options->decode_file != NULL) {
+		if (options->mode != TRACER_MODE_SINGLE ||
+		    options->spawn_args != NULL ||
+		    options->capture_file != NULL || options->preload) {
+			fprintf(stderr, "--decode doesn't trace anything\n");
+			exit(EXIT_FAILURE);
+		}
+		options->mode = TRACER_MODE_DECODE;
+	}
+
+	if (options->replay_file != NULL) {
+		if (options->mode != TRACER_MODE_SINGLE ||
+		    options->spawn_args != NULL ||
+		    options->capture_file != NULL || options->preload) {
+			fprintf(stderr, "--replay doesn't trace anything\n");
+			exit(EXIT_FAILURE);
+		}
+		if (options->output_format != TRACER_OUTPUT_INTERPRET) {
+			fprintf(stderr, "Replaying needs protocol files "
+				"(-d or --protocol-path)\n");
+			exit(EXIT_FAILURE);
+		}
+		options->mode = TRACER_MODE_REPLAY;
+	}
+
+	if (options->preload &&
+	    (options->mode != TRACER_MODE_SINGLE ||
+	     options->capture_file == NULL)) {
+		fprintf(stderr, "--preload needs --capture and no -S\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Captures are printed in one go, there's no event loop */
+	if ((options->mode == TRACER_MODE_DECODE ||
+	     options->mode == TRACER_MODE_REPLAY || options->preload) &&
+	    (options->subscriber_socket != NULL || options->ring_size != 0 ||
+	     options->top || options->metrics_file != NULL ||
+	     options->metrics_socket != NULL)) {
+		fprintf(stderr, "Live outputs don't work with captures\n");
+		exit(EXIT_FAILURE);
+	}
+
 	if (options->mode == TRACER_MODE_SINGLE &&
 	    options->spawn_args == NULL) {
 		fprintf(stderr, "No client specified in single mode\n");
 		exit(EXIT_FAILURE);
 	}
+
+	/* Analyses print as they go, which would scribble over the view */
+	if (options->top && (options->shm_analytics ||
+			     options->damage_stats || options->frame_stats)) {
+		fprintf(stderr, "--top doesn't work with --shm-analytics, "
+			"--damage-stats or --frame-stats\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((options->shm_analytics || options->damage_stats ||
+	     options->frame_stats || options->top ||
+	     !wl_list_empty(&options->plugin_list)) &&
+	    options->output_format != TRACER_OUTPUT_INTERPRET) {
+		fprintf(stderr, "Analyses need protocol files "
+			"(-d or --protocol-path)\n");
+		exit(EXIT_FAILURE);
+	}
 	return options;
 }
 
@@ -631,7 +2128,9 @@ tracer_create(struct tracer_options *options)
 	pid_t pid;
 	struct tracer *tracer;
 	char sockfdstr[12];
+	int serverfd;
 	struct protocol_file *file;
+	struct socket_option *option;
 
 	tracer = malloc(sizeof *tracer);
 	if (tracer == NULL) {
@@ -652,9 +2151,46 @@ tracer_create(struct tracer_options *options)
 	} else
 		tracer->outfp = stdout;
 
+	/* Analyses may want to add their timers while being set up */
+	tracer->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (tracer->epollfd < 0) {
+		fprintf(stderr, "Failed to create epollfd: %m\n");
+		free(tracer);
+		return NULL;
+	}
+
 	wl_list_init(&tracer->instance_list);
+	wl_list_init(&tracer->socket_list);
+	tracer->socket_count = 0;
+	wl_list_init(&tracer->instance_listener_list);
+	tracer->next_slot = 0;
+	wl_list_init(&tracer->subscriber_list);
+	wl_list_init(&tracer->plugin_list);
+	tracer->subscriber_socket = NULL;
+	tracer->ring = NULL;
+	tracer->metrics = NULL;
+	tracer->capture = NULL;
+	tracer->profile = NULL;
+	tracer->dropped_records = 0;
+
+	tracer->fdinfo = tracer_fdinfo_cache_create();
+	if (tracer->fdinfo == NULL) {
+		fprintf(stderr, "Failed to create fd cache: %m\n");
+		exit(EXIT_FAILURE);
+	}
 	tracer->next_id = 0;
+	tracer->next_seq = 0;
 	tracer->frontend_data = NULL;
+	tracer->in_batch = 0;
+
+	/* Before the frontend, so that loading protocols counts as well */
+	if (options->profile) {
+		tracer->profile = tracer_profile_create();
+		if (tracer->profile == NULL) {
+			fprintf(stderr, "Failed to set up profiling\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 
 	if (options->output_format == TRACER_OUTPUT_INTERPRET)
 		tracer->frontend = &tracer_frontend_analyze;
@@ -667,9 +2203,29 @@ tracer_create(struct tracer_options *options)
 		exit(EXIT_FAILURE);
 	}
 
+	if (options->metrics_file != NULL || options->metrics_socket != NULL) {
+		tracer->metrics = tracer_metrics_create(tracer);
+		if (tracer->metrics == NULL) {
+			fprintf(stderr, "Failed to set up metrics\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (options->mode == TRACER_MODE_DECODE ||
+	    options->mode == TRACER_MODE_REPLAY || options->preload)
+		return tracer;
+
+	if (options->capture_file != NULL) {
+		tracer->capture = tracer_capture_create(options->capture_file);
+		if (tracer->capture == NULL) {
+			fprintf(stderr, "Failed to create capture %s: %m\n",
+				options->capture_file);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	// Spawn child if we're in single mode
 	if (options->mode == TRACER_MODE_SINGLE) {
-		tracer->socket = NULL;
 		ret = socketpair(PF_LOCAL, SOCK_STREAM, 0, sock_vec);
 		if (ret != 0) {
 			fprintf(stderr, "Failed to create socketpair: %m\n");
@@ -697,48 +2253,66 @@ tracer_create(struct tracer_options *options)
 		}
 	}
 
-	tracer->epollfd = epoll_create1(0);
-	if (tracer->epollfd < 0) {
-		fprintf(stderr, "Failed to create epollfd: %m\n");
-		goto err_epoll_create;
-	}
-
 	if (options->mode == TRACER_MODE_SINGLE) {
 		close(sock_vec[1]);
-		ret = tracer_instance_create(tracer, sock_vec[0]);
+		serverfd = tracer_connect_server(NULL);
+		if (serverfd < 0) {
+			fprintf(stderr, "Failed to connect to compositor: %m\n");
+			goto err_instance;
+		}
+		ret = tracer_instance_create(tracer, NULL, sock_vec[0],
+					     serverfd);
 		if (ret < 0) {
 			fprintf(stderr, "Failed to init instance\n");
-			goto err_instance;
+			goto err_init;
 		}
 	} else {
-		ret = tracer_create_socket(tracer, "wayland-1");
-		if (ret < 0)
+		wl_list_for_each(option, &options->socket_list, link) {
+			if (tracer_create_socket(tracer, option) < 0) {
+				fprintf(stderr, "Failed to listen on %s\n",
+					option->name);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	if (options->ring_size != 0) {
+		tracer->ring = tracer_ring_create(options->ring_size);
+		if (tracer->ring == NULL) {
+			fprintf(stderr, "Failed to create ring: %m\n");
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "Trace ring at /proc/%d/fd/%d\n",
+			getpid(), tracer_ring_get_fd(tracer->ring));
+	}
+
+	if (options->subscriber_socket != NULL) {
+		ret = tracer_subscriber_socket_create(tracer,
+						      options->subscriber_socket);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to create subscriber socket\n");
 			exit(EXIT_FAILURE);
+		}
 	}
 
 	return tracer;
 
 err_socketpair:
+	close(tracer->epollfd);
 	free(tracer);
 	return NULL;
 
 err_fork:
+	close(tracer->epollfd);
 	close(sock_vec[0]);
 	close(sock_vec[1]);
 	free(tracer);
 	return NULL;
 
-err_epoll_create:
-	if (options->mode == TRACER_MODE_SINGLE) {
-		close(sock_vec[0]);
-		close(sock_vec[1]);
-	}
-	free(tracer);
-	return NULL;
-
 err_instance:
-	close(tracer->epollfd);
 	close(sock_vec[0]);
+err_init:
+	close(tracer->epollfd);
 	free(tracer);
 	return NULL;
 }
@@ -763,7 +2337,21 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	ret = tracer_run(tracer);
+	if (options->mode == TRACER_MODE_DECODE)
+		ret = tracer_capture_decode(tracer, options->decode_file);
+	else if (options->mode == TRACER_MODE_REPLAY)
+		ret = tracer_replay(tracer, options->replay_file);
+	else if (options->preload)
+		ret = tracer_run_preload(tracer);
+	else
+		ret = tracer_run(tracer);
+	if (tracer->profile != NULL) {
+		tracer_profile_report(tracer, stderr);
+		tracer_profile_destroy(tracer->profile);
+	}
+	tracer_plugin_unload_all(tracer);
+	if (tracer->capture != NULL)
+		tracer_capture_destroy(tracer->capture);
 
 	if (ret == 0)
 		exit(EXIT_SUCCESS);
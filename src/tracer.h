@@ -25,6 +25,7 @@
 
 #include <stdio.h>
 #include "wayland-util.h"
+#include "tracer-arena.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -36,6 +37,8 @@ extern "C"
 
 #define TRACER_MODE_SINGLE 0
 #define TRACER_MODE_SERVER 1
+#define TRACER_MODE_DECODE 2
+#define TRACER_MODE_REPLAY 3
 
 #define TRACER_OUTPUT_RAW 0
 #define TRACER_OUTPUT_INTERPRET 1
@@ -47,49 +50,177 @@ extern "C"
 struct tracer;
 struct tracer_instance;
 
+/* Anything the tracer waits on in its epoll set */
+struct tracer_event_source {
+	int fd;
+	void (*dispatch)(struct tracer_event_source *source, uint32_t mask);
+};
+
+/*
+ * Data waiting to be sent to one side.  fds are kept with the stream
+ * position of the message they belong to, so that they are never sent
+ * after its bytes.
+ */
+struct tracer_queue {
+	struct wl_array data;	/* bytes from stream position base on */
+	struct wl_array fds;	/* struct tracer_queued_fd */
+	uint64_t base;
+	size_t tail;		/* bytes of data already sent */
+	size_t fd_tail;		/* bytes of fds already sent */
+};
+
 struct tracer_connection {
+	struct tracer_event_source source;
 	struct wl_connection *wl_conn;
 	struct tracer_connection *peer;
 	struct tracer_instance *instance;
 	int side;
+	struct tracer_queue out;
+	uint32_t mask;		/* what we're waiting for in epoll */
+	int blocked;		/* not reading since the peer is backed up */
+	int hup;		/* hung up, waiting for the peer to drain */
+	uint64_t timestamp;	/* when data was last read */
+	uint64_t stalls;
+};
+
+/* A complete message within the data handed to a batch callback */
+struct tracer_message_desc {
+	uint32_t offset;	/* in bytes */
+	uint32_t size;
+	uint32_t id;
+	uint32_t opcode;
 };
 
+/*
+ * A frontend either handles raw data as it comes with data(), returning
+ * how much it consumed, or gets every complete message of one read at
+ * once with batch().  In the latter case the tracer consumes and
+ * forwards the messages, and flushes the output once per batch.
+ */
 struct tracer_frontend_interface {
 	int (*init)(struct tracer *);
 	int (*data)(struct tracer_connection *, int);
+	void (*batch)(struct tracer_connection *, const uint32_t *data,
+		      const struct tracer_message_desc *messages, int count);
+};
+
+#define TRACER_INSTANCE_SLOTS 8
+
+/* Running totals of what went through an instance, both directions */
+struct tracer_counters {
+	uint64_t messages;
+	uint64_t bytes;
+	uint64_t fds;
 };
 
 struct tracer_instance {
+	/* Ids count per socket, socket is the index of the -S it came from */
 	int id;
+	int socket;
+	const char *socket_name;
+	FILE *outfp;
 	struct tracer_connection *client_conn;
 	struct tracer_connection *server_conn;
 	struct tracer *tracer;
 	struct wl_list link;
 	struct wl_map map;
+	struct tracer_counters counters;
+	/* Per-instance state of analyses, see tracer_allocate_slot() */
+	void *slots[TRACER_INSTANCE_SLOTS];
+	/* What lives as long as the instance, see tracer_instance_alloc() */
+	struct tracer_arena arena;
+};
+
+/* Notified when instances come and go, e.g. to set up their slots */
+struct tracer_instance_listener {
+	void (*created)(struct tracer_instance_listener *listener,
+			struct tracer_instance *instance);
+	void (*destroyed)(struct tracer_instance_listener *listener,
+			  struct tracer_instance *instance);
+	struct wl_list link;
 };
 
+struct sockaddr_un;
 struct tracer_socket;
+struct tracer_timer;
+struct tracer_subscriber_socket;
+struct tracer_ring;
+struct tracer_fdinfo_cache;
+struct tracer_metrics;
+struct tracer_capture;
+struct tracer_profile;
 
 struct protocol_file {
 	const char *loc;
 	struct wl_list link;
 };
 
+/* A -S argument: LISTEN[=UPSTREAM][,output=FILE] */
+struct socket_option {
+	const char *name;
+	const char *upstream;
+	const char *output;
+	struct wl_list link;
+};
+
+/* A --plugin argument: PATH[=ARGS] */
+struct plugin_option {
+	const char *path;
+	const char *args;
+	struct wl_list link;
+};
+
 struct tracer_options {
 	int mode;
 	int output_format;
 	char **spawn_args;
-	char *socket;
+	struct wl_list socket_list;
+	int backlog;
 	const char *outfile;
+	const char *subscriber_socket;
+	size_t ring_size;
+	int shm_analytics;
+	int damage_stats;
+	int frame_stats;
+	int refresh_rate;
+	int quiet;
+	int top;
+	const char *metrics_file;
+	const char *metrics_socket;
+	uint32_t metrics_interval;
+	struct wl_list plugin_list;
+	const char *capture_file;
+	const char *decode_file;
+	const char *replay_file;
+	int replay_fast;
+	int preload;
+	int compiled_decoders;
+	const char *protocol_path;
 	struct wl_list protocol_file_list;
+	int profile;
 };
 
 struct tracer {
-	struct tracer_socket *socket;
+	struct wl_list socket_list;
+	int socket_count;
 	int32_t epollfd;
+	int running;
 	int next_id;
+	uint64_t next_seq;
+	uint64_t dropped_records;
 	struct wl_list instance_list;
+	struct wl_list instance_listener_list;
+	int next_slot;
+	struct wl_list subscriber_list;
+	struct tracer_subscriber_socket *subscriber_socket;
+	struct tracer_ring *ring;
+	struct tracer_fdinfo_cache *fdinfo;
+	struct tracer_metrics *metrics;
+	struct tracer_capture *capture;
+	struct tracer_profile *profile;
+	struct wl_list plugin_list;
 	struct wl_list protocol_list;
+	int in_batch;
 	struct tracer_frontend_interface *frontend;
 	void *frontend_data;
 	FILE *outfp;
@@ -102,6 +233,49 @@ void tracer_log_impl(struct tracer_instance *instance, const char *fmt, ...);
 void tracer_log_cont_impl(struct tracer_instance *instance, const char *fmt, ...);
 void tracer_log_end_impl(struct tracer_instance *instance);
 
+int tracer_epoll_add(struct tracer *tracer, struct tracer_event_source *source,
+		     uint32_t mask);
+int tracer_epoll_modify(struct tracer *tracer,
+			struct tracer_event_source *source, uint32_t mask);
+void tracer_epoll_remove(struct tracer *tracer,
+			 struct tracer_event_source *source);
+
+uint64_t tracer_now(void);
+
+int tracer_connect_to_socket(const char *name, int *in_progress);
+
+int tracer_listen_unix(const char *name, int backlog,
+		       struct sockaddr_un *addr);
+
+typedef void (*tracer_timer_func_t)(void *data);
+
+struct tracer_timer *tracer_timer_create(struct tracer *tracer,
+					 uint32_t interval,
+					 tracer_timer_func_t func, void *data);
+void tracer_timer_destroy(struct tracer_timer *timer);
+
+int tracer_connection_write(struct tracer_connection *connection,
+			    const void *data, size_t count);
+int tracer_connection_put_fd(struct tracer_connection *connection, int fd);
+size_t tracer_connection_pending(struct tracer_connection *connection);
+
+struct tracer_instance *
+tracer_instance_create_offline(struct tracer *tracer, const char *name,
+			       uint32_t socket, uint32_t id);
+int tracer_instance_feed(struct tracer_instance *instance, int side,
+			 const void *data, uint32_t length, int nfds,
+			 uint64_t timestamp);
+void tracer_instance_destroy_all(struct tracer *tracer);
+
+void tracer_record_message(struct tracer_connection *connection,
+			   const void *data, uint32_t length, int nfds);
+
+int tracer_allocate_slot(struct tracer *tracer);
+void *tracer_instance_alloc(struct tracer_instance *instance, size_t size);
+size_t tracer_instance_memory(struct tracer_instance *instance);
+void tracer_add_instance_listener(struct tracer *tracer,
+				  struct tracer_instance_listener *listener);
+
 #ifdef __cplusplus
 }
 #endif
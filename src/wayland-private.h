@@ -79,8 +79,16 @@ uint32_t wl_map_lookup_flags(struct wl_map *map, uint32_t i);
 void wl_map_for_each(struct wl_map *map, wl_iterator_func_t func, void *data);
 
 
+/*
+ * Buffers hold no memory while empty.  They get a block from a pool
+ * shared by all connections when data comes in, grow up to
+ * WL_BUFFER_MAX as needed and give it back on wl_connection_trim().
+ */
+#define WL_BUFFER_MAX	4096
+
 struct wl_buffer {
-	char data[4096];
+	char *data;
+	uint32_t size;		/* of data, a power of two */
 	uint32_t head, tail;
 };
 
@@ -104,9 +112,13 @@ struct wl_connection *wl_connection_create(int fd);
 void wl_connection_destroy(struct wl_connection *connection);
 void wl_connection_copy(struct wl_connection *connection, void *data, size_t size);
 void wl_connection_consume(struct wl_connection *connection, size_t size);
+void wl_connection_trim(struct wl_connection *connection);
+size_t wl_connection_memory(struct wl_connection *connection);
 
 int wl_connection_flush(struct wl_connection *connection);
 int wl_connection_read(struct wl_connection *connection);
+int wl_connection_feed(struct wl_connection *connection,
+		       const void *data, size_t count, int nfds);
 
 int wl_connection_write(struct wl_connection *connection, const void *data, size_t count);
 int wl_connection_queue(struct wl_connection *connection,
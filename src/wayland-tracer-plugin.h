@@ -0,0 +1,164 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef WAYLAND_TRACER_PLUGIN_H
+#define WAYLAND_TRACER_PLUGIN_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Interface for analyzers living in shared objects loaded by
+ * wayland-tracer --plugin PATH[=ARGS].
+ *
+ * A plugin exports a struct tracer_plugin named wayland_tracer_plugin.
+ * Its init function is called once the protocol files are loaded and
+ * subscribes to the messages the plugin cares about; the tracer then
+ * calls back for every such message with a view of the decoded message
+ * that points straight into its own buffers.  Nothing is formatted or
+ * copied for the plugin, and messages nobody subscribed to cost nothing.
+ *
+ * Views and everything they point to are only valid during the call.
+ * All calls come from the tracer's only thread.
+ *
+ * Compatible changes only ever append fields to the structures below and
+ * keep TRACER_PLUGIN_ABI_VERSION; the tracer refuses plugins built for a
+ * newer version than its own.
+ *
+ *	static void
+ *	handle_sync(void *data, const struct tracer_plugin_message *message)
+ *	{
+ *		...
+ *	}
+ *
+ *	static int
+ *	init(struct tracer_plugin_host *host, const char *args, void **data)
+ *	{
+ *		int opcode = host->lookup_opcode(host, "wl_display",
+ *						 TRACER_PLUGIN_REQUEST, "sync");
+ *
+ *		return host->subscribe(host, "wl_display",
+ *				       TRACER_PLUGIN_REQUEST, opcode,
+ *				       handle_sync, NULL);
+ *	}
+ *
+ *	TRACER_PLUGIN_EXPORT const struct tracer_plugin wayland_tracer_plugin = {
+ *		.abi_version = TRACER_PLUGIN_ABI_VERSION,
+ *		.name = "example",
+ *		.init = init,
+ *	};
+ */
+
+#define TRACER_PLUGIN_ABI_VERSION	1
+#define TRACER_PLUGIN_SYMBOL		"wayland_tracer_plugin"
+
+#define TRACER_PLUGIN_EXPORT	__attribute__((visibility("default")))
+
+/* Direction of a message, same as TRACER_RECORD_FROM_* */
+#define TRACER_PLUGIN_EVENT	0
+#define TRACER_PLUGIN_REQUEST	1
+
+/* Subscribe to every message of an interface in one direction */
+#define TRACER_PLUGIN_ANY_OPCODE	-1
+
+struct tracer_plugin_message {
+	uint64_t timestamp;	/* CLOCK_MONOTONIC ns when it was read */
+	uint32_t socket;	/* index of the -S socket, 0 in single mode */
+	uint32_t instance;	/* client, numbered per socket */
+	uint32_t side;		/* TRACER_PLUGIN_EVENT or _REQUEST */
+	uint32_t id;		/* object the message is sent to */
+	uint32_t opcode;
+	uint32_t size;		/* whole message, header included */
+	const char *interface;
+	const char *message;
+	/*
+	 * One character per argument: i, u, f, s, o, a, h (fd) and n for
+	 * new_id.  N is a new_id without interface, which is sent as
+	 * interface name, version and id, as in wl_registry.bind.
+	 */
+	const char *signature;
+	const uint32_t *args;	/* size - 8 bytes of wire arguments */
+	const int32_t *fds;
+	uint32_t nfds;
+};
+
+typedef void (*tracer_plugin_message_func_t)(void *data,
+			const struct tracer_plugin_message *message);
+
+/* created is 1 when a client connects, 0 once it's gone */
+typedef void (*tracer_plugin_instance_func_t)(void *data, uint32_t socket,
+					      uint32_t instance, int created);
+
+/* What the tracer offers to a plugin */
+struct tracer_plugin_host {
+	uint32_t abi_version;
+
+	/*
+	 * Calls func for every message of interface going in the given
+	 * direction with the given opcode, or all of them with
+	 * TRACER_PLUGIN_ANY_OPCODE.  Returns -1 if the interface or opcode
+	 * isn't known from the protocol files.
+	 */
+	int (*subscribe)(struct tracer_plugin_host *host,
+			 const char *interface, int side, int opcode,
+			 tracer_plugin_message_func_t func, void *data);
+
+	/* Opcode of a message by name, or -1 */
+	int (*lookup_opcode)(struct tracer_plugin_host *host,
+			     const char *interface, int side,
+			     const char *message);
+
+	/* Tells about clients coming and going */
+	int (*watch_instances)(struct tracer_plugin_host *host,
+			       tracer_plugin_instance_func_t func, void *data);
+
+	/* Prints to the tracer's output */
+	void (*print)(struct tracer_plugin_host *host, const char *fmt, ...)
+		__attribute__((format(printf, 2, 3)));
+};
+
+/* What a plugin exports as wayland_tracer_plugin */
+struct tracer_plugin {
+	uint32_t abi_version;	/* TRACER_PLUGIN_ABI_VERSION */
+	const char *name;
+
+	/*
+	 * args is what followed '=' on the command line, or NULL.  Whatever
+	 * is stored in *data is passed to fini.  Returning nonzero makes
+	 * the tracer exit.
+	 */
+	int (*init)(struct tracer_plugin_host *host, const char *args,
+		    void **data);
+
+	/* Called before the tracer exits, may be NULL */
+	void (*fini)(void *data);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
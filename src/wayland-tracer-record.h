@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef WAYLAND_TRACER_RECORD_H
+#define WAYLAND_TRACER_RECORD_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Binary record format shared by everything wayland-tracer exports
+ * (subscriber sockets, the shared memory ring, capture files).  All
+ * fields are in host byte order.
+ *
+ * A record is a fixed header followed by `length' bytes of payload,
+ * padded with zeros so that `size' is a multiple of 8.  For message
+ * records the payload is the raw wire data exactly as it was forwarded;
+ * in raw (non-interpreting) mode one record may carry several messages
+ * or a partial one, since the tracer doesn't frame data in that mode.
+ */
+
+#define TRACER_RECORD_MESSAGE	1
+#define TRACER_RECORD_DROPPED	2	/* payload: uint64_t count, see below */
+#define TRACER_RECORD_RING	4	/* payload: uint64_t size, fd attached */
+#define TRACER_RECORD_SOCKET	5	/* payload: name of -S socket `socket' */
+
+/* Direction of the data, same values as TRACER_*_SIDE */
+#define TRACER_RECORD_FROM_SERVER	0
+#define TRACER_RECORD_FROM_CLIENT	1
+
+#define TRACER_RECORD_ALIGN	8
+
+/*
+ * Records made up for a single subscriber aren't numbered on their own.
+ * A TRACER_RECORD_DROPPED record immediately precedes the first record
+ * after the gap and carries that record's seq; its count is how many
+ * records were lost right before it.  TRACER_RECORD_RING records have a
+ * seq of 0.
+ */
+struct tracer_record {
+	uint32_t size;		/* header + payload + padding */
+	uint32_t length;	/* payload length */
+	uint16_t type;
+	uint16_t side;
+	uint32_t instance;
+	uint32_t nfds;		/* fds passed along with the payload */
+	uint32_t socket;	/* index of the -S socket, 0 in single mode */
+	uint64_t seq;		/* global, increases by one per record */
+	uint64_t timestamp;	/* CLOCK_MONOTONIC, in nanoseconds */
+};
+
+/*
+ * Capture files, as written by wayland-tracer --capture and by the
+ * in-process capture library, are a tracer_capture_header followed by
+ * records.  Records of file descriptors only carry their number.  A
+ * capture taken in server mode starts with a TRACER_RECORD_SOCKET record
+ * per socket; one without them was taken in single mode.
+ */
+#define TRACER_CAPTURE_MAGIC	0x43545457	/* "WTTC" */
+#define TRACER_CAPTURE_VERSION	1
+
+struct tracer_capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pid;		/* of the captured client, 0 if proxied */
+	uint32_t reserved;
+	uint64_t start;		/* CLOCK_MONOTONIC when capture began, ns */
+};
+
+static inline uint32_t
+tracer_record_size(uint32_t length)
+{
+	return (sizeof(struct tracer_record) + length + TRACER_RECORD_ALIGN - 1) &
+		~(uint32_t) (TRACER_RECORD_ALIGN - 1);
+}
+
+static inline const void *
+tracer_record_payload(const struct tracer_record *record)
+{
+	return record + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
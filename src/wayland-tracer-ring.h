@@ -0,0 +1,307 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef WAYLAND_TRACER_RING_H
+#define WAYLAND_TRACER_RING_H
+
+/*
+ * Shared memory ring exported by wayland-tracer --ring, and a small
+ * header-only reader for it.
+ *
+ * The ring is a memfd holding a tracer_ring_header followed by
+ * data_size bytes (a power of two) of records in the format described in
+ * wayland-tracer-record.h.  There is a single producer, the tracer, and
+ * any number of readers, which never write to the ring; the tracer never
+ * waits for them.  A record is never split across the end of the data
+ * area: the producer fills the remainder with a TRACER_RECORD_PADDING
+ * record, or, if not even a record header fits, readers skip it.
+ *
+ * The producer publishes a record of n bytes at position p by
+ *
+ *   1. storing reserve = p + n, followed by a release fence,
+ *   2. writing the record,
+ *   3. storing head = p + n with release semantics.
+ *
+ * A reader at position p may look at everything below head.  Since the
+ * producer may overwrite data under a slow reader's feet, a reader must
+ * check after processing a record that reserve hasn't moved more than
+ * data_size past the record's start; tracer_ring_consume() does that.
+ * Sequence numbers in the records let readers count what they lost.
+ *
+ * Typical use:
+ *
+ *	struct tracer_ring_reader reader;
+ *	const struct tracer_record *record;
+ *
+ *	tracer_ring_reader_init(&reader, fd);
+ *	for (;;) {
+ *		while ((record = tracer_ring_peek(&reader)) != NULL) {
+ *			process(record);
+ *			if (tracer_ring_consume(&reader, record) < 0)
+ *				discard_what_process_did();
+ *		}
+ *		wait_a_little();
+ *	}
+ *
+ * The fd can be obtained by sending "ring" to the tracer's subscriber
+ * socket (see tracer_ring_connect()), or by opening /proc/PID/fd/N as
+ * printed by the tracer at startup.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "wayland-tracer-record.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define TRACER_RING_MAGIC	0x52525457	/* "WTRR" */
+#define TRACER_RING_VERSION	1
+
+#define TRACER_RECORD_PADDING	3	/* skip to the start of the ring */
+
+struct tracer_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t data_offset;
+	uint64_t data_size;
+	uint64_t pad0[5];
+
+	/* Producer positions, each on its own cache line */
+	uint64_t head;
+	uint64_t pad1[7];
+	uint64_t reserve;
+	uint64_t pad2[7];
+};
+
+struct tracer_ring_reader {
+	const struct tracer_ring_header *header;
+	const char *data;
+	uint64_t size;
+	uint64_t pos;
+	uint64_t next_seq;
+	uint64_t lost;
+	size_t map_size;
+	int synced;
+};
+
+static inline int
+tracer_ring_reader_init(struct tracer_ring_reader *reader, int fd)
+{
+	const struct tracer_ring_header *header;
+	void *map;
+
+	map = mmap(NULL, sizeof *header, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = (const struct tracer_ring_header *) map;
+	if (header->magic != TRACER_RING_MAGIC ||
+	    header->version != TRACER_RING_VERSION) {
+		munmap(map, sizeof *header);
+		return -1;
+	}
+
+	reader->map_size = header->data_offset + header->data_size;
+	reader->size = header->data_size;
+	munmap(map, sizeof *header);
+
+	map = mmap(NULL, reader->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	reader->header = (const struct tracer_ring_header *) map;
+	reader->data = (const char *) map + reader->header->data_offset;
+	reader->pos = __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+	reader->next_seq = 0;
+	reader->lost = 0;
+	reader->synced = 0;
+
+	return 0;
+}
+
+static inline void
+tracer_ring_reader_fini(struct tracer_ring_reader *reader)
+{
+	munmap((void *) reader->header, reader->map_size);
+}
+
+/* Nonzero if whatever was at pos may have been overwritten by now */
+static inline int
+tracer_ring_overrun(struct tracer_ring_reader *reader, uint64_t pos)
+{
+	uint64_t reserve;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	reserve = __atomic_load_n(&reader->header->reserve, __ATOMIC_RELAXED);
+
+	return reserve - pos > reader->size;
+}
+
+/*
+ * Returns the next record, pointing straight into the ring, or NULL if
+ * there is nothing new.  The record stays valid only if the following
+ * tracer_ring_consume() says so.
+ */
+static inline const struct tracer_record *
+tracer_ring_peek(struct tracer_ring_reader *reader)
+{
+	const struct tracer_record *record;
+	uint64_t head, offset, left;
+
+	for (;;) {
+		head = __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+		if (head == reader->pos)
+			return NULL;
+
+		/* Lapped: skip to the newest record, seq tells how much */
+		if (head - reader->pos > reader->size) {
+			reader->pos = head;
+			continue;
+		}
+
+		offset = reader->pos & (reader->size - 1);
+		left = reader->size - offset;
+		if (left < sizeof *record) {
+			reader->pos += left;
+			continue;
+		}
+
+		record = (const struct tracer_record *) (reader->data + offset);
+		if (record->size < sizeof *record || record->size > left ||
+		    record->type == TRACER_RECORD_PADDING) {
+			if (tracer_ring_overrun(reader, reader->pos)) {
+				reader->pos = head;
+				continue;
+			}
+			reader->pos += record->type == TRACER_RECORD_PADDING ?
+				       record->size : left;
+			continue;
+		}
+
+		return record;
+	}
+}
+
+/*
+ * Moves past a record returned by tracer_ring_peek().  Returns 0 if the
+ * record was intact all along, -1 if it was overwritten meanwhile, in
+ * which case anything derived from it should be thrown away.
+ */
+static inline int
+tracer_ring_consume(struct tracer_ring_reader *reader,
+		    const struct tracer_record *record)
+{
+	uint64_t seq, size;
+
+	seq = record->seq;
+	size = record->size;
+
+	if (tracer_ring_overrun(reader, reader->pos)) {
+		reader->pos = __atomic_load_n(&reader->header->head,
+					      __ATOMIC_ACQUIRE);
+		return -1;
+	}
+
+	if (reader->synced && seq != reader->next_seq)
+		reader->lost += seq - reader->next_seq;
+	reader->synced = 1;
+	reader->next_seq = seq + 1;
+	reader->pos += size;
+
+	return 0;
+}
+
+/*
+ * Asks a tracer's subscriber socket at path for the ring fd, then hangs
+ * up.  Returns the ring fd or -1.
+ */
+static inline int
+tracer_ring_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char buf[4096];
+	union {
+		char data[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	int sock, fd = -1;
+	ssize_t len;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof addr.sun_path)
+		return -1;
+	strcpy(addr.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+	    write(sock, "ring\n", 5) != 5) {
+		close(sock);
+		return -1;
+	}
+
+	while (fd < 0) {
+		iov.iov_base = buf;
+		iov.iov_len = sizeof buf;
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof control.data;
+
+		len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if (len <= 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_RIGHTS)
+				memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+		}
+	}
+
+	close(sock);
+
+	return fd;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif